@@ -0,0 +1,620 @@
+/**
+ * Multi-connection D-Bus load generator of `make bench`. It drives one
+ * workload against a running D-Hub and prints its results as a JSON object,
+ * see bench/run.sh.
+ */
+
+#include <basu/sd-bus.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+// 32 sub-buckets per power of two, percentiles are within 3%.
+#define HISTOGRAM_SUB_BITS 5
+#include "histogram.h"
+
+#define DHUB_NAME "dev.negrel.dhub"
+#define ECHO_PATH "/dev/negrel/dhub/echo"
+#define ECHO_IFACE "dev.negrel.dhub.Echoer"
+#define POWER_PATH "/dev/negrel/dhub/power"
+#define POWER_IFACE "dev.negrel.dhub.Power"
+#define SUPPLIES_PATH POWER_PATH "/supply/by_name"
+#define SUPPLY_IFACE "dev.negrel.dhub.PowerSupply"
+#define PROPERTIES_IFACE "org.freedesktop.DBus.Properties"
+
+#define CALL_TIMEOUT_US (30 * 1000000ULL)
+#define WAIT_TIMEOUT_US 100000
+
+enum workload {
+  WORKLOAD_PING,
+  WORKLOAD_ECHO,
+  WORKLOAD_BROADCAST,
+  WORKLOAD_GETALL,
+  WORKLOAD_WAIT,
+};
+
+static struct {
+  const char *name;
+  enum workload workload;
+  // Echo array length or broadcast subscribers count.
+  unsigned int arg;
+  unsigned int connections;
+  unsigned int depth;
+  unsigned int duration_s;
+  unsigned int warmup_s;
+  pid_t dhub_pid;
+  pid_t bus_pid;
+  char **strv;
+  char **paths;
+  size_t paths_len;
+  const char *getall_iface;
+} cfg = {
+    .connections = 4,
+    .depth = 16,
+    .duration_s = 5,
+    .warmup_s = 1,
+};
+
+static _Atomic bool recording = false;
+static _Atomic bool stopping = false;
+
+/**
+ * A connection and its thread. Workers send calls, subscribers receive
+ * broadcast signals.
+ */
+typedef struct worker {
+  pthread_t thread;
+  sd_bus *bus;
+  histogram_t latency;
+  uint64_t requests;
+  uint64_t errors;
+  size_t next_path;
+  int err;
+} worker_t;
+
+/**
+ * One of the `depth` calls a worker keeps in flight.
+ */
+typedef struct call {
+  worker_t *worker;
+  uint64_t start;
+} call_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int new_call(worker_t *w, sd_bus_message **m) {
+  const char *path = ECHO_PATH, *iface = ECHO_IFACE, *member = NULL;
+  switch (cfg.workload) {
+  case WORKLOAD_PING:
+    member = "Ping";
+    break;
+  case WORKLOAD_ECHO:
+    member = "Echo";
+    break;
+  case WORKLOAD_BROADCAST:
+    member = "Broadcast";
+    break;
+  case WORKLOAD_GETALL:
+    path = cfg.paths[w->next_path++ % cfg.paths_len];
+    iface = PROPERTIES_IFACE;
+    member = "GetAll";
+    break;
+  case WORKLOAD_WAIT:
+    return -EINVAL;
+  }
+
+  int r = sd_bus_message_new_method_call(w->bus, m, DHUB_NAME, path, iface,
+                                         member);
+  if (r < 0)
+    return r;
+
+  switch (cfg.workload) {
+  case WORKLOAD_ECHO:
+    return sd_bus_message_append_strv(*m, cfg.strv);
+  case WORKLOAD_BROADCAST: {
+    // Subscribers compute delivery latency from send time.
+    char payload[32];
+    snprintf(payload, sizeof(payload), "%" PRIu64, now_ns());
+    return sd_bus_message_append(*m, "s", payload);
+  }
+  case WORKLOAD_GETALL:
+    return sd_bus_message_append(*m, "s", cfg.getall_iface);
+  default:
+    return 0;
+  }
+}
+
+static int on_reply(sd_bus_message *m, void *userdata,
+                    sd_bus_error *ret_error);
+
+static void send_call(call_t *call) {
+  worker_t *w = call->worker;
+  sd_bus_message *m = NULL;
+
+  int r = new_call(w, &m);
+  if (r >= 0) {
+    call->start = now_ns();
+    r = sd_bus_call_async(w->bus, NULL, m, on_reply, call, CALL_TIMEOUT_US);
+  }
+  sd_bus_message_unref(m);
+
+  // Call slot is lost, worker runs with a lower depth.
+  if (r < 0) {
+    w->errors++;
+    w->err = r;
+  }
+}
+
+static int on_reply(sd_bus_message *m, void *userdata,
+                    sd_bus_error *ret_error) {
+  (void)ret_error;
+  call_t *call = userdata;
+  worker_t *w = call->worker;
+
+  if (atomic_load_explicit(&recording, memory_order_relaxed)) {
+    if (sd_bus_message_is_method_error(m, NULL)) {
+      w->errors++;
+    } else {
+      w->requests++;
+      histogram_record(&w->latency, now_ns() - call->start);
+    }
+  }
+
+  if (!atomic_load_explicit(&stopping, memory_order_relaxed))
+    send_call(call);
+
+  return 0;
+}
+
+static int on_broadcast(sd_bus_message *m, void *userdata,
+                        sd_bus_error *ret_error) {
+  (void)ret_error;
+  worker_t *w = userdata;
+
+  const char *payload = NULL;
+  if (sd_bus_message_read(m, "s", &payload) < 0)
+    return 0;
+
+  uint64_t sent = strtoull(payload, NULL, 10);
+  if (atomic_load_explicit(&recording, memory_order_relaxed)) {
+    w->requests++;
+    histogram_record(&w->latency, now_ns() - sent);
+  }
+
+  return 0;
+}
+
+// Processes messages of worker connection until benchmark stops.
+static void run_bus(worker_t *w) {
+  while (!atomic_load_explicit(&stopping, memory_order_relaxed)) {
+    int r = sd_bus_process(w->bus, NULL);
+    if (r < 0) {
+      w->err = r;
+      return;
+    }
+    if (r > 0)
+      continue;
+
+    r = sd_bus_wait(w->bus, WAIT_TIMEOUT_US);
+    if (r < 0 && r != -EINTR) {
+      w->err = r;
+      return;
+    }
+  }
+}
+
+static void *worker_main(void *arg) {
+  worker_t *w = arg;
+
+  call_t *calls = calloc(cfg.depth, sizeof(*calls));
+  if (calls == NULL) {
+    w->err = -ENOMEM;
+    return NULL;
+  }
+
+  // Pipelined calls, each reply sends the next call of its slot.
+  for (unsigned int i = 0; i < cfg.depth; i++) {
+    calls[i].worker = w;
+    send_call(&calls[i]);
+  }
+  run_bus(w);
+
+  // Pending replies are dropped without running their callback.
+  w->bus = sd_bus_flush_close_unref(w->bus);
+  free(calls);
+  return NULL;
+}
+
+static void *subscriber_main(void *arg) {
+  worker_t *w = arg;
+  run_bus(w);
+  w->bus = sd_bus_flush_close_unref(w->bus);
+  return NULL;
+}
+
+// Returns CPU time consumed by process `pid` so far in nanoseconds, or -1.
+static int64_t proc_cpu_ns(pid_t pid) {
+  if (pid <= 0)
+    return -1;
+
+  char path[64], buf[1024];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE *f = fopen(path, "re");
+  if (f == NULL)
+    return -1;
+  size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[n] = '\0';
+
+  // Command name may contain spaces, fields after it start at state (3rd).
+  char *p = strrchr(buf, ')');
+  unsigned long utime, stime;
+  if (p == NULL || sscanf(p + 2,
+                          "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                          &utime, &stime) != 2)
+    return -1;
+
+  return (int64_t)(utime + stime) * (1000000000 / sysconf(_SC_CLK_TCK));
+}
+
+static int64_t self_cpu_ns(void) {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) == -1)
+    return -1;
+
+  return ((int64_t)ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000 +
+         ((int64_t)ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+}
+
+static void print_cpu(const char *key, int64_t before, int64_t after,
+                      uint64_t requests, bool last) {
+  if (before < 0 || after < 0 || requests == 0)
+    printf("\"%s\":null", key);
+  else
+    printf("\"%s\":%.3f", key, (after - before) / 1e3 / requests);
+  if (!last)
+    putchar(',');
+}
+
+static void sleep_s(unsigned int s) {
+  struct timespec ts = {.tv_sec = s};
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+    ;
+}
+
+// Fills GetAll targets with power supplies objects, or with power object if
+// there is none.
+static int discover_power_objects(void) {
+  sd_bus *bus = NULL;
+  sd_bus_message *reply = NULL;
+  sd_bus_error error = SD_BUS_ERROR_NULL;
+
+  int r = sd_bus_open_user(&bus);
+  if (r < 0)
+    goto out;
+
+  const char *xml = NULL;
+  r = sd_bus_call_method(bus, DHUB_NAME, SUPPLIES_PATH,
+                         "org.freedesktop.DBus.Introspectable", "Introspect",
+                         &error, &reply, "");
+  if (r >= 0)
+    r = sd_bus_message_read(reply, "s", &xml);
+  if (r < 0)
+    goto out;
+
+  for (const char *p = xml; (p = strstr(p, "<node name=\"")) != NULL;) {
+    p += strlen("<node name=\"");
+    const char *end = strchr(p, '"');
+    if (end == NULL)
+      break;
+
+    char **paths = realloc(cfg.paths, (cfg.paths_len + 1) * sizeof(char *));
+    if (paths == NULL) {
+      r = -ENOMEM;
+      goto out;
+    }
+    cfg.paths = paths;
+    if (asprintf(&cfg.paths[cfg.paths_len], "%s/%.*s", SUPPLIES_PATH,
+                 (int)(end - p), p) == -1) {
+      r = -ENOMEM;
+      goto out;
+    }
+    cfg.paths_len++;
+    p = end;
+  }
+  cfg.getall_iface = SUPPLY_IFACE;
+
+  if (cfg.paths_len == 0) {
+    static char *power_path[] = {POWER_PATH};
+    cfg.paths = power_path;
+    cfg.paths_len = 1;
+    cfg.getall_iface = POWER_IFACE;
+  }
+
+out:
+  if (r < 0)
+    fprintf(stderr, "failed to list power objects: %s\n",
+            error.message != NULL ? error.message : strerror(-r));
+  sd_bus_error_free(&error);
+  sd_bus_message_unref(reply);
+  sd_bus_flush_close_unref(bus);
+  return r;
+}
+
+// Waits for D-Hub to own its name on the bus for at most duration.
+static int wait_dhub(void) {
+  sd_bus *bus = NULL;
+  int r = sd_bus_open_user(&bus);
+  if (r < 0) {
+    fprintf(stderr, "failed to connect to bus: %s\n", strerror(-r));
+    return 1;
+  }
+
+  uint64_t deadline = now_ns() + (uint64_t)cfg.duration_s * 1000000000;
+  int owned = 0;
+  do {
+    sd_bus_message *reply = NULL;
+    r = sd_bus_call_method(bus, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+                           "org.freedesktop.DBus", "NameHasOwner", NULL,
+                           &reply, "s", DHUB_NAME);
+    if (r >= 0)
+      r = sd_bus_message_read(reply, "b", &owned);
+    sd_bus_message_unref(reply);
+    if (r < 0 || owned)
+      break;
+
+    struct timespec ts = {.tv_nsec = 50000000};
+    nanosleep(&ts, NULL);
+  } while (now_ns() < deadline);
+
+  sd_bus_flush_close_unref(bus);
+  if (!owned)
+    fprintf(stderr, "%s isn't on the bus\n", DHUB_NAME);
+  return owned ? 0 : 1;
+}
+
+static int parse_workload(const char *name) {
+  cfg.name = name;
+  const char *colon = strchr(name, ':');
+  size_t len = colon != NULL ? (size_t)(colon - name) : strlen(name);
+
+  if (strncmp(name, "ping", len) == 0 && len == 4) {
+    cfg.workload = WORKLOAD_PING;
+  } else if (strncmp(name, "echo", len) == 0 && len == 4) {
+    cfg.workload = WORKLOAD_ECHO;
+    cfg.arg = 16;
+  } else if (strncmp(name, "broadcast", len) == 0 && len == 9) {
+    cfg.workload = WORKLOAD_BROADCAST;
+    cfg.arg = 8;
+  } else if (strncmp(name, "getall", len) == 0 && len == 6) {
+    cfg.workload = WORKLOAD_GETALL;
+  } else if (strncmp(name, "wait", len) == 0 && len == 4) {
+    cfg.workload = WORKLOAD_WAIT;
+  } else {
+    return -1;
+  }
+
+  if (colon != NULL) {
+    char *end = NULL;
+    unsigned long arg = strtoul(colon + 1, &end, 10);
+    if (*end != '\0' || arg > 1000000 ||
+        (cfg.workload != WORKLOAD_ECHO && cfg.workload != WORKLOAD_BROADCAST))
+      return -1;
+    cfg.arg = arg;
+  }
+
+  if (cfg.workload == WORKLOAD_ECHO) {
+    cfg.strv = calloc(cfg.arg + 1, sizeof(char *));
+    if (cfg.strv == NULL)
+      return -1;
+    for (unsigned int i = 0; i < cfg.arg; i++)
+      cfg.strv[i] = "dhub-bench";
+  }
+
+  return 0;
+}
+
+static void print_help(const char *argv0) {
+  printf("Usage: %s [OPTION]... WORKLOAD\n\n", argv0);
+  printf("Drives WORKLOAD against D-Hub on session bus and prints its results "
+         "as JSON.\n\n");
+  printf("Workloads:\n");
+  printf("  ping             Echoer.Ping calls\n");
+  printf("  echo[:N]         Echoer.Echo calls with N strings (16)\n");
+  printf("  broadcast[:N]    Echoer.Broadcast calls received by N subscribers "
+         "(8)\n");
+  printf("  getall           Properties.GetAll calls on power objects\n");
+  printf("  wait             wait for D-Hub to be on the bus\n\n");
+  printf("Options:\n");
+  printf("  -c, --connections=N  number of calling connections (%u)\n",
+         cfg.connections);
+  printf("  -d, --depth=N        calls in flight per connection (%u)\n",
+         cfg.depth);
+  printf("  -t, --duration=S     measured duration in seconds (%u)\n",
+         cfg.duration_s);
+  printf("  -w, --warmup=S       unmeasured warmup in seconds (%u)\n",
+         cfg.warmup_s);
+  printf("  -p, --dhub-pid=PID   D-Hub process to measure CPU time of\n");
+  printf("  -b, --bus-pid=PID    bus daemon to measure CPU time of\n");
+  printf("  -h, --help           print this help message\n");
+}
+
+static int parse_uint(const char *str, unsigned int *v) {
+  char *end = NULL;
+  errno = 0;
+  unsigned long ul = strtoul(str, &end, 10);
+  if (errno != 0 || *end != '\0' || *str == '\0' || ul > 1000000)
+    return -1;
+  *v = ul;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  static struct option long_options[] = {
+      {"connections", required_argument, NULL, 'c'},
+      {"depth", required_argument, NULL, 'd'},
+      {"duration", required_argument, NULL, 't'},
+      {"warmup", required_argument, NULL, 'w'},
+      {"dhub-pid", required_argument, NULL, 'p'},
+      {"bus-pid", required_argument, NULL, 'b'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  int opt;
+  unsigned int pid;
+  while ((opt = getopt_long(argc, argv, "c:d:t:w:p:b:h", long_options, NULL)) !=
+         -1) {
+    int r = 0;
+    switch (opt) {
+    case 'c':
+      r = parse_uint(optarg, &cfg.connections);
+      break;
+    case 'd':
+      r = parse_uint(optarg, &cfg.depth);
+      break;
+    case 't':
+      r = parse_uint(optarg, &cfg.duration_s);
+      break;
+    case 'w':
+      r = parse_uint(optarg, &cfg.warmup_s);
+      break;
+    case 'p':
+      r = parse_uint(optarg, &pid);
+      cfg.dhub_pid = pid;
+      break;
+    case 'b':
+      r = parse_uint(optarg, &pid);
+      cfg.bus_pid = pid;
+      break;
+    case 'h':
+      print_help(argv[0]);
+      return 0;
+    default:
+      return 1;
+    }
+    if (r == -1) {
+      fprintf(stderr, "invalid value for option -%c: %s\n", opt, optarg);
+      return 1;
+    }
+  }
+
+  if (optind != argc - 1 || parse_workload(argv[optind]) == -1 ||
+      cfg.connections == 0 || cfg.depth == 0 || cfg.duration_s == 0) {
+    print_help(argv[0]);
+    return 1;
+  }
+
+  if (cfg.workload == WORKLOAD_WAIT)
+    return wait_dhub();
+  if (cfg.workload == WORKLOAD_GETALL && discover_power_objects() < 0)
+    return 1;
+
+  unsigned int subscribers = cfg.workload == WORKLOAD_BROADCAST ? cfg.arg : 0;
+  unsigned int total = cfg.connections + subscribers;
+  worker_t *workers = calloc(total, sizeof(*workers));
+  if (workers == NULL) {
+    fprintf(stderr, "failed to allocate workers\n");
+    return 1;
+  }
+
+  // Connect everything and subscribe before any load is sent.
+  for (unsigned int i = 0; i < total; i++) {
+    int r = sd_bus_open_user(&workers[i].bus);
+    if (r >= 0 && i >= cfg.connections)
+      r = sd_bus_add_match(workers[i].bus, NULL,
+                           "type='signal',sender='" DHUB_NAME "',"
+                           "interface='" ECHO_IFACE "',"
+                           "member='BroadcastSignal'",
+                           on_broadcast, &workers[i]);
+    if (r < 0) {
+      fprintf(stderr, "failed to set up connection %u: %s\n", i,
+              strerror(-r));
+      return 1;
+    }
+  }
+
+  for (unsigned int i = 0; i < total; i++) {
+    int r = pthread_create(&workers[i].thread, NULL,
+                           i < cfg.connections ? worker_main : subscriber_main,
+                           &workers[i]);
+    if (r != 0) {
+      fprintf(stderr, "failed to start thread: %s\n", strerror(r));
+      return 1;
+    }
+  }
+
+  sleep_s(cfg.warmup_s);
+  int64_t dhub_cpu = proc_cpu_ns(cfg.dhub_pid);
+  int64_t bus_cpu = proc_cpu_ns(cfg.bus_pid);
+  int64_t client_cpu = self_cpu_ns();
+  uint64_t start = now_ns();
+  atomic_store(&recording, true);
+
+  sleep_s(cfg.duration_s);
+
+  atomic_store(&recording, false);
+  uint64_t elapsed = now_ns() - start;
+  int64_t dhub_cpu_end = proc_cpu_ns(cfg.dhub_pid);
+  int64_t bus_cpu_end = proc_cpu_ns(cfg.bus_pid);
+  int64_t client_cpu_end = self_cpu_ns();
+
+  atomic_store(&stopping, true);
+  static histogram_t calls, deliveries;
+  uint64_t requests = 0, errors = 0, delivered = 0;
+  for (unsigned int i = 0; i < total; i++) {
+    worker_t *w = &workers[i];
+    pthread_join(w->thread, NULL);
+    if (w->err < 0)
+      fprintf(stderr, "connection %u failed: %s\n", i, strerror(-w->err));
+
+    if (i < cfg.connections) {
+      histogram_merge(&calls, &w->latency);
+      requests += w->requests;
+      errors += w->errors;
+    } else {
+      histogram_merge(&deliveries, &w->latency);
+      delivered += w->requests;
+    }
+  }
+
+  // Broadcast latency is delivery latency of signals to subscribers.
+  histogram_t *latency = subscribers > 0 ? &deliveries : &calls;
+  double seconds = elapsed / 1e9;
+  printf("{\"workload\":\"%s\",\"connections\":%u,\"depth\":%u,"
+         "\"duration_s\":%.3f,\"requests\":%" PRIu64 ",\"errors\":%" PRIu64
+         ",\"throughput_rps\":%.1f,",
+         cfg.name, cfg.connections, cfg.depth, seconds, requests, errors,
+         requests / seconds);
+  if (subscribers > 0)
+    printf("\"subscribers\":%u,\"signals\":%" PRIu64
+           ",\"signals_per_s\":%.1f,",
+           subscribers, delivered, delivered / seconds);
+  printf("\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,\"p999\":%.1f,"
+         "\"max\":%.1f,\"mean\":%.1f},",
+         histogram_percentile(latency, 500) / 1e3,
+         histogram_percentile(latency, 990) / 1e3,
+         histogram_percentile(latency, 999) / 1e3, latency->max / 1e3,
+         latency->count > 0 ? latency->sum / 1e3 / latency->count : 0);
+  printf("\"cpu_us_per_request\":{");
+  print_cpu("dhub", dhub_cpu, dhub_cpu_end, requests, false);
+  print_cpu("bus", bus_cpu, bus_cpu_end, requests, false);
+  print_cpu("client", client_cpu, client_cpu_end, requests, true);
+  printf("}}\n");
+
+  free(workers);
+  return requests > 0 ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#!/bin/sh
+# Benchmarks D-Hub on a private bus, see `make bench`. It prints results of
+# every workload as JSON and writes them to $BENCH_OUT.
+
+set -eu
+
+BUILD_DIR="${1:-build}"
+BENCH_DIR="$(cd "$(dirname "$0")" && pwd)"
+DURATION="${BENCH_DURATION:-5}"
+WARMUP="${BENCH_WARMUP:-1}"
+CONNECTIONS="${BENCH_CONNECTIONS:-4}"
+DEPTH="${BENCH_DEPTH:-16}"
+WORKLOADS="${BENCH_WORKLOADS:-ping echo:1 echo:64 echo:1024 broadcast:1 \
+broadcast:16 getall}"
+POWER_DEVICES="${BENCH_POWER_DEVICES:-10000}"
+POWER_RATE="${BENCH_POWER_RATE:-5000}"
+POWER_REMOVE_EVERY="${BENCH_POWER_REMOVE_EVERY:-100}"
+REPLAY="${BENCH_REPLAY:-}"
+REPLAY_SPEED="${BENCH_REPLAY_SPEED:-0}"
+OUT="${BENCH_OUT:-$BUILD_DIR/bench.json}"
+
+tmp="$(mktemp -d)"
+bus_pid=""
+dhub_pid=""
+
+# Starts D-Hub with echo and power_udev modules and waits for it to be on the
+# bus. Arguments are NAME=VALUE environment variables of D-Hub.
+start_dhub() {
+  printf 'echo\npower_udev\n' >"$tmp/modules.conf"
+  env "$@" DHUB_MODULES_DIR="$BUILD_DIR/modules" \
+    "$BUILD_DIR/dhub" -v warning start -c "$tmp/modules.conf" \
+    >"$tmp/dhub.log" 2>&1 &
+  dhub_pid=$!
+  if ! "$BUILD_DIR/bench-client" -t 30 wait; then
+    cat "$tmp/dhub.log" >&2
+    exit 1
+  fi
+}
+
+stop_dhub() {
+  if [ -n "$dhub_pid" ]; then
+    kill -INT "$dhub_pid" 2>/dev/null || true
+    wait "$dhub_pid" 2>/dev/null || true
+    dhub_pid=""
+  fi
+}
+
+cleanup() {
+  stop_dhub
+  if [ -n "$bus_pid" ]; then
+    kill "$bus_pid" 2>/dev/null || true
+    wait "$bus_pid" 2>/dev/null || true
+  fi
+  rm -rf "$tmp"
+}
+trap cleanup EXIT
+trap 'exit 130' INT TERM
+
+dbus-daemon --nofork --config-file="$BENCH_DIR/bus.conf" \
+  --address="unix:path=$tmp/bus" --print-address >"$tmp/address" &
+bus_pid=$!
+for _ in $(seq 50); do
+  [ -s "$tmp/address" ] && break
+  sleep 0.1
+done
+if [ ! -s "$tmp/address" ]; then
+  echo "dbus-daemon didn't start" >&2
+  exit 1
+fi
+DBUS_SESSION_BUS_ADDRESS="$(head -n 1 "$tmp/address")"
+export DBUS_SESSION_BUS_ADDRESS
+
+{
+  printf '{"commit":"%s","date":"%s","cpus":%s,"results":[' \
+    "$(git -C "$BENCH_DIR" rev-parse --short HEAD 2>/dev/null || echo none)" \
+    "$(date -u +%Y-%m-%dT%H:%M:%SZ)" "$(nproc)"
+  sep="
+"
+  start_dhub
+  for workload in $WORKLOADS; do
+    echo "running $workload..." >&2
+    printf '%s' "$sep"
+    "$BUILD_DIR/bench-client" -c "$CONNECTIONS" -d "$DEPTH" -t "$DURATION" \
+      -w "$WARMUP" -p "$dhub_pid" -b "$bus_pid" "$workload"
+    sep=","
+  done
+  stop_dhub
+
+  # Power supplies registration and device event storm on synthetic devices,
+  # power_udev writes its measurements on unload.
+  if [ "$POWER_DEVICES" -gt 0 ]; then
+    echo "running power events..." >&2
+    start_dhub DHUB_POWER_SOURCE=synthetic \
+      DHUB_POWER_DEVICES="$POWER_DEVICES" DHUB_POWER_RATE="$POWER_RATE" \
+      DHUB_POWER_REMOVE_EVERY="$POWER_REMOVE_EVERY" \
+      DHUB_POWER_REPORT="$tmp/power.json"
+    sleep "$((WARMUP + DURATION))"
+    stop_dhub
+  fi
+  printf ']'
+  if [ -s "$tmp/power.json" ]; then
+    printf ',"power":%s' "$(cat "$tmp/power.json")"
+  fi
+
+  # Sessions recorded with `dhub start --record`, power supply events are
+  # replayed to power_udev.
+  if [ -n "$REPLAY" ]; then
+    printf ',"replay":['
+    sep="
+"
+    for recording in $REPLAY; do
+      echo "replaying $recording..." >&2
+      printf '%s' "$sep"
+      start_dhub DHUB_POWER_SOURCE=replay
+      "$BUILD_DIR/dhub" -v warning replay -s "$REPLAY_SPEED" "$recording"
+      stop_dhub
+      sep=","
+    done
+    printf ']'
+  fi
+  printf '}\n'
+} >"$tmp/bench.json"
+
+cp "$tmp/bench.json" "$OUT"
+cat "$OUT"
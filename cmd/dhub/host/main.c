@@ -0,0 +1,361 @@
+#include <getopt.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "start/link.h"
+#include "start/state.h"
+#define LOG_MODULE "dhub-host"
+#include "log.h"
+
+/**
+ * Module host process state. Module objects are added to a server D-Bus
+ * connection, method calls received from D-Hub are sent to it through a
+ * client connection over a socket pair, and signals emitted by the module are
+ * forwarded back to D-Hub.
+ */
+typedef struct host_state {
+  dhub_state_t dhub;
+  const char *modname;
+  dhub_link_t link;
+  sd_bus *client;
+  uv_poll_t client_poll;
+  int client_events;
+  uv_prepare_t client_watcher;
+  uv_signal_t sigterm;
+  uv_check_t done_check;
+} host_state_t;
+
+static host_state_t state = {0};
+
+static void send_reply_error(uint64_t id, const char *name,
+                             const char *message) {
+  dhub_buf_t msg = {0};
+  dhub_buf_put_u32(&msg, DHUB_LINK_REPLY);
+  dhub_buf_put_u64(&msg, id);
+  dhub_buf_put_str(&msg, name);
+  dhub_buf_put_str(&msg, message);
+  // Empty body.
+  dhub_buf_put(&msg, "", 1);
+  dhub_link_send(&state.link, &msg);
+}
+
+static int on_call_reply(sd_bus_message *reply, void *userdata,
+                         sd_bus_error *ret_error) {
+  (void)ret_error;
+  uint64_t id = (uintptr_t)userdata;
+
+  if (sd_bus_message_is_method_error(reply, NULL)) {
+    const sd_bus_error *error = sd_bus_message_get_error(reply);
+    send_reply_error(id, error->name, error->message);
+    return 0;
+  }
+
+  dhub_buf_t msg = {0};
+  dhub_buf_put_u32(&msg, DHUB_LINK_REPLY);
+  dhub_buf_put_u64(&msg, id);
+  dhub_buf_put_str(&msg, "");
+  dhub_buf_put_str(&msg, "");
+  int r = dhub_codec_encode_body(reply, &msg);
+  if (r < 0) {
+    dhub_buf_free(&msg);
+    send_reply_error(id, SD_BUS_ERROR_NOT_SUPPORTED,
+                     "reply can't be forwarded");
+    return 0;
+  }
+
+  r = dhub_link_send(&state.link, &msg);
+  if (r == -EMSGSIZE)
+    send_reply_error(id, SD_BUS_ERROR_LIMITS_EXCEEDED, "reply is too large");
+  return 0;
+}
+
+static void on_call(dhub_reader_t *r) {
+  uint64_t id = dhub_reader_u64(r);
+  const char *path = dhub_reader_str(r);
+  const char *iface = dhub_reader_str(r);
+  const char *member = dhub_reader_str(r);
+  if (r->err != 0) {
+    LOG_ERR("invalid method call message");
+    return;
+  }
+
+  sd_bus_message *m = NULL;
+  int ret = sd_bus_message_new_method_call(
+      state.client, &m, NULL, path, *iface != '\0' ? iface : NULL, member);
+  if (ret >= 0)
+    ret = dhub_codec_decode_body(r, m);
+
+  if (ret >= 0) {
+    if (id == 0) {
+      ret = sd_bus_message_set_expect_reply(m, 0);
+      if (ret >= 0)
+        ret = sd_bus_send(state.client, m, NULL);
+    } else {
+      ret = sd_bus_call_async(state.client, NULL, m, on_call_reply,
+                              (void *)(uintptr_t)id, 0);
+    }
+  }
+  sd_bus_message_unref(m);
+
+  if (ret < 0 && id != 0)
+    send_reply_error(id, SD_BUS_ERROR_INVALID_ARGS, strerror(-ret));
+}
+
+static void on_link_message(dhub_link_t *link, uint32_t kind,
+                            dhub_reader_t *r) {
+  (void)link;
+  switch (kind) {
+  case DHUB_LINK_CALL:
+    on_call(r);
+    break;
+  case DHUB_LINK_SHUTDOWN:
+    LOG_INFO("unloading module '%s'...", state.modname);
+    dhub_shutdown_start(&state.dhub);
+    break;
+  default:
+    LOG_WARN("unexpected message %u from D-Hub", kind);
+  }
+}
+
+static int on_client_message(sd_bus_message *m, void *userdata,
+                             sd_bus_error *ret_error) {
+  (void)userdata;
+  (void)ret_error;
+  uint8_t type = 0;
+  if (sd_bus_message_get_type(m, &type) < 0 ||
+      type != SD_BUS_MESSAGE_SIGNAL)
+    return 0;
+
+  dhub_buf_t msg = {0};
+  dhub_buf_put_u32(&msg, DHUB_LINK_SIGNAL);
+  dhub_buf_put_str(&msg, sd_bus_message_get_path(m));
+  dhub_buf_put_str(&msg, sd_bus_message_get_interface(m));
+  dhub_buf_put_str(&msg, sd_bus_message_get_member(m));
+  int r = dhub_codec_encode_body(m, &msg);
+  if (r < 0) {
+    LOG_WARN("signal %s.%s can't be forwarded: %s",
+             sd_bus_message_get_interface(m), sd_bus_message_get_member(m),
+             strerror(-r));
+    dhub_buf_free(&msg);
+    return 0;
+  }
+
+  dhub_link_send(&state.link, &msg);
+  return 0;
+}
+
+static void on_client_event(uv_poll_t *handle, int status, int events) {
+  (void)handle;
+  (void)status;
+  (void)events;
+  int r = 0;
+  while ((r = sd_bus_process(state.client, NULL)) > 0)
+    ;
+  NEG_MUST(r, "failed to process module host D-BUS messages");
+}
+
+static void on_client_before_poll(uv_prepare_t *handle) {
+  (void)handle;
+  int bus_events = sd_bus_get_events(state.client);
+  int events = UV_READABLE;
+  if (bus_events > 0 && (bus_events & POLLOUT))
+    events |= UV_WRITABLE;
+
+  if (events != state.client_events) {
+    state.client_events = events;
+    uv_poll_start(&state.client_poll, events, on_client_event);
+  }
+}
+
+static void on_sigterm(uv_signal_t *handle, int signum) {
+  (void)handle;
+  (void)signum;
+  LOG_INFO("SIGTERM received, unloading module '%s'...", state.modname);
+  dhub_shutdown_start(&state.dhub);
+}
+
+static void on_done_check(uv_check_t *handle) {
+  if (!state.dhub.shutdown.done)
+    return;
+
+  // Module is unloaded, close remaining handles so loop exits.
+  uv_close((uv_handle_t *)handle, NULL);
+  uv_close((uv_handle_t *)&state.sigterm, NULL);
+  uv_close((uv_handle_t *)&state.client_poll, NULL);
+  uv_close((uv_handle_t *)&state.client_watcher, NULL);
+  dhub_link_close(&state.link);
+}
+
+static void host_init(void) {
+  dhub_state_t *dhub = &state.dhub;
+  UV_MUST(uv_loop_init(&dhub->loop), "failed to init libuv loop");
+
+  // Module objects are added to a server connection, D-Hub calls are sent to
+  // them through a client connection on the other end of a socket pair.
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0,
+                 sv) == -1)
+    LOG_FATAL("failed to create module host D-BUS socket pair");
+
+  sd_id128_t id = {0};
+  if (getrandom(&id, sizeof(id), 0) != sizeof(id))
+    LOG_FATAL("failed to generate module host D-BUS server id");
+
+  NEG_MUST(sd_bus_new(&dhub->bus), "failed to create module D-BUS");
+  NEG_MUST(sd_bus_set_fd(dhub->bus, sv[0], sv[0]),
+           "failed to set module D-BUS socket");
+  NEG_MUST(sd_bus_set_server(dhub->bus, 1, id),
+           "failed to set module D-BUS server mode");
+  NEG_MUST(sd_bus_start(dhub->bus), "failed to start module D-BUS");
+
+  NEG_MUST(sd_bus_new(&state.client), "failed to create host D-BUS");
+  NEG_MUST(sd_bus_set_fd(state.client, sv[1], sv[1]),
+           "failed to set host D-BUS socket");
+  NEG_MUST(sd_bus_start(state.client), "failed to start host D-BUS");
+  NEG_MUST(sd_bus_add_filter(state.client, NULL, on_client_message, NULL),
+           "failed to add host D-BUS signal filter");
+
+  dhub_context_init(&dhub->ctx, dhub, &dhub->loop, dhub->bus);
+  dhub_idle_init(dhub);
+
+  UV_MUST(uv_poll_init(&dhub->loop, &state.client_poll,
+                       sd_bus_get_fd(state.client)),
+          "failed to initialize host D-BUS poll handle");
+  UV_MUST(uv_prepare_init(&dhub->loop, &state.client_watcher),
+          "failed to initialize host D-BUS prepare handle");
+  uv_prepare_start(&state.client_watcher, on_client_before_poll);
+
+  int fds[3] = {DHUB_LINK_FD_MEM, DHUB_LINK_FD_TO_HOST, DHUB_LINK_FD_TO_CORE};
+  if (dhub_link_init(&state.link, &dhub->loop, fds, false, on_link_message) ==
+      -1)
+    LOG_FATAL("failed to map D-Hub link");
+
+  UV_MUST(uv_signal_init(&dhub->loop, &state.sigterm),
+          "failed to initialize SIGTERM handler");
+  uv_signal_start_oneshot(&state.sigterm, on_sigterm, SIGTERM);
+  UV_MUST(uv_check_init(&dhub->loop, &state.done_check),
+          "failed to initialize module host check handle");
+  uv_check_start(&state.done_check, on_done_check);
+}
+
+static void send_ready(int status, const char *err) {
+  const char *prefix = NULL;
+  dhub_module_t *module =
+      dhub_registry_find(&state.dhub.modules, state.modname);
+  if (module != NULL)
+    prefix = module->object_prefix;
+
+  dhub_buf_t msg = {0};
+  dhub_buf_put_u32(&msg, DHUB_LINK_READY);
+  dhub_buf_put_u32(&msg, (uint32_t)status);
+  dhub_buf_put_str(&msg, err);
+  dhub_buf_put_str(&msg, prefix);
+  dhub_link_send(&state.link, &msg);
+}
+
+static int parse_uint(const char *str, unsigned int *value) {
+  char *end = NULL;
+  unsigned long v = strtoul(str, &end, 10);
+  if (*str == '\0' || *end != '\0' || v > UINT_MAX)
+    return -1;
+
+  *value = v;
+  return 0;
+}
+
+int host(int argc, char *argv[]) {
+  dhub_config_t *cfg = &state.dhub.config;
+  *cfg = (dhub_config_t){
+      .dispatch_budget = DHUB_DISPATCH_BUDGET,
+      .write_hwm = DHUB_WRITE_HWM,
+      .unload_timeout_ms = DHUB_UNLOAD_TIMEOUT_MS,
+      .idle_timeout_ms = DHUB_IDLE_TIMEOUT_MS,
+      .stall_ms = DHUB_STALL_MS,
+      .module_budget_ms = DHUB_MODULE_BUDGET_MS,
+  };
+
+  // Options are passed by D-Hub, they mirror its own.
+  optind = 0;
+  int c = 0;
+  unsigned int throttle = 0;
+  while ((c = getopt(argc, argv, "b:w:t:i:s:m:T:")) != -1) {
+    unsigned int *value = NULL;
+    switch (c) {
+    case 'b':
+      value = &cfg->dispatch_budget;
+      break;
+    case 'w':
+      value = &cfg->write_hwm;
+      break;
+    case 't':
+      value = &cfg->unload_timeout_ms;
+      break;
+    case 'i':
+      value = &cfg->idle_timeout_ms;
+      break;
+    case 's':
+      value = &cfg->stall_ms;
+      break;
+    case 'm':
+      value = &cfg->module_budget_ms;
+      break;
+    case 'T':
+      value = &throttle;
+      break;
+    default:
+      return EXIT_FAILURE;
+    }
+
+    if (parse_uint(optarg, value) == -1) {
+      fprintf(stderr, "invalid -%c value '%s'\n", c, optarg);
+      return EXIT_FAILURE;
+    }
+  }
+
+  cfg->throttle = throttle != 0;
+
+  if (optind >= argc) {
+    fprintf(stderr, "no module provided\n");
+    return EXIT_FAILURE;
+  }
+  state.modname = argv[optind];
+
+  // Exit with D-Hub, it handles SIGINT for us.
+  if (prctl(PR_SET_PDEATHSIG, SIGTERM) == -1 || getppid() == 1)
+    return EXIT_FAILURE;
+  signal(SIGINT, SIG_IGN);
+
+  host_init();
+
+  const char *err = NULL;
+  int status = dhub_load(&state.dhub, state.modname, &err) == -1 ? -1 : 0;
+  send_ready(status, err);
+  if (status != 0)
+    dhub_shutdown_start(&state.dhub);
+
+  while (uv_loop_alive(&state.dhub.loop)) {
+    uv_run(&state.dhub.loop, UV_RUN_DEFAULT);
+
+    // Loop was stopped with handles of a force closed module still open.
+    if (state.dhub.shutdown.done)
+      break;
+  }
+
+  dhub_link_log_stats(&state.link, state.modname);
+  NEG_TRY(sd_bus_flush(state.client), "failed to flush host D-BUS");
+  sd_bus_close(state.client);
+  sd_bus_unref(state.client);
+  dhub_deinit(&state.dhub);
+
+  return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,33 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "binlog.h"
+
+int logdump(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s FILE\n\n"
+                    "Decode a binary log dump, '-' reads standard input.\n",
+            argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  FILE *in = stdin;
+  if (strcmp(argv[1], "-") != 0) {
+    in = fopen(argv[1], "r");
+    if (in == NULL) {
+      fprintf(stderr, "failed to open '%s': %s\n", argv[1], strerror(errno));
+      return EXIT_FAILURE;
+    }
+  }
+
+  int r = binlog_decode(in, stdout);
+  if (r == -1)
+    fprintf(stderr, "invalid binary log dump '%s'\n", argv[1]);
+
+  if (in != stdin)
+    fclose(in);
+
+  return r == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
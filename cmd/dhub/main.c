@@ -1,13 +1,18 @@
 #include <getopt.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "debug.h"
+#include "start/host.h"
 #define LOG_MODULE "dhub-main"
 #include "log.h"
 
 int start(int argc, char *argv[]);
+int host(int argc, char *argv[]);
+int logdump(int argc, char *argv[]);
+int replay(int argc, char *argv[]);
 
 static void print_usage(char *prog_name) {
   static const char header[] =
@@ -19,6 +24,35 @@ static void print_usage(char *prog_name) {
 
   static const char options[] =
       "Options:\n"
+      "  -v, --log-level=LEVEL                    Most verbose messages "
+      "logged: %s\n"
+      "                                           (default: most verbose "
+      "compiled in)\n"
+      "  -B, --log-binary=LEVEL                   Record messages up to LEVEL "
+      "in binary\n"
+      "                                           buffers dumped on crash, on "
+      "SIGUSR1\n"
+      "                                           or with DumpLog D-Bus "
+      "method\n"
+      "  -D, --log-dump=FILE                      Binary log dump file "
+      "(default:\n"
+      "                                           "
+      "$XDG_RUNTIME_DIR/dhub-PID.logdump)\n"
+      "  -l, --log-overflow=POLICY                What to do with log lines "
+      "when log\n"
+      "                                           buffer is full: 'drop' or "
+      "'block'\n"
+      "                                           (default: 'drop')\n"
+      "  -j, --log-journal[=SOCKET]               Send messages to journald "
+      "native\n"
+      "                                           socket (default:\n"
+      "                                           " LOG_JOURNAL_SOCKET ")\n"
+      "  -r, --log-rate=N                         Messages logged per second "
+      "by each\n"
+      "                                           call site after a burst, 0 "
+      "disables\n"
+      "                                           rate limiting (default: "
+      "0)\n"
       "  -h, --help                               Print this message and exit\n"
       "";
 
@@ -27,29 +61,108 @@ static void print_usage(char *prog_name) {
       "  start                                    Start D-Hub service\n"
       "  stop                                     Send stop message to D-Hub "
       "server\n"
-      "  ping                                     Ping D-Hub server";
+      "  ping                                     Ping D-Hub server\n"
+      "  logdump                                  Decode a binary log dump\n"
+      "  replay                                   Replay a recorded session "
+      "to D-Hub";
 
   puts(header);
   printf("Usage: %s [OPTIONS...] command [CMD OPTIONS...] [ARGS...]\n",
          prog_name);
-  puts(options);
+  printf(options, log_level_string_hint());
+  putchar('\n');
   puts(commands);
 }
 
 int main(int argc, char *argv[]) {
-  log_init(LOG_COLORIZE_AUTO, false, LOG_FACILITY_USER, LOG_CLASS_DEBUG);
-
   char *prog_name = argv[0];
+  // Log everything compiled in by default.
+  enum log_class level = DHUB_LOG_LEVEL;
+  enum log_overflow log_overflow = LOG_OVERFLOW_DROP;
+  unsigned log_rate = LOG_RATE_DEFAULT;
+  bool journal = false;
+  const char *journal_socket = NULL;
+  enum log_class binary_level = LOG_CLASS_NONE;
+  const char *dump_path = NULL;
+  // Logging options as given, passed on to module host processes.
+  char *level_arg = NULL;
+  char *binary_arg = NULL;
+  char *overflow_arg = NULL;
+  char *rate_arg = NULL;
 
   while (1) {
-    static struct option long_options[] = {{"help", no_argument, 0, 'h'},
-                                           {0, 0, 0, 0}};
-
-    int c = getopt_long(argc, argv, "h", long_options, NULL);
+    static struct option long_options[] = {
+        {"log-level", required_argument, 0, 'v'},
+        {"log-binary", required_argument, 0, 'B'},
+        {"log-dump", required_argument, 0, 'D'},
+        {"log-overflow", required_argument, 0, 'l'},
+        {"log-rate", required_argument, 0, 'r'},
+        {"log-journal", optional_argument, 0, 'j'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}};
+
+    // Stop at the first non-option argument, it is the command.
+    int c = getopt_long(argc, argv, "+v:B:D:l:r:j::h", long_options, NULL);
     if (c == -1)
       break;
 
     switch (c) {
+    case 'v': {
+      int value = log_level_from_string(optarg);
+      if (value == -1) {
+        fprintf(stderr, "invalid log level '%s', expected one of %s\n",
+                optarg, log_level_string_hint());
+        return EXIT_FAILURE;
+      }
+      level = value;
+      level_arg = optarg;
+      break;
+    }
+
+    case 'B': {
+      int value = log_level_from_string(optarg);
+      if (value == -1) {
+        fprintf(stderr, "invalid log level '%s', expected one of %s\n",
+                optarg, log_level_string_hint());
+        return EXIT_FAILURE;
+      }
+      binary_level = value;
+      binary_arg = optarg;
+      break;
+    }
+
+    case 'D':
+      dump_path = optarg;
+      break;
+
+    case 'l': {
+      int overflow = log_overflow_from_string(optarg);
+      if (overflow == -1) {
+        fprintf(stderr, "invalid log overflow policy '%s'\n", optarg);
+        return EXIT_FAILURE;
+      }
+      log_overflow = overflow;
+      overflow_arg = optarg;
+      break;
+    }
+
+    case 'r': {
+      char *end = NULL;
+      unsigned long rate = strtoul(optarg, &end, 10);
+      if (*optarg == '\0' || *end != '\0' || rate > UINT_MAX) {
+        fprintf(stderr, "invalid log rate '%s'\n", optarg);
+        return EXIT_FAILURE;
+      }
+      log_rate = rate;
+      rate_arg = optarg;
+      break;
+    }
+
+    case 'j':
+      journal = true;
+      journal_socket = optarg;
+      break;
+
     case 'h':
       print_usage(prog_name);
       return EXIT_SUCCESS;
@@ -59,6 +172,51 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  log_init(LOG_COLORIZE_AUTO, false, LOG_FACILITY_USER, level);
+  log_set_rate_limit(log_rate);
+  if (journal && log_enable_journal(journal_socket) == -1)
+    LOG_ERRNO("failed to connect to journal socket");
+  if (binary_level != LOG_CLASS_NONE &&
+      log_enable_binary(binary_level, dump_path) == -1) {
+    fprintf(stderr, "invalid binary log dump path\n");
+    return EXIT_FAILURE;
+  }
+
+  // Logging must not block the event loop.
+  if (log_start_writer(log_overflow) == -1)
+    LOG_WARN("failed to start log writer thread, logging synchronously");
+
+  // Isolated modules log at the same level and to the same sinks. Binary log
+  // dump path isn't passed on, each host dumps to its own default file.
+  static char journal_arg[PATH_MAX + 16];
+  static char *host_log_args[DHUB_HOST_LOG_ARGS_MAX + 1];
+  size_t n = 0;
+  if (level_arg != NULL) {
+    host_log_args[n++] = "--log-level";
+    host_log_args[n++] = level_arg;
+  }
+  if (binary_arg != NULL) {
+    host_log_args[n++] = "--log-binary";
+    host_log_args[n++] = binary_arg;
+  }
+  if (overflow_arg != NULL) {
+    host_log_args[n++] = "--log-overflow";
+    host_log_args[n++] = overflow_arg;
+  }
+  if (rate_arg != NULL) {
+    host_log_args[n++] = "--log-rate";
+    host_log_args[n++] = rate_arg;
+  }
+  if (journal) {
+    if (journal_socket != NULL)
+      snprintf(journal_arg, sizeof(journal_arg), "--log-journal=%s",
+               journal_socket);
+    else
+      snprintf(journal_arg, sizeof(journal_arg), "--log-journal");
+    host_log_args[n++] = journal_arg;
+  }
+  dhub_host_set_log_args(host_log_args);
+
   if (optind >= argc) {
     fprintf(stderr, "no command provided\n");
     print_usage(prog_name);
@@ -71,6 +229,13 @@ int main(int argc, char *argv[]) {
   int code = EXIT_SUCCESS;
   if (strcmp(cmd, "start") == 0) {
     code = start(argc - optind, argv + optind);
+  } else if (strcmp(cmd, "host") == 0) {
+    // Module host process, spawned by D-Hub for isolated modules.
+    code = host(argc - optind, argv + optind);
+  } else if (strcmp(cmd, "logdump") == 0) {
+    code = logdump(argc - optind, argv + optind);
+  } else if (strcmp(cmd, "replay") == 0) {
+    code = replay(argc - optind, argv + optind);
   } else {
     fprintf(stderr, "unknown command '%s'\n", cmd);
     print_usage(prog_name);
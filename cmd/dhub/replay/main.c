@@ -0,0 +1,333 @@
+#include <basu/sd-bus.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include "histogram.h"
+#include "json.h"
+#include "start/control.h"
+#include "start/record.h"
+#define LOG_MODULE "dhub-replay"
+#include "log.h"
+
+#define DHUB_NAME "dev.negrel.dhub"
+
+// Calls awaiting a reply at most when replaying at maximum speed.
+#define REPLAY_MAX_INFLIGHT 1024
+// Time replies are awaited once every record was sent.
+#define REPLAY_DRAIN_TIMEOUT_NS (30 * 1000000000ULL)
+
+typedef struct {
+  sd_bus *bus;
+  histogram_t latency;
+  uint64_t records;
+  uint64_t calls;
+  uint64_t events;
+  uint64_t errors;
+  // Calls sent and awaiting a reply.
+  uint64_t inflight;
+} replay_t;
+
+typedef struct {
+  replay_t *rp;
+  // uv_hrtime() when call was sent.
+  uint64_t sent;
+} pending_t;
+
+static void print_usage(char *prog_name) {
+  static const char options[] =
+      "Options:\n"
+      "  -s, --speed=FACTOR                       Replay speed relative to "
+      "recording,\n"
+      "                                           0 sends records as fast as "
+      "D-Hub\n"
+      "                                           replies (default: 1)\n"
+      "  -h, --help                               Print this message and exit\n"
+      "";
+
+  printf("Usage: %s [OPTIONS...] FILE\n\n", prog_name);
+  puts("Send method calls and module events recorded by 'dhub start --record'"
+       "\nto D-Hub on session bus, then print a JSON summary.\n");
+  fputs(options, stdout);
+}
+
+static int on_reply(sd_bus_message *m, void *userdata,
+                    sd_bus_error *ret_error) {
+  (void)ret_error;
+  pending_t *p = userdata;
+  replay_t *rp = p->rp;
+
+  histogram_record(&rp->latency, uv_hrtime() - p->sent);
+  if (sd_bus_message_is_method_error(m, NULL)) {
+    const sd_bus_error *err = sd_bus_message_get_error(m);
+    LOG_WARN("replayed call failed: %s: %s", err->name, err->message);
+    rp->errors++;
+  }
+
+  rp->inflight--;
+  free(p);
+  return 0;
+}
+
+static int call_async(replay_t *rp, sd_bus_message *m) {
+  pending_t *p = malloc(sizeof(*p));
+  if (p == NULL)
+    return -ENOMEM;
+
+  *p = (pending_t){.rp = rp, .sent = uv_hrtime()};
+  int r = sd_bus_call_async(rp->bus, NULL, m, on_reply, p, 0);
+  if (r < 0) {
+    free(p);
+    return r;
+  }
+
+  rp->inflight++;
+  return r;
+}
+
+static int send_call(replay_t *rp, dhub_reader_t *r) {
+  const char *dest = dhub_reader_str(r);
+  const char *path = dhub_reader_str(r);
+  const char *iface = dhub_reader_str(r);
+  const char *member = dhub_reader_str(r);
+  dhub_reader_str(r); // Signature, body is self describing.
+  uint32_t expect_reply = dhub_reader_u32(r);
+  if (r->err != 0)
+    return r->err;
+
+  // Unique names of recorded session are meaningless now.
+  if (*dest == '\0' || *dest == ':')
+    dest = DHUB_NAME;
+
+  sd_bus_message *m = NULL;
+  int ret = sd_bus_message_new_method_call(
+      rp->bus, &m, dest, path, *iface != '\0' ? iface : NULL, member);
+  if (ret < 0)
+    return ret;
+
+  ret = dhub_codec_decode_body(r, m);
+  if (ret >= 0 && expect_reply) {
+    ret = call_async(rp, m);
+  } else if (ret >= 0) {
+    ret = sd_bus_message_set_expect_reply(m, 0);
+    if (ret >= 0)
+      ret = sd_bus_send(rp->bus, m, NULL);
+  }
+
+  sd_bus_message_unref(m);
+  rp->calls++;
+  return ret;
+}
+
+static int send_event(replay_t *rp, dhub_reader_t *r) {
+  const char *kind = dhub_reader_str(r);
+  uint32_t len = dhub_reader_u32(r);
+  const void *data = dhub_reader_get(r, len);
+  if (r->err != 0)
+    return r->err;
+
+  sd_bus_message *m = NULL;
+  int ret = sd_bus_message_new_method_call(rp->bus, &m, DHUB_NAME,
+                                           DHUB_CONTROL_PATH,
+                                           DHUB_CONTROL_IFACE, "InjectEvent");
+  if (ret < 0)
+    return ret;
+
+  ret = sd_bus_message_append(m, "s", kind);
+  if (ret >= 0)
+    ret = sd_bus_message_append_array(m, 'y', data, len);
+  if (ret >= 0)
+    ret = call_async(rp, m);
+
+  sd_bus_message_unref(m);
+  rp->events++;
+  return ret;
+}
+
+// Dispatches replies until uv_hrtime() reaches `until`.
+static int wait_until(replay_t *rp, uint64_t until) {
+  for (;;) {
+    int r = sd_bus_process(rp->bus, NULL);
+    if (r < 0)
+      return r;
+    if (r > 0)
+      continue;
+
+    uint64_t now = uv_hrtime();
+    if (now >= until)
+      return 0;
+
+    r = sd_bus_wait(rp->bus, (until - now + 999) / 1000);
+    if (r < 0)
+      return r;
+  }
+}
+
+// Dispatches replies until at most `max` calls await one. It returns
+// -ETIMEDOUT if uv_hrtime() reaches `until` first.
+static int wait_inflight(replay_t *rp, uint64_t max, uint64_t until) {
+  while (rp->inflight > max) {
+    int r = sd_bus_process(rp->bus, NULL);
+    if (r < 0)
+      return r;
+    if (r > 0)
+      continue;
+
+    uint64_t now = uv_hrtime();
+    if (now >= until)
+      return -ETIMEDOUT;
+
+    r = sd_bus_wait(rp->bus, (until - now + 999) / 1000);
+    if (r < 0)
+      return r;
+  }
+
+  return 0;
+}
+
+static int replay_file(replay_t *rp, FILE *f, double speed) {
+  dhub_buf_t buf = {0};
+  dhub_record_t rec;
+  uint64_t start = uv_hrtime();
+  uint64_t first = 0;
+  int r = 0;
+  int n = 0;
+
+  while ((n = dhub_record_read(f, &buf, &rec)) == 1) {
+    if (rp->records++ == 0)
+      first = rec.time_ns;
+
+    // Records are sent in order, at their recorded time scaled by speed or
+    // as soon as D-Hub keeps up.
+    if (speed > 0)
+      r = wait_until(rp, start + (uint64_t)((rec.time_ns - first) / speed));
+    else
+      r = wait_inflight(rp, REPLAY_MAX_INFLIGHT - 1, UINT64_MAX);
+    if (r < 0)
+      break;
+
+    switch (rec.type) {
+    case DHUB_RECORD_CALL:
+      r = send_call(rp, &rec.payload);
+      break;
+    case DHUB_RECORD_EVENT:
+      r = send_event(rp, &rec.payload);
+      break;
+    default:
+      // Records of newer versions are skipped.
+      r = 0;
+      break;
+    }
+
+    if (r == -EBADMSG) {
+      fprintf(stderr, "invalid record #%" PRIu64 "\n", rp->records);
+      break;
+    }
+    if (r < 0) {
+      LOG_ERRNO_P(-r, "failed to send record #%" PRIu64, rp->records);
+      rp->errors++;
+      r = 0;
+    }
+  }
+  if (n == -1) {
+    fprintf(stderr, "truncated record #%" PRIu64 "\n", rp->records + 1);
+    r = -EBADMSG;
+  }
+
+  if (r >= 0) {
+    r = wait_inflight(rp, 0, uv_hrtime() + REPLAY_DRAIN_TIMEOUT_NS);
+    if (r == -ETIMEDOUT)
+      fprintf(stderr, "%" PRIu64 " calls still awaiting a reply\n",
+              rp->inflight);
+  }
+
+  dhub_buf_free(&buf);
+  return r;
+}
+
+int replay(int argc, char *argv[]) {
+  double speed = 1;
+
+  optind = 0;
+  while (1) {
+    static struct option long_options[] = {
+        {"speed", required_argument, 0, 's'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}};
+
+    int c = getopt_long(argc, argv, "s:h", long_options, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 's': {
+      char *end = NULL;
+      speed = strtod(optarg, &end);
+      if (*optarg == '\0' || *end != '\0' || speed < 0) {
+        fprintf(stderr, "invalid replay speed '%s'\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+    }
+
+    case 'h':
+      print_usage(argv[0]);
+      return EXIT_SUCCESS;
+
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (optind >= argc) {
+    fprintf(stderr, "no recording file provided\n");
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const char *path = argv[optind];
+  FILE *f = fopen(path, "re");
+  if (f == NULL) {
+    fprintf(stderr, "failed to open '%s': %s\n", path, strerror(errno));
+    return EXIT_FAILURE;
+  }
+  if (dhub_record_read_header(f) == -1) {
+    fprintf(stderr, "'%s' isn't a D-Hub recording\n", path);
+    fclose(f);
+    return EXIT_FAILURE;
+  }
+
+  static replay_t rp = {0};
+  int r = sd_bus_open_user(&rp.bus);
+  if (r < 0) {
+    fprintf(stderr, "failed to connect to session bus: %s\n", strerror(-r));
+    fclose(f);
+    return EXIT_FAILURE;
+  }
+
+  uint64_t start = uv_hrtime();
+  r = replay_file(&rp, f, speed);
+  double elapsed = (uv_hrtime() - start) / 1e9;
+
+  fputs("{\"file\":", stdout);
+  json_write_string(stdout, path, SIZE_MAX);
+  printf(",\"speed\":%g,\"records\":%" PRIu64
+         ",\"calls\":%" PRIu64 ",\"events\":%" PRIu64 ",\"errors\":%" PRIu64
+         ",\"unanswered\":%" PRIu64 ",\"duration_s\":%.3f,"
+         "\"records_per_s\":%.1f,\"latency_us\":{\"p50\":%.1f,\"p99\":%.1f,"
+         "\"p999\":%.1f,\"max\":%.1f}}\n",
+         speed, rp.records, rp.calls, rp.events, rp.errors, rp.inflight,
+         elapsed, elapsed > 0 ? rp.records / elapsed : 0,
+         histogram_percentile(&rp.latency, 500) / 1e3,
+         histogram_percentile(&rp.latency, 990) / 1e3,
+         histogram_percentile(&rp.latency, 999) / 1e3, rp.latency.max / 1e3);
+
+  sd_bus_flush_close_unref(rp.bus);
+  fclose(f);
+  return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,231 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "start/context.h"
+#include "start/state.h"
+#define LOG_MODULE "dhub-budget"
+#include "log.h"
+
+#define WINDOW_NS ((uint64_t)DHUB_BUDGET_WINDOW_MS * 1000000)
+
+void dhub_budget_init(dhub_context_t *ctx, unsigned int budget_ms,
+                      bool throttle) {
+  dhub_budget_t *budget = &ctx->budget;
+  budget->budget_ns = (uint64_t)budget_ms * 1000000;
+  budget->throttle = throttle && budget_ms != 0;
+  UV_MUST(uv_mutex_init(&budget->lock), "failed to initialize budget lock");
+}
+
+void dhub_budget_deinit(dhub_context_t *ctx) {
+  dhub_budget_t *budget = &ctx->budget;
+  tll_foreach(budget->modules, it) {
+    free(it->item.module);
+    tll_remove(budget->modules, it);
+  }
+  uv_mutex_destroy(&budget->lock);
+}
+
+dhub_module_time_t *dhub_budget_module(dhub_context_t *ctx,
+                                       const char *module) {
+  dhub_budget_t *budget = &ctx->budget;
+  if (module == NULL || *module == '\0')
+    return NULL;
+
+  dhub_module_time_t *mt = NULL;
+  uv_mutex_lock(&budget->lock);
+  tll_foreach(budget->modules, it) {
+    if (strcmp(it->item.module, module) == 0) {
+      mt = &it->item;
+      break;
+    }
+  }
+  if (mt == NULL) {
+    char *name = strdup(module);
+    if (name != NULL) {
+      tll_push_back(budget->modules, ((dhub_module_time_t){.module = name}));
+      mt = &tll_back(budget->modules);
+    }
+  }
+  uv_mutex_unlock(&budget->lock);
+
+  return mt;
+}
+
+const char *dhub_budget_current(dhub_context_t *ctx) {
+  dhub_budget_scope_t *scope = ctx->budget.scope;
+  if (scope == NULL || scope->mt == NULL)
+    return "";
+
+  return scope->mt->module;
+}
+
+// Starts a new window once current one is over, flagging module if the
+// window that just ended was over budget. It must be called with budget lock
+// held.
+static void roll_window(dhub_budget_t *budget, dhub_module_time_t *mt,
+                        uint64_t now) {
+  if (now - mt->window_start < WINDOW_NS)
+    return;
+
+  // Module didn't run during last window if more than one passed.
+  bool over = mt->window_ns > budget->budget_ns &&
+              now - mt->window_start < 2 * WINDOW_NS;
+  if (over) {
+    mt->overruns++;
+    if (!mt->flagged)
+      LOG_WARN("module '%s' used %.1fms of loop time in %dms, over its %.1fms "
+               "budget%s",
+               mt->module, mt->window_ns / 1e6, DHUB_BUDGET_WINDOW_MS,
+               budget->budget_ns / 1e6,
+               budget->throttle ? ", throttling its low priority work" : "");
+  } else if (mt->flagged) {
+    LOG_INFO("module '%s' is back under its loop time budget", mt->module);
+  }
+
+  mt->flagged = over;
+  mt->window_start = now;
+  mt->window_ns = 0;
+}
+
+void dhub_budget_enter(dhub_context_t *ctx, dhub_budget_scope_t *scope,
+                       dhub_module_time_t *mt) {
+  dhub_budget_t *budget = &ctx->budget;
+  *scope = (dhub_budget_scope_t){
+      .parent = budget->scope,
+      .mt = mt,
+      .start = uv_hrtime(),
+  };
+  budget->scope = scope;
+}
+
+uint64_t dhub_budget_leave(dhub_context_t *ctx, dhub_budget_scope_t *scope) {
+  dhub_budget_t *budget = &ctx->budget;
+  uint64_t now = uv_hrtime();
+  uint64_t elapsed = now - scope->start;
+
+  budget->scope = scope->parent;
+  if (scope->parent != NULL)
+    scope->parent->nested_ns += elapsed;
+
+  dhub_module_time_t *mt = scope->mt;
+  if (mt != NULL) {
+    // Nested scopes charged their own module.
+    uint64_t self = elapsed > scope->nested_ns ? elapsed - scope->nested_ns : 0;
+
+    uv_mutex_lock(&budget->lock);
+    mt->total_ns += self;
+    if (budget->budget_ns != 0) {
+      roll_window(budget, mt, now);
+      mt->window_ns += self;
+    }
+    uv_mutex_unlock(&budget->lock);
+  }
+
+  return elapsed;
+}
+
+bool dhub_budget_throttled(dhub_context_t *ctx, dhub_module_time_t *mt) {
+  dhub_budget_t *budget = &ctx->budget;
+  if (!budget->throttle || mt == NULL)
+    return false;
+
+  uv_mutex_lock(&budget->lock);
+  roll_window(budget, mt, uv_hrtime());
+  bool throttled = mt->flagged;
+  if (throttled)
+    mt->throttled++;
+  uv_mutex_unlock(&budget->lock);
+
+  return throttled;
+}
+
+int dhub_budget_append(dhub_context_t *ctx, sd_bus_message *reply) {
+  dhub_budget_t *budget = &ctx->budget;
+  int r = 0;
+
+  uv_mutex_lock(&budget->lock);
+  tll_foreach(budget->modules, it) {
+    dhub_module_time_t *mt = &it->item;
+    r = sd_bus_message_append(reply, "(stttb)", mt->module, mt->total_ns,
+                              mt->overruns, mt->throttled, (int)mt->flagged);
+    if (r < 0)
+      break;
+  }
+  uv_mutex_unlock(&budget->lock);
+
+  return r;
+}
+
+// Returns module owning handles initialized by calling code.
+static dhub_module_time_t *handle_owner(dhub_state_t *dhub) {
+  dhub_context_t *ctx = dhub_context(dhub);
+  return dhub_budget_module(ctx, dhub_module_of(ctx, NULL));
+}
+
+static void on_poll(uv_poll_t *handle, int status, int events) {
+  dhub_poll_t *poll = (dhub_poll_t *)handle;
+  dhub_context_t *ctx = handle->loop->data;
+  dhub_module_time_t *owner = poll->owner;
+
+  const char *module = owner != NULL ? owner->module : "dhub";
+  uint64_t start = dhub_trace_begin();
+  dhub_budget_scope_t scope;
+  dhub_budget_enter(ctx, &scope, owner);
+  poll->cb(handle, status, events);
+  // Poll may be closing now, it must not be used anymore.
+  uint64_t elapsed = dhub_budget_leave(ctx, &scope);
+  dhub_lag_note(ctx, elapsed, module, "poll callback", NULL);
+  dhub_trace_end(start, "poll", module, "events=%d", events);
+}
+
+int dhub_poll_init(dhub_state_t *dhub, dhub_poll_t *poll, int fd) {
+  poll->cb = NULL;
+  poll->owner = handle_owner(dhub);
+  return uv_poll_init(dhub_loop(dhub), &poll->handle, fd);
+}
+
+int dhub_poll_start(dhub_poll_t *poll, int events, uv_poll_cb cb) {
+  poll->cb = cb;
+  return uv_poll_start(&poll->handle, events, on_poll);
+}
+
+static void on_timer(uv_timer_t *handle) {
+  dhub_timer_t *timer = (dhub_timer_t *)handle;
+  dhub_context_t *ctx = handle->loop->data;
+  dhub_module_time_t *owner = timer->owner;
+
+  if (timer->prio == DHUB_TIMER_PRIO_LOW &&
+      dhub_budget_throttled(ctx, owner)) {
+    LOG_DBG("module '%s' is throttled, delaying low priority timer",
+            owner->module);
+    uv_timer_start(handle, on_timer, DHUB_THROTTLE_DELAY_MS,
+                   uv_timer_get_repeat(handle));
+    return;
+  }
+
+  const char *module = owner != NULL ? owner->module : "dhub";
+  uint64_t start = dhub_trace_begin();
+  dhub_budget_scope_t scope;
+  dhub_budget_enter(ctx, &scope, owner);
+  timer->cb(handle);
+  // Timer may be closing now, it must not be used anymore.
+  uint64_t elapsed = dhub_budget_leave(ctx, &scope);
+  dhub_lag_note(ctx, elapsed, module, "timer callback", NULL);
+  dhub_trace_end(start, "timer", module, NULL);
+}
+
+int dhub_timer_init(dhub_state_t *dhub, dhub_timer_t *timer,
+                    enum dhub_timer_prio prio) {
+  timer->cb = NULL;
+  timer->prio = prio;
+  timer->owner = handle_owner(dhub);
+  return uv_timer_init(dhub_loop(dhub), &timer->handle);
+}
+
+int dhub_timer_start(dhub_timer_t *timer, uv_timer_cb cb, uint64_t timeout,
+                     uint64_t repeat) {
+  timer->cb = cb;
+  return uv_timer_start(&timer->handle, on_timer, timeout, repeat);
+}
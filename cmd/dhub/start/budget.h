@@ -0,0 +1,104 @@
+#ifndef HUB_BUDGET_H_INCLUDE
+#define HUB_BUDGET_H_INCLUDE
+
+#include <basu/sd-bus.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "tllist.h"
+
+// Loop time modules may use per window before being flagged, 0 disables it.
+#ifndef DHUB_MODULE_BUDGET_MS
+#define DHUB_MODULE_BUDGET_MS 250
+#endif
+#define DHUB_BUDGET_WINDOW_MS 1000
+// Delay of low priority timers of throttled modules.
+#define DHUB_THROTTLE_DELAY_MS 100
+
+struct dhub_context;
+
+/**
+ * Loop time used by a module: time spent in its load() and unload()
+ * functions, in handlers of its instrumented vtables and in callbacks of its
+ * dhub_poll_t and dhub_timer_t handles. Time of nested callbacks is charged
+ * to the module they belong to only.
+ */
+typedef struct dhub_module_time {
+  char *module;
+  uint64_t total_ns;
+  // Current window.
+  uint64_t window_start;
+  uint64_t window_ns;
+  // Windows over budget.
+  uint64_t overruns;
+  // Low priority callbacks and signals delayed or dropped while throttled.
+  uint64_t throttled;
+  // Last window was over budget.
+  bool flagged;
+} dhub_module_time_t;
+
+/**
+ * Module code running on the loop, scopes are nested when module code calls
+ * into D-Hub which calls into another module.
+ */
+typedef struct dhub_budget_scope {
+  struct dhub_budget_scope *parent;
+  dhub_module_time_t *mt;
+  uint64_t start;
+  // Time of nested scopes.
+  uint64_t nested_ns;
+} dhub_budget_scope_t;
+
+/**
+ * Per loop module time accounting. Modules over their budget are flagged
+ * and, if `throttle` is set, their low priority work is delayed until they
+ * are back under it. Entries are updated by loop thread and read by main
+ * thread, under `lock`.
+ */
+typedef struct dhub_budget {
+  uint64_t budget_ns;
+  bool throttle;
+  uv_mutex_t lock;
+  tll(dhub_module_time_t) modules;
+  dhub_budget_scope_t *scope;
+} dhub_budget_t;
+
+void dhub_budget_init(struct dhub_context *ctx, unsigned int budget_ms,
+                      bool throttle);
+void dhub_budget_deinit(struct dhub_context *ctx);
+
+/**
+ * Returns accounting entry of module, creating it, or NULL for D-Hub core
+ * (empty name).
+ */
+dhub_module_time_t *dhub_budget_module(struct dhub_context *ctx,
+                                       const char *module);
+
+/**
+ * Returns name of module whose code is running on context loop, an empty
+ * string if none is.
+ */
+const char *dhub_budget_current(struct dhub_context *ctx);
+
+/**
+ * Enters code of module `mt`, NULL for D-Hub core, until dhub_budget_leave()
+ * which charges time spent in it and returns it.
+ */
+void dhub_budget_enter(struct dhub_context *ctx, dhub_budget_scope_t *scope,
+                       dhub_module_time_t *mt);
+uint64_t dhub_budget_leave(struct dhub_context *ctx,
+                           dhub_budget_scope_t *scope);
+
+/**
+ * Returns true if low priority work of module must be delayed and counts it.
+ */
+bool dhub_budget_throttled(struct dhub_context *ctx, dhub_module_time_t *mt);
+
+/**
+ * Appends (module, total loop time in nanoseconds, windows over budget,
+ * throttled callbacks and signals, flagged) structures of context modules.
+ */
+int dhub_budget_append(struct dhub_context *ctx, sd_bus_message *reply);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef HUB_BUILTINS_H_INCLUDE
+#define HUB_BUILTINS_H_INCLUDE
+
+#include "dhub.h"
+
+/**
+ * NULL terminated list of modules linked into D-Hub binary. It is generated
+ * by the Makefile from BUILTIN_MODULES variable.
+ */
+extern const dhub_module_desc_t *const dhub_builtin_modules[];
+
+#endif
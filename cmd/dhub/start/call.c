@@ -0,0 +1,163 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "start/context.h"
+#include "start/state.h"
+#define LOG_MODULE "dhub-call"
+#include "log.h"
+
+struct dhub_call {
+  uv_timer_t timer;
+  dhub_context_t *ctx;
+  sd_bus_message *m;
+  dhub_call_drop_fn_t on_drop;
+  void *userdata;
+  // Module kept from idle unload until call is replied to.
+  dhub_handle_t idle_hold;
+  struct dhub_call *prev;
+  struct dhub_call *next;
+};
+
+static void on_call_close(uv_handle_t *handle) { free(handle->data); }
+
+/**
+ * Removes call from pending list and frees it once its timer is closed.
+ */
+static void call_release(dhub_call_t *call) {
+  dhub_calls_t *calls = &call->ctx->calls;
+
+  if (call->prev != NULL)
+    call->prev->next = call->next;
+  else
+    calls->head = call->next;
+  if (call->next != NULL)
+    call->next->prev = call->prev;
+  calls->pending--;
+  dhub_idle_release(call->ctx->dhub, call->idle_hold);
+
+  sd_bus_message_unref(call->m);
+  call->m = NULL;
+
+  uv_timer_stop(&call->timer);
+  uv_close((uv_handle_t *)&call->timer, on_call_close);
+}
+
+/**
+ * Replies with an error on module's behalf, notifies it and releases call.
+ */
+static void call_drop(dhub_call_t *call, const char *name, const char *msg) {
+  int r = sd_bus_reply_method_errorf(call->m, name, "%s", msg);
+  NEG_TRY(r, "failed to reply to dropped method call");
+
+  if (call->on_drop != NULL)
+    call->on_drop(call, call->userdata);
+
+  call->ctx->calls.stats.dropped++;
+  call_release(call);
+}
+
+static void on_call_timeout(uv_timer_t *handle) {
+  dhub_call_t *call = handle->data;
+
+  LOG_WARN("method call %s.%s on '%s' timed out",
+           sd_bus_message_get_interface(call->m),
+           sd_bus_message_get_member(call->m),
+           sd_bus_message_get_path(call->m));
+  call->ctx->calls.stats.timed_out++;
+  call_drop(call, SD_BUS_ERROR_TIMEOUT, "method call timed out");
+}
+
+dhub_call_t *dhub_call_defer(dhub_state_t *dhub, sd_bus_message *m,
+                             uint64_t timeout_ms, dhub_call_drop_fn_t on_drop,
+                             void *userdata) {
+  dhub_call_t *call = calloc(1, sizeof(*call));
+  if (call == NULL)
+    return NULL;
+
+  dhub_context_t *ctx = dhub_context(dhub);
+  *call = (dhub_call_t){
+      .ctx = ctx,
+      .m = sd_bus_message_ref(m),
+      .on_drop = on_drop,
+      .userdata = userdata,
+      .idle_hold = dhub_idle_hold(dhub, sd_bus_message_get_path(m)),
+  };
+
+  call->timer.data = call;
+  uv_timer_init(ctx->loop, &call->timer);
+  if (timeout_ms == 0)
+    timeout_ms = DHUB_CALL_TIMEOUT_MS;
+  uv_timer_start(&call->timer, on_call_timeout, timeout_ms, 0);
+
+  // Add call to pending list.
+  dhub_calls_t *calls = &ctx->calls;
+  call->next = calls->head;
+  if (calls->head != NULL)
+    calls->head->prev = call;
+  calls->head = call;
+
+  calls->pending++;
+  calls->stats.deferred++;
+  if (calls->pending > calls->stats.max_pending)
+    calls->stats.max_pending = calls->pending;
+
+  return call;
+}
+
+sd_bus_message *dhub_call_message(dhub_call_t *call) { return call->m; }
+
+void *dhub_call_userdata(dhub_call_t *call) { return call->userdata; }
+
+int dhub_call_return(dhub_call_t *call, const char *types, ...) {
+  va_list va;
+  va_start(va, types);
+  int r = sd_bus_reply_method_returnv(call->m, types, va);
+  va_end(va);
+
+  call->ctx->calls.stats.completed++;
+  call_release(call);
+  return r;
+}
+
+int dhub_call_reply(dhub_call_t *call, sd_bus_message *reply) {
+  int r = sd_bus_send(sd_bus_message_get_bus(call->m), reply, NULL);
+
+  call->ctx->calls.stats.completed++;
+  call_release(call);
+  return r;
+}
+
+int dhub_call_error(dhub_call_t *call, const char *name, const char *msg) {
+  sd_bus_error err = SD_BUS_ERROR_MAKE_CONST(name, msg);
+  int r = sd_bus_reply_method_error(call->m, &err);
+
+  call->ctx->calls.stats.completed++;
+  call_release(call);
+  return r;
+}
+
+int dhub_call_errno(dhub_call_t *call, int err) {
+  int r = sd_bus_reply_method_errno(call->m, err, NULL);
+
+  call->ctx->calls.stats.completed++;
+  call_release(call);
+  return r;
+}
+
+void dhub_calls_drop_all(dhub_context_t *ctx) {
+  while (ctx->calls.head != NULL)
+    call_drop(ctx->calls.head, SD_BUS_ERROR_NO_REPLY, "D-Hub is stopping");
+}
+
+void dhub_calls_log_stats(dhub_context_t *ctx) {
+  dhub_calls_stats_t *s = &ctx->calls.stats;
+
+  LOG_INFO("calls: deferred=%" PRIu64 " completed=%" PRIu64
+           " timed out=%" PRIu64 " dropped=%" PRIu64 " max pending=%" PRIu64,
+           s->deferred, s->completed, s->timed_out, s->dropped,
+           s->max_pending);
+}
@@ -0,0 +1,34 @@
+#ifndef HUB_CALL_H_INCLUDE
+#define HUB_CALL_H_INCLUDE
+
+#include <stdint.h>
+
+#ifndef DHUB_CALL_TIMEOUT_MS
+#define DHUB_CALL_TIMEOUT_MS 25000
+#endif
+
+struct dhub_context;
+struct dhub_call;
+
+typedef struct dhub_calls_stats {
+  uint64_t deferred;
+  uint64_t completed;
+  uint64_t timed_out;
+  uint64_t dropped;
+  uint64_t max_pending;
+} dhub_calls_stats_t;
+
+/**
+ * Method calls whose reply was deferred by a module. Pending calls are kept in
+ * an intrusive doubly linked list so completing one is O(1).
+ */
+typedef struct dhub_calls {
+  struct dhub_call *head;
+  uint64_t pending;
+  dhub_calls_stats_t stats;
+} dhub_calls_t;
+
+void dhub_calls_drop_all(struct dhub_context *ctx);
+void dhub_calls_log_stats(struct dhub_context *ctx);
+
+#endif
@@ -0,0 +1,348 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "start/codec.h"
+#define LOG_MODULE "dhub-codec"
+#include "log.h"
+
+void dhub_buf_put(dhub_buf_t *buf, const void *data, size_t len) {
+  if (buf->len + len > buf->cap) {
+    size_t cap = buf->cap == 0 ? 256 : buf->cap;
+    while (cap < buf->len + len)
+      cap *= 2;
+
+    uint8_t *d = realloc(buf->data, cap);
+    if (d == NULL)
+      LOG_FATAL("failed to grow buffer");
+    buf->data = d;
+    buf->cap = cap;
+  }
+
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+}
+
+void dhub_buf_put_u32(dhub_buf_t *buf, uint32_t v) {
+  dhub_buf_put(buf, &v, sizeof(v));
+}
+
+void dhub_buf_put_u64(dhub_buf_t *buf, uint64_t v) {
+  dhub_buf_put(buf, &v, sizeof(v));
+}
+
+void dhub_buf_put_str(dhub_buf_t *buf, const char *str) {
+  if (str == NULL)
+    str = "";
+  dhub_buf_put(buf, str, strlen(str) + 1);
+}
+
+void dhub_buf_free(dhub_buf_t *buf) {
+  free(buf->data);
+  *buf = (dhub_buf_t){0};
+}
+
+const void *dhub_reader_get(dhub_reader_t *r, size_t len) {
+  if (r->err != 0 || r->len - r->pos < len) {
+    r->err = -EBADMSG;
+    return NULL;
+  }
+
+  const void *p = r->data + r->pos;
+  r->pos += len;
+  return p;
+}
+
+uint32_t dhub_reader_u32(dhub_reader_t *r) {
+  uint32_t v = 0;
+  const void *p = dhub_reader_get(r, sizeof(v));
+  if (p != NULL)
+    memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint64_t dhub_reader_u64(dhub_reader_t *r) {
+  uint64_t v = 0;
+  const void *p = dhub_reader_get(r, sizeof(v));
+  if (p != NULL)
+    memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+const char *dhub_reader_str(dhub_reader_t *r) {
+  if (r->err != 0)
+    return NULL;
+
+  const char *str = (const char *)r->data + r->pos;
+  const char *end = memchr(str, '\0', r->len - r->pos);
+  if (end == NULL) {
+    r->err = -EBADMSG;
+    return NULL;
+  }
+
+  r->pos += end - str + 1;
+  return str;
+}
+
+// Size of fixed size basic types, 0 for strings and containers.
+static size_t basic_size(char type) {
+  switch (type) {
+  case SD_BUS_TYPE_BYTE:
+    return 1;
+  case SD_BUS_TYPE_INT16:
+  case SD_BUS_TYPE_UINT16:
+    return 2;
+  case SD_BUS_TYPE_BOOLEAN:
+  case SD_BUS_TYPE_INT32:
+  case SD_BUS_TYPE_UINT32:
+    return 4;
+  case SD_BUS_TYPE_INT64:
+  case SD_BUS_TYPE_UINT64:
+  case SD_BUS_TYPE_DOUBLE:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+static bool is_string(char type) {
+  return type == SD_BUS_TYPE_STRING || type == SD_BUS_TYPE_OBJECT_PATH ||
+         type == SD_BUS_TYPE_SIGNATURE;
+}
+
+static bool is_container(char type) {
+  return type == SD_BUS_TYPE_ARRAY || type == SD_BUS_TYPE_VARIANT ||
+         type == SD_BUS_TYPE_STRUCT || type == SD_BUS_TYPE_DICT_ENTRY;
+}
+
+int dhub_codec_encode_body(sd_bus_message *m, dhub_buf_t *buf) {
+  char type = 0;
+  const char *contents = NULL;
+  int r = 0;
+
+  while ((r = sd_bus_message_peek_type(m, &type, &contents)) > 0) {
+    dhub_buf_put(buf, &type, 1);
+
+    if (is_container(type)) {
+      dhub_buf_put_str(buf, contents);
+      r = sd_bus_message_enter_container(m, type, contents);
+      if (r < 0)
+        return r;
+      r = dhub_codec_encode_body(m, buf);
+      if (r < 0)
+        return r;
+      r = sd_bus_message_exit_container(m);
+      if (r < 0)
+        return r;
+      continue;
+    }
+
+    union {
+      uint8_t y;
+      int b;
+      int16_t n;
+      int32_t i;
+      int64_t x;
+      double d;
+      const char *s;
+    } value = {0};
+
+    if (type == SD_BUS_TYPE_UNIX_FD)
+      return -EOPNOTSUPP;
+
+    r = sd_bus_message_read_basic(m, type, &value);
+    if (r < 0)
+      return r;
+
+    if (is_string(type))
+      dhub_buf_put_str(buf, value.s);
+    else
+      dhub_buf_put(buf, &value, basic_size(type));
+  }
+  if (r < 0)
+    return r;
+
+  // End of container or body.
+  dhub_buf_put(buf, "", 1);
+  return 0;
+}
+
+int dhub_codec_decode_body(dhub_reader_t *reader, sd_bus_message *m) {
+  while (1) {
+    const char *type = dhub_reader_get(reader, 1);
+    if (type == NULL)
+      return reader->err;
+
+    // End of container or body.
+    if (*type == '\0')
+      return 0;
+
+    int r = 0;
+    if (is_container(*type)) {
+      const char *contents = dhub_reader_str(reader);
+      if (contents == NULL)
+        return reader->err;
+
+      r = sd_bus_message_open_container(m, *type, contents);
+      if (r < 0)
+        return r;
+      r = dhub_codec_decode_body(reader, m);
+      if (r < 0)
+        return r;
+      r = sd_bus_message_close_container(m);
+    } else if (is_string(*type)) {
+      const char *str = dhub_reader_str(reader);
+      if (str == NULL)
+        return reader->err;
+      r = sd_bus_message_append_basic(m, *type, str);
+    } else {
+      size_t size = basic_size(*type);
+      if (size == 0)
+        return -EBADMSG;
+
+      const void *value = dhub_reader_get(reader, size);
+      if (value == NULL)
+        return reader->err;
+
+      // Values may be unaligned.
+      uint64_t aligned = 0;
+      memcpy(&aligned, value, size);
+      r = sd_bus_message_append_basic(m, *type, &aligned);
+    }
+    if (r < 0)
+      return r;
+  }
+}
+
+static size_t align_to(size_t off, size_t align) {
+  return (off + align - 1) & ~(align - 1);
+}
+
+// Wire alignment of values of `type`.
+static size_t type_align(char type) {
+  switch (type) {
+  case SD_BUS_TYPE_ARRAY:
+  case SD_BUS_TYPE_UNIX_FD:
+  case SD_BUS_TYPE_STRING:
+  case SD_BUS_TYPE_OBJECT_PATH:
+    return 4;
+  case SD_BUS_TYPE_STRUCT_BEGIN:
+  case SD_BUS_TYPE_DICT_ENTRY_BEGIN:
+    return 8;
+  case SD_BUS_TYPE_SIGNATURE:
+  case SD_BUS_TYPE_VARIANT:
+    return 1;
+  default:
+    return basic_size(type) != 0 ? basic_size(type) : 1;
+  }
+}
+
+// Returns end of single complete type at `sig`, NULL if it is invalid.
+static const char *type_end(const char *sig) {
+  switch (*sig) {
+  case '\0':
+    return NULL;
+  case SD_BUS_TYPE_ARRAY:
+    return type_end(sig + 1);
+  case SD_BUS_TYPE_STRUCT_BEGIN:
+  case SD_BUS_TYPE_DICT_ENTRY_BEGIN: {
+    char close = *sig == SD_BUS_TYPE_STRUCT_BEGIN ? SD_BUS_TYPE_STRUCT_END
+                                                  : SD_BUS_TYPE_DICT_ENTRY_END;
+    for (sig++; sig != NULL && *sig != close; sig = type_end(sig))
+      ;
+    return sig != NULL ? sig + 1 : NULL;
+  }
+  default:
+    return sig + 1;
+  }
+}
+
+// Adds wire size of values of types [sig, end) read from `va` as
+// sd_bus_message_appendv() does to `*off`. It returns false if types are
+// invalid.
+static bool values_size(const char *sig, const char *end, va_list *va,
+                        size_t *off) {
+  while (sig < end) {
+    const char *next = type_end(sig);
+    if (next == NULL)
+      return false;
+
+    char type = *sig;
+    *off = align_to(*off, type_align(type));
+    switch (type) {
+    case SD_BUS_TYPE_INT64:
+    case SD_BUS_TYPE_UINT64:
+      (void)va_arg(*va, uint64_t);
+      *off += 8;
+      break;
+    case SD_BUS_TYPE_DOUBLE:
+      (void)va_arg(*va, double);
+      *off += 8;
+      break;
+    case SD_BUS_TYPE_STRING:
+    case SD_BUS_TYPE_OBJECT_PATH:
+    case SD_BUS_TYPE_SIGNATURE: {
+      const char *str = va_arg(*va, const char *);
+      size_t len_size = type == SD_BUS_TYPE_SIGNATURE ? 1 : 4;
+      *off += len_size + (str != NULL ? strlen(str) : 0) + 1;
+      break;
+    }
+    case SD_BUS_TYPE_VARIANT: {
+      const char *contents = va_arg(*va, const char *);
+      if (contents == NULL)
+        return false;
+      size_t len = strlen(contents);
+      *off += 1 + len + 1;
+      if (!values_size(contents, contents + len, va, off))
+        return false;
+      break;
+    }
+    case SD_BUS_TYPE_ARRAY: {
+      // Element count, then elements.
+      unsigned int n = va_arg(*va, unsigned int);
+      *off = align_to(*off + 4, type_align(sig[1]));
+      for (unsigned int i = 0; i < n; i++) {
+        if (!values_size(sig + 1, next, va, off))
+          return false;
+      }
+      break;
+    }
+    case SD_BUS_TYPE_STRUCT_BEGIN:
+    case SD_BUS_TYPE_DICT_ENTRY_BEGIN:
+      if (!values_size(sig + 1, next - 1, va, off))
+        return false;
+      break;
+    case SD_BUS_TYPE_UNIX_FD:
+      (void)va_arg(*va, int);
+      *off += 4;
+      break;
+    default: {
+      // Smaller integers are promoted to int.
+      size_t size = basic_size(type);
+      if (size == 0)
+        return false;
+      (void)va_arg(*va, int);
+      *off += size;
+      break;
+    }
+    }
+
+    sig = next;
+  }
+
+  return true;
+}
+
+size_t dhub_codec_body_size(const char *types, va_list va) {
+  if (types == NULL)
+    return 0;
+
+  va_list ap;
+  va_copy(ap, va);
+  size_t off = 0;
+  bool ok = values_size(types, types + strlen(types), &ap, &off);
+  va_end(ap);
+  return ok ? off : 0;
+}
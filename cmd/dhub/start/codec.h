@@ -0,0 +1,64 @@
+#ifndef HUB_CODEC_H_INCLUDE
+#define HUB_CODEC_H_INCLUDE
+
+#include <basu/sd-bus.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Growable byte buffer.
+ */
+typedef struct dhub_buf {
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+} dhub_buf_t;
+
+void dhub_buf_put(dhub_buf_t *buf, const void *data, size_t len);
+void dhub_buf_put_u32(dhub_buf_t *buf, uint32_t v);
+void dhub_buf_put_u64(dhub_buf_t *buf, uint64_t v);
+// NULL strings are encoded as empty strings.
+void dhub_buf_put_str(dhub_buf_t *buf, const char *str);
+void dhub_buf_free(dhub_buf_t *buf);
+
+/**
+ * Buffer reader. Reads past end of buffer fail and set `err`.
+ */
+typedef struct dhub_reader {
+  const uint8_t *data;
+  size_t len;
+  size_t pos;
+  int err;
+} dhub_reader_t;
+
+const void *dhub_reader_get(dhub_reader_t *r, size_t len);
+uint32_t dhub_reader_u32(dhub_reader_t *r);
+uint64_t dhub_reader_u64(dhub_reader_t *r);
+const char *dhub_reader_str(dhub_reader_t *r);
+
+/**
+ * Encodes D-Bus message body, from its current read position, into a self
+ * describing stream: every value is prefixed with its type, containers with
+ * their contents signature and terminated by a 0 byte. Unix file descriptors
+ * aren't supported.
+ *
+ * It returns a negative errno on error.
+ */
+int dhub_codec_encode_body(sd_bus_message *m, dhub_buf_t *buf);
+
+/**
+ * Appends values of a stream encoded by dhub_codec_encode_body() to message.
+ *
+ * It returns a negative errno on error.
+ */
+int dhub_codec_decode_body(dhub_reader_t *r, sd_bus_message *m);
+
+/**
+ * Returns wire size of a body made of `types` values in `va`, as passed to
+ * sd_bus_message_appendv(), without encoding it. It returns 0 if types are
+ * invalid.
+ */
+size_t dhub_codec_body_size(const char *types, va_list va);
+
+#endif
@@ -0,0 +1,148 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "start/builtins.h"
+#include "start/config.h"
+#include "start/state.h"
+#define LOG_MODULE "dhub-config"
+#include "log.h"
+
+static bool valid_modname(const char *name) {
+  if (*name == '\0')
+    return false;
+
+  for (const char *c = name; *c != '\0'; c++) {
+    if (!isalnum((unsigned char)*c) && *c != '_' && *c != '-')
+      return false;
+  }
+  return true;
+}
+
+static void add_module(dhub_config_t *cfg, const char *name, bool lazy,
+                       bool isolated) {
+  tll_foreach(cfg->modules, it) {
+    if (strcmp(it->item.name, name) == 0)
+      return;
+  }
+
+  tll_push_back(cfg->modules, ((dhub_config_module_t){
+                                  .name = strdup(name),
+                                  .lazy = lazy,
+                                  .isolated = isolated,
+                              }));
+}
+
+static char *strip(char *str) {
+  while (isspace((unsigned char)*str))
+    str++;
+
+  char *end = str + strlen(str);
+  while (end > str && isspace((unsigned char)end[-1]))
+    end--;
+  *end = '\0';
+
+  return str;
+}
+
+static int load_file(dhub_config_t *cfg) {
+  FILE *f = fopen(cfg->path, "r");
+  if (f == NULL) {
+    LOG_ERRNO("failed to open config file '%s'", cfg->path);
+    return -1;
+  }
+
+  int r = 0;
+  char *line = NULL;
+  size_t size = 0;
+  unsigned int lineno = 0;
+  while (getline(&line, &size, f) != -1) {
+    lineno++;
+    char *name = strip(line);
+    if (*name == '\0' || *name == '#')
+      continue;
+
+    bool lazy = false;
+    bool isolated = false;
+    if (strncmp(name, "lazy", 4) == 0 && isspace((unsigned char)name[4])) {
+      lazy = true;
+      name = strip(name + 4);
+    } else if (strncmp(name, "isolated", 8) == 0 &&
+               isspace((unsigned char)name[8])) {
+      isolated = true;
+      name = strip(name + 8);
+    }
+
+    if (!valid_modname(name)) {
+      LOG_ERR("%s:%u: invalid module name '%s'", cfg->path, lineno, name);
+      r = -1;
+      break;
+    }
+
+    add_module(cfg, name, lazy, isolated);
+  }
+
+  if (r == 0 && ferror(f)) {
+    LOG_ERRNO("failed to read config file '%s'", cfg->path);
+    r = -1;
+  }
+
+  free(line);
+  fclose(f);
+  return r;
+}
+
+static int filter_so(const struct dirent *entry) {
+  size_t len = strlen(entry->d_name);
+  return len > 3 && strcmp(entry->d_name + len - 3, ".so") == 0;
+}
+
+static void scan_dir(dhub_config_t *cfg, const char *dir) {
+  struct dirent **entries = NULL;
+  int n = scandir(dir, &entries, filter_so, alphasort);
+  if (n < 0) {
+    LOG_DBG("failed to scan modules directory '%s': %s", dir,
+            strerror(errno));
+    return;
+  }
+
+  for (int i = 0; i < n; i++) {
+    char *name = entries[i]->d_name;
+    name[strlen(name) - 3] = '\0';
+    if (valid_modname(name))
+      add_module(cfg, name, false, false);
+    free(entries[i]);
+  }
+  free(entries);
+}
+
+int dhub_config_load(dhub_config_t *cfg) {
+  if (cfg->path != NULL) {
+    LOG_INFO("reading modules list from '%s'...", cfg->path);
+    return load_file(cfg);
+  }
+
+  LOG_INFO("no config file, loading builtin modules and scanning modules "
+           "directories...");
+  for (const dhub_module_desc_t *const *desc = dhub_builtin_modules;
+       *desc != NULL; desc++)
+    add_module(cfg, (*desc)->name, false, false);
+
+  scan_dir(cfg, MODDIR);
+
+  const char *moddir = getenv("DHUB_MODULES_DIR");
+  if (moddir != NULL)
+    scan_dir(cfg, moddir);
+
+  return 0;
+}
+
+void dhub_config_deinit(dhub_config_t *cfg) {
+  tll_foreach(cfg->modules, it) {
+    free(it->item.name);
+    tll_remove(cfg->modules, it);
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef HUB_CONFIG_H_INCLUDE
+#define HUB_CONFIG_H_INCLUDE
+
+#include <stdbool.h>
+
+#include "tllist.h"
+
+typedef struct dhub_config_module {
+  char *name;
+  // Module is loaded on first D-Bus call to its object prefix.
+  bool lazy;
+  // Module runs in its own host process.
+  bool isolated;
+} dhub_config_module_t;
+
+/**
+ * Daemon configuration, filled from `dhub start` options and config file.
+ */
+typedef struct dhub_config {
+  // Maximum number of D-Bus messages processed per loop wakeup, 0 means
+  // unlimited.
+  unsigned int dispatch_budget;
+  // Number of queued outgoing D-Bus messages above which low priority signals
+  // are shed or coalesced, 0 disables it.
+  unsigned int write_hwm;
+  // Milliseconds modules have to close once unloaded during shutdown before
+  // being force closed, 0 disables it.
+  unsigned int unload_timeout_ms;
+  // Milliseconds without activity after which DHUB_MODULE_IDLE_UNLOAD modules
+  // are unloaded, 0 disables it.
+  unsigned int idle_timeout_ms;
+  // Busy time of a loop iteration above which it is reported as a stall, 0
+  // disables reports.
+  unsigned int stall_ms;
+  // Milliseconds of loop time per second a module may use before being
+  // flagged, 0 disables it.
+  unsigned int module_budget_ms;
+  // Delay low priority work of modules over their budget.
+  bool throttle;
+  // Config file path, NULL if modules directories are scanned instead.
+  const char *path;
+  // Modules loaded at startup, in load order.
+  tll(dhub_config_module_t) modules;
+} dhub_config_t;
+
+/**
+ * Fills config modules list from config file or, if there is none, with
+ * builtin modules and modules found in MODDIR and $DHUB_MODULES_DIR.
+ *
+ * Config file contains one module name per line, optionally preceded by the
+ * `lazy` or `isolated` directive. Empty lines and lines starting with '#' are
+ * ignored.
+ */
+int dhub_config_load(dhub_config_t *cfg);
+void dhub_config_deinit(dhub_config_t *cfg);
+
+#endif
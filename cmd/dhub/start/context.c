@@ -0,0 +1,63 @@
+#include "start/context.h"
+#include "start/record.h"
+#include "start/state.h"
+#include "start/thread.h"
+
+void dhub_context_init(dhub_context_t *ctx, dhub_state_t *dhub,
+                       uv_loop_t *loop, sd_bus *bus) {
+  ctx->dhub = dhub;
+  ctx->loop = loop;
+  ctx->bus = bus;
+  loop->data = ctx;
+
+  dhub_dispatch_init(ctx, dhub->config.dispatch_budget);
+  dhub_emit_init(ctx, dhub->config.write_hwm);
+  dhub_stats_init(ctx);
+  dhub_lag_init(ctx, dhub->config.stall_ms);
+  dhub_budget_init(ctx, dhub->config.module_budget_ms, dhub->config.throttle);
+  dhub_record_attach(ctx);
+}
+
+void dhub_context_close(dhub_context_t *ctx) {
+  // Complete deferred method calls before their modules go away.
+  dhub_calls_drop_all(ctx);
+
+  // Stop D-Bus dispatch.
+  dhub_dispatch_close(ctx);
+  dhub_lag_close(ctx);
+}
+
+void dhub_context_deinit(dhub_context_t *ctx) {
+  dhub_dispatch_log_stats(ctx);
+  dhub_emit_log_stats(ctx);
+  dhub_offload_log_stats(ctx);
+  dhub_calls_log_stats(ctx);
+  dhub_lag_log_stats(ctx);
+  dhub_emit_deinit(ctx);
+}
+
+dhub_context_t *dhub_context(dhub_state_t *dhub) {
+  dhub_thread_t *thread = dhub_thread_current();
+  if (thread != NULL)
+    return &thread->ctx;
+
+  return &dhub->ctx;
+}
+
+const char *dhub_module_of(dhub_context_t *ctx, const char *path) {
+  dhub_thread_t *thread = dhub_thread_current();
+  if (thread != NULL)
+    return thread->modname;
+
+  const char *current = dhub_budget_current(ctx);
+  if (*current != '\0' || path == NULL)
+    return current;
+
+  dhub_registry_foreach(&ctx->dhub->modules, it) {
+    if (it->object_prefix != NULL &&
+        dhub_path_has_prefix(path, it->object_prefix))
+      return it->name;
+  }
+
+  return "";
+}
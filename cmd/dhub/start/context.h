@@ -0,0 +1,61 @@
+#ifndef HUB_CONTEXT_H_INCLUDE
+#define HUB_CONTEXT_H_INCLUDE
+
+#include <basu/sd-bus.h>
+#include <uv.h>
+
+#include "dhub.h"
+#include "start/budget.h"
+#include "start/call.h"
+#include "start/dispatch.h"
+#include "start/emit.h"
+#include "start/lag.h"
+#include "start/offload.h"
+#include "start/stats.h"
+
+struct dhub_state;
+
+/**
+ * Event loop context. It holds an event loop, the D-Bus connection dispatched
+ * on it and per loop states of D-Hub APIs used by modules. The main loop has
+ * one and so does every threaded module.
+ *
+ * Loop's data field points to its context.
+ */
+typedef struct dhub_context {
+  struct dhub_state *dhub;
+  uv_loop_t *loop;
+  sd_bus *bus;
+  dhub_dispatch_t dispatch;
+  dhub_emit_t emit;
+  dhub_offload_t offload;
+  dhub_calls_t calls;
+  dhub_stats_t stats;
+  dhub_lag_t lag;
+  dhub_budget_t budget;
+} dhub_context_t;
+
+void dhub_context_init(dhub_context_t *ctx, struct dhub_state *dhub,
+                       uv_loop_t *loop, sd_bus *bus);
+void dhub_context_close(dhub_context_t *ctx);
+/**
+ * Deinitializes context, except its statistics and module times that are read
+ * by main thread: they're freed with dhub_stats_deinit() and
+ * dhub_budget_deinit() on main thread once context's bus is closed.
+ */
+void dhub_context_deinit(dhub_context_t *ctx);
+
+/**
+ * Returns context of the calling thread: the one of its threaded module or
+ * main context.
+ */
+dhub_context_t *dhub_context(struct dhub_state *dhub);
+
+/**
+ * Returns name of module running code on context loop: its threaded module,
+ * the module whose callback is running or the module serving object `path`,
+ * if not NULL. It returns an empty string for D-Hub core.
+ */
+const char *dhub_module_of(dhub_context_t *ctx, const char *path);
+
+#endif
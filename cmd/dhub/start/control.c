@@ -0,0 +1,202 @@
+#include <basu/sd-bus.h>
+#include <errno.h>
+
+#include "debug.h"
+#include "start/control.h"
+#include "start/state.h"
+#include "trace.h"
+#define LOG_MODULE "dhub-control"
+#include "log.h"
+
+static int method_reload(sd_bus_message *m, void *userdata,
+                         sd_bus_error *ret_error) {
+  dhub_state_t *dhub = userdata;
+
+  const char *modname = NULL;
+  int r = sd_bus_message_read(m, DHUB_STRING, &modname);
+  if (r < 0)
+    return r;
+
+  const char *err = NULL;
+  if (dhub_reload(dhub, modname, &err) == -1) {
+    return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                             "failed to reload module '%s': %s", modname, err);
+  }
+
+  return sd_bus_reply_method_return(m, "");
+}
+
+static int method_dump_log(sd_bus_message *m, void *userdata,
+                           sd_bus_error *ret_error) {
+  (void)userdata;
+  const char *path = log_dump_binary();
+  if (path == NULL) {
+    return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                             "binary logging is disabled or dump failed");
+  }
+
+  return sd_bus_reply_method_return(m, DHUB_STRING, path);
+}
+
+static void on_sigusr1(uv_signal_t *handle, int signum) {
+  (void)handle;
+  (void)signum;
+  const char *path = log_dump_binary();
+  if (path != NULL)
+    LOG_INFO("binary log dumped to '%s'", path);
+  else
+    LOG_WARN("binary logging is disabled or dump failed");
+}
+
+static int method_start_trace(sd_bus_message *m, void *userdata,
+                              sd_bus_error *ret_error) {
+  (void)userdata;
+  if (trace_start() == -1) {
+    return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                             "failed to allocate trace buffers");
+  }
+
+  return sd_bus_reply_method_return(m, "");
+}
+
+static int method_stop_trace(sd_bus_message *m, void *userdata,
+                             sd_bus_error *ret_error) {
+  (void)userdata;
+  const char *path = trace_stop();
+  if (path == NULL) {
+    return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                             "tracing isn't running or trace write failed");
+  }
+
+  return sd_bus_reply_method_return(m, DHUB_STRING, path);
+}
+
+static int method_inject_event(sd_bus_message *m, void *userdata,
+                               sd_bus_error *ret_error) {
+  dhub_state_t *dhub = userdata;
+
+  const char *kind = NULL;
+  int r = sd_bus_message_read(m, DHUB_STRING, &kind);
+  if (r < 0)
+    return r;
+
+  const void *data = NULL;
+  size_t len = 0;
+  r = sd_bus_message_read_array(m, DHUB_BYTE[0], &data, &len);
+  if (r < 0)
+    return r;
+
+  if (dhub_replay_inject(dhub, kind, data, len) == -ENOENT) {
+    return sd_bus_error_setf(ret_error, SD_BUS_ERROR_NOT_SUPPORTED,
+                             "no replay handler for '%s' events", kind);
+  }
+
+  return sd_bus_reply_method_return(m, "");
+}
+
+static void on_sigusr2(uv_signal_t *handle, int signum) {
+  (void)handle;
+  (void)signum;
+  if (!trace_running()) {
+    if (trace_start() == -1)
+      LOG_ERRNO("failed to allocate trace buffers");
+    else
+      LOG_INFO("tracing started");
+    return;
+  }
+
+  const char *path = trace_stop();
+  if (path != NULL)
+    LOG_INFO("trace written to '%s'", path);
+  else
+    LOG_ERRNO("failed to write trace");
+}
+
+static int get_tracing(sd_bus *bus, const char *path, const char *iface,
+                       const char *property, sd_bus_message *reply,
+                       void *userdata, sd_bus_error *ret_error) {
+  (void)bus;
+  (void)path;
+  (void)iface;
+  (void)property;
+  (void)userdata;
+  (void)ret_error;
+  return sd_bus_message_append(reply, DHUB_BOOL, (int)trace_running());
+}
+
+static int get_log_dropped(sd_bus *bus, const char *path, const char *iface,
+                           const char *property, sd_bus_message *reply,
+                           void *userdata, sd_bus_error *ret_error) {
+  (void)bus;
+  (void)path;
+  (void)iface;
+  (void)property;
+  (void)userdata;
+  (void)ret_error;
+  return sd_bus_message_append(reply, DHUB_UINT64, log_dropped());
+}
+
+static int get_log_suppressed(sd_bus *bus, const char *path,
+                              const char *iface, const char *property,
+                              sd_bus_message *reply, void *userdata,
+                              sd_bus_error *ret_error) {
+  (void)bus;
+  (void)path;
+  (void)iface;
+  (void)property;
+  (void)userdata;
+  (void)ret_error;
+  return sd_bus_message_append(reply, DHUB_UINT64, log_suppressed());
+}
+
+static const sd_bus_vtable control_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("Reload", DHUB_STRING, "", method_reload,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("DumpLog", "", DHUB_STRING, method_dump_log,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    // Trace is written by StopTrace, it returns trace file path.
+    SD_BUS_METHOD("StartTrace", "", "", method_start_trace,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("StopTrace", "", DHUB_STRING, method_stop_trace,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    // Feeds an event recorded by a module back to it, see `dhub replay`.
+    SD_BUS_METHOD("InjectEvent", DHUB_STRING DHUB_ARRAY(DHUB_BYTE), "",
+                  method_inject_event, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_PROPERTY("Tracing", DHUB_BOOL, get_tracing, 0, 0),
+    // Log lines lost to a full log ring and to rate limiting.
+    SD_BUS_PROPERTY("LogDropped", DHUB_UINT64, get_log_dropped, 0, 0),
+    SD_BUS_PROPERTY("LogSuppressed", DHUB_UINT64, get_log_suppressed, 0, 0),
+    SD_BUS_VTABLE_END,
+};
+
+void dhub_control_init(dhub_state_t *dhub) {
+  NEG_MUST(sd_bus_add_object_vtable(dhub->bus, &dhub->control_slot,
+                                    DHUB_CONTROL_PATH, DHUB_CONTROL_IFACE,
+                                    control_vtable, dhub),
+           "failed to add D-Hub control object to D-BUS");
+
+  // Binary log can also be dumped with SIGUSR1.
+  UV_MUST(uv_signal_init(&dhub->loop, &dhub->dump_sig),
+          "failed to initialize SIGUSR1 handler");
+  UV_MUST(uv_signal_start(&dhub->dump_sig, on_sigusr1, SIGUSR1),
+          "failed to start SIGUSR1 handler");
+  uv_unref((uv_handle_t *)&dhub->dump_sig);
+
+  // SIGUSR2 starts and stops tracing.
+  UV_MUST(uv_signal_init(&dhub->loop, &dhub->trace_sig),
+          "failed to initialize SIGUSR2 handler");
+  UV_MUST(uv_signal_start(&dhub->trace_sig, on_sigusr2, SIGUSR2),
+          "failed to start SIGUSR2 handler");
+  uv_unref((uv_handle_t *)&dhub->trace_sig);
+}
+
+void dhub_control_close(dhub_state_t *dhub) {
+  // Module host processes have no control object.
+  if (dhub->control_slot == NULL)
+    return;
+
+  dhub->control_slot = sd_bus_slot_unref(dhub->control_slot);
+  uv_close((uv_handle_t *)&dhub->dump_sig, NULL);
+  uv_close((uv_handle_t *)&dhub->trace_sig, NULL);
+}
@@ -0,0 +1,15 @@
+#ifndef HUB_CONTROL_H_INCLUDE
+#define HUB_CONTROL_H_INCLUDE
+
+#define DHUB_CONTROL_PATH "/dev/negrel/dhub"
+#define DHUB_CONTROL_IFACE "dev.negrel.dhub.Hub"
+
+struct dhub_state;
+
+/**
+ * D-Hub control object, it lets clients manage modules and dump binary log.
+ */
+void dhub_control_init(struct dhub_state *dhub);
+void dhub_control_close(struct dhub_state *dhub);
+
+#endif
@@ -0,0 +1,164 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "start/context.h"
+#define LOG_MODULE "dhub-dispatch"
+#include "log.h"
+
+static unsigned int hist_bucket(uint64_t n) {
+  unsigned int i = 0;
+  while (n > 0 && i < DHUB_DISPATCH_HIST_LEN - 1) {
+    n >>= 1;
+    i++;
+  }
+  return i;
+}
+
+static void on_dispatch_idle(uv_idle_t *handle);
+
+// Processes one D-Bus message, recording a trace span if tracing is running.
+static int process(dhub_context_t *ctx) {
+  uint64_t start = dhub_trace_begin();
+  if (start == 0)
+    return sd_bus_process(ctx->bus, NULL);
+
+  // Processed message isn't requested: sd-bus would then leave it unhandled
+  // and skip replying to unknown objects and methods. Instrumented objects
+  // fill detail in instead.
+  char *detail = ctx->dispatch.trace_detail;
+  detail[0] = '\0';
+  int r = sd_bus_process(ctx->bus, NULL);
+  dhub_trace_end(start, "dispatch", "sd_bus_process", "%s", detail);
+  return r;
+}
+
+void dhub_dispatch_trace_message(dhub_context_t *ctx, sd_bus *bus) {
+  sd_bus_message *m = sd_bus_get_current_message(bus);
+  if (m == NULL)
+    return;
+
+  const char *iface = sd_bus_message_get_interface(m);
+  const char *member = sd_bus_message_get_member(m);
+  snprintf(ctx->dispatch.trace_detail, sizeof(ctx->dispatch.trace_detail),
+           "%s.%s", iface != NULL ? iface : "", member != NULL ? member : "");
+}
+
+static void dispatch(dhub_context_t *ctx) {
+  dhub_dispatch_t *d = &ctx->dispatch;
+
+  uint64_t n = 0;
+  int r = 0;
+  while ((d->budget == 0 || n < d->budget) && (r = process(ctx)) > 0) {
+    n++;
+  }
+  NEG_MUST(r, "failed to process dbus messages");
+  LOG_DBG("dbus processed %" PRIu64 " messages", n);
+
+  d->stats.wakeups++;
+  d->stats.messages += n;
+  d->stats.per_wakeup[hist_bucket(n)]++;
+  if (n > d->stats.max_per_wakeup)
+    d->stats.max_per_wakeup = n;
+
+  // Budget exhausted while sd-bus still had work: resume on next loop
+  // iteration, after pending I/O callbacks of other handles.
+  if (r > 0) {
+    d->stats.budget_exhausted++;
+    uv_idle_start(&d->idler, on_dispatch_idle);
+  } else {
+    uv_idle_stop(&d->idler);
+  }
+}
+
+static void on_dispatch_idle(uv_idle_t *handle) {
+  dispatch(handle->loop->data);
+}
+
+static void on_dbus_event(uv_poll_t *handle, int status, int events) {
+  LOG_DBG("dbus event status=%d events=%d", status, events);
+  dhub_context_t *ctx = handle->loop->data;
+  if (events & UV_WRITABLE)
+    ctx->dispatch.stats.writable_wakeups++;
+
+  // sd_bus_process() flushes the write queue before reading messages.
+  dispatch(ctx);
+}
+
+static void on_before_poll(uv_prepare_t *handle) {
+  dhub_context_t *ctx = handle->loop->data;
+  dhub_dispatch_t *d = &ctx->dispatch;
+
+  uint64_t queued = 0;
+  NEG_TRY(sd_bus_get_n_queued_write(ctx->bus, &queued),
+          "failed to retrieve D-BUS write queue size");
+  d->stats.queued_write = queued;
+  if (queued > d->stats.queued_write_max)
+    d->stats.queued_write_max = queued;
+
+  // Emit coalesced signals once queue is back under high-water mark.
+  if (!dhub_emit_congested(ctx))
+    dhub_emit_flush(ctx);
+
+  int events = UV_READABLE;
+  if (d->stats.queued_write > 0)
+    events |= UV_WRITABLE;
+
+  if (events != d->poll_events) {
+    LOG_DBG("dbus write queue size %" PRIu64 ", polling events=%d",
+            d->stats.queued_write, events);
+    d->poll_events = events;
+    uv_poll_start(&d->poll, events, on_dbus_event);
+  }
+}
+
+void dhub_dispatch_init(dhub_context_t *ctx, unsigned int budget) {
+  dhub_dispatch_t *d = &ctx->dispatch;
+  d->budget = budget;
+
+  int fd = sd_bus_get_fd(ctx->bus);
+  if (fd < 0) {
+    NEG_MUST(fd, "failed to retrieve D-BUS file descriptor");
+  }
+  UV_MUST(uv_poll_init(ctx->loop, &d->poll, fd),
+          "failed to initialize poll handle for DBUS file descriptor");
+  UV_MUST(uv_idle_init(ctx->loop, &d->idler),
+          "failed to initialize D-BUS dispatch idle handle");
+  UV_MUST(uv_prepare_init(ctx->loop, &d->write_watcher),
+          "failed to initialize D-BUS write queue prepare handle");
+
+  d->poll_events = UV_READABLE;
+  uv_poll_start(&d->poll, d->poll_events, on_dbus_event);
+  uv_prepare_start(&d->write_watcher, on_before_poll);
+}
+
+void dhub_dispatch_close(dhub_context_t *ctx) {
+  dhub_dispatch_t *d = &ctx->dispatch;
+
+  // Stop and close D-Bus poll, idle and prepare handles.
+  uv_poll_stop(&d->poll);
+  uv_close((uv_handle_t *)&d->poll, NULL);
+  uv_idle_stop(&d->idler);
+  uv_close((uv_handle_t *)&d->idler, NULL);
+  uv_prepare_stop(&d->write_watcher);
+  uv_close((uv_handle_t *)&d->write_watcher, NULL);
+}
+
+void dhub_dispatch_log_stats(dhub_context_t *ctx) {
+  dhub_dispatch_stats_t *s = &ctx->dispatch.stats;
+
+  LOG_INFO("dispatch: budget=%u wakeups=%" PRIu64 " messages=%" PRIu64
+           " max/wakeup=%" PRIu64 " budget exhausted=%" PRIu64,
+           ctx->dispatch.budget, s->wakeups, s->messages, s->max_per_wakeup,
+           s->budget_exhausted);
+  LOG_INFO("dispatch: writable wakeups=%" PRIu64 " max queued writes=%" PRIu64,
+           s->writable_wakeups, s->queued_write_max);
+  for (unsigned int i = 0; i < DHUB_DISPATCH_HIST_LEN; i++) {
+    if (s->per_wakeup[i] == 0)
+      continue;
+    uint64_t lo = i == 0 ? 0 : UINT64_C(1) << (i - 1);
+    LOG_DBG("dispatch: %" PRIu64 "+ messages/wakeup: %" PRIu64, lo,
+            s->per_wakeup[i]);
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef HUB_DISPATCH_H_INCLUDE
+#define HUB_DISPATCH_H_INCLUDE
+
+#include <basu/sd-bus.h>
+#include <stdint.h>
+#include <uv.h>
+
+#ifndef DHUB_DISPATCH_BUDGET
+#define DHUB_DISPATCH_BUDGET 64
+#endif
+
+// Messages per wakeup are bucketed by power of two: [0], [1], [2, 3], [4, 7],
+// ... and the last bucket collects everything above.
+#define DHUB_DISPATCH_HIST_LEN 12
+
+struct dhub_context;
+
+typedef struct dhub_dispatch_stats {
+  uint64_t wakeups;
+  uint64_t messages;
+  uint64_t max_per_wakeup;
+  uint64_t budget_exhausted;
+  uint64_t per_wakeup[DHUB_DISPATCH_HIST_LEN];
+  uint64_t writable_wakeups;
+  uint64_t queued_write;
+  uint64_t queued_write_max;
+} dhub_dispatch_stats_t;
+
+/**
+ * D-Bus dispatch scheduler. It processes at most `budget` messages per wakeup
+ * and re-arms itself on an idle handle when messages are left so other handles
+ * (udev monitors, timers...) get a chance to run in between.
+ *
+ * Before blocking for I/O, the bus write queue is checked and the poll handle
+ * also waits for UV_WRITABLE while sd-bus has outgoing messages queued.
+ */
+typedef struct dhub_dispatch {
+  unsigned int budget;
+  uv_poll_t poll;
+  int poll_events;
+  uv_idle_t idler;
+  uv_prepare_t write_watcher;
+  dhub_dispatch_stats_t stats;
+  // Interface and member of message handled by an instrumented object during
+  // traced sd_bus_process() call, detail of its span.
+  char trace_detail[64];
+} dhub_dispatch_t;
+
+void dhub_dispatch_init(struct dhub_context *ctx, unsigned int budget);
+void dhub_dispatch_close(struct dhub_context *ctx);
+void dhub_dispatch_log_stats(struct dhub_context *ctx);
+
+/**
+ * Sets detail of current dispatch trace span to interface and member of
+ * message being processed on `bus`.
+ */
+void dhub_dispatch_trace_message(struct dhub_context *ctx, sd_bus *bus);
+
+#endif
@@ -0,0 +1,211 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "start/codec.h"
+#include "start/context.h"
+#include "start/state.h"
+#define LOG_MODULE "dhub-emit"
+#include "log.h"
+
+void dhub_emit_init(dhub_context_t *ctx, unsigned int hwm) {
+  ctx->emit.hwm = hwm;
+}
+
+static void pending_props_free(dhub_pending_props_t *props) {
+  free(props->path);
+  free(props->iface);
+  tll_free_and_free(props->names, free);
+}
+
+void dhub_emit_deinit(dhub_context_t *ctx) {
+  tll_foreach(ctx->emit.pending, it) {
+    pending_props_free(&it->item);
+    tll_remove(ctx->emit.pending, it);
+  }
+}
+
+bool dhub_emit_congested(dhub_context_t *ctx) {
+  if (ctx->emit.hwm == 0)
+    return false;
+
+  uint64_t queued = 0;
+  if (sd_bus_get_n_queued_write(ctx->bus, &queued) < 0)
+    return false;
+
+  return queued >= ctx->emit.hwm;
+}
+
+void dhub_emit_flush(dhub_context_t *ctx) {
+  tll_foreach(ctx->emit.pending, it) {
+    dhub_pending_props_t *props = &it->item;
+
+    size_t len = tll_length(props->names);
+    char **names = calloc(len + 1, sizeof(*names));
+    if (names == NULL) {
+      LOG_ERR("failed to allocate coalesced properties names");
+      return;
+    }
+
+    size_t i = 0;
+    tll_foreach(props->names, name) { names[i++] = name->item; }
+
+    int r = sd_bus_emit_properties_changed_strv(ctx->bus, props->path,
+                                                props->iface, names);
+    NEG_TRY(r, "failed to emit coalesced properties changed signal");
+    free(names);
+
+    ctx->emit.stats.flushed++;
+    pending_props_free(props);
+    tll_remove(ctx->emit.pending, it);
+  }
+}
+
+static int coalesce_properties_changed(dhub_context_t *ctx, const char *path,
+                                       const char *iface, char **names) {
+  dhub_pending_props_t *props = NULL;
+  tll_foreach(ctx->emit.pending, it) {
+    if (strcmp(it->item.path, path) == 0 &&
+        strcmp(it->item.iface, iface) == 0) {
+      props = &it->item;
+      break;
+    }
+  }
+
+  if (props == NULL) {
+    tll_push_back(ctx->emit.pending, ((dhub_pending_props_t){
+                                          .path = strdup(path),
+                                          .iface = strdup(iface),
+                                      }));
+    props = &ctx->emit.pending.tail->item;
+  }
+
+  for (char **name = names; *name != NULL; name++) {
+    bool found = false;
+    tll_foreach(props->names, it) {
+      if (strcmp(it->item, *name) == 0) {
+        found = true;
+        break;
+      }
+    }
+    if (!found)
+      tll_push_back(props->names, strdup(*name));
+  }
+
+  ctx->emit.stats.coalesced++;
+  return 0;
+}
+
+// Returns true if low priority signals of module serving `path` must be
+// dropped or coalesced because it is over its loop time budget.
+static bool throttled(dhub_context_t *ctx, const char *path) {
+  if (!ctx->budget.throttle)
+    return false;
+
+  return dhub_budget_throttled(
+      ctx, dhub_budget_module(ctx, dhub_module_of(ctx, path)));
+}
+
+int dhub_emit_signal(dhub_state_t *dhub, enum dhub_signal_prio prio,
+                     const char *path, const char *iface, const char *member,
+                     const char *types, ...) {
+  dhub_context_t *ctx = dhub_context(dhub);
+  if (prio == DHUB_SIGNAL_PRIO_LOW &&
+      (dhub_emit_congested(ctx) || throttled(ctx, path))) {
+    LOG_DBG("D-Bus write queue congested or module throttled, dropping "
+            "signal %s.%s on '%s'",
+            iface, member, path);
+    ctx->emit.stats.shed++;
+    return 0;
+  }
+
+  sd_bus_message *m = NULL;
+  int r = sd_bus_message_new_signal(ctx->bus, &m, path, iface, member);
+  if (r < 0)
+    return r;
+
+  size_t bytes = 0;
+  if (types != NULL) {
+    va_list va;
+    va_start(va, types);
+    // Measured from arguments, sd-bus doesn't expose size of a message.
+    bytes = dhub_codec_body_size(types, va);
+    r = sd_bus_message_appendv(m, types, va);
+    va_end(va);
+    if (r < 0)
+      goto end;
+  }
+
+  r = sd_bus_send(ctx->bus, m, NULL);
+  if (r >= 0) {
+    ctx->emit.stats.signals++;
+    dhub_stats_signal(ctx, path, bytes);
+    r = 1;
+  }
+
+  if (ctx == &dhub->ctx)
+    dhub_idle_touch(dhub, path);
+
+end:
+  sd_bus_message_unref(m);
+  return r;
+}
+
+int dhub_emit_properties_changed(dhub_state_t *dhub, enum dhub_signal_prio prio,
+                                 const char *path, const char *iface,
+                                 const char *name, ...) {
+  dhub_context_t *ctx = dhub_context(dhub);
+
+  // Collect NULL terminated property names.
+  size_t len = 0;
+  va_list va;
+  va_start(va, name);
+  for (const char *n = name; n != NULL; n = va_arg(va, const char *))
+    len++;
+  va_end(va);
+
+  char **names = calloc(len + 1, sizeof(*names));
+  if (names == NULL)
+    return -ENOMEM;
+
+  va_start(va, name);
+  size_t i = 0;
+  for (const char *n = name; n != NULL; n = va_arg(va, const char *))
+    names[i++] = (char *)n;
+  va_end(va);
+
+  int r = 0;
+  if (prio == DHUB_SIGNAL_PRIO_LOW &&
+      (dhub_emit_congested(ctx) || throttled(ctx, path))) {
+    LOG_DBG("D-Bus write queue congested or module throttled, coalescing "
+            "properties changed signal for %s on '%s'",
+            iface, path);
+    r = coalesce_properties_changed(ctx, path, iface, names);
+  } else {
+    r = sd_bus_emit_properties_changed_strv(ctx->bus, path, iface, names);
+    if (r >= 0) {
+      ctx->emit.stats.signals++;
+      // Body is built by sd-bus from property getters, it isn't measured.
+      dhub_stats_signal(ctx, path, 0);
+      r = 1;
+    }
+  }
+
+  free(names);
+
+  if (ctx == &dhub->ctx)
+    dhub_idle_touch(dhub, path);
+
+  return r;
+}
+
+void dhub_emit_log_stats(dhub_context_t *ctx) {
+  dhub_emit_stats_t *s = &ctx->emit.stats;
+
+  LOG_INFO("emit: hwm=%u signals=%" PRIu64 " shed=%" PRIu64
+           " coalesced=%" PRIu64 " flushed=%" PRIu64,
+           ctx->emit.hwm, s->signals, s->shed, s->coalesced, s->flushed);
+}
@@ -0,0 +1,49 @@
+#ifndef HUB_EMIT_H_INCLUDE
+#define HUB_EMIT_H_INCLUDE
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tllist.h"
+
+#ifndef DHUB_WRITE_HWM
+#define DHUB_WRITE_HWM 256
+#endif
+
+struct dhub_context;
+
+typedef struct dhub_emit_stats {
+  uint64_t signals;
+  uint64_t shed;
+  uint64_t coalesced;
+  uint64_t flushed;
+} dhub_emit_stats_t;
+
+/**
+ * PropertiesChanged signal waiting for the write queue to drain. Names of
+ * properties changed on the same object interface are merged.
+ */
+typedef struct dhub_pending_props {
+  char *path;
+  char *iface;
+  tll(char *) names;
+} dhub_pending_props_t;
+
+/**
+ * Signal emission state. While the number of messages queued for writing is
+ * above `hwm`, low priority signals are dropped and low priority
+ * PropertiesChanged signals are coalesced until the queue drains.
+ */
+typedef struct dhub_emit {
+  unsigned int hwm;
+  tll(dhub_pending_props_t) pending;
+  dhub_emit_stats_t stats;
+} dhub_emit_t;
+
+void dhub_emit_init(struct dhub_context *ctx, unsigned int hwm);
+void dhub_emit_deinit(struct dhub_context *ctx);
+bool dhub_emit_congested(struct dhub_context *ctx);
+void dhub_emit_flush(struct dhub_context *ctx);
+void dhub_emit_log_stats(struct dhub_context *ctx);
+
+#endif
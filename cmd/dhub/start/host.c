@@ -0,0 +1,362 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "start/host.h"
+#include "start/state.h"
+#define LOG_MODULE "dhub-host"
+#include "log.h"
+
+static void on_handle_close(dhub_host_t *host) {
+  if (--host->handles > 0)
+    return;
+
+  dhub_state_t *dhub = host->dhub;
+  dhub_handle_t handle = host->handle;
+  bool detached = host->detached;
+
+  // Complete calls host will never reply to.
+  tll_foreach(host->calls, it) {
+    sd_bus_reply_method_errorf(it->item.m, SD_BUS_ERROR_NO_REPLY,
+                               "module host '%s' exited", host->modname);
+    sd_bus_message_unref(it->item.m);
+    tll_remove(host->calls, it);
+  }
+
+  dhub_link_log_stats(&host->link, host->modname);
+  free(host->object_prefix);
+  free(host->modname);
+  free(host);
+
+  if (detached)
+    return;
+
+  dhub_module_t *module = dhub_registry_get(&dhub->modules, handle);
+  if (module == NULL)
+    return;
+  module->host = NULL;
+  module->object_prefix = NULL;
+
+  // Host exited on its own.
+  if (module->state != DHUB_MODULE_UNLOADING) {
+    module->state = DHUB_MODULE_UNLOADING;
+    module->unload_start = uv_hrtime();
+    dhub->modules.loaded--;
+  }
+
+  dhub_close(dhub, (void *)handle);
+}
+
+static void on_process_close(uv_handle_t *handle) {
+  on_handle_close(handle->data);
+}
+
+static void on_link_close(dhub_link_t *link) { on_handle_close(link->data); }
+
+static void on_process_exit(uv_process_t *process, int64_t status, int signal) {
+  dhub_host_t *host = process->data;
+  if (signal != 0) {
+    LOG_ERR("module host '%s' killed by signal %d", host->modname, signal);
+  } else if (status != 0) {
+    LOG_ERR("module host '%s' exited with status %" PRId64, host->modname,
+            status);
+  } else {
+    LOG_INFO("module host '%s' exited", host->modname);
+  }
+
+  host->fallback = sd_bus_slot_unref(host->fallback);
+  uv_close((uv_handle_t *)process, on_process_close);
+  dhub_link_close(&host->link);
+}
+
+static int on_call(sd_bus_message *m, void *userdata,
+                   sd_bus_error *ret_error) {
+  dhub_host_t *host = userdata;
+  if (tll_length(host->link.backlog) >= DHUB_HOST_BACKLOG_MAX) {
+    return sd_bus_error_setf(ret_error, SD_BUS_ERROR_LIMITS_EXCEEDED,
+                             "module host '%s' is overloaded", host->modname);
+  }
+
+  uint64_t id = 0;
+  if (sd_bus_message_get_expect_reply(m))
+    id = ++host->next_id;
+
+  dhub_buf_t msg = {0};
+  dhub_buf_put_u32(&msg, DHUB_LINK_CALL);
+  dhub_buf_put_u64(&msg, id);
+  dhub_buf_put_str(&msg, sd_bus_message_get_path(m));
+  dhub_buf_put_str(&msg, sd_bus_message_get_interface(m));
+  dhub_buf_put_str(&msg, sd_bus_message_get_member(m));
+  int r = dhub_codec_encode_body(m, &msg);
+  if (r < 0) {
+    dhub_buf_free(&msg);
+    return sd_bus_error_setf(ret_error, SD_BUS_ERROR_NOT_SUPPORTED,
+                             "failed to forward method call: %s",
+                             strerror(-r));
+  }
+
+  r = dhub_link_send(&host->link, &msg);
+  if (r < 0) {
+    return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                             "failed to forward method call: %s",
+                             strerror(-r));
+  }
+
+  if (id != 0) {
+    tll_push_back(host->calls, ((dhub_host_call_t){
+                                   .id = id,
+                                   .m = sd_bus_message_ref(m),
+                               }));
+  }
+
+  // Reply is sent once host replies.
+  return 1;
+}
+
+static void on_ready(dhub_host_t *host, dhub_reader_t *r) {
+  int32_t status = (int32_t)dhub_reader_u32(r);
+  const char *err = dhub_reader_str(r);
+  const char *prefix = dhub_reader_str(r);
+  if (r->err != 0 || host->ready)
+    return;
+
+  if (status != 0) {
+    LOG_ERR("failed to load '%s' module in its host: %s", host->modname,
+            err);
+    return;
+  }
+
+  host->ready = true;
+  dhub_state_t *dhub = host->dhub;
+  dhub_module_t *module = dhub_registry_get(&dhub->modules, host->handle);
+  if (module == NULL || module->state != DHUB_MODULE_LOADED)
+    return;
+
+  if (*prefix == '\0') {
+    LOG_WARN("isolated module '%s' has no object prefix, its objects can't "
+             "be reached",
+             host->modname);
+  } else {
+    host->object_prefix = strdup(prefix);
+    int ret = sd_bus_add_fallback(dhub->bus, &host->fallback,
+                                  host->object_prefix, on_call, host);
+    if (ret < 0) {
+      LOG_ERR("failed to add '%s' module host proxy: %s", host->modname,
+              strerror(-ret));
+    }
+    module->object_prefix = host->object_prefix;
+    dhub_idle_reindex(dhub);
+  }
+
+  module->last_activity = uv_now(&dhub->loop);
+  LOG_INFO("module '%s' loaded in host process %d", host->modname,
+           host->process.pid);
+}
+
+static void on_reply(dhub_host_t *host, dhub_reader_t *r) {
+  uint64_t id = dhub_reader_u64(r);
+  const char *err_name = dhub_reader_str(r);
+  const char *err_msg = dhub_reader_str(r);
+  if (r->err != 0)
+    return;
+
+  sd_bus_message *call = NULL;
+  tll_foreach(host->calls, it) {
+    if (it->item.id == id) {
+      call = it->item.m;
+      tll_remove(host->calls, it);
+      break;
+    }
+  }
+  if (call == NULL) {
+    LOG_WARN("module host '%s' replied to unknown call %" PRIu64,
+             host->modname, id);
+    return;
+  }
+
+  int ret = 0;
+  if (*err_name != '\0') {
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_error_set(&error, err_name, err_msg);
+    ret = sd_bus_reply_method_error(call, &error);
+    sd_bus_error_free(&error);
+  } else {
+    sd_bus_message *reply = NULL;
+    ret = sd_bus_message_new_method_return(call, &reply);
+    if (ret >= 0)
+      ret = dhub_codec_decode_body(r, reply);
+    if (ret >= 0)
+      ret = sd_bus_send(NULL, reply, NULL);
+    else
+      sd_bus_reply_method_errorf(call, SD_BUS_ERROR_FAILED,
+                                 "invalid reply from module host");
+    sd_bus_message_unref(reply);
+  }
+  NEG_TRY(ret, "failed to send module host reply");
+  sd_bus_message_unref(call);
+}
+
+static void on_signal(dhub_host_t *host, dhub_reader_t *r) {
+  const char *path = dhub_reader_str(r);
+  const char *iface = dhub_reader_str(r);
+  const char *member = dhub_reader_str(r);
+  if (r->err != 0)
+    return;
+
+  sd_bus_message *signal = NULL;
+  int ret = sd_bus_message_new_signal(host->dhub->bus, &signal, path, iface,
+                                      member);
+  if (ret >= 0)
+    ret = dhub_codec_decode_body(r, signal);
+  if (ret >= 0)
+    ret = sd_bus_send(NULL, signal, NULL);
+  NEG_TRY(ret, "failed to emit module host signal");
+  sd_bus_message_unref(signal);
+
+  dhub_idle_touch(host->dhub, path);
+}
+
+static void on_message(dhub_link_t *link, uint32_t kind, dhub_reader_t *r) {
+  dhub_host_t *host = link->data;
+  switch (kind) {
+  case DHUB_LINK_READY:
+    on_ready(host, r);
+    break;
+  case DHUB_LINK_REPLY:
+    on_reply(host, r);
+    break;
+  case DHUB_LINK_SIGNAL:
+    on_signal(host, r);
+    break;
+  default:
+    LOG_WARN("unexpected message %" PRIu32 " from module host '%s'", kind,
+             host->modname);
+  }
+}
+
+// Global logging options of module host processes.
+static char *const *log_args = NULL;
+
+void dhub_host_set_log_args(char *const *args) { log_args = args; }
+
+dhub_host_t *dhub_host_spawn(dhub_state_t *dhub, dhub_handle_t handle,
+                             const char *modname, const char **err) {
+  char exe[PATH_MAX];
+  size_t exe_len = sizeof(exe);
+  int r = uv_exepath(exe, &exe_len);
+  if (r < 0) {
+    LOG_ERR("failed to find D-Hub executable: %s", uv_strerror(r));
+    *err = "D-Hub executable not found";
+    return NULL;
+  }
+
+  int fds[3];
+  if (dhub_link_create_fds(fds) == -1) {
+    *err = "failed to create module host link";
+    return NULL;
+  }
+
+  dhub_host_t *host = calloc(1, sizeof(*host));
+  if (host == NULL)
+    LOG_FATAL("failed to allocate module host");
+  host->dhub = dhub;
+  host->handle = handle;
+  host->modname = strdup(modname);
+
+  // Host inherits D-Hub settings.
+  dhub_config_t *cfg = &dhub->config;
+  char opts[7][16];
+  snprintf(opts[0], sizeof(opts[0]), "%u", cfg->dispatch_budget);
+  snprintf(opts[1], sizeof(opts[1]), "%u", cfg->write_hwm);
+  snprintf(opts[2], sizeof(opts[2]), "%u", cfg->unload_timeout_ms);
+  snprintf(opts[3], sizeof(opts[3]), "%u", cfg->idle_timeout_ms);
+  snprintf(opts[4], sizeof(opts[4]), "%u", cfg->stall_ms);
+  snprintf(opts[5], sizeof(opts[5]), "%u", cfg->module_budget_ms);
+  snprintf(opts[6], sizeof(opts[6]), "%d", cfg->throttle);
+  char *host_args[] = {
+      "host", "-b", opts[0], "-w", opts[1], "-t", opts[2], "-i",
+      opts[3], "-s", opts[4], "-m", opts[5], "-T", opts[6], host->modname,
+  };
+
+  // Executable, global logging options then host command.
+  char *args[DHUB_HOST_LOG_ARGS_MAX + sizeof(host_args) / sizeof(*host_args) +
+             2];
+  size_t argc = 0;
+  args[argc++] = exe;
+  for (size_t i = 0; log_args != NULL && log_args[i] != NULL; i++)
+    args[argc++] = log_args[i];
+  memcpy(args + argc, host_args, sizeof(host_args));
+  argc += sizeof(host_args) / sizeof(*host_args);
+  args[argc] = NULL;
+  uv_stdio_container_t stdio[] = {
+      {.flags = UV_INHERIT_FD, .data.fd = STDIN_FILENO},
+      {.flags = UV_INHERIT_FD, .data.fd = STDOUT_FILENO},
+      {.flags = UV_INHERIT_FD, .data.fd = STDERR_FILENO},
+      [DHUB_LINK_FD_MEM] = {.flags = UV_INHERIT_FD, .data.fd = fds[0]},
+      [DHUB_LINK_FD_TO_HOST] = {.flags = UV_INHERIT_FD, .data.fd = fds[1]},
+      [DHUB_LINK_FD_TO_CORE] = {.flags = UV_INHERIT_FD, .data.fd = fds[2]},
+  };
+  uv_process_options_t options = {
+      .exit_cb = on_process_exit,
+      .file = exe,
+      .args = args,
+      .stdio_count = sizeof(stdio) / sizeof(*stdio),
+      .stdio = stdio,
+  };
+
+  host->process.data = host;
+  r = uv_spawn(&dhub->loop, &host->process, &options);
+  if (r < 0) {
+    LOG_ERR("failed to spawn '%s' module host: %s", modname, uv_strerror(r));
+    for (int i = 0; i < 3; i++)
+      close(fds[i]);
+    // Process handle must be closed even if spawn failed.
+    host->detached = true;
+    host->handles = 1;
+    uv_close((uv_handle_t *)&host->process, on_process_close);
+    *err = "failed to spawn module host";
+    return NULL;
+  }
+  host->handles++;
+
+  host->link.data = host;
+  host->link.on_close = on_link_close;
+  if (dhub_link_init(&host->link, &dhub->loop, fds, true, on_message) == -1) {
+    // Host exits once it fails to map link.
+    uv_process_kill(&host->process, SIGKILL);
+    host->detached = true;
+    // There is no link to close.
+    host->link.closing = -1;
+    *err = "failed to map module host link";
+    return NULL;
+  }
+  host->handles++;
+
+  LOG_INFO("module '%s' host process %d started", modname, host->process.pid);
+  return host;
+}
+
+void dhub_host_unload(dhub_host_t *host) {
+  // Host already exited.
+  if (uv_is_closing((uv_handle_t *)&host->process))
+    return;
+
+  host->fallback = sd_bus_slot_unref(host->fallback);
+
+  dhub_buf_t msg = {0};
+  dhub_buf_put_u32(&msg, DHUB_LINK_SHUTDOWN);
+  if (dhub_link_send(&host->link, &msg) < 0)
+    uv_process_kill(&host->process, SIGTERM);
+}
+
+void dhub_host_kill(dhub_host_t *host) {
+  host->detached = true;
+  if (!uv_is_closing((uv_handle_t *)&host->process))
+    uv_process_kill(&host->process, SIGKILL);
+}
@@ -0,0 +1,76 @@
+#ifndef HUB_HOST_H_INCLUDE
+#define HUB_HOST_H_INCLUDE
+
+#include <basu/sd-bus.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "start/link.h"
+#include "start/registry.h"
+#include "tllist.h"
+
+// Maximum number of messages waiting for room in host ring before method
+// calls are rejected.
+#ifndef DHUB_HOST_BACKLOG_MAX
+#define DHUB_HOST_BACKLOG_MAX 1024
+#endif
+
+struct dhub_state;
+
+typedef struct dhub_host_call {
+  uint64_t id;
+  sd_bus_message *m;
+} dhub_host_call_t;
+
+/**
+ * Module host process. The module runs in a `dhub host` child process linked
+ * to D-Hub over shared memory rings, D-Hub proxies method calls to objects
+ * under module object prefix and re-emits module signals on its own bus.
+ */
+typedef struct dhub_host {
+  struct dhub_state *dhub;
+  dhub_handle_t handle;
+  char *modname;
+  // Object prefix reported by host once module is loaded.
+  char *object_prefix;
+  bool ready;
+  // Module was force closed, it is no longer in registry.
+  bool detached;
+  uv_process_t process;
+  // Open handles: process and link.
+  int handles;
+  dhub_link_t link;
+  sd_bus_slot *fallback;
+  uint64_t next_id;
+  tll(dhub_host_call_t) calls;
+} dhub_host_t;
+
+// Global options passed to host processes at most.
+#define DHUB_HOST_LOG_ARGS_MAX 16
+
+/**
+ * Sets global options passed to host processes before "host" command, so
+ * isolated modules log like D-Hub. `args` is NULL terminated, holds at most
+ * DHUB_HOST_LOG_ARGS_MAX options and must outlive hosts.
+ */
+void dhub_host_set_log_args(char *const *args);
+
+/**
+ * Spawns host process of module registry entry `handle`. Module is loaded
+ * asynchronously, it is closed with dhub_close() once host exits.
+ */
+dhub_host_t *dhub_host_spawn(struct dhub_state *dhub, dhub_handle_t handle,
+                             const char *modname, const char **err);
+
+/**
+ * Asks host to unload module and exit.
+ */
+void dhub_host_unload(dhub_host_t *host);
+
+/**
+ * Kills host of a force closed module.
+ */
+void dhub_host_kill(dhub_host_t *host);
+
+#endif
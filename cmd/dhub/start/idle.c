@@ -0,0 +1,227 @@
+#include <inttypes.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "start/idle.h"
+#include "start/state.h"
+#include "start/thread.h"
+#define LOG_MODULE "dhub-idle"
+#include "log.h"
+
+static size_t heap_in_use(void) {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+static uint32_t hash_prefix(const char *prefix, size_t len) {
+  // FNV-1a.
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)prefix[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+static bool indexed(dhub_module_t *module) {
+  return module->used && (module->flags & DHUB_MODULE_IDLE_UNLOAD) &&
+         module->object_prefix != NULL;
+}
+
+void dhub_idle_reindex(dhub_state_t *dhub) {
+  dhub_idle_t *idle = &dhub->idle;
+  if (idle->timeout_ms == 0)
+    return;
+
+  size_t len = 0;
+  dhub_registry_foreach(&dhub->modules, it) {
+    if (indexed(it))
+      len++;
+  }
+
+  // Keep load factor under 1/2 so probing always ends on an empty bucket.
+  size_t cap = 8;
+  while (len * 2 >= cap)
+    cap *= 2;
+  uint32_t *prefixes = calloc(cap, sizeof(*prefixes));
+  if (prefixes == NULL)
+    LOG_FATAL("failed to allocate idle modules index");
+
+  free(idle->prefixes);
+  idle->prefixes = prefixes;
+  idle->prefixes_cap = cap;
+
+  dhub_registry_foreach(&dhub->modules, it) {
+    if (!indexed(it))
+      continue;
+
+    const char *prefix = it->object_prefix;
+    size_t mask = cap - 1;
+    size_t i = hash_prefix(prefix, strlen(prefix)) & mask;
+    while (prefixes[i] != 0)
+      i = (i + 1) & mask;
+    prefixes[i] = it - dhub->modules.entries + 1;
+  }
+}
+
+/**
+ * Returns loaded idle unloadable module with the longest object prefix
+ * matching `path`, that is the one serving it, or NULL. Path ancestors are
+ * looked up from the longest so cost doesn't depend on number of modules.
+ */
+static dhub_module_t *owner(dhub_state_t *dhub, const char *path) {
+  dhub_idle_t *idle = &dhub->idle;
+  if (idle->prefixes_cap == 0)
+    return NULL;
+
+  size_t mask = idle->prefixes_cap - 1;
+  for (size_t len = strlen(path); len > 0; len--) {
+    if (path[len] != '\0' && path[len] != '/')
+      continue;
+
+    for (size_t i = hash_prefix(path, len) & mask; idle->prefixes[i] != 0;
+         i = (i + 1) & mask) {
+      dhub_module_t *it = &dhub->modules.entries[idle->prefixes[i] - 1];
+      if (indexed(it) && it->state == DHUB_MODULE_LOADED &&
+          strncmp(it->object_prefix, path, len) == 0 &&
+          it->object_prefix[len] == '\0')
+        return it;
+    }
+  }
+
+  return NULL;
+}
+
+static void on_idle_check(uv_timer_t *handle) {
+  dhub_state_t *dhub = handle->data;
+  dhub_idle_t *idle = &dhub->idle;
+  uint64_t now = uv_now(&dhub->loop);
+
+  dhub_registry_foreach(&dhub->modules, it) {
+    if (it->state != DHUB_MODULE_LOADED ||
+        !(it->flags & DHUB_MODULE_IDLE_UNLOAD) || it->object_prefix == NULL ||
+        it->thread != NULL || it->inflight > 0 ||
+        now - it->last_activity < idle->timeout_ms)
+      continue;
+
+    LOG_INFO("module '%s' idle for %.1f s, unloading it...", it->name,
+             (double)(now - it->last_activity) / 1000);
+    it->idle_unloading = true;
+    it->heap_before = heap_in_use();
+    dhub_unload(dhub, it->name);
+  }
+}
+
+static int on_message(sd_bus_message *m, void *userdata,
+                      sd_bus_error *ret_error) {
+  (void)ret_error;
+  uint8_t type = 0;
+  if (sd_bus_message_get_type(m, &type) < 0 ||
+      type != SD_BUS_MESSAGE_METHOD_CALL)
+    return 0;
+
+  const char *path = sd_bus_message_get_path(m);
+  if (path != NULL)
+    dhub_idle_touch(userdata, path);
+
+  // Let message be dispatched.
+  return 0;
+}
+
+void dhub_idle_init(dhub_state_t *dhub) {
+  dhub_idle_t *idle = &dhub->idle;
+  idle->timeout_ms = dhub->config.idle_timeout_ms;
+  if (idle->timeout_ms == 0)
+    return;
+
+  NEG_MUST(sd_bus_add_filter(dhub->bus, &idle->filter, on_message, dhub),
+           "failed to add D-BUS activity filter");
+
+  idle->timer.data = dhub;
+  UV_MUST(uv_timer_init(&dhub->loop, &idle->timer),
+          "failed to initialize idle modules timer");
+
+  // Check a few times per timeout so modules are unloaded close to it.
+  uint64_t interval = idle->timeout_ms / 4 + 1;
+  uv_timer_start(&idle->timer, on_idle_check, interval, interval);
+  uv_unref((uv_handle_t *)&idle->timer);
+}
+
+void dhub_idle_close(dhub_state_t *dhub) {
+  dhub_idle_t *idle = &dhub->idle;
+  if (idle->timeout_ms == 0)
+    return;
+
+  idle->filter = sd_bus_slot_unref(idle->filter);
+  uv_timer_stop(&idle->timer);
+  uv_close((uv_handle_t *)&idle->timer, NULL);
+  free(idle->prefixes);
+  idle->prefixes = NULL;
+  idle->prefixes_cap = 0;
+  idle->timeout_ms = 0;
+}
+
+void dhub_idle_touch(dhub_state_t *dhub, const char *path) {
+  if (dhub->idle.timeout_ms == 0)
+    return;
+
+  dhub_module_t *module = owner(dhub, path);
+  if (module != NULL)
+    module->last_activity = uv_now(&dhub->loop);
+}
+
+dhub_handle_t dhub_idle_hold(dhub_state_t *dhub, const char *path) {
+  // Threaded modules aren't idle unloaded.
+  if (dhub->idle.timeout_ms == 0 || path == NULL ||
+      dhub_thread_current() != NULL)
+    return DHUB_HANDLE_NULL;
+
+  dhub_module_t *module = owner(dhub, path);
+  if (module == NULL)
+    return DHUB_HANDLE_NULL;
+
+  module->inflight++;
+  return dhub_registry_slot_handle(&dhub->modules, module);
+}
+
+void dhub_idle_release(dhub_state_t *dhub, dhub_handle_t handle) {
+  if (handle == DHUB_HANDLE_NULL)
+    return;
+
+  // Module may have been force closed meanwhile, hot reloads keep its slot
+  // and calls in flight.
+  dhub_module_t *module = dhub_registry_get_slot(&dhub->modules, handle);
+  if (module == NULL || module->inflight == 0)
+    return;
+
+  module->inflight--;
+  // Reply is module activity too.
+  module->last_activity = uv_now(&dhub->loop);
+}
+
+void dhub_idle_module_closed(dhub_state_t *dhub, dhub_module_t *module) {
+  // Return freed memory to the OS before measuring.
+  malloc_trim(0);
+  size_t heap = heap_in_use();
+  size_t freed = module->heap_before > heap ? module->heap_before - heap : 0;
+
+  size_t rss = 0;
+  int r = uv_resident_set_memory(&rss);
+  UV_TRY(r, "failed to retrieve resident set size");
+
+  LOG_INFO("module '%s' idle unloaded, %zu bytes of heap freed (rss=%zu)",
+           module->name, freed, rss);
+
+  dhub->idle.stats.unloads++;
+  dhub->idle.stats.heap_freed += freed;
+}
+
+void dhub_idle_log_stats(dhub_state_t *dhub) {
+  dhub_idle_stats_t *s = &dhub->idle.stats;
+
+  LOG_INFO("idle: timeout=%ums unloads=%" PRIu64 " heap freed=%" PRIu64,
+           dhub->config.idle_timeout_ms, s->unloads, s->heap_freed);
+}
@@ -0,0 +1,73 @@
+#ifndef HUB_IDLE_H_INCLUDE
+#define HUB_IDLE_H_INCLUDE
+
+#include <basu/sd-bus.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "start/registry.h"
+
+#ifndef DHUB_IDLE_TIMEOUT_MS
+#define DHUB_IDLE_TIMEOUT_MS 600000
+#endif
+
+struct dhub_state;
+struct dhub_module;
+
+typedef struct dhub_idle_stats {
+  uint64_t unloads;
+  // Sum of heap bytes freed by idle unloads.
+  uint64_t heap_freed;
+} dhub_idle_stats_t;
+
+/**
+ * Idle unloading of DHUB_MODULE_IDLE_UNLOAD modules. Activity of a module is
+ * its incoming method calls (property accesses included) and signals emitted
+ * under its object prefix. Idle modules are unloaded and lazily loaded again
+ * on next call.
+ */
+typedef struct dhub_idle {
+  uint64_t timeout_ms;
+  uv_timer_t timer;
+  sd_bus_slot *filter;
+  // Open addressing (linear probing) hash table of idle unloadable modules
+  // indexed by object prefix, buckets contain registry slot index + 1 or 0.
+  // Modules are checked on lookup so stale buckets are harmless.
+  uint32_t *prefixes;
+  size_t prefixes_cap;
+  dhub_idle_stats_t stats;
+} dhub_idle_t;
+
+void dhub_idle_init(struct dhub_state *dhub);
+void dhub_idle_close(struct dhub_state *dhub);
+void dhub_idle_log_stats(struct dhub_state *dhub);
+
+/**
+ * Rebuilds object prefix index of idle unloadable modules, it must be called
+ * once object prefix or flags of a module are set.
+ */
+void dhub_idle_reindex(struct dhub_state *dhub);
+
+/**
+ * Records activity on object at `path`.
+ */
+void dhub_idle_touch(struct dhub_state *dhub, const char *path);
+
+/**
+ * Marks a deferred or offloaded method call on object at `path` as in flight,
+ * a module isn't idle while it has calls in flight. It returns slot handle of
+ * module, which survives hot reloads, to pass to dhub_idle_release() once
+ * call is replied to, or DHUB_HANDLE_NULL if no idle unloadable module serves
+ * `path`.
+ */
+dhub_handle_t dhub_idle_hold(struct dhub_state *dhub, const char *path);
+void dhub_idle_release(struct dhub_state *dhub, dhub_handle_t handle);
+
+/**
+ * Reports memory freed by an idle unload, it must be called once module is
+ * closed.
+ */
+void dhub_idle_module_closed(struct dhub_state *dhub,
+                             struct dhub_module *module);
+
+#endif
@@ -0,0 +1,132 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "start/context.h"
+#define LOG_MODULE "dhub-lag"
+#include "log.h"
+
+static void log_active_handle(uv_handle_t *handle, void *arg) {
+  dhub_lag_t *lag = arg;
+  // Handles of lag monitor itself are always active.
+  if (!uv_is_active(handle) || handle == (uv_handle_t *)&lag->prepare ||
+      handle == (uv_handle_t *)&lag->check)
+    return;
+
+  LOG_WARN("  active %s handle %p, data %p", uv_handle_type_name(handle->type),
+           (void *)handle, handle->data);
+}
+
+static void on_check(uv_check_t *handle) {
+  dhub_context_t *ctx = handle->loop->data;
+  dhub_lag_t *lag = &ctx->lag;
+
+  // I/O callbacks ran since prepare, minus time spent waiting in poll.
+  uint64_t now = uv_hrtime();
+  uint64_t idle = uv_metrics_idle_time(handle->loop) - lag->prepare_idle;
+  uint64_t elapsed = now - lag->prepare_time;
+  lag->io_ns = elapsed > idle ? elapsed - idle : 0;
+}
+
+static void on_prepare(uv_prepare_t *handle) {
+  dhub_context_t *ctx = handle->loop->data;
+  dhub_lag_t *lag = &ctx->lag;
+
+  uint64_t now = uv_hrtime();
+  uint64_t idle_now = uv_metrics_idle_time(handle->loop);
+
+  // First prepare callback only starts measuring.
+  if (lag->prepare_time != 0) {
+    uint64_t idle = idle_now - lag->prepare_idle;
+    uint64_t elapsed = now - lag->prepare_time;
+    uint64_t busy = elapsed > idle ? elapsed - idle : 0;
+
+    lag->stats.iterations++;
+    histogram_record(&lag->stats.busy, busy);
+
+    if (lag->stall_ns != 0 && busy >= lag->stall_ns) {
+      char longest[128] = "unknown";
+      if (lag->longest_what != NULL) {
+        snprintf(longest, sizeof(longest), "%s %s%s%s", lag->longest_module,
+                 lag->longest_what, lag->longest_member != NULL ? "." : "",
+                 lag->longest_member != NULL ? lag->longest_member : "");
+      }
+
+      lag->stats.stalls++;
+      LOG_WARN("event loop stalled for %.1fms (I/O callbacks %.1fms), longest "
+               "callback: %s (%.1fms)",
+               busy / 1e6, lag->io_ns / 1e6, longest, lag->longest_ns / 1e6);
+      uv_walk(handle->loop, log_active_handle, lag);
+    }
+  }
+
+  // Measure iteration time from here, after timers, idle handles and close
+  // callbacks of current iteration ran.
+  lag->prepare_time = uv_hrtime();
+  lag->prepare_idle = idle_now;
+  lag->io_ns = 0;
+  lag->longest_ns = 0;
+  dhub_lag_forget(ctx);
+}
+
+void dhub_lag_init(dhub_context_t *ctx, unsigned int stall_ms) {
+  dhub_lag_t *lag = &ctx->lag;
+  lag->stall_ns = (uint64_t)stall_ms * 1000000;
+
+  int r = uv_loop_configure(ctx->loop, UV_METRICS_IDLE_TIME);
+  if (r < 0) {
+    UV_TRY(r, "failed to enable loop idle time metrics, lag monitor disabled");
+    return;
+  }
+  lag->enabled = true;
+
+  UV_MUST(uv_prepare_init(ctx->loop, &lag->prepare),
+          "failed to initialize lag monitor prepare handle");
+  UV_MUST(uv_check_init(ctx->loop, &lag->check),
+          "failed to initialize lag monitor check handle");
+  uv_prepare_start(&lag->prepare, on_prepare);
+  uv_check_start(&lag->check, on_check);
+  // Monitor must not keep loop alive.
+  uv_unref((uv_handle_t *)&lag->prepare);
+  uv_unref((uv_handle_t *)&lag->check);
+}
+
+void dhub_lag_close(dhub_context_t *ctx) {
+  dhub_lag_t *lag = &ctx->lag;
+  if (!lag->enabled)
+    return;
+
+  lag->enabled = false;
+  uv_close((uv_handle_t *)&lag->prepare, NULL);
+  uv_close((uv_handle_t *)&lag->check, NULL);
+}
+
+void dhub_lag_log_stats(dhub_context_t *ctx) {
+  dhub_lag_stats_t *s = &ctx->lag.stats;
+
+  LOG_INFO("lag: iterations=%" PRIu64 " stalls=%" PRIu64
+           " busy p50=%.3fms p99=%.3fms max=%.3fms",
+           s->iterations, s->stalls,
+           histogram_percentile(&s->busy, 500) / 1e6,
+           histogram_percentile(&s->busy, 990) / 1e6, s->busy.max / 1e6);
+}
+
+void dhub_lag_note(dhub_context_t *ctx, uint64_t elapsed_ns,
+                   const char *module, const char *what, const char *member) {
+  dhub_lag_t *lag = &ctx->lag;
+  if (elapsed_ns <= lag->longest_ns)
+    return;
+
+  lag->longest_ns = elapsed_ns;
+  lag->longest_module = module != NULL ? module : "dhub";
+  lag->longest_what = what;
+  lag->longest_member = member;
+}
+
+void dhub_lag_forget(dhub_context_t *ctx) {
+  dhub_lag_t *lag = &ctx->lag;
+  lag->longest_module = NULL;
+  lag->longest_what = NULL;
+  lag->longest_member = NULL;
+}
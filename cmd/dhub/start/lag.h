@@ -0,0 +1,75 @@
+#ifndef HUB_LAG_H_INCLUDE
+#define HUB_LAG_H_INCLUDE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "histogram.h"
+
+#ifndef DHUB_STALL_MS
+#define DHUB_STALL_MS 100
+#endif
+
+struct dhub_context;
+
+typedef struct dhub_lag_stats {
+  uint64_t iterations;
+  uint64_t stalls;
+  // Busy time of loop iterations, in nanoseconds.
+  histogram_t busy;
+} dhub_lag_stats_t;
+
+/**
+ * Event loop lag monitor. Busy time of every loop iteration, time not spent
+ * waiting for I/O, is measured between two prepare callbacks using loop idle
+ * time metrics. It is also the longest time an event may wait before being
+ * handled.
+ *
+ * An iteration busy for more than `stall_ns` is reported along with the
+ * longest callback noted with dhub_lag_note() during it and the active
+ * handles of the loop.
+ */
+typedef struct dhub_lag {
+  uint64_t stall_ns;
+  bool enabled;
+  uv_prepare_t prepare;
+  uv_check_t check;
+  // uv_hrtime() and loop idle time at last prepare and check callbacks.
+  uint64_t prepare_time;
+  uint64_t prepare_idle;
+  // Time spent in I/O callbacks of current iteration.
+  uint64_t io_ns;
+  // Longest callback noted during current iteration, see dhub_lag_note().
+  uint64_t longest_ns;
+  const char *longest_module;
+  const char *longest_what;
+  const char *longest_member;
+  dhub_lag_stats_t stats;
+} dhub_lag_t;
+
+/**
+ * Starts lag monitor of context loop, it must be called before loop runs.
+ * `stall_ms` is the busy time above which iterations are reported, 0
+ * disables reports.
+ */
+void dhub_lag_init(struct dhub_context *ctx, unsigned int stall_ms);
+void dhub_lag_close(struct dhub_context *ctx);
+void dhub_lag_log_stats(struct dhub_context *ctx);
+
+/**
+ * Notes a callback that ran for `elapsed_ns` on context loop: `what` of
+ * `module`, or its `what`.`member` method or property if `member` isn't NULL.
+ * Strings are only formatted if iteration stalls, they must stay valid until
+ * next iteration or until dhub_lag_forget() is called.
+ */
+void dhub_lag_note(struct dhub_context *ctx, uint64_t elapsed_ns,
+                   const char *module, const char *what, const char *member);
+
+/**
+ * Forgets description of longest callback of current iteration, it must be
+ * called before freeing strings passed to dhub_lag_note().
+ */
+void dhub_lag_forget(struct dhub_context *ctx);
+
+#endif
@@ -0,0 +1,235 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "start/link.h"
+#define LOG_MODULE "dhub-link"
+#include "log.h"
+
+int dhub_link_create_fds(int fds[3]) {
+  fds[0] = fds[1] = fds[2] = -1;
+
+  fds[0] = memfd_create("dhub-link", MFD_CLOEXEC);
+  if (fds[0] == -1)
+    goto err;
+  if (ftruncate(fds[0], 2 * dhub_ring_size(DHUB_LINK_RING_SIZE)) == -1)
+    goto err;
+
+  for (int i = 1; i < 3; i++) {
+    fds[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fds[i] == -1)
+      goto err;
+  }
+
+  return 0;
+
+err:
+  LOG_ERRNO("failed to create module host link");
+  for (int i = 0; i < 3; i++) {
+    if (fds[i] != -1)
+      close(fds[i]);
+  }
+  return -1;
+}
+
+static void notify(int fd) {
+  uint64_t one = 1;
+  // Counter overflow is harmless: peer is already notified.
+  if (write(fd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+    LOG_ERRNO("failed to notify link peer");
+}
+
+// Moves backlog to ring, returns true if it is empty.
+static bool flush_backlog(dhub_link_t *link) {
+  bool pushed = false;
+  while (tll_length(link->backlog) > 0) {
+    dhub_buf_t *msg = &tll_front(link->backlog);
+    int r = dhub_ring_push(&link->tx, msg->data, msg->len);
+    if (r == -EAGAIN) {
+      // Peer wakes us up once it pops records, unless retry succeeds.
+      dhub_ring_wait_room(&link->tx);
+      r = dhub_ring_push(&link->tx, msg->data, msg->len);
+    }
+    if (r == -EAGAIN)
+      break;
+
+    dhub_buf_free(msg);
+    tll_pop_front(link->backlog);
+    link->stats.sent++;
+    pushed = true;
+  }
+
+  if (pushed)
+    notify(link->tx_fd);
+
+  return tll_length(link->backlog) == 0;
+}
+
+static void on_retry(uv_timer_t *handle) {
+  dhub_link_t *link = handle->data;
+  if (flush_backlog(link))
+    return;
+
+  // Peer is slow or its wakeup was missed, back off.
+  link->retry_ms *= 2;
+  if (link->retry_ms > DHUB_LINK_RETRY_MAX_MS)
+    link->retry_ms = DHUB_LINK_RETRY_MAX_MS;
+  uv_timer_start(handle, on_retry, link->retry_ms, 0);
+}
+
+int dhub_link_send(dhub_link_t *link, dhub_buf_t *msg) {
+  if (link->closing) {
+    dhub_buf_free(msg);
+    return -EPIPE;
+  }
+
+  // Preserve ordering with backlogged messages.
+  int r = -EAGAIN;
+  if (tll_length(link->backlog) == 0)
+    r = dhub_ring_push(&link->tx, msg->data, msg->len);
+
+  if (r == 0) {
+    dhub_buf_free(msg);
+    link->stats.sent++;
+    notify(link->tx_fd);
+    return 0;
+  }
+
+  if (r == -EMSGSIZE) {
+    LOG_ERR("link message of %zu bytes is too large", msg->len);
+    dhub_buf_free(msg);
+    return r;
+  }
+
+  tll_push_back(link->backlog, *msg);
+  *msg = (dhub_buf_t){0};
+  link->stats.backlogged++;
+  if (!flush_backlog(link) && !uv_is_active((uv_handle_t *)&link->retry)) {
+    link->retry_ms = DHUB_LINK_RETRY_MS;
+    uv_timer_start(&link->retry, on_retry, link->retry_ms, 0);
+  }
+  return 0;
+}
+
+static void on_readable(uv_poll_t *handle, int status, int events) {
+  (void)events;
+  dhub_link_t *link = handle->data;
+  if (status < 0) {
+    LOG_ERR("link poll error: %s", uv_strerror(status));
+    return;
+  }
+
+  // Reset counter before draining ring so records published meanwhile wake
+  // us up again.
+  uint64_t count = 0;
+  if (read(link->rx_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+    LOG_ERRNO("failed to read link eventfd");
+  link->stats.wakeups++;
+
+  const void *data = NULL;
+  uint32_t len = 0;
+  size_t n = 0;
+  while (!link->closing && n < DHUB_LINK_BATCH &&
+         (data = dhub_ring_peek(&link->rx, &len)) != NULL) {
+    dhub_reader_t r = {.data = data, .len = len};
+    uint32_t kind = dhub_reader_u32(&r);
+    link->stats.received++;
+    link->on_message(link, kind, &r);
+    dhub_ring_pop(&link->rx);
+    n++;
+  }
+
+  if (link->rx.corrupted) {
+    LOG_ERR("link peer wrote an invalid record, closing link");
+    dhub_link_close(link);
+    return;
+  }
+  if (link->closing)
+    return;
+
+  // Wake peer up if it waits for room in ring.
+  if (n > 0 && dhub_ring_take_waiter(&link->rx))
+    notify(link->tx_fd);
+
+  // Handle remaining records on next loop iteration.
+  if (n == DHUB_LINK_BATCH)
+    notify(link->rx_fd);
+
+  // Peer may have consumed records, retry now.
+  if (tll_length(link->backlog) > 0 && flush_backlog(link))
+    uv_timer_stop(&link->retry);
+}
+
+int dhub_link_init(dhub_link_t *link, uv_loop_t *loop, const int fds[3],
+                   bool core, dhub_link_cb_t on_message) {
+  size_t ring_size = dhub_ring_size(DHUB_LINK_RING_SIZE);
+  link->mem_size = 2 * ring_size;
+  link->mem = mmap(NULL, link->mem_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fds[0], 0);
+  close(fds[0]);
+  if (link->mem == MAP_FAILED) {
+    LOG_ERRNO("failed to map link memory");
+    close(fds[1]);
+    close(fds[2]);
+    return -1;
+  }
+
+  // First ring goes from core to host.
+  uint8_t *to_host = link->mem;
+  uint8_t *to_core = to_host + ring_size;
+  dhub_ring_init(&link->tx, core ? to_host : to_core, DHUB_LINK_RING_SIZE);
+  dhub_ring_init(&link->rx, core ? to_core : to_host, DHUB_LINK_RING_SIZE);
+  link->tx_fd = core ? fds[1] : fds[2];
+  link->rx_fd = core ? fds[2] : fds[1];
+  link->on_message = on_message;
+
+  UV_MUST(uv_poll_init(loop, &link->poll, link->rx_fd),
+          "failed to initialize link poll handle");
+  UV_MUST(uv_timer_init(loop, &link->retry),
+          "failed to initialize link retry timer");
+  link->poll.data = link;
+  link->retry.data = link;
+  uv_poll_start(&link->poll, UV_READABLE, on_readable);
+
+  return 0;
+}
+
+static void on_handle_close(uv_handle_t *handle) {
+  dhub_link_t *link = handle->data;
+  if (--link->closing > 0)
+    return;
+
+  // Closing is non zero while closed.
+  link->closing = -1;
+  munmap(link->mem, link->mem_size);
+  close(link->tx_fd);
+  close(link->rx_fd);
+  tll_foreach(link->backlog, it) {
+    dhub_buf_free(&it->item);
+    tll_remove(link->backlog, it);
+  }
+
+  if (link->on_close != NULL)
+    link->on_close(link);
+}
+
+void dhub_link_close(dhub_link_t *link) {
+  if (link->closing)
+    return;
+
+  link->closing = 2;
+  uv_close((uv_handle_t *)&link->poll, on_handle_close);
+  uv_close((uv_handle_t *)&link->retry, on_handle_close);
+}
+
+void dhub_link_log_stats(dhub_link_t *link, const char *name) {
+  dhub_link_stats_t *s = &link->stats;
+  LOG_INFO("link %s: sent=%" PRIu64 " received=%" PRIu64
+           " backlogged=%" PRIu64 " wakeups=%" PRIu64,
+           name, s->sent, s->received, s->backlogged, s->wakeups);
+}
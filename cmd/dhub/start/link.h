@@ -0,0 +1,115 @@
+#ifndef HUB_LINK_H_INCLUDE
+#define HUB_LINK_H_INCLUDE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "start/codec.h"
+#include "start/ring.h"
+#include "tllist.h"
+
+// Size of each ring direction.
+#ifndef DHUB_LINK_RING_SIZE
+#define DHUB_LINK_RING_SIZE (1U << 20)
+#endif
+
+// File descriptors of module host process.
+#define DHUB_LINK_FD_MEM 3
+#define DHUB_LINK_FD_TO_HOST 4
+#define DHUB_LINK_FD_TO_CORE 5
+
+// Backlog of a full ring is flushed once peer pops records and wakes us up.
+// Retry timer is only a safety net: its delay starts at DHUB_LINK_RETRY_MS and
+// doubles up to DHUB_LINK_RETRY_MAX_MS.
+#ifndef DHUB_LINK_RETRY_MS
+#define DHUB_LINK_RETRY_MS 10
+#endif
+#ifndef DHUB_LINK_RETRY_MAX_MS
+#define DHUB_LINK_RETRY_MAX_MS 1000
+#endif
+
+// Maximum number of records handled per wakeup, so a busy peer doesn't starve
+// loop.
+#ifndef DHUB_LINK_BATCH
+#define DHUB_LINK_BATCH 256
+#endif
+
+enum dhub_link_kind {
+  // Host -> core: i32 load() status, string error, string object prefix.
+  DHUB_LINK_READY = 1,
+  // Core -> host: u64 call id (0 if no reply is expected), string path,
+  // interface, member and encoded body.
+  DHUB_LINK_CALL,
+  // Host -> core: u64 call id, string error name (empty on success), error
+  // message and encoded body.
+  DHUB_LINK_REPLY,
+  // Host -> core: string path, interface, member and encoded body.
+  DHUB_LINK_SIGNAL,
+  // Core -> host: unload module and exit.
+  DHUB_LINK_SHUTDOWN,
+};
+
+struct dhub_link;
+typedef void (*dhub_link_cb_t)(struct dhub_link *link, uint32_t kind,
+                               dhub_reader_t *r);
+
+typedef struct dhub_link_stats {
+  uint64_t sent;
+  uint64_t received;
+  uint64_t backlogged;
+  uint64_t wakeups;
+} dhub_link_stats_t;
+
+/**
+ * Message channel between D-Hub and a module host process. Each direction is
+ * a ring in shared memory and an eventfd written once records are published.
+ * Messages that don't fit in a full ring wait in a backlog, peer writes our
+ * eventfd back once it pops records from a ring we're waiting on.
+ */
+typedef struct dhub_link {
+  void *mem;
+  size_t mem_size;
+  dhub_ring_t tx;
+  dhub_ring_t rx;
+  int tx_fd;
+  int rx_fd;
+  uv_poll_t poll;
+  uv_timer_t retry;
+  // Current delay of retry timer.
+  uint64_t retry_ms;
+  tll(dhub_buf_t) backlog;
+  int closing;
+  dhub_link_cb_t on_message;
+  void (*on_close)(struct dhub_link *link);
+  void *data;
+  dhub_link_stats_t stats;
+} dhub_link_t;
+
+/**
+ * Creates link shared memory and eventfds, to be passed to host process as
+ * DHUB_LINK_FD_* file descriptors.
+ */
+int dhub_link_create_fds(int fds[3]);
+
+/**
+ * Maps link memory and starts polling for messages. `core` selects ring
+ * direction. Link owns eventfds, memory file descriptor is closed once
+ * mapped.
+ */
+int dhub_link_init(dhub_link_t *link, uv_loop_t *loop, const int fds[3],
+                   bool core, dhub_link_cb_t on_message);
+
+/**
+ * Sends a message whose first 32 bits are its kind. Link takes ownership of
+ * buffer. It returns -EMSGSIZE if message is larger than ring.
+ */
+int dhub_link_send(dhub_link_t *link, dhub_buf_t *msg);
+
+/**
+ * Closes link handles, on_close is called once they're closed.
+ */
+void dhub_link_close(dhub_link_t *link);
+void dhub_link_log_stats(dhub_link_t *link, const char *name);
+
+#endif
@@ -1,18 +1,219 @@
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <uv.h>
 
+#include "start/record.h"
 #include "start/state.h"
+#include "trace.h"
 
-int start(int argc, char *argv[]) {
-  (void)argc;
-  (void)argv;
+static void print_usage(char *prog_name) {
+  static const char options[] =
+      "Options:\n"
+      "  -c, --config=FILE                        Load modules listed in FILE "
+      "instead\n"
+      "                                           of every module found in "
+      "modules\n"
+      "                                           directories\n"
+      "  -b, --dispatch-budget=N                  Maximum number of D-Bus "
+      "messages\n"
+      "                                           processed per wakeup, 0 for "
+      "unlimited\n"
+      "                                           (default: %d)\n"
+      "  -w, --write-hwm=N                        Number of queued outgoing "
+      "D-Bus\n"
+      "                                           messages above which low "
+      "priority\n"
+      "                                           signals are shed, 0 to "
+      "disable\n"
+      "                                           (default: %d)\n"
+      "  -t, --unload-timeout=MS                  Milliseconds modules have to "
+      "close\n"
+      "                                           on shutdown before being "
+      "force\n"
+      "                                           closed, 0 to disable "
+      "(default: %d)\n"
+      "  -i, --idle-timeout=MS                    Milliseconds without "
+      "activity after\n"
+      "                                           which modules opting in are "
+      "unloaded,\n"
+      "                                           0 to disable (default: %d)\n"
+      "  -s, --stall-threshold=MS                 Milliseconds an event loop "
+      "iteration\n"
+      "                                           can run before being "
+      "reported as a\n"
+      "                                           stall, 0 to disable "
+      "(default: %d)\n"
+      "  -m, --module-budget=MS                   Milliseconds of loop time "
+      "per second\n"
+      "                                           a module can use before "
+      "being\n"
+      "                                           flagged, 0 to disable "
+      "(default: %d)\n"
+      "  -T, --throttle                           Delay low priority timers "
+      "and\n"
+      "                                           signals of modules over "
+      "budget\n"
+      "  -f, --trace-file=PATH                    File trace is written to "
+      "when tracing,\n"
+      "                                           toggled with SIGUSR2 or "
+      "D-Bus, stops\n"
+      "                                           (default: "
+      "$XDG_RUNTIME_DIR/dhub-PID.trace.json)\n"
+      "  -r, --record=FILE                        Record received method calls "
+      "and\n"
+      "                                           module events to FILE, see "
+      "'dhub\n"
+      "                                           replay'\n"
+      "  -h, --help                               Print this message and exit\n"
+      "";
+
+  printf("Usage: %s [OPTIONS...]\n\n", prog_name);
+  printf(options, DHUB_DISPATCH_BUDGET, DHUB_WRITE_HWM,
+         DHUB_UNLOAD_TIMEOUT_MS, DHUB_IDLE_TIMEOUT_MS, DHUB_STALL_MS,
+         DHUB_MODULE_BUDGET_MS);
+}
+
+static int parse_uint(const char *str, unsigned int *value) {
+  char *end = NULL;
+  unsigned long v = strtoul(str, &end, 10);
+  if (*str == '\0' || *end != '\0' || v > UINT_MAX)
+    return -1;
 
+  *value = v;
+  return 0;
+}
+
+int start(int argc, char *argv[]) {
   dhub_state_t dhub = {0};
+  dhub.config = (dhub_config_t){
+      .dispatch_budget = DHUB_DISPATCH_BUDGET,
+      .write_hwm = DHUB_WRITE_HWM,
+      .unload_timeout_ms = DHUB_UNLOAD_TIMEOUT_MS,
+      .idle_timeout_ms = DHUB_IDLE_TIMEOUT_MS,
+      .stall_ms = DHUB_STALL_MS,
+      .module_budget_ms = DHUB_MODULE_BUDGET_MS,
+  };
+
+  const char *record_path = NULL;
+
+  optind = 0;
+  while (1) {
+    static struct option long_options[] = {
+        {"config", required_argument, 0, 'c'},
+        {"dispatch-budget", required_argument, 0, 'b'},
+        {"write-hwm", required_argument, 0, 'w'},
+        {"unload-timeout", required_argument, 0, 't'},
+        {"idle-timeout", required_argument, 0, 'i'},
+        {"stall-threshold", required_argument, 0, 's'},
+        {"module-budget", required_argument, 0, 'm'},
+        {"throttle", no_argument, 0, 'T'},
+        {"trace-file", required_argument, 0, 'f'},
+        {"record", required_argument, 0, 'r'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}};
+
+    int c =
+        getopt_long(argc, argv, "c:b:w:t:i:s:m:Tf:r:h", long_options, NULL);
+    if (c == -1)
+      break;
+
+    switch (c) {
+    case 'c':
+      dhub.config.path = optarg;
+      break;
+
+    case 'b':
+      if (parse_uint(optarg, &dhub.config.dispatch_budget) == -1) {
+        fprintf(stderr, "invalid dispatch budget '%s'\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'w':
+      if (parse_uint(optarg, &dhub.config.write_hwm) == -1) {
+        fprintf(stderr, "invalid write high-water mark '%s'\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 't':
+      if (parse_uint(optarg, &dhub.config.unload_timeout_ms) == -1) {
+        fprintf(stderr, "invalid unload timeout '%s'\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'i':
+      if (parse_uint(optarg, &dhub.config.idle_timeout_ms) == -1) {
+        fprintf(stderr, "invalid idle timeout '%s'\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 's':
+      if (parse_uint(optarg, &dhub.config.stall_ms) == -1) {
+        fprintf(stderr, "invalid stall threshold '%s'\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'm':
+      if (parse_uint(optarg, &dhub.config.module_budget_ms) == -1) {
+        fprintf(stderr, "invalid module budget '%s'\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'T':
+      dhub.config.throttle = true;
+      break;
+
+    case 'f':
+      if (trace_set_path(optarg) == -1) {
+        fprintf(stderr, "invalid trace file path '%s'\n", optarg);
+        return EXIT_FAILURE;
+      }
+      break;
+
+    case 'r':
+      record_path = optarg;
+      break;
+
+    case 'h':
+      print_usage(argv[0]);
+      return EXIT_SUCCESS;
+
+    default:
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (dhub_config_load(&dhub.config) == -1) {
+    dhub_config_deinit(&dhub.config);
+    return EXIT_FAILURE;
+  }
+
+  // Recording starts before contexts are initialized so every bus is
+  // recorded.
+  if (record_path != NULL && dhub_record_open(record_path) == -1) {
+    fprintf(stderr, "failed to open recording file '%s': %s\n", record_path,
+            strerror(errno));
+    dhub_config_deinit(&dhub.config);
+    return EXIT_FAILURE;
+  }
+
   dhub_init(&dhub);
 
   dhub_start(&dhub);
 
   dhub_deinit(&dhub);
 
+  dhub_record_close();
+
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "start/context.h"
+#include "start/state.h"
+#include "start/thread.h"
+#define LOG_MODULE "dhub-offload"
+#include "log.h"
+
+typedef struct {
+  uv_work_t req;
+  dhub_context_t *ctx;
+  sd_bus_message *m;
+  dhub_work_fn_t work;
+  dhub_done_fn_t done;
+  void *userdata;
+  void *result;
+  int status;
+  // Module kept from idle unload until call is replied to.
+  dhub_handle_t idle_hold;
+} offload_req_t;
+
+static void on_work(uv_work_t *req) {
+  offload_req_t *o = req->data;
+  o->status = o->work(o->m, o->userdata, &o->result);
+}
+
+static void on_after_work(uv_work_t *req, int status) {
+  offload_req_t *o = req->data;
+  dhub_offload_t *offload = &o->ctx->offload;
+
+  if (status == UV_ECANCELED) {
+    o->status = -ECANCELED;
+    offload->stats.cancelled++;
+  } else {
+    offload->stats.completed++;
+  }
+
+  // Build and send reply on loop thread.
+  int r = o->done(o->m, o->userdata, o->result, o->status);
+  if (r < 0) {
+    r = sd_bus_reply_method_errno(o->m, -r, NULL);
+    NEG_TRY(r, "failed to reply to offloaded method call");
+  }
+
+  offload->pending--;
+  dhub_idle_release(o->ctx->dhub, o->idle_hold);
+  sd_bus_message_unref(o->m);
+
+  // Stop sequence waits for main context offloaded calls, module threads for
+  // their own before unloading them.
+  dhub_context_t *ctx = o->ctx;
+  free(o);
+  if (offload->pending > 0)
+    return;
+  if (ctx == &ctx->dhub->ctx)
+    dhub_shutdown_check(ctx->dhub);
+  else
+    dhub_thread_offloads_done(dhub_thread_current());
+}
+
+int dhub_offload(dhub_state_t *dhub, sd_bus_message *m, dhub_work_fn_t work,
+                 dhub_done_fn_t done, void *userdata) {
+  offload_req_t *o = calloc(1, sizeof(*o));
+  if (o == NULL)
+    return -ENOMEM;
+
+  dhub_context_t *ctx = dhub_context(dhub);
+  *o = (offload_req_t){
+      .ctx = ctx,
+      .m = sd_bus_message_ref(m),
+      .work = work,
+      .done = done,
+      .userdata = userdata,
+  };
+  o->req.data = o;
+
+  int r = uv_queue_work(ctx->loop, &o->req, on_work, on_after_work);
+  if (r < 0) {
+    LOG_ERR("failed to queue offloaded method call: %s", uv_strerror(r));
+    sd_bus_message_unref(o->m);
+    free(o);
+    return -EIO;
+  }
+
+  o->idle_hold = dhub_idle_hold(dhub, sd_bus_message_get_path(m));
+
+  dhub_offload_t *offload = &ctx->offload;
+  offload->pending++;
+  offload->stats.queued++;
+  if (offload->pending > offload->stats.max_pending)
+    offload->stats.max_pending = offload->pending;
+
+  // Reply will be sent by on_after_work.
+  return 1;
+}
+
+void dhub_offload_log_stats(dhub_context_t *ctx) {
+  dhub_offload_stats_t *s = &ctx->offload.stats;
+
+  LOG_INFO("offload: queued=%" PRIu64 " completed=%" PRIu64
+           " cancelled=%" PRIu64 " max pending=%" PRIu64,
+           s->queued, s->completed, s->cancelled, s->max_pending);
+}
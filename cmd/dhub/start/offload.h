@@ -0,0 +1,25 @@
+#ifndef HUB_OFFLOAD_H_INCLUDE
+#define HUB_OFFLOAD_H_INCLUDE
+
+#include <stdint.h>
+
+struct dhub_context;
+
+typedef struct dhub_offload_stats {
+  uint64_t queued;
+  uint64_t completed;
+  uint64_t cancelled;
+  uint64_t max_pending;
+} dhub_offload_stats_t;
+
+/**
+ * Method calls offloaded to libuv threadpool.
+ */
+typedef struct dhub_offload {
+  uint64_t pending;
+  dhub_offload_stats_t stats;
+} dhub_offload_t;
+
+void dhub_offload_log_stats(struct dhub_context *ctx);
+
+#endif
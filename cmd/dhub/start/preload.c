@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "start/preload.h"
+#include "start/state.h"
+#define LOG_MODULE "dhub-preload"
+#include "log.h"
+
+#define NS_PER_MS 1000000.0
+
+typedef struct preload_job preload_job_t;
+
+typedef struct {
+  uv_work_t req;
+  preload_job_t *job;
+  const char *name;
+  bool lazy;
+  bool isolated;
+  dhub_module_lib_t mod;
+  const char *err;
+  int r;
+} preload_entry_t;
+
+struct preload_job {
+  dhub_state_t *dhub;
+  uint64_t start;
+  size_t len;
+  size_t pending;
+  preload_entry_t entries[];
+};
+
+static void load_all(preload_job_t *job) {
+  dhub_state_t *dhub = job->dhub;
+  uint64_t resolved = uv_hrtime();
+  LOG_INFO("%zu modules opened in %.3f ms", job->len,
+           (double)(resolved - job->start) / NS_PER_MS);
+
+  for (size_t i = 0; i < job->len; i++) {
+    preload_entry_t *e = &job->entries[i];
+    if (e->r == -1) {
+      LOG_ERR("failed to open '%s' module: %s", e->name, e->err);
+      continue;
+    }
+
+    // Shutdown started while modules were being opened.
+    if (dhub->shutdown.stopping) {
+      dhub_module_lib_close(&e->mod);
+      continue;
+    }
+
+    LOG_INFO("loading module '%s'...", e->name);
+    const char *err_msg = NULL;
+    int r = e->isolated ? dhub_load_isolated(dhub, e->name, &err_msg)
+                        : dhub_load_resolved(dhub, e->name, &e->mod, e->lazy,
+                                             &err_msg);
+    if (r == -1)
+      LOG_ERR("failed to load '%s' module: %s", e->name, err_msg);
+  }
+
+  LOG_INFO("%zu modules loaded in %.3f ms", job->len,
+           (double)(uv_hrtime() - resolved) / NS_PER_MS);
+  free(job);
+}
+
+static void on_work(uv_work_t *req) {
+  preload_entry_t *e = req->data;
+  // Isolated modules are opened by their host process.
+  if (e->isolated)
+    return;
+  e->r = dhub_module_resolve(e->name, &e->mod, &e->err);
+}
+
+static void on_after_work(uv_work_t *req, int status) {
+  preload_entry_t *e = req->data;
+  if (status == UV_ECANCELED) {
+    e->r = -1;
+    e->err = "cancelled";
+  }
+
+  preload_job_t *job = e->job;
+  if (--job->pending == 0)
+    load_all(job);
+}
+
+void dhub_preload(dhub_state_t *dhub) {
+  size_t len = tll_length(dhub->config.modules);
+  if (len == 0) {
+    LOG_WARN("no modules to load");
+    return;
+  }
+
+  preload_job_t *job = calloc(1, sizeof(*job) + len * sizeof(*job->entries));
+  if (job == NULL)
+    LOG_FATAL("failed to allocate modules preload job");
+
+  job->dhub = dhub;
+  job->start = uv_hrtime();
+  job->len = len;
+
+  size_t i = 0;
+  tll_foreach(dhub->config.modules, it) {
+    preload_entry_t *e = &job->entries[i++];
+    e->job = job;
+    e->name = it->item.name;
+    e->lazy = it->item.lazy;
+    e->isolated = it->item.isolated;
+    e->req.data = e;
+  }
+
+  // Extra pending count so job outlives the queueing loop.
+  job->pending = len + 1;
+
+  LOG_INFO("opening %zu modules...", len);
+  for (i = 0; i < len; i++) {
+    preload_entry_t *e = &job->entries[i];
+    int r = uv_queue_work(&dhub->loop, &e->req, on_work, on_after_work);
+    if (r < 0) {
+      // Open it synchronously instead.
+      LOG_WARN("failed to queue '%s' module preload: %s", e->name,
+               uv_strerror(r));
+      on_work(&e->req);
+      on_after_work(&e->req, 0);
+    }
+  }
+
+  if (--job->pending == 0)
+    load_all(job);
+}
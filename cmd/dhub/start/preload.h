@@ -0,0 +1,13 @@
+#ifndef HUB_PRELOAD_H_INCLUDE
+#define HUB_PRELOAD_H_INCLUDE
+
+struct dhub_state;
+
+/**
+ * Opens configured modules libraries and resolves their symbols in parallel
+ * on libuv threadpool. Once all are resolved, modules are loaded one after
+ * the other on loop thread in configuration order.
+ */
+void dhub_preload(struct dhub_state *dhub);
+
+#endif
@@ -0,0 +1,258 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "start/context.h"
+#include "start/control.h"
+#include "start/record.h"
+#include "start/state.h"
+#include "start/thread.h"
+#define LOG_MODULE "dhub-record"
+#include "log.h"
+
+// Recording file is written in large chunks, it is flushed when full and on
+// close.
+#define RECORD_FILE_BUFFER (1U << 20)
+
+// Size, type and timestamp.
+#define RECORD_HEADER_SIZE (sizeof(uint32_t) + 1 + sizeof(uint64_t))
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+// Set before contexts are initialized and cleared once every thread exited,
+// read without lock.
+static FILE *file = NULL;
+static char *file_path = NULL;
+static uint64_t start_ns = 0;
+// Following fields are protected by lock.
+static dhub_buf_t scratch = {0};
+static uint64_t calls = 0;
+static uint64_t events = 0;
+// Method calls that couldn't be encoded, e.g. calls passing file descriptors.
+static uint64_t skipped = 0;
+static bool write_failed = false;
+
+int dhub_record_open(const char *path) {
+  FILE *f = fopen(path, "we");
+  if (f == NULL)
+    return -1;
+
+  setvbuf(f, NULL, _IOFBF, RECORD_FILE_BUFFER);
+  uint32_t version = DHUB_RECORD_VERSION;
+  if (fwrite(DHUB_RECORD_MAGIC, sizeof(DHUB_RECORD_MAGIC), 1, f) != 1 ||
+      fwrite(&version, sizeof(version), 1, f) != 1) {
+    int err = errno;
+    fclose(f);
+    errno = err;
+    return -1;
+  }
+
+  file_path = strdup(path);
+  if (file_path == NULL) {
+    fclose(f);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  start_ns = uv_hrtime();
+  file = f;
+  return 0;
+}
+
+// Starts a record in scratch buffer, lock must be held.
+static void record_begin(enum dhub_record_type type) {
+  uint8_t t = type;
+  scratch.len = 0;
+  dhub_buf_put_u32(&scratch, 0);
+  dhub_buf_put(&scratch, &t, sizeof(t));
+  dhub_buf_put_u64(&scratch, uv_hrtime() - start_ns);
+}
+
+// Writes record in scratch buffer to file, lock must be held.
+static void record_end(void) {
+  uint32_t size = scratch.len - sizeof(uint32_t);
+  memcpy(scratch.data, &size, sizeof(size));
+
+  if (fwrite(scratch.data, scratch.len, 1, file) != 1 && !write_failed) {
+    LOG_ERRNO("failed to write recording file '%s'", file_path);
+    write_failed = true;
+  }
+}
+
+static int on_message(sd_bus_message *m, void *userdata,
+                      sd_bus_error *ret_error) {
+  (void)userdata;
+  (void)ret_error;
+  if (!sd_bus_message_is_method_call(m, NULL, NULL))
+    return 0;
+
+  // Injected events are recorded by modules handling them.
+  if (sd_bus_message_is_method_call(m, DHUB_CONTROL_IFACE, "InjectEvent"))
+    return 0;
+
+  pthread_mutex_lock(&lock);
+  record_begin(DHUB_RECORD_CALL);
+  dhub_buf_put_str(&scratch, sd_bus_message_get_destination(m));
+  dhub_buf_put_str(&scratch, sd_bus_message_get_path(m));
+  dhub_buf_put_str(&scratch, sd_bus_message_get_interface(m));
+  dhub_buf_put_str(&scratch, sd_bus_message_get_member(m));
+  dhub_buf_put_str(&scratch, sd_bus_message_get_signature(m, true));
+  dhub_buf_put_u32(&scratch, sd_bus_message_get_expect_reply(m) > 0);
+  if (dhub_codec_encode_body(m, &scratch) >= 0) {
+    record_end();
+    calls++;
+  } else {
+    skipped++;
+  }
+  pthread_mutex_unlock(&lock);
+
+  // Message is dispatched once filters returned.
+  NEG_TRY(sd_bus_message_rewind(m, true), "failed to rewind recorded message");
+  return 0;
+}
+
+void dhub_record_attach(dhub_context_t *ctx) {
+  if (file == NULL)
+    return;
+
+  NEG_MUST(sd_bus_add_filter(ctx->bus, NULL, on_message, NULL),
+           "failed to add D-Bus recording filter");
+}
+
+void dhub_record_close(void) {
+  if (file == NULL)
+    return;
+
+  if (fclose(file) != 0)
+    LOG_ERRNO("failed to write recording file '%s'", file_path);
+  file = NULL;
+
+  LOG_INFO("recorded %" PRIu64 " method calls and %" PRIu64
+           " events to '%s'",
+           calls, events, file_path);
+  if (skipped != 0)
+    LOG_WARN("%" PRIu64 " method calls passing file descriptors weren't "
+             "recorded",
+             skipped);
+
+  free(file_path);
+  file_path = NULL;
+  dhub_buf_free(&scratch);
+}
+
+bool dhub_recording(dhub_state_t *dhub) {
+  (void)dhub;
+  return file != NULL;
+}
+
+void dhub_record_event(dhub_state_t *dhub, const char *kind, const void *data,
+                       size_t len) {
+  (void)dhub;
+  if (file == NULL)
+    return;
+
+  pthread_mutex_lock(&lock);
+  record_begin(DHUB_RECORD_EVENT);
+  dhub_buf_put_str(&scratch, kind);
+  dhub_buf_put_u32(&scratch, len);
+  dhub_buf_put(&scratch, data, len);
+  record_end();
+  events++;
+  pthread_mutex_unlock(&lock);
+}
+
+int dhub_replay_handler(dhub_state_t *dhub, const char *kind,
+                        dhub_replay_cb cb, void *userdata) {
+  // Handlers are called from main event loop.
+  if (dhub_thread_current() != NULL)
+    return -ENOTSUP;
+
+  tll_foreach(dhub->replay_handlers, it) {
+    if (strcmp(it->item.kind, kind) != 0)
+      continue;
+
+    if (cb == NULL) {
+      free(it->item.kind);
+      tll_remove(dhub->replay_handlers, it);
+    } else {
+      it->item.cb = cb;
+      it->item.userdata = userdata;
+    }
+    return 0;
+  }
+
+  if (cb == NULL)
+    return 0;
+
+  char *k = strdup(kind);
+  if (k == NULL)
+    return -ENOMEM;
+
+  tll_push_back(dhub->replay_handlers,
+                ((dhub_replay_handler_t){
+                    .kind = k, .cb = cb, .userdata = userdata}));
+  return 0;
+}
+
+int dhub_replay_inject(dhub_state_t *dhub, const char *kind, const void *data,
+                       size_t len) {
+  tll_foreach(dhub->replay_handlers, it) {
+    if (strcmp(it->item.kind, kind) == 0) {
+      it->item.cb(data, len, it->item.userdata);
+      return 0;
+    }
+  }
+
+  return -ENOENT;
+}
+
+void dhub_replay_deinit(dhub_state_t *dhub) {
+  tll_foreach(dhub->replay_handlers, it) {
+    LOG_WARN("replay handler of '%s' events wasn't removed", it->item.kind);
+    free(it->item.kind);
+    tll_remove(dhub->replay_handlers, it);
+  }
+}
+
+int dhub_record_read_header(FILE *f) {
+  char magic[sizeof(DHUB_RECORD_MAGIC)];
+  uint32_t version = 0;
+  if (fread(magic, sizeof(magic), 1, f) != 1 ||
+      memcmp(magic, DHUB_RECORD_MAGIC, sizeof(magic)) != 0 ||
+      fread(&version, sizeof(version), 1, f) != 1 ||
+      version != DHUB_RECORD_VERSION)
+    return -1;
+
+  return 0;
+}
+
+int dhub_record_read(FILE *f, dhub_buf_t *buf, dhub_record_t *rec) {
+  uint32_t size = 0;
+  size_t n = fread(&size, 1, sizeof(size), f);
+  if (n == 0 && feof(f))
+    return 0;
+  if (n != sizeof(size) || size < RECORD_HEADER_SIZE - sizeof(size))
+    return -1;
+
+  buf->len = 0;
+  uint8_t chunk[4096];
+  for (uint32_t left = size; left > 0;) {
+    size_t len = left < sizeof(chunk) ? left : sizeof(chunk);
+    if (fread(chunk, len, 1, f) != 1)
+      return -1;
+    dhub_buf_put(buf, chunk, len);
+    left -= len;
+  }
+
+  dhub_reader_t r = {.data = buf->data, .len = buf->len};
+  const uint8_t *type = dhub_reader_get(&r, sizeof(*type));
+  rec->time_ns = dhub_reader_u64(&r);
+  if (r.err != 0)
+    return -1;
+
+  rec->type = *type;
+  rec->payload = r;
+  return 1;
+}
@@ -0,0 +1,92 @@
+#ifndef HUB_RECORD_H_INCLUDE
+#define HUB_RECORD_H_INCLUDE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dhub.h"
+#include "start/codec.h"
+
+/**
+ * Session recording file layout, all integers are native endian:
+ *
+ * - header: DHUB_RECORD_MAGIC (8 bytes, NUL included) and a u32 version;
+ * - records: a u32 size of what follows, a u8 record type, a u64 timestamp in
+ *   nanoseconds since recording started and a type specific payload.
+ */
+#define DHUB_RECORD_MAGIC "DHUBREC"
+#define DHUB_RECORD_VERSION 1
+
+enum dhub_record_type {
+  // Method call received by D-Hub: destination, path, interface, member and
+  // signature strings, a u32 expect reply flag and body encoded with
+  // dhub_codec_encode_body().
+  DHUB_RECORD_CALL = 1,
+  // Module event recorded with dhub_record_event(): kind string, u32 data
+  // size and data.
+  DHUB_RECORD_EVENT = 2,
+};
+
+/**
+ * Replay handler registered with dhub_replay_handler().
+ */
+typedef struct dhub_replay_handler {
+  char *kind;
+  dhub_replay_cb cb;
+  void *userdata;
+} dhub_replay_handler_t;
+
+struct dhub_context;
+
+/**
+ * Starts recording method calls and module events to file at `path`. It must
+ * be called before contexts are initialized. It returns -1 and sets errno on
+ * error.
+ */
+int dhub_record_open(const char *path);
+
+/**
+ * Records method calls received on context bus, if recording.
+ */
+void dhub_record_attach(struct dhub_context *ctx);
+
+/**
+ * Flushes and closes recording file, if any.
+ */
+void dhub_record_close(void);
+
+/**
+ * Passes event data to replay handler of `kind`. It returns -ENOENT if there
+ * is none.
+ */
+int dhub_replay_inject(dhub_state_t *dhub, const char *kind, const void *data,
+                       size_t len);
+
+/**
+ * Frees replay handlers modules left behind.
+ */
+void dhub_replay_deinit(dhub_state_t *dhub);
+
+/**
+ * Record read by dhub_record_read(), payload points into reader buffer.
+ */
+typedef struct dhub_record {
+  enum dhub_record_type type;
+  uint64_t time_ns;
+  dhub_reader_t payload;
+} dhub_record_t;
+
+/**
+ * Reads and checks recording file header. It returns -1 if it isn't a
+ * supported recording.
+ */
+int dhub_record_read_header(FILE *f);
+
+/**
+ * Reads next record in `buf`. It returns 1 on success, 0 at end of file and
+ * -1 on error or truncated record.
+ */
+int dhub_record_read(FILE *f, dhub_buf_t *buf, dhub_record_t *rec);
+
+#endif
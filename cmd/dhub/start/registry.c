@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "start/registry.h"
+#include "start/state.h"
+#define LOG_MODULE "dhub-registry"
+#include "log.h"
+
+#define BUCKET_EMPTY 0
+#define BUCKET_TOMBSTONE UINT32_MAX
+
+// Handles store slot index + 1 in their lower half and generation in upper
+// half.
+#define HANDLE_HALF_BITS (sizeof(dhub_handle_t) * 4)
+#define HANDLE_HALF_MASK (((dhub_handle_t)1 << HANDLE_HALF_BITS) - 1)
+
+static uint32_t hash_name(const char *name) {
+  // FNV-1a.
+  uint32_t h = 2166136261u;
+  for (const unsigned char *c = (const unsigned char *)name; *c != '\0'; c++) {
+    h ^= *c;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+void dhub_registry_deinit(dhub_registry_t *reg) {
+  dhub_registry_foreach(reg, it) { free((void *)it->name); }
+  free(reg->entries);
+  free(reg->free);
+  free(reg->buckets);
+  *reg = (dhub_registry_t){0};
+}
+
+static void bucket_insert(dhub_registry_t *reg, uint32_t hash, uint32_t idx) {
+  size_t mask = reg->buckets_cap - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    if (reg->buckets[i] == BUCKET_EMPTY) {
+      reg->buckets_used++;
+      reg->buckets[i] = idx + 1;
+      return;
+    }
+    if (reg->buckets[i] == BUCKET_TOMBSTONE) {
+      reg->buckets[i] = idx + 1;
+      return;
+    }
+  }
+}
+
+static void rehash(dhub_registry_t *reg, size_t cap) {
+  uint32_t *buckets = calloc(cap, sizeof(*buckets));
+  if (buckets == NULL)
+    LOG_FATAL("failed to allocate module registry buckets");
+
+  free(reg->buckets);
+  reg->buckets = buckets;
+  reg->buckets_cap = cap;
+  reg->buckets_used = 0;
+
+  // Tombstones are dropped.
+  dhub_registry_foreach(reg, it) {
+    bucket_insert(reg, it->hash, it - reg->entries);
+  }
+}
+
+static void grow_entries(dhub_registry_t *reg) {
+  size_t cap = reg->entries_cap == 0 ? 8 : reg->entries_cap * 2;
+
+  dhub_module_t *entries = realloc(reg->entries, cap * sizeof(*entries));
+  uint32_t *free_slots = realloc(reg->free, cap * sizeof(*free_slots));
+  if (entries == NULL || free_slots == NULL)
+    LOG_FATAL("failed to allocate module registry slots");
+
+  memset(entries + reg->entries_cap, 0,
+         (cap - reg->entries_cap) * sizeof(*entries));
+  reg->entries = entries;
+  reg->free = free_slots;
+
+  // Push new slots so lower ones are used first.
+  for (size_t i = cap; i > reg->entries_cap; i--)
+    reg->free[reg->free_len++] = i - 1;
+  reg->entries_cap = cap;
+}
+
+dhub_module_t *dhub_registry_find(dhub_registry_t *reg, const char *name) {
+  if (reg->buckets_cap == 0)
+    return NULL;
+
+  uint32_t hash = hash_name(name);
+  size_t mask = reg->buckets_cap - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    uint32_t b = reg->buckets[i];
+    if (b == BUCKET_EMPTY)
+      return NULL;
+    if (b == BUCKET_TOMBSTONE)
+      continue;
+
+    dhub_module_t *module = &reg->entries[b - 1];
+    if (module->hash == hash && strcmp(module->name, name) == 0)
+      return module;
+  }
+}
+
+static dhub_handle_t encode_handle(dhub_registry_t *reg,
+                                   dhub_module_t *module, uint32_t gen) {
+  dhub_handle_t idx = module - reg->entries;
+  return ((gen & HANDLE_HALF_MASK) << HANDLE_HALF_BITS) | (idx + 1);
+}
+
+// Returns slot addressed by handle if it is used, NULL otherwise.
+static dhub_module_t *handle_slot(dhub_registry_t *reg, dhub_handle_t handle) {
+  dhub_handle_t idx = handle & HANDLE_HALF_MASK;
+  if (idx == 0 || idx > reg->entries_cap || !reg->entries[idx - 1].used)
+    return NULL;
+
+  return &reg->entries[idx - 1];
+}
+
+dhub_module_t *dhub_registry_get(dhub_registry_t *reg, dhub_handle_t handle) {
+  dhub_module_t *module = handle_slot(reg, handle);
+  dhub_handle_t gen = handle >> HANDLE_HALF_BITS;
+  if (module == NULL || (module->generation & HANDLE_HALF_MASK) != gen)
+    return NULL;
+
+  return module;
+}
+
+dhub_module_t *dhub_registry_get_slot(dhub_registry_t *reg,
+                                      dhub_handle_t handle) {
+  dhub_module_t *module = handle_slot(reg, handle);
+  dhub_handle_t gen = handle >> HANDLE_HALF_BITS;
+  if (module == NULL || (module->slot_generation & HANDLE_HALF_MASK) != gen)
+    return NULL;
+
+  return module;
+}
+
+dhub_module_t *dhub_registry_add(dhub_registry_t *reg, const char *name) {
+  // Keep load factor, tombstones included, under 1/2.
+  if ((reg->buckets_used + 1) * 2 > reg->buckets_cap) {
+    size_t cap = reg->buckets_cap == 0 ? 16 : reg->buckets_cap;
+    while ((reg->length + 1) * 4 > cap)
+      cap *= 2;
+    rehash(reg, cap);
+  }
+
+  if (reg->free_len == 0)
+    grow_entries(reg);
+
+  uint32_t idx = reg->free[--reg->free_len];
+  dhub_module_t *module = &reg->entries[idx];
+  uint32_t generation = module->generation;
+  uint32_t slot_generation = module->slot_generation;
+  *module = (dhub_module_t){
+      .name = strdup(name),
+      .hash = hash_name(name),
+      .generation = generation,
+      .slot_generation = slot_generation,
+      .used = true,
+  };
+
+  bucket_insert(reg, module->hash, idx);
+  reg->length++;
+
+  return module;
+}
+
+void dhub_registry_remove(dhub_registry_t *reg, dhub_module_t *module) {
+  uint32_t idx = module - reg->entries;
+
+  size_t mask = reg->buckets_cap - 1;
+  for (size_t i = module->hash & mask;; i = (i + 1) & mask) {
+    if (reg->buckets[i] == idx + 1) {
+      reg->buckets[i] = BUCKET_TOMBSTONE;
+      break;
+    }
+  }
+
+  free((void *)module->name);
+  module->name = NULL;
+  module->used = false;
+  // Invalidate handles of this slot.
+  module->generation++;
+  module->slot_generation++;
+
+  reg->free[reg->free_len++] = idx;
+  reg->length--;
+}
+
+dhub_handle_t dhub_registry_handle(dhub_registry_t *reg,
+                                   dhub_module_t *module) {
+  return encode_handle(reg, module, module->generation);
+}
+
+dhub_handle_t dhub_registry_slot_handle(dhub_registry_t *reg,
+                                        dhub_module_t *module) {
+  return encode_handle(reg, module, module->slot_generation);
+}
@@ -0,0 +1,69 @@
+#ifndef HUB_REGISTRY_H_INCLUDE
+#define HUB_REGISTRY_H_INCLUDE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct dhub_module;
+
+/**
+ * Module handle, it is the tag passed to module unload() function. It encodes
+ * module slot index and generation so handles of unloaded modules are
+ * detected even if their slot has been reused.
+ */
+typedef uintptr_t dhub_handle_t;
+
+#define DHUB_HANDLE_NULL ((dhub_handle_t)0)
+
+/**
+ * Module registry. Modules are stored in stable slots addressed by handles and
+ * indexed by name in an open addressing (linear probing) hash table.
+ */
+typedef struct dhub_registry {
+  // Module slots.
+  struct dhub_module *entries;
+  size_t entries_cap;
+  // Stack of free slots.
+  uint32_t *free;
+  size_t free_len;
+  // Hash table buckets, they contain slot index + 1 or one of BUCKET_EMPTY
+  // and BUCKET_TOMBSTONE.
+  uint32_t *buckets;
+  size_t buckets_cap;
+  size_t buckets_used;
+  // Number of registered modules.
+  size_t length;
+  // Number of modules in DHUB_MODULE_LOADED or DHUB_MODULE_LAZY state.
+  size_t loaded;
+} dhub_registry_t;
+
+void dhub_registry_deinit(dhub_registry_t *reg);
+struct dhub_module *dhub_registry_find(dhub_registry_t *reg, const char *name);
+struct dhub_module *dhub_registry_get(dhub_registry_t *reg,
+                                      dhub_handle_t handle);
+struct dhub_module *dhub_registry_add(dhub_registry_t *reg, const char *name);
+void dhub_registry_remove(dhub_registry_t *reg, struct dhub_module *module);
+dhub_handle_t dhub_registry_handle(dhub_registry_t *reg,
+                                   struct dhub_module *module);
+
+/**
+ * Returns handle of `module` slot. Unlike dhub_registry_handle() ones, it
+ * stays valid when module is hot reloaded and is only invalidated once module
+ * is removed. It must be resolved with dhub_registry_get_slot().
+ */
+dhub_handle_t dhub_registry_slot_handle(dhub_registry_t *reg,
+                                        struct dhub_module *module);
+struct dhub_module *dhub_registry_get_slot(dhub_registry_t *reg,
+                                           dhub_handle_t handle);
+
+/**
+ * Iterates over registered modules. <it> is a module pointer. Current module
+ * may be removed while iterating.
+ */
+#define dhub_registry_foreach(reg, it)                                         \
+  for (struct dhub_module *it = (reg)->entries;                                \
+       it < (reg)->entries + (reg)->entries_cap; it++)                         \
+    if (it->used)
+
+#endif
@@ -0,0 +1,104 @@
+#include <errno.h>
+#include <string.h>
+
+#include "start/ring.h"
+
+#define RING_WRAP UINT32_MAX
+#define RING_ALIGN(n) (((n) + 3U) & ~3U)
+
+size_t dhub_ring_size(uint32_t cap) {
+  return sizeof(dhub_ring_shared_t) + cap;
+}
+
+void dhub_ring_init(dhub_ring_t *ring, void *mem, uint32_t cap) {
+  *ring = (dhub_ring_t){.shm = mem, .cap = cap};
+}
+
+int dhub_ring_push(dhub_ring_t *ring, const void *data, uint32_t len) {
+  dhub_ring_shared_t *shm = ring->shm;
+  uint32_t size = RING_ALIGN(sizeof(uint32_t) + len);
+  if (len > ring->cap / 2 || size > ring->cap / 2)
+    return -EMSGSIZE;
+
+  // Only producer writes head.
+  uint32_t head = atomic_load_explicit(&shm->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&shm->tail, memory_order_acquire);
+  uint32_t used = head - tail;
+  uint32_t offset = head & (ring->cap - 1);
+  uint32_t contiguous = ring->cap - offset;
+
+  // Skip end of data if record doesn't fit before it.
+  uint32_t skip = size > contiguous ? contiguous : 0;
+  if (used + skip + size > ring->cap)
+    return -EAGAIN;
+
+  if (skip > 0) {
+    uint32_t marker = RING_WRAP;
+    memcpy(&shm->data[offset], &marker, sizeof(marker));
+    offset = 0;
+  }
+
+  memcpy(&shm->data[offset], &len, sizeof(len));
+  memcpy(&shm->data[offset + sizeof(len)], data, len);
+
+  // Publish record.
+  atomic_store_explicit(&shm->head, head + skip + size, memory_order_release);
+  return 0;
+}
+
+const void *dhub_ring_peek(dhub_ring_t *ring, uint32_t *len) {
+  dhub_ring_shared_t *shm = ring->shm;
+
+  // Only consumer writes tail.
+  uint32_t tail = atomic_load_explicit(&shm->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&shm->head, memory_order_acquire);
+  if (head == tail || ring->corrupted)
+    return NULL;
+
+  uint32_t offset = tail & (ring->cap - 1);
+  uint32_t rec_len = 0;
+  memcpy(&rec_len, &shm->data[offset], sizeof(rec_len));
+
+  ring->peeked = 0;
+  if (rec_len == RING_WRAP) {
+    ring->peeked = ring->cap - offset;
+    offset = 0;
+    memcpy(&rec_len, &shm->data[0], sizeof(rec_len));
+  }
+
+  // Peer memory can't be trusted.
+  if (rec_len > ring->cap / 2 ||
+      offset + sizeof(uint32_t) + rec_len > ring->cap) {
+    ring->corrupted = true;
+    return NULL;
+  }
+
+  ring->peeked += RING_ALIGN(sizeof(uint32_t) + rec_len);
+  *len = rec_len;
+  return &shm->data[offset + sizeof(uint32_t)];
+}
+
+void dhub_ring_pop(dhub_ring_t *ring) {
+  dhub_ring_shared_t *shm = ring->shm;
+  uint32_t tail = atomic_load_explicit(&shm->tail, memory_order_relaxed);
+
+  // Release record memory to producer.
+  atomic_store_explicit(&shm->tail, tail + ring->peeked, memory_order_release);
+  ring->peeked = 0;
+}
+
+void dhub_ring_wait_room(dhub_ring_t *ring) {
+  atomic_store_explicit(&ring->shm->waiting, 1, memory_order_relaxed);
+  // Order flag store before producer reads tail again.
+  atomic_thread_fence(memory_order_seq_cst);
+}
+
+bool dhub_ring_take_waiter(dhub_ring_t *ring) {
+  // Order tail stores of popped records before flag read.
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&ring->shm->waiting, memory_order_relaxed) == 0)
+    return false;
+
+  return atomic_exchange_explicit(&ring->shm->waiting, 0,
+                                  memory_order_relaxed) != 0;
+}
@@ -0,0 +1,82 @@
+#ifndef HUB_RING_H_INCLUDE
+#define HUB_RING_H_INCLUDE
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DHUB_RING_CACHELINE 64
+
+/**
+ * Single producer single consumer ring buffer header, followed by its data.
+ * It lives in memory shared between two processes: producer only writes
+ * `head` and consumer only writes `tail`, both are free running byte counters
+ * kept on their own cache line. `waiting` is set by a producer waiting for
+ * room and cleared by consumer.
+ */
+typedef struct dhub_ring_shared {
+  alignas(DHUB_RING_CACHELINE) _Atomic uint32_t head;
+  alignas(DHUB_RING_CACHELINE) _Atomic uint32_t tail;
+  alignas(DHUB_RING_CACHELINE) _Atomic uint32_t waiting;
+  alignas(DHUB_RING_CACHELINE) uint8_t data[];
+} dhub_ring_shared_t;
+
+/**
+ * Process local view of a ring. Records are a 32 bits length followed by
+ * their payload, padded to 4 bytes. They are never split: a record that
+ * doesn't fit before the end of data is preceded by a wrap marker.
+ */
+typedef struct dhub_ring {
+  dhub_ring_shared_t *shm;
+  // Data size, a power of two.
+  uint32_t cap;
+  // Size of record returned by last dhub_ring_peek().
+  uint32_t peeked;
+  // Peer wrote an invalid record, ring is unusable.
+  bool corrupted;
+} dhub_ring_t;
+
+/**
+ * Returns size of shared memory needed by a ring of `cap` bytes.
+ */
+size_t dhub_ring_size(uint32_t cap);
+
+/**
+ * Initializes ring view over `mem`. Memory must be zeroed before first use
+ * by either side.
+ */
+void dhub_ring_init(dhub_ring_t *ring, void *mem, uint32_t cap);
+
+/**
+ * Copies a record into ring. It returns -EAGAIN if ring is full and
+ * -EMSGSIZE if record can never fit.
+ */
+int dhub_ring_push(dhub_ring_t *ring, const void *data, uint32_t len);
+
+/**
+ * Returns next record without consuming it, NULL if ring is empty or
+ * corrupted. Record stays valid until dhub_ring_pop() is called.
+ */
+const void *dhub_ring_peek(dhub_ring_t *ring, uint32_t *len);
+
+/**
+ * Consumes record returned by dhub_ring_peek().
+ */
+void dhub_ring_pop(dhub_ring_t *ring);
+
+/**
+ * Flags producer as waiting for room after dhub_ring_push() returned -EAGAIN.
+ * Producer must retry pushing afterward: either retry succeeds or consumer
+ * sees the flag once it pops records.
+ */
+void dhub_ring_wait_room(dhub_ring_t *ring);
+
+/**
+ * Clears producer waiting flag, it returns true if it was set so consumer
+ * wakes producer up after popping records.
+ */
+bool dhub_ring_take_waiter(dhub_ring_t *ring);
+
+#endif
@@ -0,0 +1,187 @@
+#include <inttypes.h>
+#include <stdlib.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "start/control.h"
+#include "start/host.h"
+#include "start/shutdown.h"
+#include "start/state.h"
+#define LOG_MODULE "dhub-shutdown"
+#include "log.h"
+
+#define NS_PER_MS UINT64_C(1000000)
+
+static void on_deadline(uv_timer_t *handle);
+
+static void arm_deadline(dhub_state_t *dhub) {
+  dhub_shutdown_t *s = &dhub->shutdown;
+  if (s->timeout_ms == 0)
+    return;
+
+  // Earliest unload start among modules still unloading.
+  uint64_t first = UINT64_MAX;
+  dhub_registry_foreach(&dhub->modules, it) {
+    if (it->state == DHUB_MODULE_UNLOADING && it->unload_start < first)
+      first = it->unload_start;
+  }
+  if (first == UINT64_MAX)
+    return;
+
+  uint64_t deadline = first + s->timeout_ms * NS_PER_MS;
+  uint64_t now = uv_hrtime();
+  uint64_t timeout = deadline > now ? (deadline - now) / NS_PER_MS + 1 : 0;
+  uv_timer_start(&s->deadline, on_deadline, timeout, 0);
+}
+
+static void finish(dhub_state_t *dhub) {
+  dhub_shutdown_t *s = &dhub->shutdown;
+  s->done = true;
+  s->stats.duration_ns = uv_hrtime() - s->start;
+  LOG_INFO("all modules unloaded in %.3f ms",
+           (double)s->stats.duration_ns / NS_PER_MS);
+
+  uv_timer_stop(&s->deadline);
+  uv_close((uv_handle_t *)&s->deadline, NULL);
+
+  // Stop D-Bus dispatch.
+  dhub_context_close(&dhub->ctx);
+
+  // Handles of force closed modules keep the loop alive.
+  if (s->stats.forced > 0)
+    uv_stop(&dhub->loop);
+}
+
+static void force_close(dhub_state_t *dhub, dhub_module_t *module) {
+  // Module code may still be referenced by its handles or offloaded calls, so
+  // its library is intentionally left open.
+  dhub_shutdown_module_closed(dhub, module, true);
+  if (module->host != NULL)
+    dhub_host_kill(module->host);
+  free(module->lib);
+  dhub_registry_remove(&dhub->modules, module);
+}
+
+static void on_deadline(uv_timer_t *handle) {
+  dhub_state_t *dhub = handle->data;
+  dhub_shutdown_t *s = &dhub->shutdown;
+  uint64_t now = uv_hrtime();
+
+  // Offloaded calls are still running modules code, modules were never
+  // unloaded.
+  if (dhub->ctx.offload.pending > 0 && !s->offloads_expired) {
+    LOG_WARN("%" PRIu64 " offloaded method calls didn't complete within %u "
+             "ms, forcing modules closed",
+             dhub->ctx.offload.pending, s->timeout_ms);
+    s->offloads_expired = true;
+    dhub_registry_foreach(&dhub->modules, it) {
+      if (it->state != DHUB_MODULE_LOADED)
+        continue;
+
+      it->state = DHUB_MODULE_UNLOADING;
+      it->unload_start = s->start;
+      dhub->modules.loaded--;
+      force_close(dhub, it);
+    }
+  }
+
+  dhub_registry_foreach(&dhub->modules, it) {
+    if (it->state != DHUB_MODULE_UNLOADING ||
+        now - it->unload_start < s->timeout_ms * NS_PER_MS)
+      continue;
+
+    LOG_WARN("module '%s' didn't close within %u ms, forcing it closed",
+             it->name, s->timeout_ms);
+    force_close(dhub, it);
+  }
+
+  dhub_shutdown_check(dhub);
+}
+
+void dhub_shutdown_start(dhub_state_t *dhub) {
+  dhub_shutdown_t *s = &dhub->shutdown;
+  if (s->stopping)
+    return;
+
+  s->stopping = true;
+  s->start = uv_hrtime();
+  dhub_idle_close(dhub);
+  dhub_control_close(dhub);
+  dhub_stats_unexport(dhub);
+  s->timeout_ms = dhub->config.unload_timeout_ms;
+  s->deadline.data = dhub;
+  UV_MUST(uv_timer_init(&dhub->loop, &s->deadline),
+          "failed to initialize shutdown deadline timer");
+
+  // Offloaded calls are awaited before modules are unloaded, within the same
+  // deadline.
+  if (s->timeout_ms > 0)
+    uv_timer_start(&s->deadline, on_deadline, s->timeout_ms, 0);
+
+  dhub_shutdown_check(dhub);
+}
+
+void dhub_shutdown_check(dhub_state_t *dhub) {
+  dhub_shutdown_t *s = &dhub->shutdown;
+  // Modules closing synchronously from unload() re-enter here.
+  if (!s->stopping || s->checking || s->done)
+    return;
+
+  // Wait for offloaded method calls, their completion runs module code. Those
+  // of threaded modules are awaited by their thread before unload().
+  if (dhub->ctx.offload.pending > 0 && !s->offloads_expired) {
+    LOG_DBG("waiting for %" PRIu64 " offloaded method calls...",
+            dhub->ctx.offload.pending);
+    return;
+  }
+
+  s->checking = true;
+
+  // Complete deferred method calls before their modules go away.
+  dhub_calls_drop_all(&dhub->ctx);
+
+  // Unload modules.
+  if (dhub->modules.loaded > 0) {
+    dhub_registry_foreach(&dhub->modules, it) {
+      if (it->state == DHUB_MODULE_LOADED || it->state == DHUB_MODULE_LAZY)
+        dhub_unload(dhub, it->name);
+    }
+  }
+
+  s->checking = false;
+
+  if (dhub->modules.length == 0)
+    finish(dhub);
+  else
+    arm_deadline(dhub);
+}
+
+void dhub_shutdown_module_closed(dhub_state_t *dhub, dhub_module_t *module,
+                                 bool forced) {
+  uint64_t elapsed = uv_hrtime() - module->unload_start;
+  LOG_INFO("module '%s' %s in %.3f ms", module->name,
+           forced ? "force closed" : "unloaded", (double)elapsed / NS_PER_MS);
+
+  dhub_shutdown_t *s = &dhub->shutdown;
+  if (!s->stopping)
+    return;
+
+  s->stats.modules++;
+  s->stats.total_ns += elapsed;
+  if (elapsed > s->stats.max_ns)
+    s->stats.max_ns = elapsed;
+  if (forced)
+    s->stats.forced++;
+}
+
+void dhub_shutdown_log_stats(dhub_state_t *dhub) {
+  dhub_shutdown_stats_t *s = &dhub->shutdown.stats;
+  if (!dhub->shutdown.stopping)
+    return;
+
+  LOG_INFO("shutdown: timeout=%ums modules=%" PRIu64 " forced=%" PRIu64
+           " total=%.3fms max=%.3fms duration=%.3fms",
+           dhub->shutdown.timeout_ms, s->modules, s->forced,
+           (double)s->total_ns / NS_PER_MS, (double)s->max_ns / NS_PER_MS,
+           (double)s->duration_ns / NS_PER_MS);
+}
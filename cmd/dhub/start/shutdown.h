@@ -0,0 +1,50 @@
+#ifndef HUB_SHUTDOWN_H_INCLUDE
+#define HUB_SHUTDOWN_H_INCLUDE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <uv.h>
+
+#ifndef DHUB_UNLOAD_TIMEOUT_MS
+#define DHUB_UNLOAD_TIMEOUT_MS 5000
+#endif
+
+struct dhub_state;
+struct dhub_module;
+
+typedef struct dhub_shutdown_stats {
+  // Number of modules closed during shutdown, forced ones included.
+  uint64_t modules;
+  uint64_t forced;
+  // Module unload durations, from unload() call to dhub_close().
+  uint64_t total_ns;
+  uint64_t max_ns;
+  // Whole shutdown duration.
+  uint64_t duration_ns;
+} dhub_shutdown_stats_t;
+
+/**
+ * Shutdown sequence. It is driven by completion events (offloaded calls
+ * completion and module dhub_close()) and a deadline timer that force closes
+ * modules that didn't close within `timeout_ms`, or all of them if offloaded
+ * calls didn't complete within `timeout_ms` of shutdown start.
+ */
+typedef struct dhub_shutdown {
+  unsigned int timeout_ms;
+  bool stopping;
+  bool checking;
+  bool done;
+  // Offloaded calls missed the deadline, they are no longer awaited.
+  bool offloads_expired;
+  uint64_t start;
+  uv_timer_t deadline;
+  dhub_shutdown_stats_t stats;
+} dhub_shutdown_t;
+
+void dhub_shutdown_start(struct dhub_state *dhub);
+void dhub_shutdown_check(struct dhub_state *dhub);
+void dhub_shutdown_module_closed(struct dhub_state *dhub,
+                                 struct dhub_module *module, bool forced);
+void dhub_shutdown_log_stats(struct dhub_state *dhub);
+
+#endif
@@ -1,42 +1,30 @@
+#include <fcntl.h>
+#include <unistd.h>
 #include <uv.h>
 
+#include "binlog.h"
 #include "debug.h"
+#include "start/builtins.h"
+#include "start/control.h"
+#include "start/host.h"
+#include "start/preload.h"
 #include "start/state.h"
-#include "tllist.h"
+#include "start/thread.h"
+#include "trace.h"
 #define LOG_MODULE "dhub-start"
 #include "log.h"
 
 void dhub_start(dhub_state_t *dhub) {
-  // Load power_udev module.
-  const char *err_msg = NULL;
-  char *modname = "power_udev";
-  if (dhub_load(dhub, modname, &err_msg) == -1) {
-    LOG_FATAL("failed to load '%s' module: %s", modname, err_msg);
-  }
+  // Open configured modules in parallel, they're loaded once all are opened.
+  dhub_preload(dhub);
 
   LOG_INFO("starting event loop");
-  while (uv_loop_alive(&dhub->loop))
+  while (uv_loop_alive(&dhub->loop)) {
     uv_run(&dhub->loop, UV_RUN_DEFAULT);
-}
-
-void dhub_stop(uv_idle_t *handle) {
-  dhub_state_t *dhub = handle->data;
-
-  // Unload modules.
-  tll_foreach(dhub->modules, it) {
-    if (it->item.state != DHUB_MODULE_UNLOADING)
-      dhub_unload(dhub, it->item.name);
-  }
 
-  // All modules have been unloaded.
-  if (tll_length(dhub->modules) == 0) {
-    // Stop and close D-Bus poll handle.
-    uv_poll_stop(&dhub->bus_poll);
-    uv_close((uv_handle_t *)&dhub->bus_poll, NULL);
-
-    // Close dhub_stop idle handle.
-    uv_idle_stop(handle);
-    uv_close((uv_handle_t *)handle, NULL);
+    // Loop was stopped with handles of force closed modules still open.
+    if (dhub->shutdown.done)
+      break;
   }
 }
 
@@ -47,30 +35,15 @@ static void on_sigint(uv_signal_t *handle, int signum) {
     uv_close((uv_handle_t *)handle, NULL);
 
     // Start stop sequence.
-    dhub_state_t *dhub = handle->loop->data;
-    dhub->stop_idler.data = dhub;
-    uv_idle_init(handle->loop, &dhub->stop_idler);
-    uv_idle_start(&dhub->stop_idler, dhub_stop);
+    dhub_context_t *ctx = handle->loop->data;
+    dhub_shutdown_start(ctx->dhub);
   }
 }
 
-static void on_dbus_event(uv_poll_t *handle, int status, int events) {
-  (void)handle;
-  dhub_state_t *dhub = handle->loop->data;
-  LOG_DBG("dbus event status=%d events=%d", status, events);
-  int r = 1;
-  while (r > 0) {
-    r = sd_bus_process(dhub->bus, NULL);
-    LOG_DBG("dbus process r=%d", r);
-  }
-  if (r < 0)
-    NEG_MUST(r, "failed to process dbus messages");
-}
-
 void dhub_init(dhub_state_t *dhub) {
   // Setup loop.
-  dhub->loop.data = dhub;
   UV_MUST(uv_loop_init(&dhub->loop), "failed to init libuv loop");
+  trace_thread_init("dhub");
 
   // Setup signal handler.
   uv_signal_init(&dhub->loop, &dhub->sig);
@@ -78,13 +51,10 @@ void dhub_init(dhub_state_t *dhub) {
 
   // Setup D-Bus.
   NEG_MUST(sd_bus_open_user(&dhub->bus), "failed to connect to session bus");
-  int fd = sd_bus_get_fd(dhub->bus);
-  if (fd < 0) {
-    NEG_MUST(fd, "failed to retrieve D-BUS file descriptor");
-  }
-  UV_MUST(uv_poll_init(&dhub->loop, &dhub->bus_poll, fd),
-          "failed to initialize poll handle for DBUS file descriptor");
-  uv_poll_start(&dhub->bus_poll, UV_READABLE, on_dbus_event);
+  dhub_context_init(&dhub->ctx, dhub, &dhub->loop, dhub->bus);
+  dhub_idle_init(dhub);
+  dhub_control_init(dhub);
+  dhub_stats_export(dhub);
 
   char *name = "dev.negrel.dhub";
   NEG_MUST(sd_bus_request_name(dhub->bus, name, 0),
@@ -103,9 +73,25 @@ static void print_handle_info(uv_handle_t *handle, void *arg) {
 }
 
 void dhub_deinit(dhub_state_t *dhub) {
+  dhub_context_deinit(&dhub->ctx);
+  dhub_shutdown_log_stats(dhub);
+  dhub_idle_log_stats(dhub);
+  dhub_registry_deinit(&dhub->modules);
+  dhub_replay_deinit(dhub);
+  dhub_config_deinit(&dhub->config);
+
+  tll_foreach(dhub->retired, it) {
+    uv_dlclose(it->item);
+    free(it->item);
+    tll_remove(dhub->retired, it);
+    binlog_forget_strings();
+  }
+
   NEG_TRY(sd_bus_flush(dhub->bus), "failed to flush D-BUS");
   sd_bus_close(dhub->bus);
   sd_bus_unref(dhub->bus);
+  dhub_stats_deinit(&dhub->ctx);
+  dhub_budget_deinit(&dhub->ctx);
 
   int r = uv_loop_close(&dhub->loop);
   if (r == UV_EBUSY)
@@ -113,9 +99,11 @@ void dhub_deinit(dhub_state_t *dhub) {
   UV_TRY(r, "failed to close event loop")
 }
 
-sd_bus *dhub_bus(dhub_state_t *state) { return state->bus; }
+sd_bus *dhub_bus(dhub_state_t *state) { return dhub_context(state)->bus; }
 
-uv_loop_t *dhub_loop(dhub_state_t *state) { return &state->loop; }
+uv_loop_t *dhub_loop(dhub_state_t *state) {
+  return dhub_context(state)->loop;
+}
 
 static uv_lib_t *load_module(const char *modname, const char **err) {
   uv_lib_t *lib = calloc(1, sizeof(*lib));
@@ -161,60 +149,498 @@ err:
   return NULL;
 }
 
-int dhub_load(dhub_state_t *dhub, const char *modname, const char **err) {
-  LOG_INFO("trying to load module '%s'...", modname);
-  char *err_msg = NULL;
+static void close_lib(uv_lib_t *lib) {
+  // Builtin modules have no library.
+  if (lib == NULL)
+    return;
 
-  tll_foreach(dhub->modules, it) {
-    if (strcmp(it->item.name, modname) == 0 &&
-        it->item.state == DHUB_MODULE_LOADED) {
-      LOG_INFO("module '%s' already loaded", modname);
-      return 0;
-    }
+  uv_dlclose(lib);
+  free(lib);
+
+  // Log strings of module may be unmapped.
+  binlog_forget_strings();
+}
+
+static const dhub_module_desc_t *find_builtin(const char *modname) {
+  for (const dhub_module_desc_t *const *desc = dhub_builtin_modules;
+       *desc != NULL; desc++) {
+    if (strcmp((*desc)->name, modname) == 0)
+      return *desc;
+  }
+
+  return NULL;
+}
+
+static int check_desc(const char *modname, const dhub_module_desc_t *desc,
+                      const char **err) {
+  if (desc->abi_version < DHUB_MODULE_ABI_VERSION_MIN ||
+      desc->abi_version > DHUB_MODULE_ABI_VERSION) {
+    LOG_ERR("module '%s' ABI version %u isn't supported (expected %u to %u)",
+            modname, desc->abi_version, DHUB_MODULE_ABI_VERSION_MIN,
+            DHUB_MODULE_ABI_VERSION);
+    *err = "unsupported module ABI version";
+    return -1;
+  }
+
+  if (desc->load == NULL || desc->unload == NULL) {
+    LOG_ERR("module '%s' descriptor has no load or unload function", modname);
+    *err = "module has no load or unload function";
+    return -1;
+  }
+
+  if (desc->name == NULL || strcmp(desc->name, modname) != 0) {
+    LOG_WARN("module '%s' descriptor is named '%s'", modname,
+             desc->name != NULL ? desc->name : "(null)");
+  }
+
+  return 0;
+}
+
+int dhub_module_resolve(const char *modname, dhub_module_lib_t *mod,
+                        const char **err) {
+  *mod = (dhub_module_lib_t){0};
+
+  // Builtin modules don't need dlopen nor relocations.
+  const dhub_module_desc_t *desc = find_builtin(modname);
+  if (desc != NULL) {
+    LOG_INFO("module '%s' is builtin", modname);
+    mod->desc = desc;
+    return 0;
   }
 
   uv_lib_t *lib = load_module(modname, err);
   if (lib == NULL)
     return -1;
 
-  load_fn_t load = NULL;
-  unload_fn_t unload = NULL;
-
-  if (uv_dlsym(lib, "load", (void **)&load) == -1) {
-    LOG_ERR("load function not found");
-    err_msg = "load function not found";
+  if (uv_dlsym(lib, "dhub_module", (void **)&desc) == -1) {
+    LOG_ERR("module '%s' has no descriptor: %s", modname, uv_dlerror(lib));
+    *err = "module descriptor not found";
     goto err;
   }
 
-  if (uv_dlsym(lib, "unload", (void **)&unload) == -1) {
-    LOG_ERR("unload function not found");
-    err_msg = "unload function not found";
+  if (check_desc(modname, desc, err) == -1)
     goto err;
+
+  mod->lib = lib;
+  mod->desc = desc;
+  return 0;
+
+err:
+  close_lib(lib);
+  return -1;
+}
+
+void dhub_module_lib_close(dhub_module_lib_t *mod) {
+  close_lib(mod->lib);
+  *mod = (dhub_module_lib_t){0};
+}
+
+// Returns 1 if module can be loaded, 0 if it is already loaded and -1 if it
+// is being loaded or unloaded.
+static int check_loadable(dhub_state_t *dhub, const char *modname,
+                          const char **err) {
+  dhub_module_t *module = dhub_registry_find(&dhub->modules, modname);
+  if (module == NULL)
+    return 1;
+
+  if (module->state == DHUB_MODULE_LOADED ||
+      module->state == DHUB_MODULE_LAZY) {
+    LOG_INFO("module '%s' already loaded", modname);
+    return 0;
   }
 
+  LOG_ERR("module '%s' is being loaded or unloaded", modname);
+  if (err != NULL)
+    *err = "module is being loaded or unloaded";
+  return -1;
+}
+
+// Calls load() of a module in DHUB_MODULE_LOADING state. Module is removed
+// on failure.
+static int module_load(dhub_state_t *dhub, dhub_handle_t handle,
+                       const char **err) {
+  dhub_module_t *module = dhub_registry_get(&dhub->modules, handle);
+  const char *name = module->name;
+  load_fn_t load = module->load;
+  unload_fn_t unload = module->unload;
+
   void *data = NULL;
-  int code = load(dhub, &data);
+  dhub_thread_t *thread = NULL;
+  int code = 0;
+  if (module->flags & DHUB_MODULE_THREADED) {
+    thread = dhub_thread_load(dhub, name, (void *)handle, load, unload, &code);
+    if (thread != NULL)
+      data = thread->data;
+  } else {
+    uint64_t start = dhub_trace_begin();
+    dhub_module_time_t *mt = dhub_budget_module(&dhub->ctx, name);
+    dhub_budget_scope_t scope;
+    dhub_budget_enter(&dhub->ctx, &scope, mt);
+    code = load(dhub, &data);
+    uint64_t elapsed = dhub_budget_leave(&dhub->ctx, &scope);
+    // Module name may be freed before iteration ends, accounting one isn't.
+    dhub_lag_note(&dhub->ctx, elapsed, mt != NULL ? mt->module : NULL,
+                  "load()", NULL);
+    dhub_trace_end(start, "module", "load", "%s", name);
+  }
+
+  // Registry slots may have moved if load() loaded other modules.
+  module = dhub_registry_get(&dhub->modules, handle);
   if (code != 0) {
     LOG_ERR(
         "failed to load '%s' module: load() returned non zero exit code (%d)",
-        modname, code);
-    err_msg = "module 'load' function failed";
+        name, code);
+    close_lib(module->lib);
+    dhub_registry_remove(&dhub->modules, module);
+    if (err != NULL)
+      *err = "module 'load' function failed";
+    return -1;
+  }
+
+  module->data = data;
+  module->thread = thread;
+  module->state = DHUB_MODULE_LOADED;
+  module->last_activity = uv_now(&dhub->loop);
+  dhub->modules.loaded++;
+
+  if ((module->flags & DHUB_MODULE_IDLE_UNLOAD) &&
+      (module->object_prefix == NULL || thread != NULL)) {
+    LOG_WARN("module '%s' can't be unloaded when idle, it must export its "
+             "object prefix and must not be threaded",
+             name);
+  }
+
+  LOG_INFO("module '%s' loaded", name);
+  return 1;
+}
+
+static int lazy_activate(dhub_state_t *dhub, dhub_module_t *module,
+                         const char **err) {
+  LOG_INFO("activating lazy module '%s'...", module->name);
+
+  module->lazy_slot = sd_bus_slot_unref(module->lazy_slot);
+  module->state = DHUB_MODULE_LOADING;
+  dhub->modules.loaded--;
+
+  return module_load(dhub, dhub_registry_handle(&dhub->modules, module), err);
+}
+
+bool dhub_path_has_prefix(const char *path, const char *prefix) {
+  size_t len = strlen(prefix);
+  return strncmp(path, prefix, len) == 0 &&
+         (path[len] == '\0' || path[len] == '/');
+}
+
+static int on_lazy_call(sd_bus_message *m, void *userdata,
+                        sd_bus_error *ret_error) {
+  dhub_state_t *dhub = userdata;
+  const char *path = sd_bus_message_get_path(m);
+
+  // Find lazy module with the longest prefix matching message path.
+  dhub_module_t *module = NULL;
+  size_t module_prefix_len = 0;
+  dhub_registry_foreach(&dhub->modules, it) {
+    if (it->state != DHUB_MODULE_LAZY ||
+        !dhub_path_has_prefix(path, it->object_prefix))
+      continue;
+
+    size_t len = strlen(it->object_prefix);
+    if (len > module_prefix_len) {
+      module = it;
+      module_prefix_len = len;
+    }
+  }
+  if (module == NULL)
+    return 0;
+
+  const char *err_msg = NULL;
+  if (lazy_activate(dhub, module, &err_msg) == -1) {
+    return sd_bus_error_setf(ret_error, SD_BUS_ERROR_FAILED,
+                             "failed to activate module: %s", err_msg);
+  }
+
+  // Module added its objects and our fallback is gone, sd-bus dispatches
+  // message again.
+  return 0;
+}
+
+// Puts module in DHUB_MODULE_LAZY state.
+static int lazy_arm(dhub_state_t *dhub, dhub_module_t *module) {
+  int r = sd_bus_add_fallback(dhub->bus, &module->lazy_slot,
+                              module->object_prefix, on_lazy_call, dhub);
+  if (r < 0) {
+    LOG_ERR("failed to add '%s' module lazy activation handler: %s",
+            module->name, strerror(-r));
+    return -1;
+  }
+
+  module->state = DHUB_MODULE_LAZY;
+  dhub->modules.loaded++;
+  LOG_INFO("module '%s' will be loaded on first call to '%s'", module->name,
+           module->object_prefix);
+  return 0;
+}
+
+int dhub_load_resolved(dhub_state_t *dhub, const char *modname,
+                       dhub_module_lib_t *mod, bool lazy, const char **err) {
+  int r = check_loadable(dhub, modname, err);
+  if (r != 1) {
+    dhub_module_lib_close(mod);
+    return r;
+  }
+
+  const dhub_module_desc_t *desc = mod->desc;
+  if (lazy && desc->object_prefix == NULL) {
+    LOG_WARN("module '%s' has no object prefix, it can't be lazily loaded",
+             modname);
+    lazy = false;
+  } else if (lazy && (desc->flags & DHUB_MODULE_THREADED)) {
+    LOG_WARN("module '%s' is threaded, it can't be lazily loaded", modname);
+    lazy = false;
+  }
+
+  dhub_module_t *module = dhub_registry_add(&dhub->modules, modname);
+  module->lib = mod->lib;
+  module->desc = desc;
+  module->load = desc->load;
+  module->unload = desc->unload;
+  module->flags = desc->flags;
+  module->object_prefix = desc->object_prefix;
+  module->state = DHUB_MODULE_LOADING;
+  *mod = (dhub_module_lib_t){0};
+  dhub_idle_reindex(dhub);
+
+  if (lazy && lazy_arm(dhub, module) == 0)
+    return 1;
+
+  return module_load(dhub, dhub_registry_handle(&dhub->modules, module), err);
+}
+
+int dhub_load(dhub_state_t *dhub, const char *modname, const char **err) {
+  LOG_INFO("trying to load module '%s'...", modname);
+
+  dhub_module_t *module = dhub_registry_find(&dhub->modules, modname);
+  if (module != NULL && module->state == DHUB_MODULE_LAZY)
+    return lazy_activate(dhub, module, err);
+
+  int r = check_loadable(dhub, modname, err);
+  if (r != 1)
+    return r;
+
+  dhub_module_lib_t mod = {0};
+  const char *err_msg = NULL;
+  if (dhub_module_resolve(modname, &mod, &err_msg) == -1) {
+    if (err != NULL)
+      *err = err_msg;
+    return -1;
+  }
+
+  return dhub_load_resolved(dhub, modname, &mod, false, err);
+}
+
+int dhub_load_isolated(dhub_state_t *dhub, const char *modname,
+                       const char **err) {
+  LOG_INFO("trying to load module '%s' in a host process...", modname);
+
+  int r = check_loadable(dhub, modname, err);
+  if (r != 1)
+    return r;
+
+  dhub_module_t *module = dhub_registry_add(&dhub->modules, modname);
+  module->state = DHUB_MODULE_LOADING;
+  dhub_handle_t handle = dhub_registry_handle(&dhub->modules, module);
+  dhub_host_t *host = dhub_host_spawn(dhub, handle, modname, err);
+
+  module = dhub_registry_get(&dhub->modules, handle);
+  if (host == NULL) {
+    dhub_registry_remove(&dhub->modules, module);
+    return -1;
+  }
+
+  // Host unloads module on request even if its load() didn't return yet.
+  module->host = host;
+  module->state = DHUB_MODULE_LOADED;
+  module->last_activity = uv_now(&dhub->loop);
+  dhub->modules.loaded++;
+  return 1;
+}
+
+// Opens a new copy of module library. Dynamic loader returns already loaded
+// library when opening the same path again, so it is opened through a
+// /proc/self/fd/ path instead. It still returns the loaded one if file wasn't
+// replaced.
+static uv_lib_t *reopen_module(const char *modname, const char **err) {
+  const char *dirs[] = {MODDIR, getenv("DHUB_MODULES_DIR")};
+
+  for (size_t i = 0; i < sizeof(dirs) / sizeof(*dirs); i++) {
+    if (dirs[i] == NULL)
+      continue;
+
+    char *path = NULL;
+    if (asprintf(&path, "%s/%s.so", dirs[i], modname) == -1)
+      LOG_FATAL("failed to allocate module path");
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      free(path);
+      continue;
+    }
+
+    char *fd_path = NULL;
+    if (asprintf(&fd_path, "/proc/self/fd/%d", fd) == -1)
+      LOG_FATAL("failed to allocate module path");
+
+    uv_lib_t *lib = calloc(1, sizeof(*lib));
+    LOG_DBG("dlopen '%s' (%s)...", path, fd_path);
+    int r = uv_dlopen(fd_path, lib);
+    close(fd);
+    free(fd_path);
+    free(path);
+
+    if (r == -1) {
+      *err = uv_dlerror(lib);
+      free(lib);
+      return NULL;
+    }
+
+    return lib;
+  }
+
+  *err = "module library not found";
+  return NULL;
+}
+
+int dhub_reload(dhub_state_t *dhub, const char *modname, const char **err) {
+  LOG_INFO("trying to reload module '%s'...", modname);
+  uint64_t start = uv_hrtime();
+  const char *err_msg = NULL;
+  uv_lib_t *lib = NULL;
+
+  dhub_module_t *module = dhub_registry_find(&dhub->modules, modname);
+  if (module == NULL ||
+      (module->state != DHUB_MODULE_LOADED &&
+       module->state != DHUB_MODULE_LAZY)) {
+    err_msg = "module isn't loaded";
+    goto err;
+  }
+  if (dhub->shutdown.stopping) {
+    err_msg = "D-Hub is stopping";
+    goto err;
+  }
+  if (module->host != NULL) {
+    err_msg = "isolated modules can't be reloaded";
+    goto err;
+  }
+  if (module->lib == NULL) {
+    err_msg = "builtin modules can't be reloaded";
+    goto err;
+  }
+  if (module->thread != NULL) {
+    err_msg = "threaded modules can't be reloaded";
+    goto err;
+  }
+
+  lib = reopen_module(modname, &err_msg);
+  if (lib == NULL)
+    goto err;
+
+  const dhub_module_desc_t *desc = NULL;
+  if (uv_dlsym(lib, "dhub_module", (void **)&desc) == -1) {
+    err_msg = "module descriptor not found";
+    goto err;
+  }
+  if (check_desc(modname, desc, &err_msg) == -1)
+    goto err;
+  if (desc == module->desc) {
+    err_msg = "module library didn't change";
     goto err;
   }
 
-  tll_push_back(dhub->modules, ((dhub_module_t){
-                                   .name = strdup(modname),
-                                   .lib = lib,
-                                   .data = data,
-                                   .load = load,
-                                   .unload = unload,
-                                   .state = DHUB_MODULE_LOADED,
-                               }));
+  // Module was never loaded, simply swap libraries.
+  if (module->state == DHUB_MODULE_LAZY) {
+    module->lazy_slot = sd_bus_slot_unref(module->lazy_slot);
+    dhub->modules.loaded--;
+    close_lib(module->lib);
+  } else {
+    int (*save)(dhub_state_t *, void *, void **, size_t *) =
+        module->desc->abi_version >= 2 ? module->desc->save : NULL;
+    int (*restore)(dhub_state_t *, void **, const void *, size_t) =
+        desc->abi_version >= 2 ? desc->restore : NULL;
+    if (save == NULL || restore == NULL) {
+      err_msg = "module doesn't support hot reload";
+      goto err;
+    }
+
+    void *blob = NULL;
+    size_t size = 0;
+    if (save(dhub, module->data, &blob, &size) != 0) {
+      err_msg = "module failed to save its state";
+      goto err;
+    }
 
-  LOG_INFO("module '%s' loaded", modname);
+    // Vtables of new module are instrumented anew.
+    dhub_stats_module_closed(&dhub->ctx, modname);
+
+    // Handles restored by new module are charged to it.
+    void *data = NULL;
+    uint64_t start = dhub_trace_begin();
+    dhub_budget_scope_t scope;
+    dhub_budget_enter(&dhub->ctx, &scope,
+                      dhub_budget_module(&dhub->ctx, modname));
+    int code = restore(dhub, &data, blob, size);
+    dhub_budget_leave(&dhub->ctx, &scope);
+    dhub_trace_end(start, "module", "restore", "%s", modname);
+    if (code != 0) {
+      LOG_ERR("new '%s' module failed to restore state, rolling back...",
+              modname);
+      int (*rollback)(dhub_state_t *, void **, const void *, size_t) =
+          module->desc->abi_version >= 2 ? module->desc->restore : NULL;
+      if (rollback == NULL || rollback(dhub, &module->data, blob, size) != 0) {
+        LOG_ERR("old '%s' module failed to restore state, module is lost",
+                modname);
+        tll_push_back(dhub->retired, module->lib);
+        dhub->modules.loaded--;
+        dhub_registry_remove(&dhub->modules, module);
+      }
+      free(blob);
+      err_msg = "module failed to restore its state";
+      goto err;
+    }
+    free(blob);
+
+    // Old module callbacks may still run.
+    tll_push_back(dhub->retired, module->lib);
+    module->data = data;
+
+    // Reject tags of old module.
+    module->generation++;
+  }
+
+  module->lib = lib;
+  module->desc = desc;
+  module->load = desc->load;
+  module->unload = desc->unload;
+  module->flags = desc->flags;
+  module->object_prefix = desc->object_prefix;
+  dhub_idle_reindex(dhub);
+
+  if (module->state == DHUB_MODULE_LAZY) {
+    if (module->object_prefix == NULL || lazy_arm(dhub, module) == -1) {
+      // Load it now so it is reachable.
+      module->state = DHUB_MODULE_LOADING;
+      if (module_load(dhub, dhub_registry_handle(&dhub->modules, module),
+                      err) == -1)
+        return -1;
+    }
+  }
+
+  LOG_INFO("module '%s' reloaded in %.3f ms", modname,
+           (double)(uv_hrtime() - start) / 1e6);
   return 1;
 
 err:
+  LOG_ERR("failed to reload module '%s': %s", modname, err_msg);
+  close_lib(lib);
   if (err != NULL)
     *err = err_msg;
   return -1;
@@ -223,34 +649,95 @@ err:
 int dhub_unload(dhub_state_t *dhub, const char *modname) {
   LOG_INFO("trying to unload module '%s'...", modname);
 
-  tll_foreach(dhub->modules, it) {
-    if (strcmp(it->item.name, modname) == 0) {
-      if (it->item.state == DHUB_MODULE_UNLOADING) {
-        LOG_INFO("already unloading module '%s'...", modname);
-        return 0;
-      }
+  dhub_module_t *module = dhub_registry_find(&dhub->modules, modname);
+  if (module == NULL || module->state == DHUB_MODULE_LOADING) {
+    LOG_INFO("module '%s' wasn't loaded", modname);
+    return 0;
+  }
 
-      it->item.state = DHUB_MODULE_UNLOADING;
-      it->item.unload(dhub, it->item.data, it->item.lib);
-      // it->item might be deallocated now if unload() called dhub_close.
+  if (module->state == DHUB_MODULE_UNLOADING) {
+    LOG_INFO("already unloading module '%s'...", modname);
+    return 0;
+  }
 
-      return 1;
-    }
+  // Lazy module was never loaded, there is nothing to unload.
+  if (module->state == DHUB_MODULE_LAZY) {
+    module->lazy_slot = sd_bus_slot_unref(module->lazy_slot);
+    close_lib(module->lib);
+    dhub->modules.loaded--;
+    LOG_INFO("lazy module '%s' unloaded", modname);
+    dhub_registry_remove(&dhub->modules, module);
+    return 1;
   }
 
-  LOG_INFO("module '%s' wasn't loaded", modname);
-  return 0;
+  module->state = DHUB_MODULE_UNLOADING;
+  module->unload_start = uv_hrtime();
+  dhub->modules.loaded--;
+
+  if (module->thread != NULL) {
+    // Module is unloaded on its thread.
+    dhub_thread_unload(module->thread);
+    return 1;
+  }
+
+  if (module->host != NULL) {
+    // Module is closed once its host exited.
+    dhub_host_unload(module->host);
+    return 1;
+  }
+
+  dhub_handle_t handle = dhub_registry_handle(&dhub->modules, module);
+  uint64_t start = dhub_trace_begin();
+  dhub_module_time_t *mt = dhub_budget_module(&dhub->ctx, modname);
+  dhub_budget_scope_t scope;
+  dhub_budget_enter(&dhub->ctx, &scope, mt);
+  module->unload(dhub, module->data, (void *)handle);
+  // module might be deallocated now if unload() called dhub_close.
+  uint64_t elapsed = dhub_budget_leave(&dhub->ctx, &scope);
+  dhub_lag_note(&dhub->ctx, elapsed, mt != NULL ? mt->module : NULL,
+                "unload()", NULL);
+  dhub_trace_end(start, "module", "unload", "%s", modname);
+
+  return 1;
 }
 
 void dhub_close(dhub_state_t *dhub, void *tag) {
-  tll_foreach(dhub->modules, it) {
-    if (it->item.lib == tag && it->item.state == DHUB_MODULE_UNLOADING) {
-      uv_dlclose(it->item.lib);
-      free(it->item.lib);
-      LOG_INFO("module '%s' unloaded", it->item.name);
-      free((void *)it->item.name);
-
-      tll_remove(dhub->modules, it);
-    }
+  // Threaded module is closed on main thread once its thread exited.
+  dhub_thread_t *thread = dhub_thread_current();
+  if (thread != NULL) {
+    dhub_thread_close(thread);
+    return;
   }
+
+  dhub_module_t *module =
+      dhub_registry_get(&dhub->modules, (dhub_handle_t)tag);
+  if (module == NULL) {
+    LOG_WARN("dhub_close() called with a stale or invalid module tag");
+    return;
+  }
+
+  if (module->state != DHUB_MODULE_UNLOADING) {
+    LOG_WARN("dhub_close() called on module '%s' that isn't unloading",
+             module->name);
+    return;
+  }
+
+  dhub_stats_module_closed(&dhub->ctx, module->name);
+
+  if (module->idle_unloading) {
+    module->idle_unloading = false;
+    dhub_idle_module_closed(dhub, module);
+
+    // Keep library opened and load module again on next call.
+    if (!dhub->shutdown.stopping && lazy_arm(dhub, module) == 0)
+      return;
+  }
+
+  close_lib(module->lib);
+  dhub_shutdown_module_closed(dhub, module, false);
+
+  dhub_registry_remove(&dhub->modules, module);
+
+  // Continue stop sequence if we're stopping.
+  dhub_shutdown_check(dhub);
 }
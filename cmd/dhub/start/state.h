@@ -6,41 +6,138 @@
 #include <uv.h>
 
 #include "dhub.h"
-#include "tllist.h"
+#include "start/config.h"
+#include "start/context.h"
+#include "start/idle.h"
+#include "start/record.h"
+#include "start/registry.h"
+#include "start/shutdown.h"
 
 #ifndef MODDIR
 #define MODDIR "/etc/dhub/modules.d"
 #endif
 
 struct dhub_state;
+struct dhub_thread;
+struct dhub_host;
 typedef int (*load_fn_t)(struct dhub_state *, void **);
 typedef void (*unload_fn_t)(struct dhub_state *, void *, void *);
 
 enum dhub_module_state {
+  // Library is opened and load() is called on first D-Bus call to module
+  // object prefix.
+  DHUB_MODULE_LAZY,
+  DHUB_MODULE_LOADING,
   DHUB_MODULE_LOADED,
   DHUB_MODULE_UNLOADING,
 };
 
+/**
+ * Module registry entry. Modules linked into D-Hub binary and isolated modules
+ * have a NULL `lib`.
+ */
 typedef struct dhub_module {
+  // Registry slot fields.
+  bool used;
+  uint32_t hash;
+  uint32_t generation;
+  // Like generation but not bumped on hot reload, see
+  // dhub_registry_slot_handle().
+  uint32_t slot_generation;
+
   const char *name;
   uv_lib_t *lib;
+  const dhub_module_desc_t *desc;
   void *data;
   load_fn_t load;
   unload_fn_t unload;
+  unsigned int flags;
+  // D-Bus object path prefix served by module, NULL if it doesn't export one.
+  const char *object_prefix;
+  // Fallback handler activating DHUB_MODULE_LAZY modules.
+  sd_bus_slot *lazy_slot;
+  // uv_now() of last method call or signal on module objects.
+  uint64_t last_activity;
+  // Deferred and offloaded method calls on module objects awaiting a reply.
+  uint32_t inflight;
+  // Module is being unloaded because it was idle, it goes back to
+  // DHUB_MODULE_LAZY state once closed.
+  bool idle_unloading;
+  // Heap in use when idle unload started.
+  size_t heap_before;
+  // Thread of DHUB_MODULE_THREADED modules, NULL otherwise.
+  struct dhub_thread *thread;
+  // Host process of isolated modules, NULL otherwise.
+  struct dhub_host *host;
   enum dhub_module_state state;
+  // uv_hrtime() of unload() call.
+  uint64_t unload_start;
 } dhub_module_t;
 
+/**
+ * Resolved module descriptor and its library, NULL for builtin modules.
+ */
+typedef struct dhub_module_lib {
+  uv_lib_t *lib;
+  const dhub_module_desc_t *desc;
+} dhub_module_lib_t;
+
 typedef struct dhub_state {
+  dhub_config_t config;
   uv_loop_t loop;
   uv_signal_t sig;
   sd_bus *bus;
-  uv_poll_t bus_poll;
-  tll(dhub_module_t) modules;
-  uv_idle_t stop_idler;
+  dhub_context_t ctx;
+  dhub_registry_t modules;
+  dhub_shutdown_t shutdown;
+  dhub_idle_t idle;
+  // Libraries of hot reloaded modules, closed on exit.
+  tll(uv_lib_t *) retired;
+  // D-Hub control object.
+  sd_bus_slot *control_slot;
+  // SIGUSR1 handler dumping binary log.
+  uv_signal_t dump_sig;
+  // SIGUSR2 handler starting and stopping tracing.
+  uv_signal_t trace_sig;
+  // dev.negrel.dhub.Stats interface of control object.
+  sd_bus_slot *stats_slot;
+  // Handlers of events injected with InjectEvent, see dhub_replay_handler().
+  tll(dhub_replay_handler_t) replay_handlers;
 } dhub_state_t;
 
 void dhub_init(dhub_state_t *dhub);
 void dhub_start(dhub_state_t *dhub);
 void dhub_deinit(dhub_state_t *dhub);
 
+/**
+ * Returns true if object `path` is `prefix` or one of its descendants.
+ */
+bool dhub_path_has_prefix(const char *path, const char *prefix);
+
+/**
+ * Finds builtin module or opens module library and resolves its descriptor. It
+ * doesn't touch D-Hub state and can be called from any thread.
+ */
+int dhub_module_resolve(const char *modname, dhub_module_lib_t *mod,
+                        const char **err);
+void dhub_module_lib_close(dhub_module_lib_t *mod);
+
+/**
+ * Loads a resolved module, it takes ownership of module library. Returns 1 on
+ * success, 0 if module is already loaded and -1 on error.
+ *
+ * If `lazy` is true and module exports an object prefix, module load() is
+ * deferred until first D-Bus call to an object under its prefix.
+ */
+int dhub_load_resolved(dhub_state_t *dhub, const char *modname,
+                       dhub_module_lib_t *mod, bool lazy, const char **err);
+
+/**
+ * Loads module in a host process. Returns 1 once host is spawned, 0 if module
+ * is already loaded and -1 on error. Module load() runs asynchronously, its
+ * objects are reachable once it returned.
+ */
+int dhub_load_isolated(dhub_state_t *dhub, const char *modname,
+                       const char **err);
+
 #endif
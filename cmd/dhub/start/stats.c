@@ -0,0 +1,650 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "start/context.h"
+#include "start/control.h"
+#include "start/state.h"
+#include "start/stats.h"
+#include "start/thread.h"
+#define LOG_MODULE "dhub-stats"
+#include "log.h"
+
+// Object registered through dhub_add_object_vtable(), it is the userdata of
+// its D-Bus object.
+typedef struct dhub_object {
+  dhub_vtable_stats_t *vt;
+  void *userdata;
+} dhub_object_t;
+
+void dhub_stats_init(dhub_context_t *ctx) {
+  UV_MUST(uv_mutex_init(&ctx->stats.lock), "failed to initialize stats lock");
+}
+
+static void vtable_stats_free(dhub_vtable_stats_t *vt) {
+  for (size_t i = 0; i < vt->members_len; i++)
+    free((char *)vt->members[i].member);
+  free(vt->members);
+  free(vt->snapshot);
+  free(vt->vtable);
+  free(vt->module);
+  free(vt->iface);
+  free(vt);
+}
+
+static void rows_free(dhub_stats_rows_t *rows) {
+  tll_foreach(*rows, it) {
+    free((char *)it->item.module);
+    free((char *)it->item.iface);
+    free((char *)it->item.member);
+    tll_remove(*rows, it);
+  }
+}
+
+// Returns row of member, adding it if there is none.
+static dhub_stats_row_t *find_row(dhub_stats_rows_t *rows, const char *module,
+                                  const char *iface, const char *member,
+                                  char kind) {
+  tll_foreach(*rows, it) {
+    dhub_stats_row_t *row = &it->item;
+    if (row->kind == kind && strcmp(row->module, module) == 0 &&
+        strcmp(row->iface, iface) == 0 && strcmp(row->member, member) == 0)
+      return row;
+  }
+
+  dhub_stats_row_t row = {
+      .module = strdup(module),
+      .iface = strdup(iface),
+      .member = strdup(member),
+      .kind = kind,
+  };
+  if (row.module == NULL || row.iface == NULL || row.member == NULL) {
+    free((char *)row.module);
+    free((char *)row.iface);
+    free((char *)row.member);
+    return NULL;
+  }
+
+  tll_push_back(*rows, row);
+  return &tll_back(*rows);
+}
+
+static void row_add(dhub_stats_row_t *row, uint64_t calls, uint64_t errors,
+                    const histogram_t *latency) {
+  row->calls += calls;
+  row->errors += errors;
+  histogram_merge(&row->latency, latency);
+}
+
+// Moves statistics of vtable to retired rows and frees it, stats lock must be
+// held and vtable removed from list.
+static void vtable_stats_drop(dhub_stats_t *stats, dhub_vtable_stats_t *vt) {
+  for (size_t i = 0; i < vt->members_len; i++) {
+    dhub_member_stats_t *ms = &vt->members[i];
+    dhub_stats_row_t *row =
+        find_row(&stats->retired, vt->module, vt->iface, ms->member, ms->kind);
+    if (row != NULL)
+      row_add(row, ms->calls, ms->errors, &ms->latency);
+  }
+  // Vtable strings may be noted as longest callback.
+  dhub_lag_forget(vt->ctx);
+  vtable_stats_free(vt);
+}
+
+void dhub_stats_deinit(dhub_context_t *ctx) {
+  dhub_stats_t *stats = &ctx->stats;
+
+  tll_free_and_free(stats->vtables, vtable_stats_free);
+  rows_free(&stats->retired);
+  tll_foreach(stats->signals, it) {
+    free(it->item.module);
+    tll_remove(stats->signals, it);
+  }
+  uv_mutex_destroy(&stats->lock);
+}
+
+static dhub_member_stats_t *find_member(dhub_vtable_stats_t *vt, char kind,
+                                        const char *member) {
+  for (size_t i = 0; i < vt->members_len; i++) {
+    dhub_member_stats_t *ms = &vt->members[i];
+    if (ms->kind == kind && strcmp(ms->member, member) == 0)
+      return ms;
+  }
+
+  return NULL;
+}
+
+static void vtable_stats_unref(dhub_vtable_stats_t *vt) {
+  if (--vt->refs > 0 || !vt->retired)
+    return;
+
+  dhub_stats_t *stats = &vt->ctx->stats;
+  uv_mutex_lock(&stats->lock);
+  tll_foreach(stats->vtables, it) {
+    if (it->item == vt) {
+      tll_remove(stats->vtables, it);
+      break;
+    }
+  }
+  vtable_stats_drop(stats, vt);
+  uv_mutex_unlock(&stats->lock);
+}
+
+static void record(dhub_vtable_stats_t *vt, dhub_member_stats_t *ms,
+                   uint64_t elapsed, bool failed) {
+  dhub_lag_note(vt->ctx, elapsed, vt->owner != NULL ? vt->owner->module : NULL,
+                vt->iface, ms->member);
+
+  dhub_stats_t *stats = &vt->ctx->stats;
+  uv_mutex_lock(&stats->lock);
+  ms->calls++;
+  if (failed)
+    ms->errors++;
+  histogram_record(&ms->latency, elapsed);
+  uv_mutex_unlock(&stats->lock);
+}
+
+static int method_trampoline(sd_bus_message *m, void *userdata,
+                             sd_bus_error *ret_error) {
+  dhub_object_t *obj = userdata;
+  // Handler may remove object, freeing `obj`. Its vtable is referenced until
+  // handler returns.
+  dhub_vtable_stats_t *vt = obj->vt;
+  dhub_member_stats_t *ms = find_member(vt, _SD_BUS_VTABLE_METHOD,
+                                        sd_bus_message_get_member(m));
+  if (ms == NULL)
+    return -EINVAL;
+
+  const sd_bus_vtable *entry = ms->entry;
+  vt->refs++;
+  uint64_t start = dhub_trace_begin();
+  if (start != 0)
+    dhub_dispatch_trace_message(vt->ctx, sd_bus_message_get_bus(m));
+  dhub_budget_scope_t scope;
+  dhub_budget_enter(vt->ctx, &scope, vt->owner);
+  int r = entry->x.method.handler(
+      m, (uint8_t *)obj->userdata + entry->x.method.offset, ret_error);
+  uint64_t elapsed = dhub_budget_leave(vt->ctx, &scope);
+  record(vt, ms, elapsed, r < 0 || sd_bus_error_is_set(ret_error));
+  dhub_trace_end(start, "method", ms->member, "%s %s",
+                 sd_bus_message_get_path(m), vt->iface);
+  vtable_stats_unref(vt);
+  return r;
+}
+
+static int getter_trampoline(sd_bus *bus, const char *path, const char *iface,
+                             const char *property, sd_bus_message *reply,
+                             void *userdata, sd_bus_error *ret_error) {
+  dhub_object_t *obj = userdata;
+  dhub_vtable_stats_t *vt = obj->vt;
+  dhub_member_stats_t *ms = find_member(vt, _SD_BUS_VTABLE_PROPERTY, property);
+  if (ms == NULL)
+    return -EINVAL;
+
+  const sd_bus_vtable *entry = ms->entry;
+  vt->refs++;
+  uint64_t start = dhub_trace_begin();
+  if (start != 0)
+    dhub_dispatch_trace_message(vt->ctx, bus);
+  dhub_budget_scope_t scope;
+  dhub_budget_enter(vt->ctx, &scope, vt->owner);
+  int r = entry->x.property.get(
+      bus, path, iface, property, reply,
+      (uint8_t *)obj->userdata + entry->x.property.offset, ret_error);
+  uint64_t elapsed = dhub_budget_leave(vt->ctx, &scope);
+  record(vt, ms, elapsed, r < 0 || sd_bus_error_is_set(ret_error));
+  dhub_trace_end(start, "get", property, "%s %s", path, iface);
+  vtable_stats_unref(vt);
+  return r;
+}
+
+static int setter_trampoline(sd_bus *bus, const char *path, const char *iface,
+                             const char *property, sd_bus_message *value,
+                             void *userdata, sd_bus_error *ret_error) {
+  dhub_object_t *obj = userdata;
+  dhub_vtable_stats_t *vt = obj->vt;
+  dhub_member_stats_t *ms =
+      find_member(vt, _SD_BUS_VTABLE_WRITABLE_PROPERTY, property);
+  if (ms == NULL)
+    return -EINVAL;
+
+  const sd_bus_vtable *entry = ms->entry;
+  vt->refs++;
+  uint64_t start = dhub_trace_begin();
+  if (start != 0)
+    dhub_dispatch_trace_message(vt->ctx, bus);
+  dhub_budget_scope_t scope;
+  dhub_budget_enter(vt->ctx, &scope, vt->owner);
+  int r = entry->x.property.set(
+      bus, path, iface, property, value,
+      (uint8_t *)obj->userdata + entry->x.property.offset, ret_error);
+  uint64_t elapsed = dhub_budget_leave(vt->ctx, &scope);
+  record(vt, ms, elapsed, r < 0 || sd_bus_error_is_set(ret_error));
+  dhub_trace_end(start, "set", property, "%s %s", path, iface);
+  vtable_stats_unref(vt);
+  return r;
+}
+
+static bool add_member(dhub_vtable_stats_t *vt, char kind,
+                       const sd_bus_vtable *entry) {
+  const char *member = kind == _SD_BUS_VTABLE_METHOD ? entry->x.method.member
+                                                     : entry->x.property.member;
+  char *name = strdup(member);
+  if (name == NULL)
+    return false;
+
+  vt->members[vt->members_len++] = (dhub_member_stats_t){
+      .kind = kind,
+      .member = name,
+      .entry = entry,
+  };
+  return true;
+}
+
+// Builds instrumented copy of `vtable`. It returns NULL if vtable can't be
+// instrumented: properties read or written by sd-bus directly, without
+// getter or setter, expect original userdata.
+static dhub_vtable_stats_t *vtable_stats_new(dhub_context_t *ctx,
+                                             const char *module,
+                                             const char *iface,
+                                             const sd_bus_vtable *vtable,
+                                             size_t len) {
+  size_t members = 0;
+  for (size_t i = 0; i < len; i++) {
+    const sd_bus_vtable *entry = &vtable[i];
+    switch (entry->type) {
+    case _SD_BUS_VTABLE_METHOD:
+      members++;
+      break;
+    case _SD_BUS_VTABLE_WRITABLE_PROPERTY:
+      if (entry->x.property.set == NULL)
+        return NULL;
+      members++;
+      // fallthrough
+    case _SD_BUS_VTABLE_PROPERTY:
+      if (entry->x.property.get == NULL)
+        return NULL;
+      members++;
+      break;
+    }
+  }
+
+  dhub_vtable_stats_t *vt = calloc(1, sizeof(*vt));
+  if (vt == NULL)
+    return NULL;
+
+  size_t size = len * sizeof(*vtable);
+  vt->ctx = ctx;
+  vt->orig = vtable;
+  vt->len = len;
+  vt->snapshot = malloc(size);
+  vt->vtable = malloc(size);
+  vt->module = strdup(module);
+  vt->iface = strdup(iface);
+  vt->members = calloc(members, sizeof(*vt->members));
+  vt->owner = dhub_budget_module(ctx, module);
+  if (vt->snapshot == NULL || vt->vtable == NULL || vt->module == NULL ||
+      vt->iface == NULL || (members > 0 && vt->members == NULL))
+    goto err;
+  memcpy(vt->snapshot, vtable, size);
+  memcpy(vt->vtable, vtable, size);
+
+  // Trampolines receive dhub_object_t and apply original offsets.
+  for (size_t i = 0; i < len; i++) {
+    sd_bus_vtable *entry = &vt->vtable[i];
+    switch (entry->type) {
+    case _SD_BUS_VTABLE_METHOD:
+      if (!add_member(vt, entry->type, &vt->snapshot[i]))
+        goto err;
+      entry->x.method.handler = method_trampoline;
+      entry->x.method.offset = 0;
+      break;
+    case _SD_BUS_VTABLE_WRITABLE_PROPERTY:
+      if (!add_member(vt, entry->type, &vt->snapshot[i]))
+        goto err;
+      entry->x.property.set = setter_trampoline;
+      // fallthrough
+    case _SD_BUS_VTABLE_PROPERTY:
+      if (!add_member(vt, _SD_BUS_VTABLE_PROPERTY, &vt->snapshot[i]))
+        goto err;
+      entry->x.property.get = getter_trampoline;
+      entry->x.property.offset = 0;
+      break;
+    }
+  }
+
+  return vt;
+
+err:
+  vtable_stats_free(vt);
+  return NULL;
+}
+
+// Returns instrumented copy of `vtable`, objects of a module registered with
+// the same vtable share it.
+static dhub_vtable_stats_t *vtable_stats_get(dhub_context_t *ctx,
+                                             const char *module,
+                                             const char *iface,
+                                             const sd_bus_vtable *vtable) {
+  dhub_stats_t *stats = &ctx->stats;
+
+  size_t len = 0;
+  while (vtable[len].type != _SD_BUS_VTABLE_END)
+    len++;
+  len++;
+
+  tll_foreach(stats->vtables, it) {
+    dhub_vtable_stats_t *vt = it->item;
+    if (!vt->retired && vt->orig == vtable && vt->len == len &&
+        memcmp(vt->snapshot, vtable, len * sizeof(*vtable)) == 0 &&
+        strcmp(vt->module, module) == 0 && strcmp(vt->iface, iface) == 0)
+      return vt;
+  }
+
+  dhub_vtable_stats_t *vt = vtable_stats_new(ctx, module, iface, vtable, len);
+  if (vt == NULL)
+    return NULL;
+
+  uv_mutex_lock(&stats->lock);
+  tll_push_back(stats->vtables, vt);
+  uv_mutex_unlock(&stats->lock);
+  return vt;
+}
+
+static void object_free(void *userdata) {
+  dhub_object_t *obj = userdata;
+  dhub_vtable_stats_t *vt = obj->vt;
+  free(obj);
+  vtable_stats_unref(vt);
+}
+
+int dhub_add_object_vtable(dhub_state_t *dhub, sd_bus_slot **slot,
+                           const char *path, const char *iface,
+                           const sd_bus_vtable *vtable, void *userdata) {
+  dhub_context_t *ctx = dhub_context(dhub);
+
+  dhub_vtable_stats_t *vt =
+      vtable_stats_get(ctx, dhub_module_of(ctx, path), iface, vtable);
+  if (vt == NULL) {
+    LOG_DBG("vtable of %s on '%s' isn't instrumented", iface, path);
+    return sd_bus_add_object_vtable(ctx->bus, slot, path, iface, vtable,
+                                    userdata);
+  }
+
+  dhub_object_t *obj = malloc(sizeof(*obj));
+  if (obj == NULL)
+    return -ENOMEM;
+  *obj = (dhub_object_t){.vt = vt, .userdata = userdata};
+
+  sd_bus_slot *s = NULL;
+  int r = sd_bus_add_object_vtable(ctx->bus, &s, path, iface, vt->vtable, obj);
+  if (r < 0) {
+    free(obj);
+    return r;
+  }
+  vt->refs++;
+  sd_bus_slot_set_destroy_callback(s, object_free);
+
+  if (slot != NULL) {
+    *slot = s;
+  } else {
+    // Object lives as long as the bus, as with sd_bus_add_object_vtable().
+    sd_bus_slot_set_floating(s, 1);
+    sd_bus_slot_unref(s);
+  }
+
+  return r;
+}
+
+void dhub_stats_module_closed(dhub_context_t *ctx, const char *module) {
+  dhub_stats_t *stats = &ctx->stats;
+
+  uv_mutex_lock(&stats->lock);
+  tll_foreach(stats->vtables, it) {
+    dhub_vtable_stats_t *vt = it->item;
+    if (vt->retired || strcmp(vt->module, module) != 0)
+      continue;
+
+    vt->retired = true;
+    if (vt->refs == 0) {
+      tll_remove(stats->vtables, it);
+      vtable_stats_drop(stats, vt);
+    }
+  }
+  uv_mutex_unlock(&stats->lock);
+}
+
+void dhub_stats_signal(dhub_context_t *ctx, const char *path, size_t bytes) {
+  dhub_stats_t *stats = &ctx->stats;
+  const char *module = dhub_module_of(ctx, path);
+
+  uv_mutex_lock(&stats->lock);
+  dhub_signal_stats_t *s = NULL;
+  tll_foreach(stats->signals, it) {
+    if (strcmp(it->item.module, module) == 0) {
+      s = &it->item;
+      break;
+    }
+  }
+  if (s == NULL) {
+    char *name = strdup(module);
+    if (name != NULL) {
+      tll_push_back(stats->signals, ((dhub_signal_stats_t){.module = name}));
+      s = &tll_back(stats->signals);
+    }
+  }
+  if (s != NULL) {
+    s->signals++;
+    s->bytes += bytes;
+  }
+  uv_mutex_unlock(&stats->lock);
+}
+
+static dhub_signal_stats_t *snapshot_signal_row(dhub_stats_snapshot_t *snap,
+                                                const char *module) {
+  tll_foreach(snap->signals, it) {
+    if (strcmp(it->item.module, module) == 0)
+      return &it->item;
+  }
+
+  dhub_signal_stats_t row = {.module = strdup(module)};
+  if (row.module == NULL)
+    return NULL;
+
+  tll_push_back(snap->signals, row);
+  return &tll_back(snap->signals);
+}
+
+static void snapshot_context(dhub_context_t *ctx, dhub_stats_snapshot_t *snap) {
+  dhub_stats_t *stats = &ctx->stats;
+  uv_mutex_lock(&stats->lock);
+
+  // Objects of a member may be registered with several vtables.
+  tll_foreach(stats->vtables, it) {
+    dhub_vtable_stats_t *vt = it->item;
+    for (size_t i = 0; i < vt->members_len; i++) {
+      dhub_member_stats_t *ms = &vt->members[i];
+      dhub_stats_row_t *row = find_row(&snap->members, vt->module, vt->iface,
+                                       ms->member, ms->kind);
+      if (row != NULL)
+        row_add(row, ms->calls, ms->errors, &ms->latency);
+    }
+  }
+  tll_foreach(stats->retired, it) {
+    dhub_stats_row_t *r = &it->item;
+    dhub_stats_row_t *row =
+        find_row(&snap->members, r->module, r->iface, r->member, r->kind);
+    if (row != NULL)
+      row_add(row, r->calls, r->errors, &r->latency);
+  }
+
+  tll_foreach(stats->signals, it) {
+    dhub_signal_stats_t *row = snapshot_signal_row(snap, it->item.module);
+    if (row == NULL)
+      continue;
+
+    row->signals += it->item.signals;
+    row->bytes += it->item.bytes;
+  }
+
+  uv_mutex_unlock(&stats->lock);
+}
+
+void dhub_stats_snapshot(dhub_state_t *dhub, dhub_stats_snapshot_t *snap) {
+  snapshot_context(&dhub->ctx, snap);
+  dhub_registry_foreach(&dhub->modules, it) {
+    if (it->thread != NULL)
+      snapshot_context(&it->thread->ctx, snap);
+  }
+}
+
+void dhub_stats_snapshot_free(dhub_stats_snapshot_t *snap) {
+  rows_free(&snap->members);
+  tll_foreach(snap->signals, it) {
+    free(it->item.module);
+    tll_remove(snap->signals, it);
+  }
+}
+
+static void reset_context(dhub_context_t *ctx) {
+  dhub_stats_t *stats = &ctx->stats;
+  uv_mutex_lock(&stats->lock);
+
+  tll_foreach(stats->vtables, it) {
+    dhub_vtable_stats_t *vt = it->item;
+    for (size_t i = 0; i < vt->members_len; i++) {
+      vt->members[i].calls = 0;
+      vt->members[i].errors = 0;
+      histogram_reset(&vt->members[i].latency);
+    }
+  }
+  rows_free(&stats->retired);
+  tll_foreach(stats->signals, it) {
+    it->item.signals = 0;
+    it->item.bytes = 0;
+  }
+
+  uv_mutex_unlock(&stats->lock);
+}
+
+void dhub_stats_reset(dhub_state_t *dhub) {
+  reset_context(&dhub->ctx);
+  dhub_registry_foreach(&dhub->modules, it) {
+    if (it->thread != NULL)
+      reset_context(&it->thread->ctx);
+  }
+}
+
+static int append_stats(sd_bus_message *reply, dhub_stats_snapshot_t *snap) {
+  int r = sd_bus_message_open_container(reply, 'a', "(sssytttttt)");
+  if (r < 0)
+    return r;
+  tll_foreach(snap->members, it) {
+    dhub_stats_row_t *row = &it->item;
+    r = sd_bus_message_append(
+        reply, "(sssytttttt)", row->module, row->iface, row->member,
+        (uint8_t)row->kind, row->calls, row->errors, row->latency.sum,
+        row->latency.max, histogram_percentile(&row->latency, 500),
+        histogram_percentile(&row->latency, 990));
+    if (r < 0)
+      return r;
+  }
+  r = sd_bus_message_close_container(reply);
+  if (r < 0)
+    return r;
+
+  r = sd_bus_message_open_container(reply, 'a', "(stt)");
+  if (r < 0)
+    return r;
+  tll_foreach(snap->signals, it) {
+    r = sd_bus_message_append(reply, "(stt)", it->item.module,
+                              it->item.signals, it->item.bytes);
+    if (r < 0)
+      return r;
+  }
+  return sd_bus_message_close_container(reply);
+}
+
+static int method_get_stats(sd_bus_message *m, void *userdata,
+                            sd_bus_error *ret_error) {
+  (void)ret_error;
+  dhub_state_t *dhub = userdata;
+
+  sd_bus_message *reply = NULL;
+  int r = sd_bus_message_new_method_return(m, &reply);
+  if (r < 0)
+    return r;
+
+  dhub_stats_snapshot_t snap = {0};
+  dhub_stats_snapshot(dhub, &snap);
+  r = append_stats(reply, &snap);
+  dhub_stats_snapshot_free(&snap);
+
+  if (r >= 0)
+    r = sd_bus_send(NULL, reply, NULL);
+  sd_bus_message_unref(reply);
+  return r;
+}
+
+static int method_reset(sd_bus_message *m, void *userdata,
+                        sd_bus_error *ret_error) {
+  (void)ret_error;
+  dhub_stats_reset(userdata);
+  return sd_bus_reply_method_return(m, "");
+}
+
+static int method_get_module_times(sd_bus_message *m, void *userdata,
+                                   sd_bus_error *ret_error) {
+  (void)ret_error;
+  dhub_state_t *dhub = userdata;
+
+  sd_bus_message *reply = NULL;
+  int r = sd_bus_message_new_method_return(m, &reply);
+  if (r < 0)
+    return r;
+
+  r = sd_bus_message_open_container(reply, 'a', "(stttb)");
+  if (r >= 0)
+    r = dhub_budget_append(&dhub->ctx, reply);
+  dhub_registry_foreach(&dhub->modules, it) {
+    if (r >= 0 && it->thread != NULL)
+      r = dhub_budget_append(&it->thread->ctx, reply);
+  }
+  if (r >= 0)
+    r = sd_bus_message_close_container(reply);
+
+  if (r >= 0)
+    r = sd_bus_send(NULL, reply, NULL);
+  sd_bus_message_unref(reply);
+  return r;
+}
+
+static const sd_bus_vtable stats_vtable[] = {
+    SD_BUS_VTABLE_START(0),
+    // Per member: module, interface, member, kind ('M' method, 'P' property
+    // read, 'W' property write), calls, errors, total, maximum, median and
+    // 99th percentile latencies in nanoseconds.
+    // Per module: module, signals and body bytes of signals emitted with
+    // dhub_emit_signal(), PropertiesChanged bodies aren't measured.
+    SD_BUS_METHOD("GetStats", "", "a(sssytttttt)a(stt)", method_get_stats,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    // Per module: module, loop time in nanoseconds spent in its callbacks,
+    // budget windows it overran, low priority callbacks and signals throttled
+    // and whether it is currently over budget.
+    SD_BUS_METHOD("GetModuleTimes", "", "a(stttb)", method_get_module_times,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Reset", "", "", method_reset, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_VTABLE_END,
+};
+
+void dhub_stats_export(dhub_state_t *dhub) {
+  NEG_MUST(sd_bus_add_object_vtable(dhub->bus, &dhub->stats_slot,
+                                    DHUB_CONTROL_PATH, DHUB_STATS_IFACE,
+                                    stats_vtable, dhub),
+           "failed to add D-Hub stats object to D-BUS");
+}
+
+void dhub_stats_unexport(dhub_state_t *dhub) {
+  dhub->stats_slot = sd_bus_slot_unref(dhub->stats_slot);
+}
@@ -0,0 +1,134 @@
+#ifndef HUB_STATS_H_INCLUDE
+#define HUB_STATS_H_INCLUDE
+
+#include <basu/sd-bus.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <uv.h>
+
+#include "histogram.h"
+#include "tllist.h"
+
+#define DHUB_STATS_IFACE "dev.negrel.dhub.Stats"
+
+struct dhub_context;
+struct dhub_state;
+
+/**
+ * Statistics of a method, a property getter or a property setter of a vtable
+ * registered with dhub_add_object_vtable(). Latency is the time spent in its
+ * handler, on the event loop.
+ */
+typedef struct dhub_member_stats {
+  // Vtable entry type: _SD_BUS_VTABLE_METHOD, _SD_BUS_VTABLE_PROPERTY for
+  // getters or _SD_BUS_VTABLE_WRITABLE_PROPERTY for setters.
+  char kind;
+  const char *member;
+  // Original entry, in hub owned vtable snapshot as module vtable may be
+  // unmapped.
+  const sd_bus_vtable *entry;
+  uint64_t calls;
+  uint64_t errors;
+  histogram_t latency;
+} dhub_member_stats_t;
+
+/**
+ * Instrumented copy of a module vtable. Its handlers are trampolines
+ * recording statistics of the original ones, it is shared by every object
+ * registered with the same vtable.
+ */
+typedef struct dhub_vtable_stats {
+  struct dhub_context *ctx;
+  const sd_bus_vtable *orig;
+  // Copy of original vtable, to detect a vtable mapped at the same address
+  // by another library.
+  sd_bus_vtable *snapshot;
+  sd_bus_vtable *vtable;
+  size_t len;
+  char *module;
+  // Module charged for handlers time, NULL for D-Hub core.
+  struct dhub_module_time *owner;
+  char *iface;
+  dhub_member_stats_t *members;
+  size_t members_len;
+  // Objects registered with vtable and running handlers.
+  size_t refs;
+  // Module was closed, vtable is freed once it is no longer referenced.
+  bool retired;
+} dhub_vtable_stats_t;
+
+typedef struct dhub_signal_stats {
+  char *module;
+  uint64_t signals;
+  // Body bytes of signals emitted with dhub_emit_signal().
+  uint64_t bytes;
+} dhub_signal_stats_t;
+
+/**
+ * Statistics of a module member, merged from every context.
+ */
+typedef struct dhub_stats_row {
+  const char *module;
+  const char *iface;
+  const char *member;
+  char kind;
+  uint64_t calls;
+  uint64_t errors;
+  histogram_t latency;
+} dhub_stats_row_t;
+
+typedef tll(dhub_stats_row_t) dhub_stats_rows_t;
+
+/**
+ * Per loop statistics. They're updated by loop thread and read by main
+ * thread, under `lock`.
+ */
+typedef struct dhub_stats {
+  uv_mutex_t lock;
+  tll(dhub_vtable_stats_t *) vtables;
+  // Statistics of freed vtables, merged by member.
+  dhub_stats_rows_t retired;
+  tll(dhub_signal_stats_t) signals;
+} dhub_stats_t;
+
+typedef struct dhub_stats_snapshot {
+  dhub_stats_rows_t members;
+  tll(dhub_signal_stats_t) signals;
+} dhub_stats_snapshot_t;
+
+void dhub_stats_init(struct dhub_context *ctx);
+void dhub_stats_deinit(struct dhub_context *ctx);
+
+/**
+ * Records a signal, whose body is `bytes` long, emitted by module serving
+ * object `path`.
+ */
+void dhub_stats_signal(struct dhub_context *ctx, const char *path,
+                       size_t bytes);
+
+/**
+ * Releases instrumented vtables of a closed module, their statistics are
+ * kept. Vtables still used by objects are released once they're removed.
+ */
+void dhub_stats_module_closed(struct dhub_context *ctx, const char *module);
+
+/**
+ * Merges statistics of main and threaded modules contexts into `snap`, it
+ * must be called on main thread. Snapshot owns its strings.
+ */
+void dhub_stats_snapshot(struct dhub_state *dhub, dhub_stats_snapshot_t *snap);
+void dhub_stats_snapshot_free(dhub_stats_snapshot_t *snap);
+
+/**
+ * Clears statistics of every context.
+ */
+void dhub_stats_reset(struct dhub_state *dhub);
+
+/**
+ * Adds dev.negrel.dhub.Stats interface to D-Hub control object.
+ */
+void dhub_stats_export(struct dhub_state *dhub);
+void dhub_stats_unexport(struct dhub_state *dhub);
+
+#endif
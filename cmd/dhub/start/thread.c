@@ -0,0 +1,192 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <uv.h>
+
+#include "debug.h"
+#include "start/state.h"
+#include "start/thread.h"
+#include "trace.h"
+#define LOG_MODULE "dhub-thread"
+#include "log.h"
+
+static _Thread_local dhub_thread_t *current_thread = NULL;
+
+dhub_thread_t *dhub_thread_current(void) { return current_thread; }
+
+static void thread_unload(dhub_thread_t *thread) {
+  LOG_INFO("unloading threaded module '%s'...", thread->modname);
+  uint64_t start = dhub_trace_begin();
+  thread->unload(thread->dhub, thread->data, thread->tag);
+  dhub_trace_end(start, "module", "unload", "%s", thread->modname);
+}
+
+static void on_unload_request(uv_async_t *handle) {
+  dhub_thread_t *thread = handle->data;
+
+  // Completion of offloaded calls runs module code, module is unloaded once
+  // they are done. Main thread deadline still applies.
+  if (thread->ctx.offload.pending > 0) {
+    LOG_DBG("module '%s' waits for %" PRIu64 " offloaded method calls...",
+            thread->modname, thread->ctx.offload.pending);
+    thread->unload_requested = true;
+    return;
+  }
+
+  thread_unload(thread);
+}
+
+void dhub_thread_offloads_done(dhub_thread_t *thread) {
+  if (thread == NULL || !thread->unload_requested)
+    return;
+
+  thread->unload_requested = false;
+  thread_unload(thread);
+}
+
+void dhub_thread_close(dhub_thread_t *thread) {
+  // Close remaining handles so module thread's loop exits.
+  dhub_context_close(&thread->ctx);
+  uv_close((uv_handle_t *)&thread->unload_async, NULL);
+}
+
+static void thread_setup(dhub_thread_t *thread) {
+  UV_MUST(uv_loop_init(&thread->loop), "failed to init module libuv loop");
+
+  // Each module thread has its own D-Bus connection and a well-known name
+  // under dev.negrel.dhub: a name is owned by a single connection.
+  NEG_MUST(sd_bus_open_user(&thread->bus),
+           "failed to connect module thread to session bus");
+  char *name = NULL;
+  if (asprintf(&name, "dev.negrel.dhub.%s", thread->modname) == -1) {
+    LOG_ERR("failed to allocate module D-Bus name");
+    abort();
+  }
+  NEG_MUST(sd_bus_request_name(thread->bus, name, 0),
+           "failed to acquire module D-BUS name");
+  LOG_INFO("module '%s' thread acquired D-Bus name '%s'", thread->modname,
+           name);
+  free(name);
+
+  dhub_context_init(&thread->ctx, thread->dhub, &thread->loop, thread->bus);
+
+  thread->unload_async.data = thread;
+  UV_MUST(uv_async_init(&thread->loop, &thread->unload_async,
+                        on_unload_request),
+          "failed to initialize module thread unload async handle");
+}
+
+static void thread_teardown(dhub_thread_t *thread) {
+  dhub_context_deinit(&thread->ctx);
+
+  NEG_TRY(sd_bus_flush(thread->bus), "failed to flush module D-BUS");
+  sd_bus_close(thread->bus);
+  sd_bus_unref(thread->bus);
+
+  int r = uv_loop_close(&thread->loop);
+  UV_TRY(r, "failed to close module event loop");
+}
+
+static void thread_main(void *arg) {
+  dhub_thread_t *thread = arg;
+  current_thread = thread;
+  trace_thread_init(thread->modname);
+
+  thread_setup(thread);
+
+  uint64_t start = dhub_trace_begin();
+  thread->load_code = thread->load(thread->dhub, &thread->data);
+  dhub_trace_end(start, "module", "load", "%s", thread->modname);
+  if (thread->load_code != 0) {
+    dhub_thread_close(thread);
+    uv_run(&thread->loop, UV_RUN_DEFAULT);
+    thread_teardown(thread);
+    trace_thread_exit();
+    uv_sem_post(&thread->loaded);
+    return;
+  }
+
+  // Module is loaded, main thread can resume.
+  uv_sem_post(&thread->loaded);
+
+  while (uv_loop_alive(&thread->loop))
+    uv_run(&thread->loop, UV_RUN_DEFAULT);
+
+  thread_teardown(thread);
+  trace_thread_exit();
+
+  // Notify main thread.
+  uv_async_send(&thread->exit_async);
+}
+
+static void on_exit_async_close(uv_handle_t *handle) {
+  dhub_thread_t *thread = handle->data;
+  dhub_state_t *dhub = thread->dhub;
+  void *tag = thread->tag;
+  dhub_stats_deinit(&thread->ctx);
+  dhub_budget_deinit(&thread->ctx);
+  free(thread);
+
+  // We're on main thread, it frees the module.
+  dhub_close(dhub, tag);
+}
+
+static void on_thread_exit(uv_async_t *handle) {
+  dhub_thread_t *thread = handle->data;
+  uv_thread_join(&thread->thread);
+  LOG_INFO("module '%s' thread exited", thread->modname);
+  uv_close((uv_handle_t *)handle, on_exit_async_close);
+}
+
+static void on_failed_thread_close(uv_handle_t *handle) {
+  dhub_thread_t *thread = handle->data;
+  dhub_stats_deinit(&thread->ctx);
+  dhub_budget_deinit(&thread->ctx);
+  free(thread);
+}
+
+dhub_thread_t *dhub_thread_load(dhub_state_t *dhub, const char *modname,
+                                void *tag, load_fn_t load, unload_fn_t unload,
+                                int *code) {
+  dhub_thread_t *thread = calloc(1, sizeof(*thread));
+  if (thread == NULL) {
+    LOG_ERR("failed to allocate module thread");
+    *code = -1;
+    return NULL;
+  }
+
+  *thread = (dhub_thread_t){
+      .dhub = dhub,
+      .modname = modname,
+      .tag = tag,
+      .load = load,
+      .unload = unload,
+  };
+
+  UV_MUST(uv_sem_init(&thread->loaded, 0),
+          "failed to initialize module thread semaphore");
+  thread->exit_async.data = thread;
+  UV_MUST(uv_async_init(&dhub->loop, &thread->exit_async, on_thread_exit),
+          "failed to initialize module thread exit async handle");
+
+  LOG_INFO("starting module '%s' thread...", modname);
+  UV_MUST(uv_thread_create(&thread->thread, thread_main, thread),
+          "failed to create module thread");
+
+  // Wait for module load() to return.
+  uv_sem_wait(&thread->loaded);
+  uv_sem_destroy(&thread->loaded);
+
+  *code = thread->load_code;
+  if (*code != 0) {
+    uv_thread_join(&thread->thread);
+    uv_close((uv_handle_t *)&thread->exit_async, on_failed_thread_close);
+    return NULL;
+  }
+
+  return thread;
+}
+
+void dhub_thread_unload(dhub_thread_t *thread) {
+  uv_async_send(&thread->unload_async);
+}
@@ -0,0 +1,53 @@
+#ifndef HUB_THREAD_H_INCLUDE
+#define HUB_THREAD_H_INCLUDE
+
+#include <basu/sd-bus.h>
+#include <uv.h>
+
+#include "start/context.h"
+#include "start/state.h"
+
+/**
+ * Thread of a module loaded with DHUB_MODULE_THREADED flag. It runs its own
+ * event loop and D-Bus connection, the module is loaded, dispatched and
+ * unloaded on it.
+ */
+typedef struct dhub_thread {
+  struct dhub_state *dhub;
+  const char *modname;
+  void *tag;
+  load_fn_t load;
+  unload_fn_t unload;
+  void *data;
+
+  uv_thread_t thread;
+  uv_loop_t loop;
+  sd_bus *bus;
+  dhub_context_t ctx;
+
+  // Posted by module thread once load() returned.
+  uv_sem_t loaded;
+  int load_code;
+
+  // Handle of module thread's loop, used to request module unload.
+  uv_async_t unload_async;
+  // Unload was requested while offloaded calls were pending, it happens once
+  // they completed.
+  bool unload_requested;
+  // Handle of main loop, used to notify that module thread exited.
+  uv_async_t exit_async;
+} dhub_thread_t;
+
+dhub_thread_t *dhub_thread_load(struct dhub_state *dhub, const char *modname,
+                                void *tag, load_fn_t load, unload_fn_t unload,
+                                int *code);
+void dhub_thread_unload(dhub_thread_t *thread);
+
+/**
+ * Unloads module of calling thread if it awaited its last offloaded call.
+ */
+void dhub_thread_offloads_done(dhub_thread_t *thread);
+void dhub_thread_close(dhub_thread_t *thread);
+dhub_thread_t *dhub_thread_current(void);
+
+#endif
@@ -21,6 +21,7 @@
 
                   clang-tools
                   valgrind-light
+                  dbus # make bench
                 ] ++ deps;
               LD_LIBRARY_PATH = "${lib.makeLibraryPath buildInputs}";
               DEBUG = 1;
@@ -2,6 +2,7 @@
 #define DHUB_H_INCLUDE
 
 #include <basu/sd-bus.h>
+#include <stdbool.h>
 #include <uv.h>
 
 /**
@@ -40,6 +41,93 @@ typedef const char *dhub_type_t;
  */
 typedef struct dhub_state dhub_state_t;
 
+/**
+ * Module flags, set in module descriptor.
+ *
+ * DHUB_MODULE_THREADED: module is loaded on its own thread, with its own event
+ * loop and D-Bus connection owning the `dev.negrel.dhub.<module name>` name.
+ * dhub_loop() and dhub_bus() return them when called from this thread. Such a
+ * module must not call dhub_load() nor dhub_unload().
+ */
+#define DHUB_MODULE_THREADED (1U << 0)
+
+/**
+ * DHUB_MODULE_IDLE_UNLOAD: module is unloaded once it had no activity, that is
+ * no method call to and no signal emitted with dhub_emit_* functions from its
+ * objects, for `dhub start --idle-timeout` milliseconds. It is loaded again on
+ * next method call. Deferred and offloaded calls awaiting a reply keep it
+ * loaded. Module must have an object prefix and must not be threaded.
+ */
+#define DHUB_MODULE_IDLE_UNLOAD (1U << 1)
+
+/**
+ * Module descriptor ABI version. D-Hub refuses modules built against a version
+ * it doesn't support.
+ *
+ * 1: initial descriptor.
+ * 2: adds `save` and `restore` hot reload hooks.
+ */
+#define DHUB_MODULE_ABI_VERSION 2
+#define DHUB_MODULE_ABI_VERSION_MIN 1
+
+/**
+ * Module descriptor, every module defines one with DHUB_MODULE().
+ *
+ * `load` initializes the module and stores its data in `mod_data`, it returns
+ * a non zero value on error. `unload` must release module resources and call
+ * dhub_close() with `tag` once done.
+ *
+ * `object_prefix` is the D-Bus object path prefix served by the module, it is
+ * optional. A module marked `lazy` in D-Hub config file is only loaded on the
+ * first method call to an object under this prefix, the call is then
+ * dispatched to the module as if it had always been loaded. Threaded modules
+ * can't be lazily loaded.
+ */
+typedef struct dhub_module_desc {
+  unsigned int abi_version;
+  const char *name;
+  unsigned int flags;
+  const char *object_prefix;
+  int (*load)(dhub_state_t *dhub, void **mod_data);
+  void (*unload)(dhub_state_t *dhub, void *mod_data, void *tag);
+
+  // Hot reload hooks, they're optional (ABI version 2).
+  //
+  // `save` hands module state over to the new version of the module: it must
+  // remove module D-Bus objects and stop its handles without releasing
+  // resources handed over, and store them in a malloc()-ed `blob` of `size`
+  // bytes. Module must not call dhub_close(). It returns a non zero value if
+  // module can't be reloaded, module must then be left untouched.
+  //
+  // `restore` takes over the state saved by the old version of the module,
+  // possibly an older or newer one, so blob should be versioned. It returns a
+  // non zero value on error, blob must then be left untouched.
+  int (*save)(dhub_state_t *dhub, void *mod_data, void **blob, size_t *size);
+  int (*restore)(dhub_state_t *dhub, void **mod_data, const void *blob,
+                 size_t size);
+} dhub_module_desc_t;
+
+#ifdef DHUB_BUILTIN_MODULE
+#define DHUB_MODULE_SYMBOL(name) dhub_builtin_##name
+#else
+#define DHUB_MODULE_SYMBOL(name) dhub_module
+#endif
+
+/**
+ * Defines module descriptor of module `modname`. Remaining arguments are
+ * designated initializers of dhub_module_desc_t fields:
+ *
+ * DHUB_MODULE(echo, .load = echo_load, .unload = echo_unload);
+ *
+ * Descriptor is exported as `dhub_module` symbol or, when module is linked
+ * into D-Hub binary (DHUB_BUILTIN_MODULE defined), as `dhub_builtin_<name>`.
+ */
+#define DHUB_MODULE(modname, ...)                                              \
+  const dhub_module_desc_t DHUB_MODULE_SYMBOL(modname) = {                     \
+      .abi_version = DHUB_MODULE_ABI_VERSION,                                  \
+      .name = #modname,                                                        \
+      __VA_ARGS__}
+
 /**
  * Loads a D-Hub module into the system if it is not already loaded.
  *
@@ -48,6 +136,20 @@ typedef struct dhub_state dhub_state_t;
  */
 int dhub_load(dhub_state_t *dhub, const char *modname, const char **err);
 
+/**
+ * Reloads a D-Hub module from its library, that may have been replaced since
+ * it was loaded, without unloading it. Old version of the module saves its
+ * state and new one restores it within the same loop iteration, so its D-Bus
+ * objects never disappear. Both versions must implement hot reload hooks.
+ *
+ * Old library stays mapped until D-Hub exits as callbacks of handles closed
+ * by old module may still run.
+ *
+ * This function returns -1, log and write error message `err` if an error
+ * occurred and 1 otherwise.
+ */
+int dhub_reload(dhub_state_t *dhub, const char *modname, const char **err);
+
 /**
  * Unloads a D-Hub module from the system if it is currently loaded.
  *
@@ -61,15 +163,258 @@ int dhub_unload(dhub_state_t *dhub, const char *modname);
 void dhub_close(dhub_state_t *dhub, void *tag);
 
 /**
- * Getter for global D-Bus handle.
+ * Getter for D-Bus handle of calling thread: the global one or the one of the
+ * calling threaded module.
  */
 sd_bus *dhub_bus(dhub_state_t *dhub);
 
 /**
- * Getter for global libuv loop handle.
+ * Getter for libuv loop handle of calling thread: the global one or the one of
+ * the calling threaded module.
  */
 uv_loop_t *dhub_loop(dhub_state_t *dhub);
 
+/**
+ * Adds a D-Bus object on D-Bus handle of calling thread, as
+ * sd_bus_add_object_vtable() does. D-Hub records call counts, errors and
+ * latencies of its methods and property accessors, they're reported by
+ * dev.negrel.dhub.Stats interface. Their time is charged to the module
+ * serving the object.
+ *
+ * Slot userdata isn't `userdata`. Vtables with properties that have no getter
+ * or writable properties with no setter aren't instrumented.
+ */
+int dhub_add_object_vtable(dhub_state_t *dhub, sd_bus_slot **slot,
+                           const char *path, const char *iface,
+                           const sd_bus_vtable *vtable, void *userdata);
+
+struct dhub_module_time;
+
+/**
+ * Poll handle whose callbacks are timed and charged to the module that
+ * initialized it, see `dhub start --module-budget`. `handle` is a regular
+ * libuv poll handle: its data field is free for module use and it is stopped
+ * and closed with libuv functions.
+ */
+typedef struct dhub_poll {
+  uv_poll_t handle;
+  // Private.
+  uv_poll_cb cb;
+  struct dhub_module_time *owner;
+} dhub_poll_t;
+
+/**
+ * Initializes `poll` on libuv loop of calling thread to watch `fd`, as
+ * uv_poll_init() does.
+ */
+int dhub_poll_init(dhub_state_t *dhub, dhub_poll_t *poll, int fd);
+
+/**
+ * Starts polling `events`, as uv_poll_start() does. `cb` receives `handle`.
+ */
+int dhub_poll_start(dhub_poll_t *poll, int events, uv_poll_cb cb);
+
+/**
+ * Priority of timers. Low priority timers of a module over its loop time
+ * budget are delayed while `dhub start --throttle` is set.
+ */
+enum dhub_timer_prio {
+  DHUB_TIMER_PRIO_NORMAL,
+  DHUB_TIMER_PRIO_LOW,
+};
+
+/**
+ * Timer handle whose callbacks are timed and charged to the module that
+ * initialized it. `handle` is a regular libuv timer handle: its data field is
+ * free for module use and it is stopped and closed with libuv functions.
+ */
+typedef struct dhub_timer {
+  uv_timer_t handle;
+  // Private.
+  uv_timer_cb cb;
+  enum dhub_timer_prio prio;
+  struct dhub_module_time *owner;
+} dhub_timer_t;
+
+/**
+ * Initializes `timer` on libuv loop of calling thread, as uv_timer_init()
+ * does.
+ */
+int dhub_timer_init(dhub_state_t *dhub, dhub_timer_t *timer,
+                    enum dhub_timer_prio prio);
+
+/**
+ * Starts `timer`, as uv_timer_start() does. `cb` receives `handle`.
+ */
+int dhub_timer_start(dhub_timer_t *timer, uv_timer_cb cb, uint64_t timeout,
+                     uint64_t repeat);
+
+/**
+ * Priority of emitted signals. When D-Bus write queue is above its high-water
+ * mark, low priority signals are dropped and low priority PropertiesChanged
+ * signals are coalesced and emitted once the queue drains. They're also
+ * dropped and coalesced while their module is throttled.
+ */
+enum dhub_signal_prio {
+  DHUB_SIGNAL_PRIO_NORMAL,
+  DHUB_SIGNAL_PRIO_LOW,
+};
+
+/**
+ * Emits a signal on D-Bus handle of calling thread. Arguments are appended as
+ * with sd_bus_message_append().
+ *
+ * This function returns a negative errno-style error code on failure, 0 if the
+ * signal was dropped and 1 otherwise.
+ */
+int dhub_emit_signal(dhub_state_t *dhub, enum dhub_signal_prio prio,
+                     const char *path, const char *iface, const char *member,
+                     const char *types, ...);
+
+/**
+ * Emits a PropertiesChanged signal for the NULL terminated list of properties
+ * on D-Bus handle of calling thread.
+ *
+ * This function returns a negative errno-style error code on failure, 0 if the
+ * signal was coalesced and 1 otherwise.
+ */
+int dhub_emit_properties_changed(dhub_state_t *dhub, enum dhub_signal_prio prio,
+                                 const char *path, const char *iface,
+                                 const char *name, ...);
+
+/**
+ * Work function of an offloaded method call. It runs on a libuv threadpool
+ * thread and must not use D-Bus nor libuv loop, it may only read arguments of
+ * method call `m`. It stores its result in `result` and returns a negative
+ * errno-style error code on failure.
+ */
+typedef int (*dhub_work_fn_t)(sd_bus_message *m, void *userdata,
+                              void **result);
+
+/**
+ * Completion function of an offloaded method call. It runs on loop thread once
+ * work function returned (`status` is its return value, -ECANCELED if work was
+ * cancelled) and builds and sends the reply to `m`. If it returns a negative
+ * errno-style error code, an error reply is sent.
+ */
+typedef int (*dhub_done_fn_t)(sd_bus_message *m, void *userdata, void *result,
+                              int status);
+
+/**
+ * Offloads a method call to libuv threadpool so slow handlers don't block
+ * other modules. Method handlers that should run off the loop thread return
+ * the result of this function directly. Message `m` is referenced until
+ * `done` returns.
+ *
+ * This function returns a negative errno-style error code on failure and 1
+ * otherwise.
+ */
+int dhub_offload(dhub_state_t *dhub, sd_bus_message *m, dhub_work_fn_t work,
+                 dhub_done_fn_t done, void *userdata);
+
+/**
+ * Pending method call whose reply was deferred by a module. It lets a handler
+ * return immediately and complete the call later from any libuv callback.
+ *
+ * This structure is opaque and data must be accessed through dhub_call_*
+ * functions.
+ */
+typedef struct dhub_call dhub_call_t;
+
+/**
+ * Called when D-Hub completes a pending call on module's behalf, because it
+ * timed out or the daemon is stopping. `call` is freed once it returns and
+ * must not be used anymore.
+ */
+typedef void (*dhub_call_drop_fn_t)(dhub_call_t *call, void *userdata);
+
+/**
+ * Takes ownership of method call `m` and defers its reply. A method handler
+ * that defers its reply must return 1. If the call isn't completed within
+ * `timeout_ms` milliseconds (0 for default), a Timeout error is sent and
+ * `on_drop` is called.
+ *
+ * This function returns NULL if an error occurred.
+ */
+dhub_call_t *dhub_call_defer(dhub_state_t *dhub, sd_bus_message *m,
+                             uint64_t timeout_ms, dhub_call_drop_fn_t on_drop,
+                             void *userdata);
+
+/**
+ * Getter for method call message of a pending call.
+ */
+sd_bus_message *dhub_call_message(dhub_call_t *call);
+
+/**
+ * Getter for user data of a pending call.
+ */
+void *dhub_call_userdata(dhub_call_t *call);
+
+/**
+ * Completes a pending call with a method return. Arguments are appended as
+ * with sd_bus_message_append(). `call` is freed and must not be used anymore.
+ */
+int dhub_call_return(dhub_call_t *call, const char *types, ...);
+
+/**
+ * Completes a pending call by sending `reply`, created from
+ * dhub_call_message(). `call` is freed and must not be used anymore.
+ */
+int dhub_call_reply(dhub_call_t *call, sd_bus_message *reply);
+
+/**
+ * Completes a pending call with an error. `call` is freed and must not be
+ * used anymore.
+ */
+int dhub_call_error(dhub_call_t *call, const char *name, const char *msg);
+
+/**
+ * Completes a pending call with an error built from errno-style error code
+ * `err`. `call` is freed and must not be used anymore.
+ */
+int dhub_call_errno(dhub_call_t *call, int err);
+
+/**
+ * Starts a trace span. It returns 0, and dhub_trace_end() does nothing, if
+ * tracing isn't running so spans cost a single check when it is disabled.
+ */
+uint64_t dhub_trace_begin(void);
+
+/**
+ * Ends span started at `start` by dhub_trace_begin() and records it in
+ * calling thread trace buffer. `cat` and `name` are shown in trace viewers,
+ * details are formatted from `fmt` as with printf(), it may be NULL. Strings
+ * are truncated.
+ */
+void dhub_trace_end(uint64_t start, const char *cat, const char *name,
+                    const char *fmt, ...);
+
+/**
+ * Returns true if D-Hub records its traffic, see `dhub start --record`.
+ * Modules check it before building data for dhub_record_event().
+ */
+bool dhub_recording(dhub_state_t *dhub);
+
+/**
+ * Records a module input that isn't a D-Bus method call, such as a udev
+ * event, so `dhub replay` feeds it back to replay handler of `kind`. It does
+ * nothing if D-Hub isn't recording and can be called from any thread.
+ */
+void dhub_record_event(dhub_state_t *dhub, const char *kind, const void *data,
+                       size_t len);
+
+typedef void (*dhub_replay_cb)(const void *data, size_t len, void *userdata);
+
+/**
+ * Registers `cb` as handler of replayed events of `kind`, it is called from
+ * main event loop with data passed to dhub_record_event(). A NULL `cb`
+ * removes handler, modules must remove theirs before closing. It returns
+ * -ENOTSUP if called from a threaded module and -ENOMEM on allocation
+ * failure.
+ */
+int dhub_replay_handler(dhub_state_t *dhub, const char *kind,
+                        dhub_replay_cb cb, void *userdata);
+
 enum log_class {
   LOG_CLASS_NONE,
   LOG_CLASS_ERROR,
@@ -89,23 +434,50 @@ void log_errno_provided(enum log_class log_class, const char *module,
                         const char *file, int lineno, int _errno,
                         const char *fmt, ...);
 
+/**
+ * Waits for queued log lines to be written.
+ */
+void log_flush(void);
+
+/**
+ * Most verbose log class compiled in, call sites of more verbose classes are
+ * removed. It is a number so it can be set from compiler flags:
+ * -DDHUB_LOG_LEVEL=3 keeps errors, warnings and info messages.
+ */
+#ifndef DHUB_LOG_LEVEL
+#define DHUB_LOG_LEVEL 4
+#endif
+
+/**
+ * Most verbose log class enabled at runtime.
+ */
+extern enum log_class log_level;
+
+/**
+ * Returns true if messages of `log_class` are logged. Checked before log
+ * arguments are evaluated.
+ */
+#define LOG_ENABLED(log_class)                                                 \
+  ((log_class) <= DHUB_LOG_LEVEL && (log_class) <= log_level)
+
+#define LOG_AT(log_fn, log_class, ...)                                         \
+  do {                                                                         \
+    if (LOG_ENABLED(log_class))                                                \
+      log_fn(log_class, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__);          \
+  } while (0)
+
 #define LOG_FATAL(...)                                                         \
   do {                                                                         \
     log_msg(LOG_CLASS_ERROR, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__);     \
+    log_flush();                                                               \
     abort();                                                                   \
   } while (0)
-#define LOG_ERR(...)                                                           \
-  log_msg(LOG_CLASS_ERROR, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_ERRNO(...)                                                         \
-  log_errno(LOG_CLASS_ERROR, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__)
+#define LOG_ERR(...) LOG_AT(log_msg, LOG_CLASS_ERROR, __VA_ARGS__)
+#define LOG_ERRNO(...) LOG_AT(log_errno, LOG_CLASS_ERROR, __VA_ARGS__)
 #define LOG_ERRNO_P(_errno, ...)                                               \
-  log_errno_provided(LOG_CLASS_ERROR, LOG_MODULE, __FILE__, __LINE__, _errno,  \
-                     __VA_ARGS__)
-#define LOG_WARN(...)                                                          \
-  log_msg(LOG_CLASS_WARNING, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_INFO(...)                                                          \
-  log_msg(LOG_CLASS_INFO, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_DBG(...)                                                           \
-  log_msg(LOG_CLASS_DEBUG, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__)
+  LOG_AT(log_errno_provided, LOG_CLASS_ERROR, _errno, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(log_msg, LOG_CLASS_WARNING, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(log_msg, LOG_CLASS_INFO, __VA_ARGS__)
+#define LOG_DBG(...) LOG_AT(log_msg, LOG_CLASS_DEBUG, __VA_ARGS__)
 
 #endif
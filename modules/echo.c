@@ -4,7 +4,9 @@
  */
 
 #include "basu/sd-bus.h"
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define LOG_MODULE "mod-echo"
 #include "dhub.h"
@@ -23,13 +25,31 @@
     goto label;                                                                \
   }
 
+struct delayed_ping;
+
 /**
  * Echo module data.
  */
 typedef struct {
+  dhub_state_t *dhub;
+  void *tag;
   sd_bus_slot *slot;
+  struct delayed_ping *pings; // Pending PingLater calls.
+  int closing;                // Number of timers being closed.
+  int unloading;
 } echo_data_t;
 
+/**
+ * A PingLater call whose reply is deferred until its timer fires.
+ */
+typedef struct delayed_ping {
+  dhub_timer_t timer;
+  dhub_call_t *call;
+  echo_data_t *data;
+  struct delayed_ping *prev;
+  struct delayed_ping *next;
+} delayed_ping_t;
+
 /**
  * This is the ping method implementation of our D-Bus object.
  */
@@ -41,57 +61,184 @@ static int method_ping(sd_bus_message *m, void *userdata,
 }
 
 /**
- * This is the echo method implementation of our D-Bus object.
+ * Frees module data and notifies D-Hub that module can be closed.
  */
-static int method_echo(sd_bus_message *m, void *userdata,
-                       sd_bus_error *ret_error) {
-  (void)userdata;
-  (void)ret_error;
-  int r = 0;
+static void echo_close(echo_data_t *data) {
+  dhub_state_t *dhub = data->dhub;
+  void *tag = data->tag;
+  free(data);
+  dhub_close(dhub, tag);
+}
 
-  sd_bus_message *reply = NULL;
+static void on_ping_timer_close(uv_handle_t *handle) {
+  delayed_ping_t *ping = handle->data;
+  echo_data_t *data = ping->data;
+  free(ping);
 
-  // Create reply message.
-  r = sd_bus_message_new_method_return(m, &reply);
-  SD_LOG_ERR_GOTO(r, "failed to create echo reply", ret);
+  // Last timer closed while unloading, we can close the module.
+  data->closing--;
+  if (data->unloading && data->closing == 0)
+    echo_close(data);
+}
+
+/**
+ * Removes delayed ping from pending list and frees it once its timer is
+ * closed. Its call must have been completed.
+ */
+static void delayed_ping_free(delayed_ping_t *ping) {
+  echo_data_t *data = ping->data;
+
+  if (ping->prev != NULL)
+    ping->prev->next = ping->next;
+  else
+    data->pings = ping->next;
+  if (ping->next != NULL)
+    ping->next->prev = ping->prev;
+
+  data->closing++;
+  uv_timer_stop(&ping->timer.handle);
+  uv_close((uv_handle_t *)&ping->timer.handle, on_ping_timer_close);
+}
 
-  // Open array container in reply.
-  r = sd_bus_message_open_container(reply, DHUB_ARRAY_CTR, DHUB_STRING);
-  SD_LOG_ERR_GOTO(r, "failed to open echo reply", err);
+static void on_ping_timer(uv_timer_t *handle) {
+  delayed_ping_t *ping = handle->data;
 
-  // Start reading string array.
-  r = sd_bus_message_enter_container(m, DHUB_ARRAY_CTR, DHUB_STRING);
-  SD_LOG_ERR_GOTO(r, "failed to enter echo message", err);
+  // Complete deferred call.
+  int r = dhub_call_return(ping->call, DHUB_STRING, "PONG");
+  if (r < 0)
+    LOG_ERR("failed to reply to delayed ping: %s", strerror(-r));
 
-  // Copy message to reply.
-  const char *input = NULL;
-  while ((r = sd_bus_message_read(m, DHUB_STRING, &input)) > 0) {
-    r = sd_bus_message_append(reply, DHUB_STRING, input);
-    SD_LOG_ERR_GOTO(r, "failed to append to echo reply", err);
+  delayed_ping_free(ping);
+}
+
+/**
+ * Called when D-Hub completed the call on our behalf (e.g. it timed out).
+ */
+static void on_ping_drop(dhub_call_t *call, void *userdata) {
+  (void)call;
+  delayed_ping_free(userdata);
+}
+
+/**
+ * This is the ping later method implementation of our D-Bus object. It
+ * returns immediately and replies after the given delay without blocking the
+ * event loop.
+ */
+static int method_ping_later(sd_bus_message *m, void *userdata,
+                             sd_bus_error *ret_error) {
+  (void)ret_error;
+  echo_data_t *data = userdata;
+
+  // Read delay.
+  uint32_t delay_ms = 0;
+  int r = sd_bus_message_read(m, DHUB_UINT32, &delay_ms);
+  SD_LOG_ERR_GOTO(r, "failed to read delay", ret);
+
+  delayed_ping_t *ping = calloc(1, sizeof(*ping));
+  if (ping == NULL)
+    return -ENOMEM;
+
+  // Defer reply, D-Hub replies with an error if it takes too long.
+  ping->call = dhub_call_defer(data->dhub, m, 0, on_ping_drop, ping);
+  if (ping->call == NULL) {
+    free(ping);
+    return -ENOMEM;
   }
 
-  // Stop reading string array.
-  r = sd_bus_message_exit_container(m);
-  SD_LOG_ERR_GOTO(r, "failed to exit echo message", err);
+  // Start timer, its callback time is charged to echo module. It completes a
+  // call so it must not be delayed when module is throttled.
+  ping->data = data;
+  ping->timer.handle.data = ping;
+  dhub_timer_init(data->dhub, &ping->timer, DHUB_TIMER_PRIO_NORMAL);
+  dhub_timer_start(&ping->timer, on_ping_timer, delay_ms, 0);
 
-  // Close reply array.
-  r = sd_bus_message_close_container(reply);
-  SD_LOG_ERR_GOTO(r, "failed to close echo reply", err);
+  // Add to pending list.
+  ping->next = data->pings;
+  if (data->pings != NULL)
+    data->pings->prev = ping;
+  data->pings = ping;
 
-  // Send reply.
-  sd_bus_send(sd_bus_message_get_bus(reply), reply, NULL);
-  SD_LOG_ERR_GOTO(r, "failed to send echo reply", err);
+  // Reply is deferred.
+  return 1;
 
-  // Free reply.
-  sd_bus_message_unref(reply);
+ret:
   return r;
+}
+
+/**
+ * Frees a NULL terminated array of strings.
+ */
+static void strv_free(char **strv) {
+  if (strv == NULL)
+    return;
+
+  for (char **s = strv; *s != NULL; s++)
+    free(*s);
+  free(strv);
+}
+
+/**
+ * Work function of the echo method. Echoing thousands of strings is slow so it
+ * runs on libuv threadpool, where it is only allowed to read the message.
+ */
+static int echo_work(sd_bus_message *m, void *userdata, void **result) {
+  (void)userdata;
+
+  // Read string array.
+  char **strv = NULL;
+  int r = sd_bus_message_read_strv(m, &strv);
+  SD_LOG_ERR_GOTO(r, "failed to read echo message", ret);
+
+  *result = strv;
 
-err:
-  sd_bus_message_unref(reply);
 ret:
   return r;
 }
 
+/**
+ * Completion function of the echo method, it runs on loop thread and sends the
+ * reply.
+ */
+static int echo_done(sd_bus_message *m, void *userdata, void *result,
+                     int status) {
+  (void)userdata;
+  char **strv = result;
+  int r = status;
+
+  sd_bus_message *reply = NULL;
+  if (r < 0)
+    goto ret;
+
+  // Create reply message.
+  r = sd_bus_message_new_method_return(m, &reply);
+  SD_LOG_ERR_GOTO(r, "failed to create echo reply", ret);
+
+  // Copy strings to reply.
+  r = sd_bus_message_append_strv(reply, strv);
+  SD_LOG_ERR_GOTO(r, "failed to append to echo reply", ret);
+
+  // Send reply.
+  r = sd_bus_send(sd_bus_message_get_bus(reply), reply, NULL);
+  SD_LOG_ERR_GOTO(r, "failed to send echo reply", ret);
+
+ret:
+  // Free reply and strings.
+  sd_bus_message_unref(reply);
+  strv_free(strv);
+  return r;
+}
+
+/**
+ * This is the echo method implementation of our D-Bus object. It offloads the
+ * call to libuv threadpool, echo_done() replies once echo_work() is done.
+ */
+static int method_echo(sd_bus_message *m, void *userdata,
+                       sd_bus_error *ret_error) {
+  (void)ret_error;
+  echo_data_t *data = userdata;
+  return dhub_offload(data->dhub, m, echo_work, echo_done, data);
+}
+
 /**
  * This is the echo method implementation of our D-Bus object.
  */
@@ -126,6 +273,8 @@ static const sd_bus_vtable echo_vtable[] = {
     SD_BUS_VTABLE_START(0),
     SD_BUS_METHOD("Ping", "", DHUB_STRING, method_ping,
                   SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("PingLater", DHUB_UINT32, DHUB_STRING, method_ping_later,
+                  SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Echo", DHUB_ARRAY(DHUB_STRING), DHUB_ARRAY(DHUB_STRING),
                   method_echo, SD_BUS_VTABLE_UNPRIVILEGED),
     SD_BUS_METHOD("Broadcast", DHUB_STRING, "", method_broadcast,
@@ -134,24 +283,35 @@ static const sd_bus_vtable echo_vtable[] = {
     SD_BUS_VTABLE_END};
 
 /**
- * Unload global function is used by D-Hub to unload the module.
+ * Unload function is used by D-Hub to unload the module.
  * You should clean up any allocated resources in this function.
  */
-void unload(dhub_state_t *dhub, void *mod_data, void *tag) {
+static void echo_unload(dhub_state_t *dhub, void *mod_data, void *tag) {
   (void)dhub;
   echo_data_t *data = (echo_data_t *)mod_data;
 
   if (data != NULL) {
     sd_bus_slot_unref(data->slot);
-    free(data);
-    dhub_close(dhub, tag);
+
+    // Complete pending delayed pings.
+    while (data->pings != NULL) {
+      dhub_call_error(data->pings->call, SD_BUS_ERROR_NO_REPLY,
+                      "echo module unloaded");
+      delayed_ping_free(data->pings);
+    }
+
+    // Module is closed once all timers are closed.
+    data->tag = tag;
+    data->unloading = 1;
+    if (data->closing == 0)
+      echo_close(data);
   }
 }
 
 /**
- * Load global function is used by D-Hub to initialize the module.
+ * Load function is used by D-Hub to initialize the module.
  */
-int load(dhub_state_t *dhub, void **mod_data) {
+static int echo_load(dhub_state_t *dhub, void **mod_data) {
   // Allocate our module data.
   echo_data_t *data = calloc(1, sizeof(*data));
   if (data == NULL) {
@@ -161,21 +321,27 @@ int load(dhub_state_t *dhub, void **mod_data) {
 
   // Store it.
   *mod_data = data;
+  data->dhub = dhub;
 
-  // Get reference to D-Bus.
-  sd_bus *bus = dhub_bus(dhub);
-
-  // Add our echo object to the bus.
-  int r = sd_bus_add_object_vtable(bus, &data->slot, DBUS_PATH, DBUS_IFACE,
-                                   echo_vtable,
-                                   data); // data will be passed as user data to
-                                          // D-Bus methods, getters and setters.
+  // Add our echo object to D-Bus, D-Hub records statistics of its methods.
+  int r = dhub_add_object_vtable(dhub, &data->slot, DBUS_PATH, DBUS_IFACE,
+                                 echo_vtable,
+                                 data); // data will be passed as user data to
+                                        // D-Bus methods, getters and setters.
   SD_LOG_ERR_GOTO(r, "failed to add Echoer object to D-Bus", err);
 
   return 0;
 
 err:
   // Free allocated resources on error.
-  unload(dhub, NULL, NULL);
+  echo_unload(dhub, NULL, NULL);
   return 1;
 }
+
+/**
+ * Module descriptor, D-Hub finds our entry points and metadata through it.
+ * Echo module is rarely used, it lets D-Hub unload it when idle and load it
+ * again on the next call to an object under its prefix.
+ */
+DHUB_MODULE(echo, .flags = DHUB_MODULE_IDLE_UNLOAD, .object_prefix = DBUS_PATH,
+            .load = echo_load, .unload = echo_unload);
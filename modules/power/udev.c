@@ -1,13 +1,16 @@
 #include "basu/sd-bus.h"
 #include "string.h"
-#include <libudev.h>
+#include <inttypes.h>
+#include <malloc.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 #define LOG_MODULE "mod-power"
 #include "dhub.h"
+#include "histogram.h"
 #include "tllist.h"
+#include "udev/source.h"
 
 #define LOG_ERR_GOTO(err, label, fmt, ...)                                     \
   if (err) {                                                                   \
@@ -26,37 +29,42 @@
     goto label;                                                                \
   }
 
-#define UDEV_LOG_ERR_GOTO(err, label, fmt, ...)                                \
-  LOG_ERR_GOTO(err < 0, label, fmt, #__VA_ARGS__)
-
-#define UV_LOG_ERR_GOTO(err, label, fmt, ...)                                  \
-  if (err < 0) {                                                               \
-    LOG_ERR(fmt ": %s", ##__VA_ARGS__, uv_strerror(err));                      \
-    goto label;                                                                \
-  }
-
 #define DBUS_POWER_PATH "/dev/negrel/dhub/power"
 #define DBUS_POWER_IFACE "dev.negrel.dhub.Power"
 #define DBUS_POWER_SUPPLY_IFACE "dev.negrel.dhub.PowerSupply"
 #define DBUS_POWER_SUPPLY_BATTERY_IFACE "dev.negrel.dhub.PowerSupply.Battery"
 
 typedef struct {
+  dhub_state_t *dhub;
   sd_bus *bus;
-  struct udev_device *dev;
+  power_device_t *dev;
   tll(sd_bus_slot **) slots;
   char *by_path_obj_path;
   char *by_name_obj_path;
 } power_supply_t;
 
+/**
+ * Measurements written to $DHUB_POWER_REPORT on unload, for benchmarks.
+ */
+typedef struct {
+  // register_all_power_devices() duration.
+  uint64_t register_ns;
+  size_t register_devices;
+  // Heap growth during register_all_power_devices() or -1 if unknown.
+  long long register_bytes;
+  // Time from device events to their handling end.
+  histogram_t event_latency;
+} power_stats_t;
+
 typedef struct {
   dhub_state_t *dhub;
   void *tag;
   sd_bus *bus;
-  struct udev *udev;
-  struct udev_monitor *mon;
-  uv_poll_t mon_poll;
+  power_source_t *source;
+  bool enumerating;
   tll(power_supply_t *) power_devices;
   sd_bus_slot *slot;
+  power_stats_t stats;
 } power_data_t;
 
 static void encode_object_path(char *path) {
@@ -71,16 +79,16 @@ static void encode_object_path(char *path) {
 }
 
 static void power_supply_update_device(power_supply_t *power_supply,
-                                       struct udev_device *dev) {
-#define POWER_SUPPLY_UPDATE(prop, newv, iface, get, ...)                       \
+                                       power_device_t *dev) {
+#define POWER_SUPPLY_UPDATE(prop, newv, iface, field)                          \
   do {                                                                         \
-    const char *oldv = get(old, ##__VA_ARGS__);                                \
-    newv = get(dev, ##__VA_ARGS__);                                            \
+    const char *oldv = old->field;                                             \
+    newv = dev->field;                                                         \
     if (strcmp(oldv, newv) != 0) {                                             \
       LOG_DBG("properties '%s' changed from '%s' to '%s'", prop, oldv, newv);  \
-      int r = sd_bus_emit_properties_changed(power_supply->bus,                \
-                                             power_supply->by_path_obj_path,   \
-                                             iface, prop, NULL);               \
+      int r = dhub_emit_properties_changed(                                    \
+          power_supply->dhub, DHUB_SIGNAL_PRIO_LOW,                            \
+          power_supply->by_path_obj_path, iface, prop, NULL);                  \
       SD_LOG_ERR(r,                                                            \
                  "failed to emit properties changed signal for property '%s' " \
                  "on object '%s'",                                             \
@@ -89,32 +97,27 @@ static void power_supply_update_device(power_supply_t *power_supply,
   } while (0)
 
   // Update device.
-  struct udev_device *old = power_supply->dev;
+  power_device_t *old = power_supply->dev;
   power_supply->dev = dev;
 
   // Check for changes and emit signals.
   const char *newv = NULL;
-  POWER_SUPPLY_UPDATE("Name", newv, DBUS_POWER_SUPPLY_IFACE,
-                      udev_device_get_sysname);
-  POWER_SUPPLY_UPDATE("Path", newv, DBUS_POWER_SUPPLY_IFACE,
-                      udev_device_get_syspath);
-  POWER_SUPPLY_UPDATE("Type", newv, DBUS_POWER_SUPPLY_IFACE,
-                      udev_device_get_property_value, "POWER_SUPPLY_TYPE");
+  POWER_SUPPLY_UPDATE("Name", newv, DBUS_POWER_SUPPLY_IFACE, sysname);
+  POWER_SUPPLY_UPDATE("Path", newv, DBUS_POWER_SUPPLY_IFACE, syspath);
+  POWER_SUPPLY_UPDATE("Type", newv, DBUS_POWER_SUPPLY_IFACE, type);
 
   if (strcmp(newv, "Battery") == 0) {
     POWER_SUPPLY_UPDATE("Status", newv, DBUS_POWER_SUPPLY_BATTERY_IFACE,
-                        udev_device_get_property_value, "POWER_SUPPLY_STATUS");
+                        status);
     POWER_SUPPLY_UPDATE("Capacity", newv, DBUS_POWER_SUPPLY_BATTERY_IFACE,
-                        udev_device_get_property_value,
-                        "POWER_SUPPLY_CAPACITY");
+                        capacity);
     POWER_SUPPLY_UPDATE("CapacityLevel", newv, DBUS_POWER_SUPPLY_BATTERY_IFACE,
-                        udev_device_get_property_value,
-                        "POWER_SUPPLY_CAPACITY_LEVEL");
+                        capacity_level);
   }
 
 #undef POWER_SUPPLY_UPDATE
 
-  udev_device_unref(old);
+  free(old);
 }
 
 #define DBUS_POWER_SUPPLY_GETTER(prop, expr)                                   \
@@ -134,11 +137,9 @@ static void power_supply_update_device(power_supply_t *power_supply,
     return sd_bus_message_append(reply, DHUB_STRING, (expr));                  \
   }
 
-DBUS_POWER_SUPPLY_GETTER(Name, udev_device_get_sysname(power_supply->dev))
-DBUS_POWER_SUPPLY_GETTER(Path, udev_device_get_syspath(power_supply->dev))
-DBUS_POWER_SUPPLY_GETTER(Type,
-                         udev_device_get_property_value(power_supply->dev,
-                                                        "POWER_SUPPLY_TYPE"))
+DBUS_POWER_SUPPLY_GETTER(Name, power_supply->dev->sysname)
+DBUS_POWER_SUPPLY_GETTER(Path, power_supply->dev->syspath)
+DBUS_POWER_SUPPLY_GETTER(Type, power_supply->dev->type)
 
 /**
  * D-Bus base virtual table of power supplies objects.
@@ -154,15 +155,9 @@ static const sd_bus_vtable power_supply_vtable[] = {
     SD_BUS_VTABLE_END,
 };
 
-DBUS_POWER_SUPPLY_GETTER(Status,
-                         udev_device_get_property_value(power_supply->dev,
-                                                        "POWER_SUPPLY_STATUS"))
-DBUS_POWER_SUPPLY_GETTER(
-    Capacity,
-    udev_device_get_property_value(power_supply->dev, "POWER_SUPPLY_CAPACITY"))
-DBUS_POWER_SUPPLY_GETTER(CapacityLevel,
-                         udev_device_get_property_value(
-                             power_supply->dev, "POWER_SUPPLY_CAPACITY_LEVEL"))
+DBUS_POWER_SUPPLY_GETTER(Status, power_supply->dev->status)
+DBUS_POWER_SUPPLY_GETTER(Capacity, power_supply->dev->capacity)
+DBUS_POWER_SUPPLY_GETTER(CapacityLevel, power_supply->dev->capacity_level)
 
 /**
  * D-Bus virtual table for battery power supplies objects.
@@ -202,8 +197,7 @@ static int dbus_get_power_devices(struct sd_bus *bus, const char *path,
   SD_LOG_ERR_GOTO(r, err, "failed to open reply container");
 
   tll_foreach(data->power_devices, it) {
-    const char *syspath = udev_device_get_syspath(it->item->dev);
-    r = sd_bus_message_append(reply, DHUB_STRING, syspath);
+    r = sd_bus_message_append(reply, DHUB_STRING, it->item->dev->syspath);
     SD_LOG_ERR_GOTO(r, err, "failed to append to reply");
   }
 
@@ -231,11 +225,11 @@ static const sd_bus_vtable power_vtable[] = {
     SD_BUS_VTABLE_END,
 };
 
-#define DBUS_ADD_POWER_SUPPLY(bus, power_supply, vtable, iface, obj_path)      \
+#define DBUS_ADD_POWER_SUPPLY(dhub, power_supply, vtable, iface, obj_path)     \
   do {                                                                         \
     sd_bus_slot **slot = calloc(1, sizeof(slot));                              \
-    int r = sd_bus_add_object_vtable(bus, slot, obj_path, iface, vtable,       \
-                                     power_supply);                            \
+    int r = dhub_add_object_vtable(dhub, slot, obj_path, iface, vtable,        \
+                                   power_supply);                              \
     SD_LOG_ERR(r, "failed to add " iface " object");                           \
     if (r < 0)                                                                 \
       free(slot);                                                              \
@@ -243,40 +237,111 @@ static const sd_bus_vtable power_vtable[] = {
       tll_push_back(power_supply->slots, slot);                                \
   } while (0)
 
-#define DBUS_ADD_POWER_SUPPLY_FMT(bus, power_supply, vtable, iface, str_dst,   \
+#define DBUS_ADD_POWER_SUPPLY_FMT(dhub, power_supply, vtable, iface, str_dst,  \
                                   fmt, ...)                                    \
   do {                                                                         \
     int r = asprintf(&str_dst, fmt, ##__VA_ARGS__);                            \
     encode_object_path(str_dst);                                               \
     if (r == -1)                                                               \
       LOG_FATAL("failed to allocate power supply D-Bus object path");          \
-    DBUS_ADD_POWER_SUPPLY(bus, power_supply, vtable, iface, str_dst);          \
+    DBUS_ADD_POWER_SUPPLY(dhub, power_supply, vtable, iface, str_dst);         \
   } while (0)
 
+/**
+ * Adds D-Bus objects of a power supply.
+ */
+static void power_supply_add_objects(power_data_t *data,
+                                     power_supply_t *power_supply) {
+  // /by_path/ object.
+  DBUS_ADD_POWER_SUPPLY_FMT(
+      data->dhub, power_supply, power_supply_vtable, DBUS_POWER_SUPPLY_IFACE,
+      power_supply->by_path_obj_path, "%s/supply/by_path%s", DBUS_POWER_PATH,
+      power_supply->dev->syspath);
+
+  // /by_name/ object.
+  DBUS_ADD_POWER_SUPPLY_FMT(
+      data->dhub, power_supply, power_supply_vtable, DBUS_POWER_SUPPLY_IFACE,
+      power_supply->by_name_obj_path, "%s/supply/by_name/%s", DBUS_POWER_PATH,
+      power_supply->dev->sysname);
+
+  // Power supply battery interface.
+  if (strcmp(power_supply->dev->type, "Battery") == 0) {
+
+    // /by_path/ object.
+    DBUS_ADD_POWER_SUPPLY(data->dhub, power_supply, power_supply_battery_vtable,
+                          DBUS_POWER_SUPPLY_BATTERY_IFACE,
+                          power_supply->by_path_obj_path);
+    // /by_name/ object.
+    DBUS_ADD_POWER_SUPPLY(data->dhub, power_supply, power_supply_battery_vtable,
+                          DBUS_POWER_SUPPLY_BATTERY_IFACE,
+                          power_supply->by_name_obj_path);
+  }
+}
+
+/**
+ * Removes D-Bus objects of a power supply.
+ */
+static void power_supply_remove_objects(power_supply_t *power_supply) {
+  // Free D-Bus slots.
+  tll_foreach(power_supply->slots, it) {
+    sd_bus_slot_unref(*it->item);
+    free(it->item);
+    tll_remove(power_supply->slots, it);
+  }
+
+  // Free object paths.
+  free(power_supply->by_path_obj_path);
+  free(power_supply->by_name_obj_path);
+  power_supply->by_path_obj_path = NULL;
+  power_supply->by_name_obj_path = NULL;
+}
+
+/**
+ * Adds a power supply and its D-Bus objects without emitting any signal. It
+ * takes ownership of device.
+ */
+static power_supply_t *add_power_device(power_data_t *data,
+                                        power_device_t *dev) {
+  power_supply_t *power_supply = calloc(1, sizeof(*power_supply));
+  if (power_supply == NULL)
+    LOG_FATAL("failed to allocate power supply");
+
+  power_supply->dev = dev;
+  power_supply->dhub = data->dhub;
+  power_supply->bus = data->bus;
+  power_supply_add_objects(data, power_supply);
+
+  // Add power supply to list.
+  tll_push_back(data->power_devices, power_supply);
+
+  return power_supply;
+}
+
 /**
  * Register power supply device if it is not already registered and returns
  * true if device wasn't registered.
  */
 static power_supply_t *register_power_device(power_data_t *data,
-                                             struct udev_device *dev) {
+                                             power_device_t *dev) {
 
-  const char *syspath = udev_device_get_syspath(dev);
+  const char *syspath = dev->syspath;
 
   tll_foreach(data->power_devices, it) {
-    if (strcmp(udev_device_get_syspath(it->item->dev), syspath) == 0) {
+    if (strcmp(it->item->dev->syspath, syspath) == 0) {
       // Update device.
       power_supply_update_device(it->item, dev);
 
       power_supply_t *power_supply = it->item;
 
-      // Emit DeviceUpdated signal.
-      int r = sd_bus_emit_signal(data->bus, DBUS_POWER_PATH, DBUS_POWER_IFACE,
-                                 "DeviceUpdated", DHUB_OBJ_PATH,
-                                 power_supply->by_path_obj_path);
+      // Emit DeviceUpdated signal, it is dropped if D-Bus is congested.
+      int r = dhub_emit_signal(data->dhub, DHUB_SIGNAL_PRIO_LOW,
+                               DBUS_POWER_PATH, DBUS_POWER_IFACE,
+                               "DeviceUpdated", DHUB_OBJ_PATH,
+                               power_supply->by_path_obj_path);
       SD_LOG_ERR(r, "failed to emit DeviceUpdated signal");
-      r = sd_bus_emit_signal(data->bus, DBUS_POWER_PATH, DBUS_POWER_IFACE,
-                             "DeviceUpdated", DHUB_OBJ_PATH,
-                             power_supply->by_name_obj_path);
+      r = dhub_emit_signal(data->dhub, DHUB_SIGNAL_PRIO_LOW, DBUS_POWER_PATH,
+                           DBUS_POWER_IFACE, "DeviceUpdated", DHUB_OBJ_PATH,
+                           power_supply->by_name_obj_path);
       SD_LOG_ERR(r, "failed to emit DeviceUpdated signal");
 
       return it->item;
@@ -285,36 +350,7 @@ static power_supply_t *register_power_device(power_data_t *data,
 
   LOG_DBG("new device registered %s", syspath);
 
-  power_supply_t *power_supply = calloc(1, sizeof(*power_supply));
-  power_supply->dev = dev;
-  power_supply->bus = data->bus;
-
-  // /by_path/ object.
-  DBUS_ADD_POWER_SUPPLY_FMT(
-      data->bus, power_supply, power_supply_vtable, DBUS_POWER_SUPPLY_IFACE,
-      power_supply->by_path_obj_path, "%s/supply/by_path%s", DBUS_POWER_PATH,
-      udev_device_get_syspath(power_supply->dev));
-
-  // /by_name/ object.
-  DBUS_ADD_POWER_SUPPLY_FMT(
-      data->bus, power_supply, power_supply_vtable, DBUS_POWER_SUPPLY_IFACE,
-      power_supply->by_name_obj_path, "%s/supply/by_name/%s", DBUS_POWER_PATH,
-      udev_device_get_sysname(power_supply->dev));
-
-  // Power supply battery interface.
-  if (strcmp(udev_device_get_property_value(power_supply->dev,
-                                            "POWER_SUPPLY_TYPE"),
-             "Battery") == 0) {
-
-    // /by_path/ object.
-    DBUS_ADD_POWER_SUPPLY(data->bus, power_supply, power_supply_battery_vtable,
-                          DBUS_POWER_SUPPLY_BATTERY_IFACE,
-                          power_supply->by_path_obj_path);
-    // /by_name/ object.
-    DBUS_ADD_POWER_SUPPLY(data->bus, power_supply, power_supply_battery_vtable,
-                          DBUS_POWER_SUPPLY_BATTERY_IFACE,
-                          power_supply->by_name_obj_path);
-  }
+  power_supply_t *power_supply = add_power_device(data, dev);
 
   // Emit property change signal.
   int r = sd_bus_emit_properties_changed(data->bus, DBUS_POWER_PATH,
@@ -326,9 +362,6 @@ static power_supply_t *register_power_device(power_data_t *data,
                          "DeviceAdded", DHUB_STRING, syspath);
   SD_LOG_ERR(r, "failed to emit DeviceAdded signal");
 
-  // Add power supply to list.
-  tll_push_back(data->power_devices, power_supply);
-
   return power_supply;
 }
 
@@ -336,15 +369,15 @@ static power_supply_t *register_power_device(power_data_t *data,
  * Unregister power supply device if it is registered and returns
  * true if device was registered.
  */
-bool unregister_power_device(power_data_t *data, struct udev_device *dev) {
+static bool unregister_power_device(power_data_t *data, const char *syspath) {
   tll_foreach(data->power_devices, it) {
-    if (it->item->dev == dev) {
+    if (strcmp(it->item->dev->syspath, syspath) == 0) {
       power_supply_t *power_supply = it->item;
+      power_device_t *dev = power_supply->dev;
 
       // Remove device from list.
       tll_remove(data->power_devices, it);
 
-      const char *syspath = udev_device_get_syspath(dev);
       LOG_DBG("unregister %s", syspath);
 
       // Emit property change signal.
@@ -357,22 +390,14 @@ bool unregister_power_device(power_data_t *data, struct udev_device *dev) {
                              "DeviceRemoved", DHUB_STRING, syspath);
       SD_LOG_ERR(r, "failed to emit DeviceRemoved signal");
 
-      // Free D-Bus slots.
-      tll_foreach(power_supply->slots, it) {
-        sd_bus_slot_unref(*it->item);
-        free(it->item);
-        tll_remove(power_supply->slots, it);
-      }
-
-      // Free object paths.
-      free(power_supply->by_path_obj_path);
-      free(power_supply->by_name_obj_path);
+      // Free D-Bus objects.
+      power_supply_remove_objects(power_supply);
 
       // Free power supply.
       free(power_supply);
 
-      // Free udev device.
-      udev_device_unref(dev);
+      // Free device, syspath may be one of its strings.
+      free(dev);
 
       return true;
     }
@@ -381,61 +406,121 @@ bool unregister_power_device(power_data_t *data, struct udev_device *dev) {
   return false;
 }
 
+// Returns bytes allocated on the heap, or -1 if unknown.
+static long long heap_used(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+#else
+  return -1;
+#endif
+}
+
 /**
  * Iterates over all power devices and register them if not already
  * registered.
  */
-void register_all_power_devices(power_data_t *data) {
-  struct udev_enumerate *enumerate = udev_enumerate_new(data->udev);
-  udev_enumerate_add_match_subsystem(enumerate, "power_supply");
-  udev_enumerate_scan_devices(enumerate);
-
-  struct udev_list_entry *devices = udev_enumerate_get_list_entry(enumerate);
-  struct udev_list_entry *entry;
-
-  udev_list_entry_foreach(entry, devices) {
-    const char *path = udev_list_entry_get_name(entry);
-    struct udev_device *dev = udev_device_new_from_syspath(data->udev, path);
+static void register_all_power_devices(power_data_t *data) {
+  long long heap = heap_used();
+  uint64_t start = uv_hrtime();
+
+  data->enumerating = true;
+  data->source->enumerate(data->source);
+  data->enumerating = false;
+
+  power_stats_t *stats = &data->stats;
+  stats->register_ns = uv_hrtime() - start;
+  stats->register_devices = tll_length(data->power_devices);
+  stats->register_bytes = heap != -1 ? heap_used() - heap : -1;
+
+  LOG_INFO("registered %zu power supplies from %s source in %.1fms",
+           stats->register_devices, data->source->name,
+           stats->register_ns / 1e6);
+}
 
-    if (dev != NULL)
-      register_power_device(data, dev);
+// Records event so `dhub replay` feeds it back to replay source.
+static void record_event(power_data_t *data, const power_event_t *ev) {
+  size_t len = 0;
+  void *buf = power_event_encode(ev, &len);
+  if (buf == NULL) {
+    LOG_ERR("failed to encode power supply event");
+    return;
   }
 
-  udev_enumerate_unref(enumerate);
+  dhub_record_event(data->dhub, POWER_REPLAY_KIND, buf, len);
+  free(buf);
 }
 
-static void on_udev_event(uv_poll_t *handle, int status, int events) {
-  LOG_DBG("udev event status=%d events=%d", status, events);
+static void on_device_event(void *userdata, power_event_t *ev) {
+  static const char *const actions[] = {
+      [POWER_ACTION_ADD] = "add",
+      [POWER_ACTION_CHANGE] = "change",
+      [POWER_ACTION_REMOVE] = "remove",
+  };
+  power_data_t *data = userdata;
 
-  power_data_t *data = handle->data;
-  if (handle->data == NULL)
-    return;
+  uint64_t start = dhub_trace_begin();
+  LOG_DBG("%s event '%s' on device '%s'", data->source->name,
+          actions[ev->action], ev->dev->syspath);
 
-  struct udev_device *dev = udev_monitor_receive_device(data->mon);
-  if (dev) {
-    const char *action = udev_device_get_action(dev);
-    const char *path = udev_device_get_syspath(dev);
+  if (dhub_recording(data->dhub))
+    record_event(data, ev);
 
-    LOG_DBG("udev event '%s' on device '%s'", action, path);
+  // Device may be freed once handled.
+  char detail[64] = "";
+  if (start != 0)
+    snprintf(detail, sizeof(detail), "%s %s", actions[ev->action],
+             ev->dev->sysname);
 
-    if (strcmp(action, "remove") == 0) {
-      unregister_power_device(data, dev);
-    } else {
-      register_power_device(data, dev);
-    }
+  if (ev->action == POWER_ACTION_REMOVE) {
+    unregister_power_device(data, ev->dev->syspath);
+    free(ev->dev);
+  } else {
+    register_power_device(data, ev->dev);
   }
+
+  if (!data->enumerating)
+    histogram_record(&data->stats.event_latency, uv_hrtime() - ev->time);
+  dhub_trace_end(start, data->source->name, "event", "%s", detail);
 }
 
-static void on_poll_close(uv_handle_t *handle) {
-  power_data_t *data = handle->data;
+// Writes measurements to $DHUB_POWER_REPORT as JSON, if set.
+static void write_report(power_data_t *data) {
+  const char *path = getenv("DHUB_POWER_REPORT");
+  if (path == NULL || *path == '\0')
+    return;
 
-  // Free udev monitor.
-  if (data->mon != NULL)
-    udev_monitor_unref(data->mon);
+  FILE *f = fopen(path, "we");
+  if (f == NULL) {
+    LOG_ERRNO("failed to open power report file '%s'", path);
+    return;
+  }
 
-  // Free udev context.
-  if (data->udev != NULL)
-    udev_unref(data->udev);
+  power_stats_t *stats = &data->stats;
+  histogram_t *latency = &stats->event_latency;
+  fprintf(f,
+          "{\"source\":\"%s\",\"devices\":%zu,\"register_all_ms\":%.3f,"
+          "\"bytes_per_device\":",
+          data->source->name, stats->register_devices,
+          stats->register_ns / 1e6);
+  if (stats->register_bytes < 0 || stats->register_devices == 0)
+    fputs("null", f);
+  else
+    fprintf(f, "%lld",
+            stats->register_bytes / (long long)stats->register_devices);
+  fprintf(f,
+          ",\"events\":%" PRIu64 ",\"event_latency_us\":{\"p50\":%.1f,"
+          "\"p99\":%.1f,\"p999\":%.1f,\"max\":%.1f}}\n",
+          latency->count, histogram_percentile(latency, 500) / 1e3,
+          histogram_percentile(latency, 990) / 1e3,
+          histogram_percentile(latency, 999) / 1e3, latency->max / 1e3);
+
+  if (fclose(f) != 0)
+    LOG_ERRNO("failed to write power report file '%s'", path);
+}
+
+static void on_source_close(void *userdata) {
+  power_data_t *data = userdata;
 
   // Free D-Bus slot.
   if (data->slot != NULL)
@@ -447,24 +532,23 @@ static void on_poll_close(uv_handle_t *handle) {
   dhub_close(dhub, tag);
 }
 
-void unload(dhub_state_t *dhub, void *mod_data, void *tag) {
+static void power_unload(dhub_state_t *dhub, void *mod_data, void *tag) {
   (void)dhub;
   power_data_t *data = (power_data_t *)mod_data;
 
-  if (data != NULL) {
-    // Free power devices.
-    tll_foreach(data->power_devices, it) {
-      unregister_power_device(data, it->item->dev);
-    }
+  write_report(data);
 
-    // Stop and close poll handle for udev monitor.
-    data->tag = tag;
-    uv_poll_stop(&data->mon_poll);
-    uv_close((uv_handle_t *)&data->mon_poll, on_poll_close);
+  // Free power devices.
+  tll_foreach(data->power_devices, it) {
+    unregister_power_device(data, it->item->dev->syspath);
   }
+
+  // Stop and close device source.
+  data->tag = tag;
+  data->source->close(data->source, on_source_close);
 }
 
-int load(dhub_state_t *dhub, void **mod_data) {
+static int power_load(dhub_state_t *dhub, void **mod_data) {
   power_data_t *data = calloc(1, sizeof(*data));
   LOG_ERR_GOTO(data == NULL, err, "failed to allocate power module data");
 
@@ -472,55 +556,136 @@ int load(dhub_state_t *dhub, void **mod_data) {
 
   // Store D-Hub reference.
   data->dhub = dhub;
+  data->bus = dhub_bus(dhub);
 
-  // Create udev context.
-  data->udev = udev_new();
-  LOG_ERR_GOTO(data->udev == NULL, err, "failed to create udev context");
+  // Open device source, udev unless $DHUB_POWER_SOURCE says otherwise.
+  data->source = power_source_open(dhub, on_device_event, data);
+  LOG_ERR_GOTO(data->source == NULL, err, "failed to open power device source");
 
-  // Create udev monitor.
-  data->mon = udev_monitor_new_from_netlink(data->udev, "udev");
-  LOG_ERR_GOTO(data->mon == NULL, err, "failed to create udev monitor");
+  // Add object to D-Bus.
+  int r = dhub_add_object_vtable(data->dhub, &data->slot, DBUS_POWER_PATH,
+                                 DBUS_POWER_IFACE, power_vtable, data);
+  SD_LOG_ERR_GOTO(r, close, "failed to add Power object to D-Bus");
 
-  // Filter for power supply devices.
-  int r = udev_monitor_filter_add_match_subsystem_devtype(data->mon,
-                                                          "power_supply", NULL);
-  UDEV_LOG_ERR_GOTO(
-      r, err, "failed to add power_supply subsystem filter to udev monitor");
+  register_all_power_devices(data);
 
-  // Start monitoring.
-  r = udev_monitor_enable_receiving(data->mon);
-  UDEV_LOG_ERR_GOTO(r, err, "failed to enable receiving on udev monitor");
+  return 0;
 
-  // Get monitor fd for polling
-  int fd = udev_monitor_get_fd(data->mon);
-  UDEV_LOG_ERR_GOTO(fd, err, "failed to retrieve udev monitor fd");
+close:
+  data->source->close(data->source, free);
+  return 1;
 
-  // Create libuv poll for FD.
-  uv_loop_t *loop = dhub_loop(dhub);
+err:
+  // Free allocated resources on error.
+  free(data);
+  return 1;
+}
 
-  data->mon_poll.data = data;
+// Hot reload state blob, bump version on layout change. Version 1 handed
+// udev devices over, version 2 hands power_device_t over.
+#define POWER_HANDOFF_VERSION 2
 
-  // Poll FD to detect new udev events.
-  r = uv_poll_init(loop, &data->mon_poll, fd);
-  UV_LOG_ERR_GOTO(r, err, "failed to create libuv poll for udev monitor");
+typedef struct {
+  uint32_t version;
+  struct udev *udev;
+  struct udev_monitor *mon;
+  size_t devices_len;
+  void *devices[];
+} power_handoff_t;
 
-  // Add object to D-Bus.
+static int power_save(dhub_state_t *dhub, void *mod_data, void **blob,
+                      size_t *size) {
+  (void)dhub;
+  power_data_t *data = (power_data_t *)mod_data;
+
+  if (data->source->save == NULL) {
+    LOG_ERR("%s power device source can't be handed over",
+            data->source->name);
+    goto err;
+  }
+
+  size_t len = tll_length(data->power_devices);
+  power_handoff_t *handoff =
+      calloc(1, sizeof(*handoff) + len * sizeof(*handoff->devices));
+  LOG_ERR_GOTO(handoff == NULL, err, "failed to allocate power module state");
+
+  *handoff = (power_handoff_t){
+      .version = POWER_HANDOFF_VERSION,
+      .devices_len = len,
+  };
+
+  // Hand devices over and remove their objects.
+  size_t i = 0;
+  tll_foreach(data->power_devices, it) {
+    power_supply_t *power_supply = it->item;
+    handoff->devices[i++] = power_supply->dev;
+    power_supply_remove_objects(power_supply);
+    free(power_supply);
+    tll_remove(data->power_devices, it);
+  }
+
+  data->slot = sd_bus_slot_unref(data->slot);
+
+  // New module polls monitor with its own handle.
+  data->source->save(data->source, &handoff->udev, &handoff->mon);
+  free(data);
+
+  *blob = handoff;
+  *size = sizeof(*handoff) + len * sizeof(*handoff->devices);
+  return 0;
+
+err:
+  return 1;
+}
+
+static int power_restore(dhub_state_t *dhub, void **mod_data, const void *blob,
+                         size_t size) {
+  const power_handoff_t *handoff = blob;
+  if (size < sizeof(*handoff) ||
+      (handoff->version != 1 && handoff->version != POWER_HANDOFF_VERSION) ||
+      size < sizeof(*handoff) +
+                 handoff->devices_len * sizeof(*handoff->devices)) {
+    LOG_ERR("unsupported power module state");
+    return 1;
+  }
+
+  power_data_t *data = calloc(1, sizeof(*data));
+  LOG_ERR_GOTO(data == NULL, err, "failed to allocate power module data");
+
+  data->dhub = dhub;
   data->bus = dhub_bus(dhub);
-  r = sd_bus_add_object_vtable(data->bus, &data->slot, DBUS_POWER_PATH,
-                               DBUS_POWER_IFACE, power_vtable, data);
-  SD_LOG_ERR_GOTO(r, err, "failed to add Power object to D-Bus");
 
-  // Start polling for udev event.
-  r = uv_poll_start(&data->mon_poll, UV_READABLE, on_udev_event);
-  UV_LOG_ERR_GOTO(r, err,
-                  "failed to start polling udev monitor libuv poll handle");
+  int r = dhub_add_object_vtable(data->dhub, &data->slot, DBUS_POWER_PATH,
+                                 DBUS_POWER_IFACE, power_vtable, data);
+  SD_LOG_ERR_GOTO(r, err, "failed to add Power object to D-Bus");
 
-  register_all_power_devices(data);
+  data->source = power_source_udev_restore(dhub, handoff->udev, handoff->mon,
+                                           on_device_event, data);
+  LOG_ERR_GOTO(data->source == NULL, err, "failed to restore udev source");
+
+  // Blob is ours from now on. Devices are registered again without
+  // enumeration nor signals, clients don't see any change.
+  for (size_t i = 0; i < handoff->devices_len; i++) {
+    power_device_t *dev = handoff->devices[i];
+    if (handoff->version == 1) {
+      dev = power_device_from_udev(handoff->devices[i]);
+      if (dev == NULL)
+        LOG_FATAL("failed to allocate power supply device");
+      udev_device_unref(handoff->devices[i]);
+    }
+    add_power_device(data, dev);
+  }
 
+  *mod_data = data;
   return 0;
 
 err:
-  // Free allocated resources on error.
-  unload(dhub, NULL, NULL);
+  if (data != NULL)
+    sd_bus_slot_unref(data->slot);
+  free(data);
   return 1;
 }
+
+DHUB_MODULE(power_udev, .object_prefix = DBUS_POWER_PATH, .load = power_load,
+            .unload = power_unload, .save = power_save,
+            .restore = power_restore);
@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_MODULE "mod-power"
+#include "source.h"
+
+typedef struct {
+  power_source_t source;
+  dhub_state_t *dhub;
+  struct udev *udev;
+  struct udev_monitor *mon;
+  // Allocated apart from source so a restored source doesn't wait for it to
+  // be closed.
+  dhub_poll_t *poll;
+  void (*close_cb)(void *data);
+} udev_source_t;
+
+power_device_t *power_device_from_udev(struct udev_device *dev) {
+  return power_device_new(
+      udev_device_get_syspath(dev), udev_device_get_sysname(dev),
+      udev_device_get_property_value(dev, "POWER_SUPPLY_TYPE"),
+      udev_device_get_property_value(dev, "POWER_SUPPLY_STATUS"),
+      udev_device_get_property_value(dev, "POWER_SUPPLY_CAPACITY"),
+      udev_device_get_property_value(dev, "POWER_SUPPLY_CAPACITY_LEVEL"));
+}
+
+static void report(udev_source_t *src, enum power_action action,
+                   struct udev_device *udev_dev) {
+  power_event_t ev = {
+      .action = action,
+      .dev = power_device_from_udev(udev_dev),
+      .time = uv_hrtime(),
+  };
+  udev_device_unref(udev_dev);
+  if (ev.dev == NULL) {
+    LOG_ERR("failed to allocate power supply device");
+    return;
+  }
+
+  src->source.cb(src->source.data, &ev);
+}
+
+static void source_enumerate(power_source_t *source) {
+  udev_source_t *src = (udev_source_t *)source;
+
+  struct udev_enumerate *enumerate = udev_enumerate_new(src->udev);
+  udev_enumerate_add_match_subsystem(enumerate, "power_supply");
+  udev_enumerate_scan_devices(enumerate);
+
+  struct udev_list_entry *devices = udev_enumerate_get_list_entry(enumerate);
+  struct udev_list_entry *entry;
+
+  udev_list_entry_foreach(entry, devices) {
+    const char *path = udev_list_entry_get_name(entry);
+    struct udev_device *dev = udev_device_new_from_syspath(src->udev, path);
+
+    if (dev != NULL)
+      report(src, POWER_ACTION_ADD, dev);
+  }
+
+  udev_enumerate_unref(enumerate);
+}
+
+static void on_udev_event(uv_poll_t *handle, int status, int events) {
+  LOG_DBG("udev event status=%d events=%d", status, events);
+
+  udev_source_t *src = handle->data;
+  struct udev_device *dev = udev_monitor_receive_device(src->mon);
+  if (dev == NULL)
+    return;
+
+  const char *action = udev_device_get_action(dev);
+  LOG_DBG("udev event '%s' on device '%s'", action,
+          udev_device_get_syspath(dev));
+
+  if (strcmp(action, "remove") == 0)
+    report(src, POWER_ACTION_REMOVE, dev);
+  else if (strcmp(action, "add") == 0)
+    report(src, POWER_ACTION_ADD, dev);
+  else
+    report(src, POWER_ACTION_CHANGE, dev);
+}
+
+static void on_poll_close(uv_handle_t *handle) { free(handle); }
+
+static void stop_poll(udev_source_t *src) {
+  uv_poll_stop(&src->poll->handle);
+  uv_close((uv_handle_t *)&src->poll->handle, on_poll_close);
+  src->poll = NULL;
+}
+
+static void on_close(uv_handle_t *handle) {
+  udev_source_t *src = handle->data;
+  free(handle);
+
+  udev_monitor_unref(src->mon);
+  udev_unref(src->udev);
+
+  void (*close_cb)(void *data) = src->close_cb;
+  void *data = src->source.data;
+  free(src);
+  close_cb(data);
+}
+
+static void source_close(power_source_t *source,
+                         void (*close_cb)(void *data)) {
+  udev_source_t *src = (udev_source_t *)source;
+  src->close_cb = close_cb;
+
+  uv_poll_stop(&src->poll->handle);
+  uv_close((uv_handle_t *)&src->poll->handle, on_close);
+}
+
+static void source_save(power_source_t *source, struct udev **udev,
+                        struct udev_monitor **mon) {
+  udev_source_t *src = (udev_source_t *)source;
+
+  // New module polls monitor with its own handle.
+  stop_poll(src);
+  *udev = src->udev;
+  *mon = src->mon;
+  free(src);
+}
+
+// Starts polling monitor of `src`, it returns a negative libuv error code on
+// error.
+static int start_poll(udev_source_t *src) {
+  src->poll = calloc(1, sizeof(*src->poll));
+  if (src->poll == NULL)
+    return UV_ENOMEM;
+
+  int fd = udev_monitor_get_fd(src->mon);
+  if (fd < 0) {
+    LOG_ERR("failed to retrieve udev monitor fd");
+    free(src->poll);
+    src->poll = NULL;
+    return UV_EBADF;
+  }
+
+  src->poll->handle.data = src;
+  int r = dhub_poll_init(src->dhub, src->poll, fd);
+  if (r < 0) {
+    LOG_ERR("failed to create libuv poll for udev monitor: %s",
+            uv_strerror(r));
+    free(src->poll);
+    src->poll = NULL;
+    return r;
+  }
+
+  r = dhub_poll_start(src->poll, UV_READABLE, on_udev_event);
+  if (r < 0) {
+    LOG_ERR("failed to start polling udev monitor: %s", uv_strerror(r));
+    stop_poll(src);
+  }
+
+  return r;
+}
+
+static udev_source_t *new_source(dhub_state_t *dhub, power_event_cb cb,
+                                 void *data) {
+  udev_source_t *src = calloc(1, sizeof(*src));
+  if (src == NULL) {
+    LOG_ERR("failed to allocate udev device source");
+    return NULL;
+  }
+
+  src->source = (power_source_t){
+      .name = "udev",
+      .cb = cb,
+      .data = data,
+      .enumerate = source_enumerate,
+      .close = source_close,
+      .save = source_save,
+  };
+  src->dhub = dhub;
+  return src;
+}
+
+power_source_t *power_source_udev_open(dhub_state_t *dhub, power_event_cb cb,
+                                       void *data) {
+  udev_source_t *src = new_source(dhub, cb, data);
+  if (src == NULL)
+    return NULL;
+
+  // Create udev context.
+  src->udev = udev_new();
+  if (src->udev == NULL) {
+    LOG_ERR("failed to create udev context");
+    goto err;
+  }
+
+  // Create udev monitor.
+  src->mon = udev_monitor_new_from_netlink(src->udev, "udev");
+  if (src->mon == NULL) {
+    LOG_ERR("failed to create udev monitor");
+    goto err;
+  }
+
+  // Filter for power supply devices.
+  int r = udev_monitor_filter_add_match_subsystem_devtype(src->mon,
+                                                          "power_supply", NULL);
+  if (r < 0) {
+    LOG_ERR("failed to add power_supply subsystem filter to udev monitor");
+    goto err;
+  }
+
+  // Start monitoring.
+  r = udev_monitor_enable_receiving(src->mon);
+  if (r < 0) {
+    LOG_ERR("failed to enable receiving on udev monitor");
+    goto err;
+  }
+
+  if (start_poll(src) < 0)
+    goto err;
+
+  return &src->source;
+
+err:
+  if (src->mon != NULL)
+    udev_monitor_unref(src->mon);
+  if (src->udev != NULL)
+    udev_unref(src->udev);
+  free(src);
+  return NULL;
+}
+
+power_source_t *power_source_udev_restore(dhub_state_t *dhub,
+                                          struct udev *udev,
+                                          struct udev_monitor *mon,
+                                          power_event_cb cb, void *data) {
+  udev_source_t *src = new_source(dhub, cb, data);
+  if (src == NULL)
+    return NULL;
+
+  src->udev = udev;
+  src->mon = mon;
+  if (start_poll(src) < 0) {
+    free(src);
+    return NULL;
+  }
+
+  return &src->source;
+}
@@ -0,0 +1,66 @@
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_MODULE "mod-power"
+#include "source.h"
+
+typedef struct {
+  power_source_t source;
+  dhub_state_t *dhub;
+} replay_source_t;
+
+static void on_replay(const void *data, size_t len, void *userdata) {
+  replay_source_t *src = userdata;
+
+  power_event_t ev;
+  if (power_event_decode(data, len, &ev) == -1) {
+    LOG_WARN("invalid replayed power supply event");
+    return;
+  }
+
+  src->source.cb(src->source.data, &ev);
+}
+
+static void source_enumerate(power_source_t *source) {
+  // Recording starts with add events of devices present at the time.
+  (void)source;
+}
+
+static void source_close(power_source_t *source,
+                         void (*close_cb)(void *data)) {
+  replay_source_t *src = (replay_source_t *)source;
+  dhub_replay_handler(src->dhub, POWER_REPLAY_KIND, NULL, NULL);
+
+  void *data = src->source.data;
+  free(src);
+  close_cb(data);
+}
+
+power_source_t *power_source_replay_open(dhub_state_t *dhub, power_event_cb cb,
+                                         void *data) {
+  replay_source_t *src = calloc(1, sizeof(*src));
+  if (src == NULL) {
+    LOG_ERR("failed to allocate replay device source");
+    return NULL;
+  }
+
+  // Replayed devices can't be handed over on hot reload.
+  src->source = (power_source_t){
+      .name = "replay",
+      .cb = cb,
+      .data = data,
+      .enumerate = source_enumerate,
+      .close = source_close,
+  };
+  src->dhub = dhub;
+
+  int r = dhub_replay_handler(dhub, POWER_REPLAY_KIND, on_replay, src);
+  if (r < 0) {
+    LOG_ERR("failed to register power supply replay handler: %s",
+            strerror(-r));
+    free(src);
+    return NULL;
+  }
+
+  return &src->source;
+}
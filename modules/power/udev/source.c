@@ -0,0 +1,92 @@
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG_MODULE "mod-power"
+#include "source.h"
+
+power_device_t *power_device_new(const char *syspath, const char *sysname,
+                                 const char *type, const char *status,
+                                 const char *capacity,
+                                 const char *capacity_level) {
+  const char *src[] = {syspath, sysname, type, status, capacity,
+                       capacity_level};
+  size_t len[sizeof(src) / sizeof(*src)];
+  size_t size = sizeof(power_device_t);
+  for (size_t i = 0; i < sizeof(src) / sizeof(*src); i++) {
+    if (src[i] == NULL)
+      src[i] = "";
+    len[i] = strlen(src[i]) + 1;
+    size += len[i];
+  }
+
+  power_device_t *dev = malloc(size);
+  if (dev == NULL)
+    return NULL;
+
+  // Copy strings one after the other.
+  const char **dst[] = {&dev->syspath, &dev->sysname,  &dev->type,
+                        &dev->status,  &dev->capacity, &dev->capacity_level};
+  char *str = dev->strings;
+  for (size_t i = 0; i < sizeof(src) / sizeof(*src); i++) {
+    memcpy(str, src[i], len[i]);
+    *dst[i] = str;
+    str += len[i];
+  }
+
+  return dev;
+}
+
+void *power_event_encode(const power_event_t *ev, size_t *len) {
+  // Device strings are stored one after the other, capacity level is last.
+  const power_device_t *dev = ev->dev;
+  size_t size = dev->capacity_level + strlen(dev->capacity_level) + 1 -
+                dev->strings;
+
+  uint8_t *buf = malloc(1 + size);
+  if (buf == NULL)
+    return NULL;
+
+  buf[0] = ev->action;
+  memcpy(buf + 1, dev->strings, size);
+  *len = 1 + size;
+  return buf;
+}
+
+int power_event_decode(const void *data, size_t len, power_event_t *ev) {
+  const char *p = data;
+  const char *end = p + len;
+  if (len < 1 || (uint8_t)*p > POWER_ACTION_REMOVE)
+    return -1;
+
+  enum power_action action = (uint8_t)*p++;
+  const char *props[6];
+  for (size_t i = 0; i < sizeof(props) / sizeof(*props); i++) {
+    const char *nul = memchr(p, '\0', end - p);
+    if (nul == NULL)
+      return -1;
+    props[i] = p;
+    p = nul + 1;
+  }
+
+  power_device_t *dev = power_device_new(props[0], props[1], props[2],
+                                         props[3], props[4], props[5]);
+  if (dev == NULL)
+    return -1;
+
+  *ev = (power_event_t){.action = action, .dev = dev, .time = uv_hrtime()};
+  return 0;
+}
+
+power_source_t *power_source_open(dhub_state_t *dhub, power_event_cb cb,
+                                  void *data) {
+  const char *name = getenv("DHUB_POWER_SOURCE");
+  if (name == NULL || *name == '\0' || strcmp(name, "udev") == 0)
+    return power_source_udev_open(dhub, cb, data);
+  if (strcmp(name, "synthetic") == 0)
+    return power_source_synthetic_open(dhub, cb, data);
+  if (strcmp(name, "replay") == 0)
+    return power_source_replay_open(dhub, cb, data);
+
+  LOG_ERR("unknown power device source '%s'", name);
+  return NULL;
+}
@@ -0,0 +1,148 @@
+#ifndef DHUB_POWER_SOURCE_H_INCLUDE
+#define DHUB_POWER_SOURCE_H_INCLUDE
+
+#include <libudev.h>
+#include <stdint.h>
+
+#include "dhub.h"
+
+/**
+ * Snapshot of a power supply device properties. Strings are stored right
+ * after the structure, in the same allocation, and missing properties are
+ * empty strings. It is freed with free().
+ */
+typedef struct power_device {
+  const char *syspath;
+  const char *sysname;
+  const char *type;
+  const char *status;
+  const char *capacity;
+  const char *capacity_level;
+  char strings[];
+} power_device_t;
+
+/**
+ * Allocates a device snapshot, NULL properties are stored as empty strings.
+ * It returns NULL on allocation failure.
+ */
+power_device_t *power_device_new(const char *syspath, const char *sysname,
+                                 const char *type, const char *status,
+                                 const char *capacity,
+                                 const char *capacity_level);
+
+/**
+ * Returns a snapshot of udev device `dev`, or NULL on allocation failure.
+ */
+power_device_t *power_device_from_udev(struct udev_device *dev);
+
+enum power_action {
+  POWER_ACTION_ADD,
+  POWER_ACTION_CHANGE,
+  POWER_ACTION_REMOVE,
+};
+
+/**
+ * A device event: an added, changed or removed device.
+ */
+typedef struct power_event {
+  enum power_action action;
+  // Ownership is passed to event callback.
+  power_device_t *dev;
+  // uv_hrtime() when event occurred.
+  uint64_t time;
+} power_event_t;
+
+typedef void (*power_event_cb)(void *data, power_event_t *ev);
+
+// Kind of power supply events recorded with dhub_record_event().
+#define POWER_REPLAY_KIND "power_udev"
+
+/**
+ * Encodes event for dhub_record_event(): action byte followed by device
+ * properties as NUL-terminated strings. It returns a buffer to free with
+ * free() or NULL on allocation failure.
+ */
+void *power_event_encode(const power_event_t *ev, size_t *len);
+
+/**
+ * Decodes an event encoded by power_event_encode(), its time is set to now.
+ * It returns -1 if data is invalid or on allocation failure.
+ */
+int power_event_decode(const void *data, size_t len, power_event_t *ev);
+
+/**
+ * A power supply device source: live udev devices or synthetic ones. Events
+ * are reported to `cb` from loop callbacks.
+ */
+typedef struct power_source {
+  const char *name;
+  power_event_cb cb;
+  void *data;
+
+  /**
+   * Reports every present device with an add event.
+   */
+  void (*enumerate)(struct power_source *source);
+
+  /**
+   * Stops reporting events and frees source. `close_cb` is called with
+   * source `data` once done.
+   */
+  void (*close)(struct power_source *source, void (*close_cb)(void *data));
+
+  /**
+   * Stops reporting events and hands udev context and monitor over for hot
+   * reload, then frees source. It is NULL if source can't be handed over.
+   */
+  void (*save)(struct power_source *source, struct udev **udev,
+               struct udev_monitor **mon);
+} power_source_t;
+
+/**
+ * Opens source selected by $DHUB_POWER_SOURCE, "udev" (default),
+ * "synthetic" or "replay". It returns NULL on error.
+ */
+power_source_t *power_source_open(dhub_state_t *dhub, power_event_cb cb,
+                                  void *data);
+
+/**
+ * Opens a source monitoring udev power_supply subsystem. It returns NULL on
+ * error.
+ */
+power_source_t *power_source_udev_open(dhub_state_t *dhub, power_event_cb cb,
+                                       void *data);
+
+/**
+ * Opens a udev source taking over `udev` and `mon` handed over by save().
+ * They're left untouched on error.
+ */
+power_source_t *power_source_udev_restore(dhub_state_t *dhub,
+                                          struct udev *udev,
+                                          struct udev_monitor *mon,
+                                          power_event_cb cb, void *data);
+
+/**
+ * Opens a source of generated devices, for benchmarks and tests without
+ * hardware. It is configured with environment variables:
+ *
+ * - $DHUB_POWER_DEVICES: number of devices, 1000 by default.
+ * - $DHUB_POWER_RATE: events per second, none by default. Events go through
+ *   devices in a round-robin fashion and change their capacity.
+ * - $DHUB_POWER_REMOVE_EVERY: one in N events removes its device, it is added
+ *   back by its next event. Devices are never removed by default.
+ * - $DHUB_POWER_EVENTS: number of events after which the stream ends,
+ *   unbounded by default.
+ *
+ * It returns NULL on error.
+ */
+power_source_t *power_source_synthetic_open(dhub_state_t *dhub,
+                                            power_event_cb cb, void *data);
+
+/**
+ * Opens a source of events replayed by `dhub replay` from a recording. It has
+ * no device until replayed events add them. It returns NULL on error.
+ */
+power_source_t *power_source_replay_open(dhub_state_t *dhub, power_event_cb cb,
+                                         void *data);
+
+#endif
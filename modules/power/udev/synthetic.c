@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LOG_MODULE "mod-power"
+#include "source.h"
+
+// Events generated per timer tick at most, a source lagging behind its rate
+// catches up over several ticks.
+#define MAX_BATCH 1024
+
+typedef struct {
+  power_source_t source;
+  dhub_timer_t timer;
+  void (*close_cb)(void *data);
+  unsigned int devices;
+  unsigned int rate;
+  unsigned int remove_every;
+  unsigned int events;
+  uint64_t generated;
+  // uv_hrtime() of first tick.
+  uint64_t start;
+  bool *removed;
+} synthetic_source_t;
+
+static unsigned int env_uint(const char *name, unsigned int def) {
+  const char *str = getenv(name);
+  if (str == NULL || *str == '\0')
+    return def;
+
+  char *end = NULL;
+  errno = 0;
+  unsigned long v = strtoul(str, &end, 10);
+  if (errno != 0 || *end != '\0' || v > UINT_MAX) {
+    LOG_WARN("invalid $%s value '%s', using %u", name, str, def);
+    return def;
+  }
+
+  return v;
+}
+
+// Returns state of device `i` after `round` events, capacity goes down by one
+// on each event.
+static power_device_t *new_device(unsigned int i, uint64_t round) {
+  char sysname[16], syspath[64], capacity[4];
+  bool mains = i % 4 == 3;
+  snprintf(sysname, sizeof(sysname), "%s%u", mains ? "AC" : "BAT", i);
+  snprintf(syspath, sizeof(syspath), "/sys/devices/synthetic/power_supply/%s",
+           sysname);
+  if (mains)
+    return power_device_new(syspath, sysname, "Mains", NULL, NULL, NULL);
+
+  unsigned int level = 100 - (i + round) % 101;
+  snprintf(capacity, sizeof(capacity), "%u", level);
+  return power_device_new(syspath, sysname, "Battery",
+                          level == 100 ? "Full" : "Discharging", capacity,
+                          level == 100  ? "Full"
+                          : level > 20 ? "Normal"
+                          : level > 5  ? "Low"
+                                       : "Critical");
+}
+
+static void report(synthetic_source_t *src, enum power_action action,
+                   power_device_t *dev, uint64_t time) {
+  if (dev == NULL) {
+    LOG_ERR("failed to allocate power supply device");
+    return;
+  }
+
+  power_event_t ev = {.action = action, .dev = dev, .time = time};
+  src->source.cb(src->source.data, &ev);
+}
+
+static void source_enumerate(power_source_t *source) {
+  synthetic_source_t *src = (synthetic_source_t *)source;
+  for (unsigned int i = 0; i < src->devices; i++) {
+    if (!src->removed[i])
+      report(src, POWER_ACTION_ADD, new_device(i, 0), uv_hrtime());
+  }
+}
+
+// Generates event number `src->generated`.
+static void generate(synthetic_source_t *src) {
+  uint64_t n = src->generated++;
+  unsigned int i = n % src->devices;
+  uint64_t round = n / src->devices + 1;
+  // Time event is due at, so latency includes time spent lagging behind.
+  uint64_t time = src->start + (uint64_t)(n * 1e9 / src->rate);
+
+  enum power_action action = POWER_ACTION_CHANGE;
+  if (src->removed[i]) {
+    action = POWER_ACTION_ADD;
+    src->removed[i] = false;
+  } else if (src->remove_every != 0 && (n + 1) % src->remove_every == 0) {
+    action = POWER_ACTION_REMOVE;
+    src->removed[i] = true;
+  }
+
+  report(src, action, new_device(i, round), time);
+}
+
+static void on_tick(uv_timer_t *handle) {
+  synthetic_source_t *src = handle->data;
+  uint64_t now = uv_hrtime();
+  if (src->start == 0)
+    src->start = now;
+
+  uint64_t due = (uint64_t)((now - src->start) / 1e9 * src->rate) + 1;
+  if (src->events != 0 && due > src->events)
+    due = src->events;
+
+  for (unsigned int n = 0; src->generated < due && n < MAX_BATCH; n++)
+    generate(src);
+
+  if (src->events != 0 && src->generated >= src->events) {
+    LOG_INFO("synthetic event stream ended after %" PRIu64 " events",
+             src->generated);
+    uv_timer_stop(handle);
+  }
+}
+
+static void on_close(uv_handle_t *handle) {
+  synthetic_source_t *src = handle->data;
+  void (*close_cb)(void *data) = src->close_cb;
+  void *data = src->source.data;
+
+  free(src->removed);
+  free(src);
+  close_cb(data);
+}
+
+static void on_error_close(uv_handle_t *handle) { free(handle->data); }
+
+static void source_close(power_source_t *source,
+                         void (*close_cb)(void *data)) {
+  synthetic_source_t *src = (synthetic_source_t *)source;
+  src->close_cb = close_cb;
+
+  uv_timer_stop(&src->timer.handle);
+  uv_close((uv_handle_t *)&src->timer.handle, on_close);
+}
+
+power_source_t *power_source_synthetic_open(dhub_state_t *dhub,
+                                            power_event_cb cb, void *data) {
+  synthetic_source_t *src = calloc(1, sizeof(*src));
+  if (src == NULL) {
+    LOG_ERR("failed to allocate synthetic device source");
+    return NULL;
+  }
+
+  // Synthetic devices can't be handed over on hot reload.
+  src->source = (power_source_t){
+      .name = "synthetic",
+      .cb = cb,
+      .data = data,
+      .enumerate = source_enumerate,
+      .close = source_close,
+  };
+  src->devices = env_uint("DHUB_POWER_DEVICES", 1000);
+  src->rate = env_uint("DHUB_POWER_RATE", 0);
+  src->remove_every = env_uint("DHUB_POWER_REMOVE_EVERY", 0);
+  src->events = env_uint("DHUB_POWER_EVENTS", 0);
+
+  src->removed = calloc(src->devices, sizeof(*src->removed));
+  if (src->removed == NULL && src->devices != 0) {
+    LOG_ERR("failed to allocate synthetic devices");
+    free(src);
+    return NULL;
+  }
+
+  src->timer.handle.data = src;
+  int r = dhub_timer_init(dhub, &src->timer, DHUB_TIMER_PRIO_NORMAL);
+  if (r < 0) {
+    LOG_ERR("failed to create synthetic events timer: %s", uv_strerror(r));
+    free(src->removed);
+    free(src);
+    return NULL;
+  }
+
+  if (src->rate != 0 && src->devices != 0) {
+    // Tick every millisecond at most, several events are generated per tick
+    // at high rates.
+    uint64_t period = src->rate >= 1000 ? 1 : 1000 / src->rate;
+    r = dhub_timer_start(&src->timer, on_tick, period, period);
+    if (r < 0) {
+      LOG_ERR("failed to start synthetic events timer: %s", uv_strerror(r));
+      free(src->removed);
+      uv_close((uv_handle_t *)&src->timer.handle, on_error_close);
+      return NULL;
+    }
+  }
+
+  LOG_INFO("synthetic source: %u devices, %u events/s", src->devices,
+           src->rate);
+  return &src->source;
+}
@@ -0,0 +1,737 @@
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "binlog.h"
+#include "dumpfile.h"
+
+#define BINLOG_MAP_SIZE (2 * BINLOG_MAX_STRINGS)
+
+// Buffer of a thread. It is a flight recorder: oldest records are dropped to
+// make room for new ones. Buffers are never freed so they can be dumped after
+// their thread exited, until a new thread reuses them.
+typedef struct binlog_buffer {
+  struct binlog_buffer *next;
+  _Atomic bool used;
+  uint64_t thread_id;
+  // Bytes written so far and position of oldest record.
+  _Atomic uint64_t head;
+  _Atomic uint64_t tail;
+
+  // Interned strings addresses, reset when epoch changes.
+  uint32_t epoch;
+  struct {
+    const char *ptr;
+    uint32_t id;
+  } map[BINLOG_MAP_SIZE];
+  uint32_t map_len;
+  // Interned strings ids + 1 indexed by content, they are kept across epochs
+  // so strings of reloaded modules are interned once.
+  uint32_t by_content[BINLOG_MAP_SIZE];
+  _Atomic uint32_t nstrings;
+  char *strings[BINLOG_MAX_STRINGS];
+
+  uint8_t data[BINLOG_BUFFER_SIZE];
+} binlog_buffer_t;
+
+static _Thread_local binlog_buffer_t *current = NULL;
+static binlog_buffer_t *_Atomic buffers = NULL;
+static _Atomic uint32_t epoch = 0;
+// Releases buffer of an exiting thread.
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+
+static void release_buffer(void *data) {
+  binlog_buffer_t *buf = data;
+  if (current == buf)
+    current = NULL;
+  atomic_store_explicit(&buf->used, false, memory_order_release);
+}
+
+static void create_buffer_key(void) {
+  pthread_key_create(&buffer_key, release_buffer);
+}
+
+// Claims buffer of an exited thread, if any. Its records are dropped but its
+// interned strings are kept, their addresses are valid until epoch changes.
+static binlog_buffer_t *reuse_buffer(void) {
+  for (binlog_buffer_t *buf = atomic_load(&buffers); buf != NULL;
+       buf = buf->next) {
+    bool used = false;
+    if (atomic_load_explicit(&buf->used, memory_order_relaxed) ||
+        !atomic_compare_exchange_strong(&buf->used, &used, true))
+      continue;
+
+    uint64_t head = atomic_load_explicit(&buf->head, memory_order_relaxed);
+    atomic_store_explicit(&buf->tail, head, memory_order_release);
+    return buf;
+  }
+
+  return NULL;
+}
+
+static binlog_buffer_t *thread_buffer(void) {
+  if (current != NULL)
+    return current;
+
+  pthread_once(&buffer_key_once, create_buffer_key);
+  binlog_buffer_t *buf = reuse_buffer();
+  if (buf == NULL) {
+    buf = calloc(1, sizeof(*buf));
+    if (buf == NULL)
+      return NULL;
+    buf->used = true;
+    buf->epoch = atomic_load_explicit(&epoch, memory_order_relaxed);
+
+    // Lock-free push, buffers are never removed.
+    binlog_buffer_t *head = atomic_load(&buffers);
+    do {
+      buf->next = head;
+    } while (!atomic_compare_exchange_weak(&buffers, &head, buf));
+  }
+  buf->thread_id = (uint64_t)gettid();
+
+  // Buffer is never reused if it can't be released on exit.
+  pthread_setspecific(buffer_key, buf);
+  current = buf;
+  return buf;
+}
+
+static uint32_t hash_string(const char *str) {
+  // FNV-1a.
+  uint32_t h = 2166136261u;
+  for (const unsigned char *c = (const unsigned char *)str; *c != '\0'; c++) {
+    h ^= *c;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// Returns id of string equal to `str`, interning it if there is none.
+static uint32_t intern_content(binlog_buffer_t *buf, const char *str) {
+  size_t i = hash_string(str);
+  while (1) {
+    i &= BINLOG_MAP_SIZE - 1;
+    uint32_t id = buf->by_content[i];
+    if (id == 0)
+      break;
+    if (strcmp(buf->strings[id - 1], str) == 0)
+      return id - 1;
+    i++;
+  }
+
+  // Table holds at most BINLOG_MAX_STRINGS entries, it can't be full.
+  uint32_t id = atomic_load_explicit(&buf->nstrings, memory_order_relaxed);
+  if (id >= BINLOG_MAX_STRINGS)
+    return BINLOG_NO_STRING;
+
+  buf->strings[id] = strdup(str);
+  if (buf->strings[id] == NULL)
+    return BINLOG_NO_STRING;
+  atomic_store_explicit(&buf->nstrings, id + 1, memory_order_release);
+
+  buf->by_content[i] = id + 1;
+  return id;
+}
+
+static uint32_t intern(binlog_buffer_t *buf, const char *str) {
+  if (str == NULL)
+    return BINLOG_NO_STRING;
+
+  uint32_t e = atomic_load_explicit(&epoch, memory_order_relaxed);
+  if (buf->epoch != e) {
+    memset(buf->map, 0, sizeof(buf->map));
+    buf->map_len = 0;
+    buf->epoch = e;
+  }
+
+  size_t i = ((uintptr_t)str * UINT64_C(0x9E3779B97F4A7C15)) >> 32;
+  while (1) {
+    i &= BINLOG_MAP_SIZE - 1;
+    if (buf->map[i].ptr == str)
+      return buf->map[i].id;
+    if (buf->map[i].ptr == NULL)
+      break;
+    i++;
+  }
+
+  uint32_t id = intern_content(buf, str);
+  // Equal strings at different addresses share an id, stop caching
+  // addresses once map is half full so it never fills up.
+  if (id == BINLOG_NO_STRING || buf->map_len >= BINLOG_MAX_STRINGS)
+    return id;
+
+  buf->map[i].ptr = str;
+  buf->map[i].id = id;
+  buf->map_len++;
+  return id;
+}
+
+void binlog_forget_strings(void) { atomic_fetch_add(&epoch, 1); }
+
+static void ring_write(binlog_buffer_t *buf, uint64_t pos, const void *data,
+                       size_t len) {
+  size_t offset = pos & (BINLOG_BUFFER_SIZE - 1);
+  size_t first = BINLOG_BUFFER_SIZE - offset;
+  if (first > len)
+    first = len;
+
+  memcpy(&buf->data[offset], data, first);
+  memcpy(&buf->data[0], (const uint8_t *)data + first, len - first);
+}
+
+static void ring_read(const uint8_t *data, uint64_t pos, void *out,
+                      size_t len) {
+  size_t offset = pos & (BINLOG_BUFFER_SIZE - 1);
+  size_t first = BINLOG_BUFFER_SIZE - offset;
+  if (first > len)
+    first = len;
+
+  memcpy(out, &data[offset], first);
+  memcpy((uint8_t *)out + first, &data[0], len - first);
+}
+
+typedef struct {
+  uint8_t data[BINLOG_RECORD_MAX];
+  size_t len;
+  unsigned int nargs;
+  bool full;
+} record_buf_t;
+
+static void put_arg(record_buf_t *rec, enum binlog_arg type, uint64_t value) {
+  if (rec->full || rec->nargs == UINT8_MAX ||
+      rec->len + 1 + sizeof(value) > sizeof(rec->data)) {
+    rec->full = true;
+    return;
+  }
+
+  rec->data[rec->len++] = type;
+  memcpy(&rec->data[rec->len], &value, sizeof(value));
+  rec->len += sizeof(value);
+  rec->nargs++;
+}
+
+static void put_string(record_buf_t *rec, const char *str, int precision) {
+  if (str == NULL)
+    str = "(null)";
+
+  size_t room = sizeof(rec->data) - rec->len;
+  if (rec->full || rec->nargs == UINT8_MAX || room < 1 + sizeof(uint16_t)) {
+    rec->full = true;
+    return;
+  }
+  room -= 1 + sizeof(uint16_t);
+
+  size_t len = precision >= 0 ? strnlen(str, precision) : strlen(str);
+  if (len > room)
+    len = room;
+  uint16_t len16 = len;
+
+  rec->data[rec->len++] = BINLOG_ARG_STRING;
+  memcpy(&rec->data[rec->len], &len16, sizeof(len16));
+  rec->len += sizeof(len16);
+  memcpy(&rec->data[rec->len], str, len);
+  rec->len += len;
+  rec->nargs++;
+}
+
+enum length {
+  LEN_NONE,
+  LEN_HH,
+  LEN_H,
+  LEN_L,
+  LEN_LL,
+  LEN_Z,
+  LEN_J,
+  LEN_T,
+  LEN_LONG_DOUBLE,
+};
+
+// Parses length modifier at `*p` and moves past it.
+static enum length parse_length(const char **p) {
+  const char *c = *p;
+  enum length len = LEN_NONE;
+  switch (*c) {
+  case 'h':
+    len = c[1] == 'h' ? LEN_HH : LEN_H;
+    break;
+  case 'l':
+    len = c[1] == 'l' ? LEN_LL : LEN_L;
+    break;
+  case 'q':
+    len = LEN_LL;
+    break;
+  case 'z':
+    len = LEN_Z;
+    break;
+  case 'j':
+    len = LEN_J;
+    break;
+  case 't':
+    len = LEN_T;
+    break;
+  case 'L':
+    len = LEN_LONG_DOUBLE;
+    break;
+  default:
+    return LEN_NONE;
+  }
+
+  *p += len == LEN_HH || (len == LEN_LL && *c == 'l') ? 2 : 1;
+  return len;
+}
+
+static int64_t signed_arg(enum length len, va_list *va) {
+  switch (len) {
+  case LEN_L:
+    return va_arg(*va, long);
+  case LEN_LL:
+    return va_arg(*va, long long);
+  case LEN_Z:
+    return va_arg(*va, ssize_t);
+  case LEN_J:
+    return va_arg(*va, intmax_t);
+  case LEN_T:
+    return va_arg(*va, ptrdiff_t);
+  default:
+    return va_arg(*va, int);
+  }
+}
+
+static uint64_t unsigned_arg(enum length len, va_list *va) {
+  switch (len) {
+  case LEN_L:
+    return va_arg(*va, unsigned long);
+  case LEN_LL:
+    return va_arg(*va, unsigned long long);
+  case LEN_Z:
+    return va_arg(*va, size_t);
+  case LEN_J:
+    return va_arg(*va, uintmax_t);
+  case LEN_T:
+    return va_arg(*va, ptrdiff_t);
+  default:
+    return va_arg(*va, unsigned int);
+  }
+}
+
+// Records arguments referenced by printf format `fmt`.
+static void put_args(record_buf_t *rec, const char *fmt, va_list *va) {
+  for (const char *p = fmt; *p != '\0'; p++) {
+    if (*p != '%')
+      continue;
+    p++;
+    if (*p == '%')
+      continue;
+
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+      p++;
+
+    if (*p == '*') {
+      put_arg(rec, BINLOG_ARG_INT, va_arg(*va, int));
+      p++;
+    } else {
+      while (isdigit((unsigned char)*p))
+        p++;
+    }
+
+    int precision = -1;
+    if (*p == '.') {
+      p++;
+      if (*p == '*') {
+        precision = va_arg(*va, int);
+        put_arg(rec, BINLOG_ARG_INT, precision);
+        p++;
+      } else {
+        precision = atoi(p);
+        while (isdigit((unsigned char)*p))
+          p++;
+      }
+    }
+
+    enum length len = parse_length(&p);
+    switch (*p) {
+    case 'd':
+    case 'i':
+      put_arg(rec, BINLOG_ARG_INT, signed_arg(len, va));
+      break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+      put_arg(rec, BINLOG_ARG_UINT, unsigned_arg(len, va));
+      break;
+    case 'c':
+      put_arg(rec, BINLOG_ARG_INT, va_arg(*va, int));
+      break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A': {
+      double d = len == LEN_LONG_DOUBLE ? (double)va_arg(*va, long double)
+                                        : va_arg(*va, double);
+      uint64_t bits = 0;
+      memcpy(&bits, &d, sizeof(bits));
+      put_arg(rec, BINLOG_ARG_DOUBLE, bits);
+      break;
+    }
+    case 's':
+      put_string(rec, va_arg(*va, const char *), precision);
+      break;
+    case 'p':
+      put_arg(rec, BINLOG_ARG_POINTER, (uintptr_t)va_arg(*va, void *));
+      break;
+    case 'n':
+      (void)va_arg(*va, void *);
+      break;
+    default:
+      // Unsupported conversion, following arguments can't be located.
+      return;
+    }
+  }
+}
+
+void binlog_record(enum log_class log_class, const char *module,
+                   const char *file, int lineno, int sys_errno,
+                   const char *fmt, va_list va) {
+  binlog_buffer_t *buf = thread_buffer();
+  if (buf == NULL)
+    return;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  record_buf_t rec;
+  rec.len = sizeof(binlog_record_t);
+  rec.nargs = 0;
+  rec.full = false;
+
+  va_list args;
+  va_copy(args, va);
+  put_args(&rec, fmt, &args);
+  va_end(args);
+
+  binlog_record_t hdr = {
+      .size = rec.len,
+      .log_class = log_class,
+      .nargs = rec.nargs,
+      .fmt = intern(buf, fmt),
+      .file = intern(buf, file),
+      .module = intern(buf, module),
+      .lineno = lineno,
+      .sys_errno = sys_errno,
+      .timestamp_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec,
+  };
+  memcpy(rec.data, &hdr, sizeof(hdr));
+
+  // Drop oldest records to make room.
+  uint64_t head = atomic_load_explicit(&buf->head, memory_order_relaxed);
+  uint64_t tail = atomic_load_explicit(&buf->tail, memory_order_relaxed);
+  while (head + rec.len - tail > BINLOG_BUFFER_SIZE) {
+    uint16_t size = 0;
+    ring_read(buf->data, tail, &size, sizeof(size));
+    tail += size;
+  }
+  atomic_store_explicit(&buf->tail, tail, memory_order_release);
+
+  ring_write(buf, head, rec.data, rec.len);
+  atomic_store_explicit(&buf->head, head + rec.len, memory_order_release);
+}
+
+static int dump_buffer(binlog_buffer_t *buf, FILE *f) {
+  uint32_t nstrings =
+      atomic_load_explicit(&buf->nstrings, memory_order_acquire);
+  uint64_t head = atomic_load_explicit(&buf->head, memory_order_acquire);
+  uint64_t tail = atomic_load_explicit(&buf->tail, memory_order_acquire);
+  // Oldest records were dropped after head was read.
+  uint64_t len = tail <= head ? head - tail : 0;
+
+  fwrite(&buf->thread_id, sizeof(buf->thread_id), 1, f);
+  fwrite(&nstrings, sizeof(nstrings), 1, f);
+  for (uint32_t i = 0; i < nstrings; i++) {
+    uint32_t str_len = strlen(buf->strings[i]);
+    fwrite(&str_len, sizeof(str_len), 1, f);
+    fwrite(buf->strings[i], 1, str_len, f);
+  }
+
+  // Records may be overwritten meanwhile, decoder checks them.
+  uint8_t *data = malloc(len);
+  if (data == NULL)
+    len = 0;
+  else
+    ring_read(buf->data, tail, data, len);
+  fwrite(&len, sizeof(len), 1, f);
+  fwrite(data, 1, len, f);
+  free(data);
+
+  return ferror(f) ? -1 : 0;
+}
+
+int binlog_dump(const char *path) {
+  FILE *f = dumpfile_open(path);
+  if (f == NULL)
+    return -1;
+
+  int r = fwrite(BINLOG_MAGIC, 1, strlen(BINLOG_MAGIC), f) ==
+                  strlen(BINLOG_MAGIC)
+              ? 0
+              : -1;
+  for (binlog_buffer_t *buf = atomic_load(&buffers); buf != NULL && r == 0;
+       buf = buf->next) {
+    r = dump_buffer(buf, f);
+  }
+
+  if (fclose(f) != 0)
+    r = -1;
+  return r;
+}
+
+typedef struct {
+  const uint8_t *data;
+  size_t len;
+  size_t pos;
+} cursor_t;
+
+static bool cursor_read(cursor_t *c, void *out, size_t len) {
+  if (c->len - c->pos < len)
+    return false;
+  memcpy(out, c->data + c->pos, len);
+  c->pos += len;
+  return true;
+}
+
+typedef struct {
+  char type;
+  uint64_t value;
+  const char *str;
+  uint16_t str_len;
+} decoded_arg_t;
+
+static const char *const class_names[] = {
+    [LOG_CLASS_NONE] = "none",  [LOG_CLASS_ERROR] = " err",
+    [LOG_CLASS_WARNING] = "warn", [LOG_CLASS_INFO] = "info",
+    [LOG_CLASS_DEBUG] = " dbg",
+};
+
+// Formats `fmt` with decoded arguments, mirroring put_args().
+static void format_args(FILE *out, const char *fmt, decoded_arg_t *args,
+                        unsigned int nargs) {
+  unsigned int next = 0;
+  for (const char *p = fmt; *p != '\0'; p++) {
+    if (*p != '%') {
+      fputc(*p, out);
+      continue;
+    }
+
+    const char *start = p++;
+    if (*p == '%') {
+      fputc('%', out);
+      continue;
+    }
+
+    // Rebuild conversion spec without length modifier and with values of
+    // '*' width and precision.
+    char spec[64];
+    size_t len = 0;
+    spec[len++] = '%';
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL && len < 8)
+      spec[len++] = *p++;
+
+    for (int i = 0; i < 2; i++) {
+      if (i == 1) {
+        if (*p != '.')
+          break;
+        spec[len++] = *p++;
+      }
+
+      if (*p == '*') {
+        int v = next < nargs ? (int)args[next++].value : 0;
+        len += snprintf(spec + len, sizeof(spec) - len, "%d", v);
+        p++;
+      } else {
+        while (isdigit((unsigned char)*p) && len < 40)
+          spec[len++] = *p++;
+      }
+    }
+
+    parse_length(&p);
+    char conv = *p;
+    if (conv == '\0' || strchr("diuoxXceEfFgGaAspn", conv) == NULL) {
+      // Unsupported conversion, print rest as is.
+      fputs(start, out);
+      return;
+    }
+    if (conv == 'n')
+      continue;
+
+    if (next >= nargs) {
+      fputs("<?>", out);
+      continue;
+    }
+    decoded_arg_t *arg = &args[next++];
+
+    switch (conv) {
+    case 'd':
+    case 'i':
+      memcpy(spec + len, "ll", 2);
+      spec[len + 2] = conv;
+      spec[len + 3] = '\0';
+      fprintf(out, spec, (long long)arg->value);
+      break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+      memcpy(spec + len, "ll", 2);
+      spec[len + 2] = conv;
+      spec[len + 3] = '\0';
+      fprintf(out, spec, (unsigned long long)arg->value);
+      break;
+    case 'c':
+      spec[len++] = 'c';
+      spec[len] = '\0';
+      fprintf(out, spec, (int)arg->value);
+      break;
+    case 's':
+      // Strings are recorded with their precision applied.
+      fprintf(out, "%.*s", (int)arg->str_len, arg->str != NULL ? arg->str : "");
+      break;
+    case 'p':
+      fprintf(out, "%p", (void *)(uintptr_t)arg->value);
+      break;
+    default: {
+      double d = 0;
+      memcpy(&d, &arg->value, sizeof(d));
+      spec[len++] = conv;
+      spec[len] = '\0';
+      fprintf(out, spec, d);
+    }
+    }
+  }
+}
+
+static const char *string_at(char **strings, uint32_t nstrings, uint32_t id) {
+  return id < nstrings ? strings[id] : "?";
+}
+
+static void decode_record(const binlog_record_t *hdr, cursor_t *c,
+                          char **strings, uint32_t nstrings, FILE *out) {
+  decoded_arg_t args[UINT8_MAX];
+  unsigned int nargs = 0;
+  for (; nargs < hdr->nargs; nargs++) {
+    decoded_arg_t *arg = &args[nargs];
+    *arg = (decoded_arg_t){0};
+    uint8_t type = 0;
+    if (!cursor_read(c, &type, 1))
+      break;
+
+    arg->type = type;
+    if (type == BINLOG_ARG_STRING) {
+      if (!cursor_read(c, &arg->str_len, sizeof(arg->str_len)) ||
+          c->len - c->pos < arg->str_len)
+        break;
+      arg->str = (const char *)c->data + c->pos;
+      c->pos += arg->str_len;
+    } else if (!cursor_read(c, &arg->value, sizeof(arg->value))) {
+      break;
+    }
+  }
+
+  time_t sec = hdr->timestamp_ns / 1000000000;
+  struct tm tm;
+  char time_str[32];
+  strftime(time_str, sizeof(time_str), "%F %T", gmtime_r(&sec, &tm));
+
+  unsigned int log_class = hdr->log_class;
+  fprintf(out, "%s.%09" PRIu64 " %s: %s:%" PRIu32 ": [%s] ", time_str,
+          hdr->timestamp_ns % 1000000000,
+          log_class < LOG_CLASS_COUNT ? class_names[log_class] : "????",
+          string_at(strings, nstrings, hdr->file), hdr->lineno,
+          string_at(strings, nstrings, hdr->module));
+  format_args(out, string_at(strings, nstrings, hdr->fmt), args, nargs);
+  if (hdr->sys_errno != 0)
+    fprintf(out, ": %s", strerror(hdr->sys_errno));
+  fputc('\n', out);
+}
+
+static int decode_buffer(FILE *in, FILE *out) {
+  uint64_t thread_id = 0;
+  uint32_t nstrings = 0;
+  if (fread(&thread_id, sizeof(thread_id), 1, in) != 1)
+    return feof(in) ? 0 : -1;
+  if (fread(&nstrings, sizeof(nstrings), 1, in) != 1 ||
+      nstrings > BINLOG_MAX_STRINGS)
+    return -1;
+
+  int r = -1;
+  uint8_t *data = NULL;
+  char **strings = calloc(nstrings + 1, sizeof(*strings));
+  if (strings == NULL)
+    return -1;
+
+  for (uint32_t i = 0; i < nstrings; i++) {
+    uint32_t len = 0;
+    if (fread(&len, sizeof(len), 1, in) != 1 || len > (1U << 20))
+      goto out;
+    strings[i] = calloc(1, len + 1);
+    if (strings[i] == NULL || fread(strings[i], 1, len, in) != len)
+      goto out;
+  }
+
+  uint64_t len = 0;
+  if (fread(&len, sizeof(len), 1, in) != 1 || len > BINLOG_BUFFER_SIZE)
+    goto out;
+  data = malloc(len + 1);
+  if (data == NULL || fread(data, 1, len, in) != len)
+    goto out;
+
+  fprintf(out, "# thread %" PRIu64 "\n", thread_id);
+  cursor_t c = {.data = data, .len = len};
+  while (c.pos < c.len) {
+    size_t start = c.pos;
+    binlog_record_t hdr;
+    if (!cursor_read(&c, &hdr, sizeof(hdr)) || hdr.size < sizeof(hdr) ||
+        start + hdr.size > c.len) {
+      fprintf(out, "# truncated record\n");
+      break;
+    }
+
+    cursor_t args = {.data = data, .len = start + hdr.size, .pos = c.pos};
+    decode_record(&hdr, &args, strings, nstrings, out);
+    c.pos = start + hdr.size;
+  }
+  r = 1;
+
+out:
+  for (uint32_t i = 0; i < nstrings; i++)
+    free(strings[i]);
+  free(strings);
+  free(data);
+  return r;
+}
+
+int binlog_decode(FILE *in, FILE *out) {
+  char magic[sizeof(BINLOG_MAGIC) - 1];
+  if (fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+      memcmp(magic, BINLOG_MAGIC, sizeof(magic)) != 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  int r = 0;
+  while ((r = decode_buffer(in, out)) > 0)
+    ;
+  return r;
+}
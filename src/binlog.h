@@ -0,0 +1,77 @@
+#ifndef DHUB_BINLOG_H_INCLUDE
+#define DHUB_BINLOG_H_INCLUDE
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "dhub.h"
+
+#define BINLOG_MAGIC "DHUBLOG1"
+
+// Size of each thread buffer, a power of two.
+#ifndef BINLOG_BUFFER_SIZE
+#define BINLOG_BUFFER_SIZE (256U << 10)
+#endif
+// Maximum number of distinct strings (formats, files, modules) per thread.
+#ifndef BINLOG_MAX_STRINGS
+#define BINLOG_MAX_STRINGS 4096
+#endif
+// Maximum size of a record, longer string arguments are truncated.
+#define BINLOG_RECORD_MAX 2048
+
+// String id of strings that couldn't be interned.
+#define BINLOG_NO_STRING UINT32_MAX
+
+// Argument types.
+enum binlog_arg {
+  BINLOG_ARG_INT = 'i',
+  BINLOG_ARG_UINT = 'u',
+  BINLOG_ARG_DOUBLE = 'f',
+  BINLOG_ARG_STRING = 's',
+  BINLOG_ARG_POINTER = 'p',
+};
+
+/**
+ * Record header, followed by its arguments: a type byte and a 64 bits value,
+ * or a 16 bits length and bytes for strings. Format, file and module are ids
+ * of strings interned by recording thread.
+ */
+typedef struct binlog_record {
+  uint16_t size;
+  uint8_t log_class;
+  uint8_t nargs;
+  uint32_t fmt;
+  uint32_t file;
+  uint32_t module;
+  uint32_t lineno;
+  int32_t sys_errno;
+  uint64_t timestamp_ns;
+} binlog_record_t;
+
+/**
+ * Records a log message in calling thread buffer without formatting it.
+ * Oldest records are overwritten once buffer is full.
+ */
+void binlog_record(enum log_class log_class, const char *module,
+                   const char *file, int lineno, int sys_errno,
+                   const char *fmt, va_list va);
+
+/**
+ * Forgets interned string addresses, they may be reused once a module
+ * library is closed. Strings interned so far are kept and reused by content.
+ */
+void binlog_forget_strings(void);
+
+/**
+ * Writes buffers of all threads to `path`.
+ */
+int binlog_dump(const char *path);
+
+/**
+ * Decodes a dump and writes formatted messages to `out`, oldest first for
+ * each thread.
+ */
+int binlog_decode(FILE *in, FILE *out);
+
+#endif
@@ -13,6 +13,14 @@
 #define ASAN_ENABLED 1
 #endif
 
+// Dumps recent binary log records so events leading to the crash can be
+// decoded.
+static void dump_binary_log(void) {
+  const char *path = log_dump_binary();
+  if (path != NULL)
+    fprintf(stderr, "binary log dumped to %s\n", path);
+}
+
 static void print_stack_trace(void) {
 #ifdef ASAN_ENABLED
   fputs("\nStack trace:\n", stderr);
@@ -23,6 +31,8 @@ static void print_stack_trace(void) {
 noreturn void fatal_error(const char *file, int line, const char *msg,
                           int err) {
   log_msg(LOG_CLASS_ERROR, "debug", file, line, "%s: %s", msg, strerror(err));
+  log_flush();
+  dump_binary_log();
   print_stack_trace();
   fflush(stderr);
   abort();
@@ -34,6 +44,8 @@ noreturn void uv_fatal_error(const char *file, int line, char *msg, int err) {
 
   log_msg(LOG_CLASS_ERROR, "debug", file, line, "%s: libuv error(%s): %s", msg,
           err_name, strerr);
+  log_flush();
+  dump_binary_log();
   print_stack_trace();
   fflush(stderr);
   abort();
@@ -49,6 +61,8 @@ noreturn void bug(const char *file, int line, const char *func, const char *fmt,
 
   const char *msg = likely(n >= 0) ? buf : "??";
   log_msg(LOG_CLASS_ERROR, "debug", file, line, "BUG in %s(): %s", func, msg);
+  log_flush();
+  dump_binary_log();
   print_stack_trace();
   fflush(stderr);
   abort();
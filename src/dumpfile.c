@@ -0,0 +1,45 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dumpfile.h"
+
+int dumpfile_default_path(char *path, size_t size, const char *suffix) {
+  const char *dir = getenv("XDG_RUNTIME_DIR");
+  if (dir == NULL || *dir == '\0')
+    dir = getenv("TMPDIR");
+  if (dir == NULL || *dir == '\0')
+    dir = "/tmp";
+
+  int n = snprintf(path, size, "%s/dhub-%d.%s", dir, getpid(), suffix);
+  if (n < 0 || (size_t)n >= size) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+
+  return 0;
+}
+
+FILE *dumpfile_open(const char *path) {
+  int flags = O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC;
+  int fd = open(path, flags, 0600);
+
+  // Previous dump is replaced, O_EXCL then fails if anything else, a symbolic
+  // link included, is created in between.
+  struct stat st;
+  if (fd == -1 && errno == EEXIST && lstat(path, &st) == 0 &&
+      S_ISREG(st.st_mode) && st.st_uid == geteuid() && unlink(path) == 0)
+    fd = open(path, flags, 0600);
+  if (fd == -1)
+    return NULL;
+
+  FILE *f = fdopen(fd, "w");
+  if (f == NULL) {
+    int err = errno;
+    close(fd);
+    errno = err;
+  }
+  return f;
+}
@@ -0,0 +1,22 @@
+#ifndef DHUB_DUMPFILE_H_INCLUDE
+#define DHUB_DUMPFILE_H_INCLUDE
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Formats default path of dump file named dhub-PID.`suffix` in
+ * $XDG_RUNTIME_DIR, or in $TMPDIR or /tmp if it isn't set. It returns -1 and
+ * sets errno if it doesn't fit in `size` bytes.
+ */
+int dumpfile_default_path(char *path, size_t size, const char *suffix);
+
+/**
+ * Creates file at `path` only readable by current user and opens it for
+ * writing. An existing regular file owned by current user is replaced, other
+ * files and symbolic links are never followed nor overwritten. It returns NULL
+ * and sets errno on error.
+ */
+FILE *dumpfile_open(const char *path);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef DHUB_HISTOGRAM_H_INCLUDE
+#define DHUB_HISTOGRAM_H_INCLUDE
+
+#include <stdint.h>
+#include <string.h>
+
+// Log-linear histogram: values are bucketed by power of two, each power of two
+// is split in HISTOGRAM_SUB linear sub-buckets so relative error stays under
+// 1 / HISTOGRAM_SUB. Values from 2^HISTOGRAM_MAX_BITS go to the last bucket.
+#ifndef HISTOGRAM_SUB_BITS
+#define HISTOGRAM_SUB_BITS 2
+#endif
+#define HISTOGRAM_SUB (1U << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40
+#define HISTOGRAM_BUCKETS                                                      \
+  ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB)
+
+typedef struct histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+static inline unsigned int histogram_bucket(uint64_t v) {
+  if (v < HISTOGRAM_SUB)
+    return v;
+
+  unsigned int exp = 63 - __builtin_clzll(v);
+  if (exp >= HISTOGRAM_MAX_BITS)
+    return HISTOGRAM_BUCKETS - 1;
+
+  unsigned int sub = (v >> (exp - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB - 1);
+  return (exp - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB + sub;
+}
+
+// Smallest value of bucket `i`.
+static inline uint64_t histogram_bucket_min(unsigned int i) {
+  if (i < HISTOGRAM_SUB)
+    return i;
+
+  unsigned int exp = i / HISTOGRAM_SUB + HISTOGRAM_SUB_BITS - 1;
+  uint64_t sub = i % HISTOGRAM_SUB;
+  return (HISTOGRAM_SUB + sub) << (exp - HISTOGRAM_SUB_BITS);
+}
+
+static inline void histogram_record(histogram_t *h, uint64_t v) {
+  h->count++;
+  h->sum += v;
+  if (v > h->max)
+    h->max = v;
+  h->buckets[histogram_bucket(v)]++;
+}
+
+static inline void histogram_merge(histogram_t *dst, const histogram_t *src) {
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->max > dst->max)
+    dst->max = src->max;
+  for (unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    dst->buckets[i] += src->buckets[i];
+}
+
+static inline void histogram_reset(histogram_t *h) { memset(h, 0, sizeof(*h)); }
+
+/**
+ * Returns an upper bound of `permille`th value of histogram, it is never
+ * above its maximum.
+ */
+static inline uint64_t histogram_percentile(const histogram_t *h,
+                                            unsigned int permille) {
+  if (h->count == 0)
+    return 0;
+
+  uint64_t rank = (h->count * permille + 999) / 1000;
+  uint64_t seen = 0;
+  for (unsigned int i = 0; i < HISTOGRAM_BUCKETS - 1; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      uint64_t upper = histogram_bucket_min(i + 1) - 1;
+      return upper < h->max ? upper : h->max;
+    }
+  }
+
+  return h->max;
+}
+
+#endif
@@ -0,0 +1,15 @@
+#include "json.h"
+
+void json_write_string(FILE *f, const char *str, size_t len) {
+  fputc('"', f);
+  for (size_t i = 0; i < len && str[i] != '\0'; i++) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+  fputc('"', f);
+}
@@ -0,0 +1,13 @@
+#ifndef DHUB_JSON_H_INCLUDE
+#define DHUB_JSON_H_INCLUDE
+
+#include <stddef.h>
+#include <stdio.h>
+
+/**
+ * Writes at most `len` bytes of `str`, up to its NUL byte, as a quoted JSON
+ * string. Quotes, backslashes and control characters are escaped.
+ */
+void json_write_string(FILE *f, const char *str, size_t len);
+
+#endif
@@ -1,21 +1,41 @@
 #include "log.h"
 
 #include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdalign.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <syslog.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "binlog.h"
 #include "debug.h"
+#include "dumpfile.h"
+#include "trace.h"
 #include "xsnprintf.h"
 
 static bool colorize = false;
 static bool do_syslog = false;
-static enum log_class log_level = LOG_CLASS_NONE;
+enum log_class log_level = LOG_CLASS_NONE;
+// Most verbose classes formatted as text and recorded in binary buffers,
+// `log_level` is the most verbose of both.
+static enum log_class text_level = LOG_CLASS_NONE;
+static enum log_class binary_level = LOG_CLASS_NONE;
+static char binary_dump_path[PATH_MAX];
+// Socket of journal sink, -1 if disabled.
+static int journal_fd = -1;
 
 static const struct {
   const char name[8];
@@ -30,6 +50,86 @@ static const struct {
     [LOG_CLASS_DEBUG] = {"debug", " dbg", 36, LOG_DEBUG},
 };
 
+// Maximum number of lines written per writev() call.
+#define LOG_WRITE_BATCH 64
+
+// Formatted line waiting for writer thread.
+struct log_slot {
+  // Ring position this slot is ready for: equals position when slot is free
+  // and position + 1 once line is published.
+  _Atomic size_t seq;
+  size_t pos;
+  enum log_class log_class;
+  size_t len;
+  size_t body_off;
+  size_t body_len;
+  char module[32];
+  // Call site, only filled in when journal sink is enabled. File name is at
+  // [file_off, file_off + file_len) of text as its literal may be unmapped
+  // before line is written.
+  size_t file_off;
+  size_t file_len;
+  int lineno;
+  int sys_errno;
+  char text[LOG_LINE_MAX];
+};
+
+// Bounded multi-producer single-consumer ring of log lines, drained by a
+// writer thread.
+static struct {
+  struct log_slot *slots;
+  alignas(64) _Atomic size_t enqueue_pos;
+  alignas(64) size_t dequeue_pos;
+  _Atomic bool running;
+  // Producers between their running check and publishing their line, slots
+  // are freed once there are none left.
+  _Atomic unsigned producers;
+  _Atomic bool sleeping;
+  bool stop;
+  enum log_overflow overflow;
+  _Atomic uint64_t queued;
+  _Atomic uint64_t dropped;
+  uint64_t written;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t flushed;
+} ring = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .flushed = PTHREAD_COND_INITIALIZER,
+};
+
+// Rate limit state of a log call site, updated lock-free. Its module and file
+// names are copied as they may be unmapped before its suppressed messages are
+// summarized.
+struct log_site {
+  // Hash of call site file and line, 0 if slot is free.
+  _Atomic uint64_t key;
+  // Set once names are copied.
+  _Atomic bool ready;
+  _Atomic int log_class;
+  // Theoretical arrival time of next message: messages are let through as
+  // long as it is at most a burst ahead of now.
+  _Atomic uint64_t tat_ns;
+  _Atomic uint64_t suppressed;
+  int lineno;
+  char module[32];
+  char file[96];
+};
+
+// Per call site rate limiter, an open addressing table of call sites.
+static struct {
+  _Atomic unsigned rate;
+  _Atomic size_t used;
+  // Accessed by writer thread only.
+  uint64_t next_summary_ns;
+  _Atomic uint64_t suppressed;
+  struct log_site sites[LOG_RATE_SITES];
+} limiter = {
+    .rate = LOG_RATE_DEFAULT,
+};
+
 void log_init(enum log_colorize _colorize, bool _do_syslog,
               enum log_facility syslog_facility, enum log_class _log_level) {
   static const int facility_map[] = {
@@ -45,7 +145,8 @@ void log_init(enum log_colorize _colorize, bool _do_syslog,
       _colorize == LOG_COLORIZE_ALWAYS ||
       (_colorize == LOG_COLORIZE_AUTO && !no_color && isatty(STDERR_FILENO));
   do_syslog = _do_syslog;
-  log_level = _log_level;
+  text_level = _log_level;
+  log_level = text_level > binary_level ? text_level : binary_level;
 
   int slvl = log_level_map[_log_level].syslog_equivalent;
   if (slvl < 0)
@@ -60,8 +161,402 @@ void log_init(enum log_colorize _colorize, bool _do_syslog,
 }
 
 void log_deinit(void) {
+  log_stop_writer();
   if (do_syslog)
     closelog();
+  if (journal_fd >= 0) {
+    close(journal_fd);
+    journal_fd = -1;
+  }
+}
+
+int log_enable_journal(const char *socket_path) {
+  if (socket_path == NULL)
+    socket_path = LOG_JOURNAL_SOCKET;
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    int err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+  }
+
+  journal_fd = fd;
+  return 0;
+}
+
+// Appends to `buf` holding `len` bytes out of `max`, truncating output.
+static size_t append_va(char *buf, size_t len, size_t max, const char *fmt,
+                        va_list va) {
+  if (len >= max)
+    return len;
+
+  int n = vsnprintf(buf + len, max - len, fmt, va);
+  if (n < 0)
+    return len;
+
+  // Output was truncated, drop its terminating NUL byte.
+  return len + n < max ? len + n : max - 1;
+}
+
+static size_t append(char *buf, size_t len, size_t max, const char *fmt, ...)
+    PRINTF(4);
+
+static size_t append(char *buf, size_t len, size_t max, const char *fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  len = append_va(buf, len, max, fmt, va);
+  va_end(va);
+  return len;
+}
+
+// Formats a log line into `buf`. Call site file name is at
+// [*file_off, *file_off + *file_len) and message body, without color codes
+// nor trailing newline, at [*body_off, *body_off + *body_len).
+static size_t format_line(char *buf, size_t size, enum log_class log_class,
+                          const char *module, const char *file, int lineno,
+                          const char *fmt, int sys_errno, va_list va,
+                          size_t *file_off, size_t *file_len,
+                          size_t *body_off, size_t *body_len) {
+  const char *prefix = log_level_map[log_class].log_prefix;
+  unsigned int class_clr = log_level_map[log_class].color;
+
+  // Keep room for trailing newline.
+  size_t max = size - 1;
+  size_t len = 0;
+  if (colorize) {
+    len = append(buf, len, max, "\033[%um%s\033[0m: \033[2m", class_clr,
+                 prefix);
+  } else {
+    len = append(buf, len, max, "%s: ", prefix);
+  }
+  *file_off = len;
+  len = append(buf, len, max, "%s", file);
+  *file_len = len - *file_off;
+  len = append(buf, len, max, ":%d: [%s] ", lineno, module);
+  if (colorize)
+    len = append(buf, len, max, "\033[0m");
+
+  *body_off = len;
+  len = append_va(buf, len, max, fmt, va);
+  if (sys_errno != 0)
+    len = append(buf, len, max, ": %s", strerror(sys_errno));
+
+  *body_len = len - *body_off;
+  buf[len++] = '\n';
+  return len;
+}
+
+static void write_all(const struct iovec *iov, int iovcnt) {
+  struct iovec vec[LOG_WRITE_BATCH];
+  memcpy(vec, iov, iovcnt * sizeof(*iov));
+
+  struct iovec *v = vec;
+  while (iovcnt > 0) {
+    ssize_t n = writev(STDERR_FILENO, v, iovcnt);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+
+    // Skip written lines and resume partially written one.
+    while (iovcnt > 0 && (size_t)n >= v->iov_len) {
+      n -= v->iov_len;
+      v++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      v->iov_base = (char *)v->iov_base + n;
+      v->iov_len -= n;
+    }
+  }
+}
+
+// Sends a message to journald native protocol socket, one field per line.
+// Message body is sent in binary form, as it may contain newlines: field
+// name, newline, its length as a little endian 64 bits integer and its value.
+static void journal_send(enum log_class log_class, const char *module,
+                         const char *file, size_t file_len, int lineno,
+                         int sys_errno, const char *body, size_t body_len) {
+  char priority[16];
+  char code_line[32];
+  char err[32];
+  int priority_len = snprintf(priority, sizeof(priority), "PRIORITY=%d\n",
+                              log_level_map[log_class].syslog_equivalent);
+  int code_line_len =
+      snprintf(code_line, sizeof(code_line), "CODE_LINE=%d\n", lineno);
+  int err_len =
+      sys_errno != 0 ? snprintf(err, sizeof(err), "ERRNO=%d\n", sys_errno) : 0;
+
+  uint8_t msg_len[8];
+  for (int i = 0; i < 8; i++)
+    msg_len[i] = (uint64_t)body_len >> (i * 8);
+
+#define IOV_STR(str) {.iov_base = (void *)(str), .iov_len = strlen(str)}
+  struct iovec iov[] = {
+      {.iov_base = priority, .iov_len = priority_len},
+      IOV_STR("SYSLOG_IDENTIFIER=dhub\n"),
+      IOV_STR("MODULE="),
+      IOV_STR(module),
+      IOV_STR("\nCODE_FILE="),
+      {.iov_base = (void *)file, .iov_len = file_len},
+      IOV_STR("\n"),
+      {.iov_base = code_line, .iov_len = code_line_len},
+      {.iov_base = err, .iov_len = err_len},
+      IOV_STR("MESSAGE\n"),
+      {.iov_base = msg_len, .iov_len = sizeof(msg_len)},
+      {.iov_base = (void *)body, .iov_len = body_len},
+      IOV_STR("\n"),
+  };
+#undef IOV_STR
+
+  // Journal may be down, don't block nor retry.
+  struct msghdr msg = {.msg_iov = iov, .msg_iovlen = ALEN(iov)};
+  while (sendmsg(journal_fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT) < 0 &&
+         errno == EINTR)
+    ;
+}
+
+static void sys_log(enum log_class log_class, const char *module,
+                    const char *file, size_t file_len, int lineno,
+                    int sys_errno, const char *body, size_t body_len) {
+  if (journal_fd >= 0)
+    journal_send(log_class, module, file, file_len, lineno, sys_errno, body,
+                 body_len);
+
+  if (!do_syslog)
+    return;
+
+  /* Map our log level to syslog's level */
+  int level = log_level_map[log_class].syslog_equivalent;
+  syslog(level, "%s: %.*s", module, (int)body_len, body);
+}
+
+static struct log_slot *ring_reserve(void) {
+  size_t pos = atomic_load_explicit(&ring.enqueue_pos, memory_order_relaxed);
+  while (1) {
+    struct log_slot *slot = &ring.slots[pos & (LOG_RING_SLOTS - 1)];
+    size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&ring.enqueue_pos, &pos,
+                                                pos + 1, memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        slot->pos = pos;
+        return slot;
+      }
+    } else if (diff < 0) {
+      // Ring is full.
+      return NULL;
+    } else {
+      pos = atomic_load_explicit(&ring.enqueue_pos, memory_order_relaxed);
+    }
+  }
+}
+
+static void wake_writer(void) {
+  // Pairs with fence in writer before it goes to sleep.
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!atomic_load_explicit(&ring.sleeping, memory_order_relaxed))
+    return;
+
+  pthread_mutex_lock(&ring.lock);
+  pthread_cond_signal(&ring.wake);
+  pthread_mutex_unlock(&ring.lock);
+}
+
+static void ring_publish(struct log_slot *slot) {
+  atomic_store_explicit(&slot->seq, slot->pos + 1, memory_order_release);
+  atomic_fetch_add_explicit(&ring.queued, 1, memory_order_relaxed);
+  wake_writer();
+}
+
+static struct log_slot *ring_reserve_or_wait(void) {
+  while (1) {
+    struct log_slot *slot = ring_reserve();
+    if (slot != NULL || ring.overflow == LOG_OVERFLOW_DROP)
+      return slot;
+
+    // Wait for writer to make room.
+    wake_writer();
+    sched_yield();
+  }
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Returns call site, creating it, or NULL if table is full.
+static struct log_site *site_lookup(const char *module, const char *file,
+                                    int lineno) {
+  uint64_t key = ((uintptr_t)file ^ ((uint64_t)lineno << 48)) *
+                 0x9e3779b97f4a7c15;
+  if (key == 0)
+    key = 1;
+
+  size_t i = key >> 32;
+  for (size_t n = 0; n < LOG_RATE_SITES; n++, i++) {
+    struct log_site *site = &limiter.sites[i & (LOG_RATE_SITES - 1)];
+    uint64_t k = atomic_load_explicit(&site->key, memory_order_relaxed);
+    if (k == key)
+      return site;
+    if (k != 0)
+      continue;
+
+    // Keep table sparse so probe sequences stay short.
+    if (atomic_load_explicit(&limiter.used, memory_order_relaxed) >=
+        LOG_RATE_SITES / 4 * 3)
+      return NULL;
+
+    // Slot may be claimed concurrently, by same call site or another one.
+    if (!atomic_compare_exchange_strong_explicit(
+            &site->key, &k, key, memory_order_relaxed, memory_order_relaxed)) {
+      if (k == key)
+        return site;
+      continue;
+    }
+
+    atomic_fetch_add_explicit(&limiter.used, 1, memory_order_relaxed);
+    site->lineno = lineno;
+    snprintf(site->module, sizeof(site->module), "%s", module);
+    snprintf(site->file, sizeof(site->file), "%s", file);
+    atomic_store_explicit(&site->ready, true, memory_order_release);
+    return site;
+  }
+
+  return NULL;
+}
+
+// Takes a token from call site bucket, returns false if message must be
+// suppressed. Otherwise `*summary` is set to number of messages suppressed
+// since last one.
+static bool rate_allow(enum log_class log_class, const char *module,
+                       const char *file, int lineno, uint64_t *summary) {
+  *summary = 0;
+  unsigned rate = atomic_load_explicit(&limiter.rate, memory_order_relaxed);
+  if (rate == 0)
+    return true;
+
+  struct log_site *site = site_lookup(module, file, lineno);
+  if (site == NULL)
+    return true;
+
+  // Generic cell rate algorithm, a token bucket held in a single word.
+  uint64_t now = now_ns();
+  uint64_t interval = 1000000000 / rate;
+  uint64_t tat = atomic_load_explicit(&site->tat_ns, memory_order_relaxed);
+  bool allow = false;
+  do {
+    uint64_t next = (tat > now ? tat : now) + interval;
+    allow = next - now <= (uint64_t)LOG_RATE_BURST * interval;
+    if (!allow)
+      break;
+    if (atomic_compare_exchange_weak_explicit(&site->tat_ns, &tat, next,
+                                              memory_order_relaxed,
+                                              memory_order_relaxed))
+      break;
+  } while (1);
+
+  if (allow) {
+    *summary = atomic_exchange_explicit(&site->suppressed, 0,
+                                        memory_order_relaxed);
+  } else {
+    atomic_store_explicit(&site->log_class, log_class, memory_order_relaxed);
+    atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&limiter.suppressed, 1, memory_order_relaxed);
+  }
+  return allow;
+}
+
+static void write_sync(enum log_class log_class, const char *module,
+                       const char *file, int lineno, const char *fmt,
+                       int sys_errno, va_list va) {
+  char line[LOG_LINE_MAX];
+  size_t file_off = 0;
+  size_t file_len = 0;
+  size_t body_off = 0;
+  size_t body_len = 0;
+  size_t len =
+      format_line(line, sizeof(line), log_class, module, file, lineno, fmt,
+                  sys_errno, va, &file_off, &file_len, &body_off, &body_len);
+  write_all(&(struct iovec){.iov_base = line, .iov_len = len}, 1);
+  sys_log(log_class, module, line + file_off, file_len, lineno, sys_errno,
+          line + body_off, body_len);
+}
+
+// Formats a text line and hands it to writer thread, or writes it if there
+// is none.
+static void log_text(enum log_class log_class, const char *module,
+                     const char *file, int lineno, const char *fmt,
+                     int sys_errno, va_list va) {
+  // Pairs with log_stop_writer(): either it sees this producer or this
+  // producer sees writer is stopped.
+  atomic_fetch_add_explicit(&ring.producers, 1, memory_order_seq_cst);
+  if (!atomic_load_explicit(&ring.running, memory_order_seq_cst)) {
+    atomic_fetch_sub_explicit(&ring.producers, 1, memory_order_release);
+    write_sync(log_class, module, file, lineno, fmt, sys_errno, va);
+    return;
+  }
+
+  struct log_slot *slot = ring_reserve_or_wait();
+  if (slot == NULL) {
+    atomic_fetch_add_explicit(&ring.dropped, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&ring.producers, 1, memory_order_release);
+    return;
+  }
+
+  // Line is formatted once, straight into its slot.
+  size_t file_off = 0;
+  size_t file_len = 0;
+  size_t body_off = 0;
+  size_t body_len = 0;
+  slot->log_class = log_class;
+  slot->len = format_line(slot->text, sizeof(slot->text), log_class, module,
+                          file, lineno, fmt, sys_errno, va, &file_off,
+                          &file_len, &body_off, &body_len);
+  slot->body_off = body_off;
+  slot->body_len = body_len;
+  // Module name may be unmapped before line is written.
+  snprintf(slot->module, sizeof(slot->module), "%s", module);
+  if (journal_fd >= 0) {
+    slot->file_off = file_off;
+    slot->file_len = file_len;
+    slot->lineno = lineno;
+    slot->sys_errno = sys_errno;
+  }
+  ring_publish(slot);
+  atomic_fetch_sub_explicit(&ring.producers, 1, memory_order_release);
+}
+
+static void log_summary(enum log_class log_class, const char *module,
+                        const char *file, int lineno, bool sync,
+                        const char *fmt, ...) PRINTF(6);
+
+static void log_summary(enum log_class log_class, const char *module,
+                        const char *file, int lineno, bool sync,
+                        const char *fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  if (sync)
+    write_sync(log_class, module, file, lineno, fmt, 0, va);
+  else
+    log_text(log_class, module, file, lineno, fmt, 0, va);
+  va_end(va);
 }
 
 static void _log(enum log_class log_class, const char *module, const char *file,
@@ -73,60 +568,267 @@ static void _log(enum log_class log_class, const char *module, const char *file,
   if (log_class > log_level)
     return;
 
-  const char *prefix = log_level_map[log_class].log_prefix;
-  unsigned int class_clr = log_level_map[log_class].color;
+  if (log_class <= binary_level)
+    binlog_record(log_class, module, file, lineno, sys_errno, fmt, va);
+  if (log_class > text_level)
+    return;
 
-  char clr[16];
-  xsnprintf(clr, sizeof(clr), "\033[%um", class_clr);
-  fprintf(stderr, "%s%s%s: ", colorize ? clr : "", prefix,
-          colorize ? "\033[0m" : "");
+  uint64_t suppressed = 0;
+  if (!rate_allow(log_class, module, file, lineno, &suppressed))
+    return;
+  if (suppressed > 0) {
+    log_summary(log_class, module, file, lineno, false,
+                "suppressed %" PRIu64 " similar messages", suppressed);
+  }
 
-  if (colorize)
-    fputs("\033[2m", stderr);
-  fprintf(stderr, "%s:%d: [%s] ", file, lineno, module);
-  if (colorize)
-    fputs("\033[0m", stderr);
+  log_text(log_class, module, file, lineno, fmt, sys_errno, va);
+}
 
-  vfprintf(stderr, fmt, va);
+// Summarizes messages suppressed by rate limiting once every
+// LOG_RATE_SUMMARY_MS, from writer thread.
+static void write_suppressed(void) {
+  uint64_t now = now_ns();
+  if (now < limiter.next_summary_ns)
+    return;
+  limiter.next_summary_ns = now + (uint64_t)LOG_RATE_SUMMARY_MS * 1000000;
+
+  for (size_t i = 0; i < LOG_RATE_SITES; i++) {
+    struct log_site *site = &limiter.sites[i];
+    if (atomic_load_explicit(&site->suppressed, memory_order_relaxed) == 0 ||
+        !atomic_load_explicit(&site->ready, memory_order_acquire))
+      continue;
+
+    uint64_t suppressed =
+        atomic_exchange_explicit(&site->suppressed, 0, memory_order_relaxed);
+    if (suppressed == 0)
+      continue;
+    log_summary(atomic_load_explicit(&site->log_class, memory_order_relaxed),
+                site->module, site->file, site->lineno, true,
+                "suppressed %" PRIu64 " similar messages", suppressed);
+  }
+}
 
-  if (sys_errno != 0)
-    fprintf(stderr, ": %s", strerror(sys_errno));
+static void write_dropped(uint64_t dropped) {
+  char line[128];
+  int len = snprintf(line, sizeof(line), "%s: %s:%d: [log] %" PRIu64
+                     " log lines dropped, log ring is full\n",
+                     log_level_map[LOG_CLASS_WARNING].log_prefix, __FILE__,
+                     __LINE__, dropped);
+  write_all(&(struct iovec){.iov_base = line, .iov_len = len}, 1);
+}
 
-  fputc('\n', stderr);
+// Writes a batch of published lines, returns number of lines written.
+static size_t drain(void) {
+  struct iovec iov[LOG_WRITE_BATCH];
+  struct log_slot *batch[LOG_WRITE_BATCH];
+  size_t n = 0;
+
+  while (n < LOG_WRITE_BATCH) {
+    size_t pos = ring.dequeue_pos + n;
+    struct log_slot *slot = &ring.slots[pos & (LOG_RING_SLOTS - 1)];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+      break;
+
+    batch[n] = slot;
+    iov[n] = (struct iovec){.iov_base = slot->text, .iov_len = slot->len};
+    n++;
+  }
+  if (n == 0)
+    return 0;
+
+  uint64_t start = dhub_trace_begin();
+  write_all(iov, n);
+  for (size_t i = 0; i < n; i++) {
+    struct log_slot *slot = batch[i];
+    sys_log(slot->log_class, slot->module, slot->text + slot->file_off,
+            slot->file_len, slot->lineno, slot->sys_errno,
+            slot->text + slot->body_off, slot->body_len);
+
+    // Hand slot back to producers for next lap.
+    atomic_store_explicit(&slot->seq, slot->pos + LOG_RING_SLOTS,
+                          memory_order_release);
+  }
+  ring.dequeue_pos += n;
+  dhub_trace_end(start, "log", "flush", "%zu lines", n);
+  return n;
 }
 
-static void _sys_log(enum log_class log_class, const char *module,
-                     const char UNUSED *file, int UNUSED lineno,
-                     const char *fmt, int sys_errno, va_list va) {
-  xassert(log_class > LOG_CLASS_NONE);
-  xassert(log_class < ALEN(log_level_map));
+static void *writer_main(void *arg) {
+  (void)arg;
+  uint64_t dropped_reported = 0;
+  trace_thread_init("log writer");
+
+  pthread_mutex_lock(&ring.lock);
+  while (1) {
+    pthread_mutex_unlock(&ring.lock);
+    size_t n = 0;
+    size_t total = 0;
+    while ((n = drain()) > 0)
+      total += n;
+
+    uint64_t dropped =
+        atomic_load_explicit(&ring.dropped, memory_order_relaxed);
+    if (dropped != dropped_reported) {
+      write_dropped(dropped - dropped_reported);
+      dropped_reported = dropped;
+    }
+    write_suppressed();
+    pthread_mutex_lock(&ring.lock);
+
+    if (total > 0) {
+      ring.written += total;
+      pthread_cond_broadcast(&ring.flushed);
+      continue;
+    }
+    if (ring.stop)
+      break;
+
+    // Sleep until a producer publishes a line, check ring again once
+    // sleeping flag is visible so no wakeup is lost. Wake up periodically
+    // to summarize suppressed messages.
+    atomic_store_explicit(&ring.sleeping, true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    struct log_slot *next =
+        &ring.slots[ring.dequeue_pos & (LOG_RING_SLOTS - 1)];
+    if (atomic_load_explicit(&next->seq, memory_order_acquire) !=
+        ring.dequeue_pos + 1) {
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += LOG_RATE_SUMMARY_MS / 1000;
+      pthread_cond_timedwait(&ring.wake, &ring.lock, &deadline);
+    }
+    atomic_store_explicit(&ring.sleeping, false, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&ring.lock);
+  trace_thread_exit();
 
-  if (!do_syslog)
+  return NULL;
+}
+
+int log_start_writer(enum log_overflow overflow) {
+  if (atomic_load(&ring.running))
+    return 0;
+
+  ring.slots = calloc(LOG_RING_SLOTS, sizeof(*ring.slots));
+  if (ring.slots == NULL)
+    return -1;
+  for (size_t i = 0; i < LOG_RING_SLOTS; i++)
+    atomic_init(&ring.slots[i].seq, i);
+  // Writer may be started again after being stopped.
+  atomic_store_explicit(&ring.enqueue_pos, 0, memory_order_relaxed);
+  ring.dequeue_pos = 0;
+
+  ring.overflow = overflow;
+  ring.stop = false;
+  if (pthread_create(&ring.thread, NULL, writer_main, NULL) != 0) {
+    free(ring.slots);
+    ring.slots = NULL;
+    return -1;
+  }
+
+  atomic_store_explicit(&ring.running, true, memory_order_release);
+
+  // Lines logged right before exit() must not be lost.
+  static bool registered = false;
+  if (!registered) {
+    atexit(log_flush);
+    registered = true;
+  }
+  return 0;
+}
+
+void log_stop_writer(void) {
+  if (!atomic_load(&ring.running))
     return;
 
-  if (log_class > log_level)
+  // New lines are written synchronously. Wait for producers already past
+  // their running check, writer keeps making room for blocked ones.
+  atomic_store_explicit(&ring.running, false, memory_order_seq_cst);
+  while (atomic_load_explicit(&ring.producers, memory_order_seq_cst) > 0) {
+    wake_writer();
+    sched_yield();
+  }
+
+  // Writer drains published lines before exiting.
+  pthread_mutex_lock(&ring.lock);
+  ring.stop = true;
+  pthread_cond_signal(&ring.wake);
+  pthread_mutex_unlock(&ring.lock);
+  pthread_join(ring.thread, NULL);
+
+  free(ring.slots);
+  ring.slots = NULL;
+}
+
+void log_flush(void) {
+  if (!atomic_load_explicit(&ring.running, memory_order_acquire))
     return;
 
-  /* Map our log level to syslog's level */
-  int level = log_level_map[log_class].syslog_equivalent;
+  uint64_t target = atomic_load_explicit(&ring.queued, memory_order_relaxed);
+  wake_writer();
+
+  // Writer may be stuck, don't wait forever on fatal paths.
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 1;
+
+  pthread_mutex_lock(&ring.lock);
+  while (ring.written < target &&
+         pthread_cond_timedwait(&ring.flushed, &ring.lock, &deadline) == 0)
+    ;
+  pthread_mutex_unlock(&ring.lock);
+}
+
+int log_enable_binary(enum log_class level, const char *dump_path) {
+  if (dump_path == NULL) {
+    if (dumpfile_default_path(binary_dump_path, sizeof(binary_dump_path),
+                              "logdump") == -1)
+      return -1;
+  } else {
+    int n = snprintf(binary_dump_path, sizeof(binary_dump_path), "%s",
+                     dump_path);
+    if (n < 0 || (size_t)n >= sizeof(binary_dump_path))
+      return -1;
+  }
+
+  binary_level = level;
+  log_level = text_level > binary_level ? text_level : binary_level;
+  return 0;
+}
 
-  char msg[4096];
-  int n = vsnprintf(msg, sizeof(msg), fmt, va);
-  xassert(n >= 0);
+const char *log_dump_binary(void) {
+  if (binary_level == LOG_CLASS_NONE)
+    return NULL;
 
-  if (sys_errno != 0 && (size_t)n < sizeof(msg))
-    snprintf(msg + n, sizeof(msg) - n, ": %s", strerror(sys_errno));
+  if (binlog_dump(binary_dump_path) == -1)
+    return NULL;
 
-  syslog(level, "%s: %s", module, msg);
+  return binary_dump_path;
+}
+
+void log_set_rate_limit(unsigned rate) {
+  atomic_store_explicit(&limiter.rate, rate, memory_order_relaxed);
+}
+
+uint64_t log_dropped(void) {
+  return atomic_load_explicit(&ring.dropped, memory_order_relaxed);
+}
+
+uint64_t log_suppressed(void) {
+  return atomic_load_explicit(&limiter.suppressed, memory_order_relaxed);
+}
+
+int log_overflow_from_string(const char *str) {
+  if (strcmp(str, "drop") == 0)
+    return LOG_OVERFLOW_DROP;
+  if (strcmp(str, "block") == 0)
+    return LOG_OVERFLOW_BLOCK;
+  return -1;
 }
 
 void log_msg_va(enum log_class log_class, const char *module, const char *file,
                 int lineno, const char *fmt, va_list va) {
-  va_list va2;
-  va_copy(va2, va);
   _log(log_class, module, file, lineno, fmt, 0, va);
-  _sys_log(log_class, module, file, lineno, fmt, 0, va2);
-  va_end(va2);
 }
 
 void log_msg(enum log_class log_class, const char *module, const char *file,
@@ -153,11 +855,7 @@ void log_errno(enum log_class log_class, const char *module, const char *file,
 void log_errno_provided_va(enum log_class log_class, const char *module,
                            const char *file, int lineno, int errno_copy,
                            const char *fmt, va_list va) {
-  va_list va2;
-  va_copy(va2, va);
   _log(log_class, module, file, lineno, fmt, errno_copy, va);
-  _sys_log(log_class, module, file, lineno, fmt, errno_copy, va2);
-  va_end(va2);
 }
 
 void log_errno_provided(enum log_class log_class, const char *module,
@@ -171,8 +869,8 @@ void log_errno_provided(enum log_class log_class, const char *module,
 
 static size_t map_len(void) {
   size_t len = ALEN(log_level_map);
-#ifndef _DEBUG
-  /* Exclude "debug" entry for non-debug builds */
+#if DHUB_LOG_LEVEL < 4
+  /* Exclude "debug" entry when debug messages aren't compiled in */
   len--;
 #endif
   return len;
@@ -3,6 +3,7 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "dhub.h"
 #include "macros.h"
@@ -14,10 +15,87 @@ enum log_colorize {
 };
 enum log_facility { LOG_FACILITY_USER, LOG_FACILITY_DAEMON };
 
+// What producers do when log ring is full.
+enum log_overflow { LOG_OVERFLOW_DROP, LOG_OVERFLOW_BLOCK };
+
+// Number of lines of log ring, a power of two, and maximum line length.
+#ifndef LOG_RING_SLOTS
+#define LOG_RING_SLOTS 1024
+#endif
+#ifndef LOG_LINE_MAX
+#define LOG_LINE_MAX 1024
+#endif
+
+// Messages logged per second by each call site once its burst is spent, 0
+// by default so rate limiting is opt-in, number of call sites rate limited, a
+// power of two, and interval at which suppressed messages are summarized.
+#ifndef LOG_RATE_DEFAULT
+#define LOG_RATE_DEFAULT 0
+#endif
+#define LOG_RATE_BURST 50
+#ifndef LOG_RATE_SITES
+#define LOG_RATE_SITES 1024
+#endif
+#define LOG_RATE_SUMMARY_MS 5000
+
+// journald native protocol socket.
+#define LOG_JOURNAL_SOCKET "/run/systemd/journal/socket"
+
 void log_init(enum log_colorize colorize, bool do_syslog,
               enum log_facility syslog_facility, enum log_class log_level);
 void log_deinit(void);
 
+/**
+ * Starts writer thread. Log lines are then formatted by the logging thread
+ * into a lock-free ring and written to stderr and syslog by the writer
+ * thread. Lines are logged synchronously until it is started and once it is
+ * stopped.
+ */
+int log_start_writer(enum log_overflow overflow);
+void log_stop_writer(void);
+
+/**
+ * Sends log messages to journald native protocol datagram socket at
+ * `socket_path`, or LOG_JOURNAL_SOCKET if it is NULL, as structured entries
+ * with PRIORITY, MODULE, CODE_FILE, CODE_LINE, ERRNO and MESSAGE fields. It
+ * must be called before log writer thread is started. Returns -1 and sets
+ * errno on error.
+ */
+int log_enable_journal(const char *socket_path);
+
+/**
+ * Records messages up to `level` in per-thread binary buffers, their format
+ * string and raw arguments are recorded without formatting them. Buffers are
+ * written to `dump_path`, or to a file in $XDG_RUNTIME_DIR if it is NULL, by
+ * log_dump_binary() and are decoded with `dhub logdump`.
+ */
+int log_enable_binary(enum log_class level, const char *dump_path);
+
+/**
+ * Dumps binary log buffers, it returns dump path or NULL on error or if
+ * binary logging is disabled.
+ */
+const char *log_dump_binary(void);
+
+/**
+ * Limits text messages of each call site, a (file, line) pair, to `rate`
+ * messages per second after a burst of LOG_RATE_BURST messages. Suppressed
+ * messages are counted and summarized in a single line per call site. 0
+ * disables rate limiting. Binary log records every message.
+ */
+void log_set_rate_limit(unsigned rate);
+
+/**
+ * Returns number of lines dropped because log ring was full.
+ */
+uint64_t log_dropped(void);
+
+/**
+ * Returns number of messages suppressed by rate limiting.
+ */
+uint64_t log_suppressed(void);
+int log_overflow_from_string(const char *str);
+
 void log_msg_va(enum log_class log_class, const char *module, const char *file,
                 int lineno, const char *fmt, va_list va) VPRINTF(5);
 void log_errno_va(enum log_class log_class, const char *module,
@@ -30,20 +108,6 @@ void log_errno_provided_va(enum log_class log_class, const char *module,
 int log_level_from_string(const char *str);
 const char *log_level_string_hint(void);
 
-#define LOG_ERR(...)                                                           \
-  log_msg(LOG_CLASS_ERROR, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_ERRNO(...)                                                         \
-  log_errno(LOG_CLASS_ERROR, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_ERRNO_P(_errno, ...)                                               \
-  log_errno_provided(LOG_CLASS_ERROR, LOG_MODULE, __FILE__, __LINE__, _errno,  \
-                     __VA_ARGS__)
-#define LOG_WARN(...)                                                          \
-  log_msg(LOG_CLASS_WARNING, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_INFO(...)                                                          \
-  log_msg(LOG_CLASS_INFO, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__)
-#define LOG_DBG(...)                                                           \
-  log_msg(LOG_CLASS_DEBUG, LOG_MODULE, __FILE__, __LINE__, __VA_ARGS__)
-
 #define NEG_TRY(err, ctx)                                                      \
   if (err < 0) {                                                               \
     LOG_ERR("%s: %s", ctx, strerror(-err));                                    \
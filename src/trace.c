@@ -0,0 +1,238 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dumpfile.h"
+#include "json.h"
+#include "trace.h"
+
+// Buffer of a registered thread. Descriptors are never freed, buffers of
+// exited threads are reused by new ones.
+typedef struct trace_buffer {
+  struct trace_buffer *next;
+  _Atomic bool used;
+  uint64_t thread_id;
+  char thread_name[16];
+  // Spans recorded so far, written by owning thread only.
+  _Atomic uint64_t head;
+  trace_event_t *_Atomic events;
+} trace_buffer_t;
+
+static _Thread_local trace_buffer_t *current = NULL;
+static trace_buffer_t *_Atomic buffers = NULL;
+static _Atomic bool running = false;
+// Serializes buffers allocation, start and stop.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char path[PATH_MAX];
+
+static uint64_t now_ns(void) {
+  // Same clock as uv_hrtime().
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Allocates buffer events and faults their pages in. It must be called with
+// lock held.
+static int alloc_events(trace_buffer_t *buf) {
+  if (atomic_load_explicit(&buf->events, memory_order_relaxed) != NULL)
+    return 0;
+
+  trace_event_t *events = malloc(TRACE_BUFFER_EVENTS * sizeof(*events));
+  if (events == NULL)
+    return -1;
+  memset(events, 0, TRACE_BUFFER_EVENTS * sizeof(*events));
+
+  atomic_store_explicit(&buf->events, events, memory_order_release);
+  return 0;
+}
+
+void trace_thread_init(const char *name) {
+  pthread_mutex_lock(&lock);
+
+  trace_buffer_t *buf = NULL;
+  for (trace_buffer_t *b = atomic_load(&buffers); b != NULL; b = b->next) {
+    if (!atomic_load(&b->used)) {
+      buf = b;
+      break;
+    }
+  }
+  if (buf == NULL) {
+    buf = calloc(1, sizeof(*buf));
+    if (buf == NULL)
+      goto out;
+    buf->next = atomic_load(&buffers);
+    atomic_store(&buffers, buf);
+  }
+
+  buf->thread_id = (uint64_t)gettid();
+  snprintf(buf->thread_name, sizeof(buf->thread_name), "%s", name);
+  atomic_store_explicit(&buf->head, 0, memory_order_relaxed);
+  atomic_store(&buf->used, true);
+  if (atomic_load(&running))
+    alloc_events(buf);
+  current = buf;
+
+out:
+  pthread_mutex_unlock(&lock);
+}
+
+void trace_thread_exit(void) {
+  if (current == NULL)
+    return;
+
+  pthread_mutex_lock(&lock);
+  atomic_store(&current->used, false);
+  current = NULL;
+  pthread_mutex_unlock(&lock);
+}
+
+int trace_set_path(const char *p) {
+  int n = snprintf(path, sizeof(path), "%s", p);
+  return n < 0 || (size_t)n >= sizeof(path) ? -1 : 0;
+}
+
+int trace_start(void) {
+  int r = 0;
+  pthread_mutex_lock(&lock);
+  if (atomic_load(&running))
+    goto out;
+
+  for (trace_buffer_t *b = atomic_load(&buffers); b != NULL; b = b->next) {
+    if (atomic_load(&b->used) && alloc_events(b) == -1) {
+      r = -1;
+      goto out;
+    }
+    // Threads don't record spans while tracing is stopped.
+    atomic_store_explicit(&b->head, 0, memory_order_relaxed);
+  }
+  atomic_store_explicit(&running, true, memory_order_release);
+
+out:
+  pthread_mutex_unlock(&lock);
+  return r;
+}
+
+bool trace_running(void) {
+  return atomic_load_explicit(&running, memory_order_relaxed);
+}
+
+uint64_t dhub_trace_begin(void) {
+  if (!atomic_load_explicit(&running, memory_order_relaxed))
+    return 0;
+
+  return now_ns();
+}
+
+void dhub_trace_end(uint64_t start, const char *cat, const char *name,
+                    const char *fmt, ...) {
+  if (start == 0 || !atomic_load_explicit(&running, memory_order_acquire))
+    return;
+
+  trace_buffer_t *buf = current;
+  if (buf == NULL)
+    return;
+  trace_event_t *events =
+      atomic_load_explicit(&buf->events, memory_order_acquire);
+  if (events == NULL)
+    return;
+
+  uint64_t head = atomic_load_explicit(&buf->head, memory_order_relaxed);
+  trace_event_t *ev = &events[head & (TRACE_BUFFER_EVENTS - 1)];
+  ev->start_ns = start;
+  ev->duration_ns = now_ns() - start;
+  snprintf(ev->cat, sizeof(ev->cat), "%s", cat);
+  snprintf(ev->name, sizeof(ev->name), "%s", name);
+  ev->args[0] = '\0';
+  if (fmt != NULL) {
+    va_list va;
+    va_start(va, fmt);
+    vsnprintf(ev->args, sizeof(ev->args), fmt, va);
+    va_end(va);
+  }
+
+  atomic_store_explicit(&buf->head, head + 1, memory_order_release);
+}
+
+static void write_buffer(FILE *f, trace_buffer_t *buf, pid_t pid,
+                         bool *first) {
+  trace_event_t *events = atomic_load(&buf->events);
+  if (events == NULL)
+    return;
+
+  fprintf(f,
+          "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+          "\"tid\":%" PRIu64 ",\"args\":{\"name\":",
+          *first ? "" : ",", pid, buf->thread_id);
+  json_write_string(f, buf->thread_name, sizeof(buf->thread_name));
+  fputs("}}", f);
+  *first = false;
+
+  // A span being recorded while tracing stopped may be torn, strings are
+  // bounded by their field size.
+  uint64_t head = atomic_load_explicit(&buf->head, memory_order_acquire);
+  uint64_t tail = head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0;
+  for (uint64_t i = tail; i < head; i++) {
+    trace_event_t *ev = &events[i & (TRACE_BUFFER_EVENTS - 1)];
+    fputs(",\n{\"name\":", f);
+    json_write_string(f, ev->name, sizeof(ev->name));
+    fputs(",\"cat\":", f);
+    json_write_string(f, ev->cat, sizeof(ev->cat));
+    fprintf(f,
+            ",\"ph\":\"X\",\"ts\":%" PRIu64 ".%03u,\"dur\":%" PRIu64
+            ".%03u,\"pid\":%d,\"tid\":%" PRIu64,
+            ev->start_ns / 1000, (unsigned int)(ev->start_ns % 1000),
+            ev->duration_ns / 1000, (unsigned int)(ev->duration_ns % 1000),
+            pid, buf->thread_id);
+    if (ev->args[0] != '\0') {
+      fputs(",\"args\":{\"detail\":", f);
+      json_write_string(f, ev->args, sizeof(ev->args));
+      fputc('}', f);
+    }
+    fputc('}', f);
+  }
+}
+
+const char *trace_stop(void) {
+  const char *r = NULL;
+  pthread_mutex_lock(&lock);
+  if (!atomic_load(&running)) {
+    errno = EINVAL;
+    goto out;
+  }
+  atomic_store(&running, false);
+
+  if (path[0] == '\0' &&
+      dumpfile_default_path(path, sizeof(path), "trace.json") == -1) {
+    path[0] = '\0';
+    goto out;
+  }
+
+  FILE *f = dumpfile_open(path);
+  if (f == NULL)
+    goto out;
+
+  pid_t pid = getpid();
+  bool first = true;
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+  for (trace_buffer_t *b = atomic_load(&buffers); b != NULL; b = b->next)
+    write_buffer(f, b, pid, &first);
+  fputs("\n]}\n", f);
+
+  bool failed = ferror(f);
+  if (fclose(f) != 0 || failed)
+    goto out;
+  r = path;
+
+out:
+  pthread_mutex_unlock(&lock);
+  return r;
+}
@@ -0,0 +1,62 @@
+#ifndef DHUB_TRACE_H_INCLUDE
+#define DHUB_TRACE_H_INCLUDE
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "dhub.h"
+
+// Number of spans kept per thread, a power of two. Oldest spans are
+// overwritten once a buffer is full.
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS (1U << 13)
+#endif
+
+/**
+ * Span recorded by dhub_trace_end(). Strings are truncated copies so spans
+ * never reference memory of unloaded modules nor freed messages.
+ */
+typedef struct trace_event {
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  char cat[16];
+  char name[48];
+  char args[56];
+} trace_event_t;
+
+/**
+ * Registers calling thread, `name` is shown in trace viewers. Spans of
+ * unregistered threads are ignored. Thread buffers are allocated when
+ * tracing starts or, if it is running, right away so recording a span never
+ * allocates.
+ */
+void trace_thread_init(const char *name);
+
+/**
+ * Unregisters calling thread, its buffer is reused by the next registered
+ * thread.
+ */
+void trace_thread_exit(void);
+
+/**
+ * Sets path of trace file written by trace_stop(), by default it is a file
+ * in $XDG_RUNTIME_DIR. It returns -1 if path is too long.
+ */
+int trace_set_path(const char *path);
+
+/**
+ * Allocates and touches buffers of every registered thread, then starts
+ * recording spans. It returns -1 and sets errno on error.
+ */
+int trace_start(void);
+
+/**
+ * Stops recording spans and writes them to trace file in Chrome trace event
+ * JSON format, readable by Perfetto and chrome://tracing. It returns trace
+ * file path or NULL on error.
+ */
+const char *trace_stop(void);
+
+bool trace_running(void);
+
+#endif
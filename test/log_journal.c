@@ -0,0 +1,185 @@
+// Checks journald native protocol encoding of log messages: messages are
+// logged to a datagram socket standing in for journald and their fields are
+// decoded back.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+
+// Longer than any fixed size buffer so truncation shows up.
+#define LONG_FILE                                                              \
+  "/nix/store/0123456789abcdefghijklmnopqrstuvwxyz-dhub-source/modules/"       \
+  "some/deeply/nested/directory/of/a/module/with/a/rather/long/name.c"
+
+static int failures = 0;
+
+#define CHECK(cond, ...)                                                       \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__);                     \
+      fprintf(stderr, __VA_ARGS__);                                            \
+      fputc('\n', stderr);                                                     \
+      failures++;                                                              \
+    }                                                                          \
+  } while (0)
+
+typedef struct {
+  char priority[16];
+  char identifier[32];
+  char module[64];
+  char code_file[256];
+  char code_line[16];
+  char err[16];
+  char message[LOG_LINE_MAX];
+  size_t message_len;
+} fields_t;
+
+// Copies text field value at `p`, up to newline, into `out`.
+static const char *text_field(const char *p, const char *end, char *out,
+                              size_t size) {
+  const char *nl = memchr(p, '\n', end - p);
+  if (nl == NULL || (size_t)(nl - p) >= size)
+    return NULL;
+
+  memcpy(out, p, nl - p);
+  out[nl - p] = '\0';
+  return nl + 1;
+}
+
+// Decodes a datagram, returns -1 if it isn't valid native protocol.
+static int decode(const char *p, size_t len, fields_t *f) {
+  const char *end = p + len;
+  *f = (fields_t){0};
+  while (p < end) {
+    const char *nl = memchr(p, '\n', end - p);
+    const char *eq = memchr(p, '=', end - p);
+    if (nl == NULL)
+      return -1;
+
+    if (eq == NULL || eq > nl) {
+      // Binary field: name, newline, 64 bits little endian size and value.
+      if (nl - p != 7 || memcmp(p, "MESSAGE", 7) != 0 || end - nl < 9)
+        return -1;
+      uint64_t size = 0;
+      for (int i = 0; i < 8; i++)
+        size |= (uint64_t)(uint8_t)nl[1 + i] << (i * 8);
+      p = nl + 9;
+      if (size >= sizeof(f->message) || (uint64_t)(end - p) < size + 1 ||
+          p[size] != '\n')
+        return -1;
+      memcpy(f->message, p, size);
+      f->message_len = size;
+      p += size + 1;
+      continue;
+    }
+
+    const char *name = p;
+    size_t name_len = eq - p;
+    struct {
+      const char *name;
+      char *out;
+      size_t size;
+    } known[] = {
+        {"PRIORITY", f->priority, sizeof(f->priority)},
+        {"SYSLOG_IDENTIFIER", f->identifier, sizeof(f->identifier)},
+        {"MODULE", f->module, sizeof(f->module)},
+        {"CODE_FILE", f->code_file, sizeof(f->code_file)},
+        {"CODE_LINE", f->code_line, sizeof(f->code_line)},
+        {"ERRNO", f->err, sizeof(f->err)},
+    };
+
+    p = NULL;
+    for (size_t i = 0; i < sizeof(known) / sizeof(*known); i++) {
+      if (strlen(known[i].name) == name_len &&
+          memcmp(known[i].name, name, name_len) == 0)
+        p = text_field(eq + 1, end, known[i].out, known[i].size);
+    }
+    if (p == NULL)
+      return -1;
+  }
+
+  return 0;
+}
+
+static void receive(int fd, fields_t *f) {
+  char buf[4096];
+  ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+  CHECK(n > 0, "no datagram received: %s", strerror(errno));
+  if (n <= 0) {
+    *f = (fields_t){0};
+    return;
+  }
+
+  CHECK(decode(buf, n, f) == 0, "invalid datagram: %.*s", (int)n, buf);
+}
+
+static void check_message(int fd, const char *what) {
+  fields_t f;
+  static const char message[] = "multi\nline 42: Permission denied";
+
+  receive(fd, &f);
+  CHECK(strcmp(f.priority, "3") == 0, "%s: PRIORITY=%s", what, f.priority);
+  CHECK(strcmp(f.identifier, "dhub") == 0, "%s: SYSLOG_IDENTIFIER=%s", what,
+        f.identifier);
+  CHECK(strcmp(f.module, "test") == 0, "%s: MODULE=%s", what, f.module);
+  CHECK(strcmp(f.code_file, LONG_FILE) == 0, "%s: CODE_FILE=%s", what,
+        f.code_file);
+  CHECK(strcmp(f.code_line, "1234") == 0, "%s: CODE_LINE=%s", what,
+        f.code_line);
+  CHECK(strcmp(f.err, "13") == 0, "%s: ERRNO=%s", what, f.err);
+  CHECK(f.message_len == sizeof(message) - 1 &&
+            memcmp(f.message, message, f.message_len) == 0,
+        "%s: MESSAGE=%.*s", what, (int)f.message_len, f.message);
+}
+
+int main(void) {
+  char dir[] = "/tmp/dhub-test-XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/journal", dir);
+  int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    perror("failed to bind journal socket");
+    return EXIT_FAILURE;
+  }
+
+  log_init(LOG_COLORIZE_NEVER, false, LOG_FACILITY_USER, LOG_CLASS_ERROR);
+  if (log_enable_journal(addr.sun_path) == -1) {
+    perror("log_enable_journal");
+    return EXIT_FAILURE;
+  }
+
+  // Written synchronously without writer thread.
+  log_errno_provided(LOG_CLASS_ERROR, "test", LONG_FILE, 1234, EACCES,
+                     "multi\nline %d", 42);
+  check_message(fd, "sync");
+
+  // Written from writer thread, out of log ring.
+  log_start_writer(LOG_OVERFLOW_BLOCK);
+  log_errno_provided(LOG_CLASS_ERROR, "test", LONG_FILE, 1234, EACCES,
+                     "multi\nline %d", 42);
+  log_flush();
+  check_message(fd, "writer");
+
+  log_deinit();
+  close(fd);
+  unlink(addr.sun_path);
+  rmdir(dir);
+
+  if (failures != 0)
+    return EXIT_FAILURE;
+
+  puts("log journal encoding: ok");
+  return EXIT_SUCCESS;
+}